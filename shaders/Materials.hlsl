@@ -7,6 +7,8 @@
 
 #include "../src/hlsl/RaytracingHlslCompat.h"
 
+// The CPU reference renderer mirrors these terms in src/cpurt/Materials.h, keep both in sync
+
 float3 fresnelSchlick(float cosTheta, float3 F0) {
     return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }
@@ -47,6 +47,26 @@ float3 HitAttribute(float3 vertexAttribute[3], BuiltInTriangleIntersectionAttrib
         attr.barycentrics.y * (vertexAttribute[2] - vertexAttribute[0]);
 }
 
+// Decode a normal stored as two 16 bit SNORMs in octahedral encoding (x in the low, y in the high 16 bits).
+float3 DecodeOctahedralNormal(uint encoded) {
+    int2 snorm  = int2(encoded << 16, encoded) >> 16; // Sign extend both halves
+    float2 e    = max(float2(snorm) / 32767.0f, -1.0f);
+    float3 n    = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t     = saturate(-n.z);
+    n.x         += n.x >= 0.0f ? -t : t;
+    n.y         += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+// Retrieve the object space normal of a vertex. Positions are only consumed by the BLAS builds, which decode them on their own.
+float3 VertexNormal(DeviceVertex vertex) {
+#if COMPACT_VERTICES
+    return DecodeOctahedralNormal(vertex.normal);
+#else
+    return vertex.normal;
+#endif
+}
+
 // Generate a ray in world space for a camera pixel corresponding to an index from the dispatched 2D grid.
 inline void GenerateCameraRay(uint2 index, out float3 origin, out float3 direction) {
     float2 xy = index + 0.5f; // center in the middle of the pixel.
@@ -153,22 +173,32 @@ void MyClosestHitShader(inout RayPayload payload, in BuiltInTriangleIntersection
     if (payload.isShadowRay) {
         payload.hit = true;
     } else {
-        // Retrieve the index, vertex, and material index buffers of the instance we hit
-        uint object_srv_idx_base                    = DescriptorHeapSlots::IndexVertexMaterialBuffersBegin + (InstanceID() * 2U);
-        ByteAddressBuffer instanceIndices           = ResourceDescriptorHeap[object_srv_idx_base];
-        StructuredBuffer<Vertex> instanceVertices   = ResourceDescriptorHeap[object_srv_idx_base + 1];
-        ByteAddressBuffer instanceMaterialIndices   = ResourceDescriptorHeap[object_srv_idx_base + 2];
+#if PACKED_GEOMETRY_BUFFERS
+        // All instances share the packed index, vertex, and material index buffers, the instance's record locates its geometry in them
+        StructuredBuffer<GeometryRecord> geometryRecords    = ResourceDescriptorHeap[DescriptorHeapSlots::GeometryRecordsBuffer];
+        ByteAddressBuffer instanceIndices                   = ResourceDescriptorHeap[DescriptorHeapSlots::PackedIndicesBuffer];
+        StructuredBuffer<DeviceVertex> instanceVertices     = ResourceDescriptorHeap[DescriptorHeapSlots::PackedVerticesBuffer];
+        ByteAddressBuffer instanceMaterialIndices           = ResourceDescriptorHeap[DescriptorHeapSlots::PackedMaterialIndicesBuffer];
+        const GeometryRecord record                         = geometryRecords[InstanceID()];
+#else
+        // Retrieve the index, vertex, and material index buffers of the instance we hit, which start at its first element
+        uint object_srv_idx_base                        = DescriptorHeapSlots::IndexVertexMaterialBuffersBegin + (InstanceID() * 3U);
+        ByteAddressBuffer instanceIndices               = ResourceDescriptorHeap[object_srv_idx_base];
+        StructuredBuffer<DeviceVertex> instanceVertices = ResourceDescriptorHeap[object_srv_idx_base + 1];
+        ByteAddressBuffer instanceMaterialIndices       = ResourceDescriptorHeap[object_srv_idx_base + 2];
+        const GeometryRecord record                     = (GeometryRecord)0;
+#endif
         
-        // Load up 3 32 bit indices for the triangle.
+        // Load up 3 32 bit indices for the triangle and make them relative to the start of the vertex buffer.
         static const uint indexSizeInBytes      = 4;
         static const uint indicesPerTriangle    = 3;
         static const uint triangleIndexStride   = indicesPerTriangle * indexSizeInBytes;
-        const uint baseIndex                    = PrimitiveIndex() * triangleIndexStride;
-        const uint3 indices                     = instanceIndices.Load3(baseIndex);
+        const uint baseIndex                    = record.firstIndex * indexSizeInBytes + PrimitiveIndex() * triangleIndexStride;
+        const uint3 indices                     = instanceIndices.Load3(baseIndex) + record.firstVertex;
 
         // Load the corrsponding material for the triangle (or the default material if this triangle does not have one).
         static const uint materialIndexSizeInBytes  = 4;
-        const uint triangleIndex                    = PrimitiveIndex() * materialIndexSizeInBytes;
+        const uint triangleIndex                    = (record.firstTriangle + PrimitiveIndex()) * materialIndexSizeInBytes;
         const int materialIndex                     = asint(instanceMaterialIndices.Load(triangleIndex));
         MaterialPBR triangleMaterial;
         if (materialIndex == -1) {
@@ -182,13 +212,13 @@ void MyClosestHitShader(inout RayPayload payload, in BuiltInTriangleIntersection
 
         // Retrieve corresponding vertex normals for the triangle vertices.
         float3 vertexNormals[3] = {
-            instanceVertices[indices[0]].normal,
-            instanceVertices[indices[1]].normal,
-            instanceVertices[indices[2]].normal 
+            VertexNormal(instanceVertices[indices[0]]),
+            VertexNormal(instanceVertices[indices[1]]),
+            VertexNormal(instanceVertices[indices[2]])
         };
 
-        // Compute the triangle's normal.
-        float3 triangleNormal = HitAttribute(vertexNormals, attr);
+        // Compute the triangle's normal, and bring it from object to world space with the inverse transpose of the instance's transform.
+        float3 triangleNormal = normalize(mul(HitAttribute(vertexNormals, attr), (float3x3)WorldToObject3x4()));
 
         // Compute the final pixel color
         float3 hitPosition      = HitWorldPosition();
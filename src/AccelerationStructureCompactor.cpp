@@ -0,0 +1,102 @@
+//
+// AccelerationStructureCompactor.cpp - Shrinks acceleration structures to their compacted size after they have been built
+//
+
+#include "utils/stdafx.h"
+#include "AccelerationStructureCompactor.h"
+#include "DirectXRaytracingHelper.h"
+
+using namespace DX;
+
+AccelerationStructureCompactor::AccelerationStructureCompactor(DeviceResources* deviceResources, ID3D12GraphicsCommandList4* commandList,
+                                                               std::vector<D3DResource>& structures, UINT64 batchBudget, D3D12MA::Pool* pool,
+                                                               D3D12MA::ALLOCATION_FLAGS allocationFlags) :
+    m_deviceResources(deviceResources),
+    m_commandList(commandList),
+    m_structures(structures),
+    m_compactedStructures(structures.size()),
+    m_planner(batchBudget),
+    m_pool(pool),
+    m_allocationFlags(allocationFlags),
+    m_recording(false)
+{
+    for (const D3DResource& structure : structures)
+    {
+        m_planner.Add(structure.resource->GetDesc().Width);
+    }
+
+    D3D12MA::Allocator* allocator   = deviceResources->GetD3DMAllocator();
+    UINT64 sizesSize                = (std::max)(structures.size(), size_t(1)) * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
+    AllocateDeviceBuffer(allocator, sizesSize, &m_compactedSizes.resource, &m_compactedSizes.allocation, true, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, L"CompactedSizes");
+    AllocateReadbackBuffer(allocator, sizesSize, &m_compactedSizesReadback.resource, &m_compactedSizesReadback.allocation, L"CompactedSizesReadback");
+}
+
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC AccelerationStructureCompactor::PostbuildInfoDesc(UINT structure) const
+{
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC desc = {};
+    desc.DestBuffer = m_compactedSizes.resource->GetGPUVirtualAddress() + structure * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
+    desc.InfoType   = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+    return desc;
+}
+
+void AccelerationStructureCompactor::RecordSizeReadback()
+{
+    if (m_structures.empty())
+    {
+        return;
+    }
+
+    CD3DX12_RESOURCE_BARRIER toCopySource = CD3DX12_RESOURCE_BARRIER::Transition(m_compactedSizes.resource.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    m_commandList->ResourceBarrier(1, &toCopySource);
+    m_commandList->CopyBufferRegion(m_compactedSizesReadback.resource.Get(), 0, m_compactedSizes.resource.Get(), 0,
+                                    m_structures.size() * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC));
+}
+
+const CompactionPlanner::Stats& AccelerationStructureCompactor::Compact()
+{
+    if (!m_structures.empty())
+    {
+        void* mappedSizes = nullptr;
+        CD3DX12_RANGE readRange(0, m_structures.size() * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC));
+        ThrowIfFailed(m_compactedSizesReadback.resource->Map(0, &readRange, &mappedSizes));
+        const auto* sizes = static_cast<const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC*>(mappedSizes);
+        for (UINT i = 0; i < static_cast<UINT>(m_structures.size()); i++)
+        {
+            ThrowIfFalse(sizes[i].CompactedSizeInBytes > 0, L"Acceleration structure was not built with ALLOW_COMPACTION.\n");
+            m_planner.SetCompactedSize(i, sizes[i].CompactedSizeInBytes);
+        }
+        CD3DX12_RANGE writeRange(0, 0); // Nothing was written
+        m_compactedSizesReadback.resource->Unmap(0, &writeRange);
+    }
+    return m_planner.Execute(*this);
+}
+
+void AccelerationStructureCompactor::CopyCompacted(uint32_t structure, uint64_t size)
+{
+    // The planner waits for every batch, so the command allocator is idle by the time the next batch starts recording
+    if (!m_recording)
+    {
+        ID3D12CommandAllocator* commandAllocator = m_deviceResources->GetCommandAllocator();
+        ThrowIfFailed(commandAllocator->Reset());
+        ThrowIfFailed(m_commandList->Reset(commandAllocator, nullptr));
+        m_recording = true;
+    }
+
+    D3DResource& compacted = m_compactedStructures[structure];
+    AllocateDeviceBuffer(m_deviceResources->GetD3DMAllocator(), size, &compacted.resource, &compacted.allocation, true, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+                         nullptr, m_pool, m_allocationFlags);
+    m_commandList->CopyRaytracingAccelerationStructure(compacted.resource->GetGPUVirtualAddress(), m_structures[structure].resource->GetGPUVirtualAddress(),
+                                                       D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+}
+
+void AccelerationStructureCompactor::ExecuteCopies()
+{
+    m_deviceResources->ExecuteCommandList();
+    m_deviceResources->WaitForGpu();
+    m_recording = false;
+}
+
+void AccelerationStructureCompactor::ReleaseOriginal(uint32_t structure)
+{
+    m_structures[structure] = std::move(m_compactedStructures[structure]);
+}
@@ -0,0 +1,55 @@
+//
+// AccelerationStructureCompactor.h - Shrinks acceleration structures to their compacted size after they have been built
+//
+
+#pragma once
+
+#include "DeviceResources.h"
+#include "utils/CompactionPlanner.h"
+
+namespace DX
+{
+    // Compacts acceleration structures that were built with ALLOW_COMPACTION into buffers of the maximum result size.
+    // Every build emits its compacted size through PostbuildInfoDesc(), and RecordSizeReadback() copies all sizes to the CPU after the
+    // builds on the same command list. Once the builds have completed, Compact() copies the structures batch by batch (see
+    // CompactionPlanner), replacing every entry of structures with its compacted copy, so GPU addresses have to be read afterwards.
+    class AccelerationStructureCompactor : private CompactionDevice
+    {
+    public:
+        AccelerationStructureCompactor(DeviceResources* deviceResources, ID3D12GraphicsCommandList4* commandList,
+                                       std::vector<D3DResource>& structures, UINT64 batchBudget, D3D12MA::Pool* pool = nullptr,
+                                       D3D12MA::ALLOCATION_FLAGS allocationFlags = D3D12MA::ALLOCATION_FLAG_NONE);
+
+        AccelerationStructureCompactor(AccelerationStructureCompactor&&) = delete;
+        AccelerationStructureCompactor& operator= (AccelerationStructureCompactor&&) = delete;
+
+        AccelerationStructureCompactor(AccelerationStructureCompactor const&) = delete;
+        AccelerationStructureCompactor& operator= (AccelerationStructureCompactor const&) = delete;
+
+        // Postbuild info to pass to the build of the given structure
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC PostbuildInfoDesc(UINT structure) const;
+
+        // Copy the emitted sizes to the CPU, after all builds have been recorded and separated from this by a UAV barrier
+        void RecordSizeReadback();
+
+        // Compact all structures, the builds and the size readback must have completed. Leaves the command list closed.
+        const CompactionPlanner::Stats& Compact();
+
+    private:
+        // CompactionDevice
+        void CopyCompacted(uint32_t structure, uint64_t size) override;
+        void ExecuteCopies() override;
+        void ReleaseOriginal(uint32_t structure) override;
+
+        DeviceResources*                m_deviceResources;
+        ID3D12GraphicsCommandList4*     m_commandList;
+        std::vector<D3DResource>&       m_structures;
+        std::vector<D3DResource>        m_compactedStructures;
+        D3DResource                     m_compactedSizes;           // One UINT64 per structure, written by the builds
+        D3DResource                     m_compactedSizesReadback;
+        CompactionPlanner               m_planner;
+        D3D12MA::Pool*                  m_pool;                     // Of the compacted copies
+        D3D12MA::ALLOCATION_FLAGS       m_allocationFlags;
+        bool                            m_recording;
+    };
+}
@@ -0,0 +1,95 @@
+// Command line front end of the CPU reference renderer, built without the Windows SDK by CMakeLists.txt.
+// Renders the first frame of a scene with the default camera of CpuRT::View::Default(), like the sample's -cpuRender does, or runs one of
+// the sample's CPU benchmarks on it.
+
+#include "cpurt/Renderer.h"
+#include "cpurt/Tools.h"
+#include "utils/LoadScene.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace
+{
+void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " <scene.obj|scene.pbrt> <output.ppm> [width height]\n"
+              << "       " << program << " -benchmarkRaySorting <scene.obj|scene.pbrt> [width height]\n"
+              << "       " << program << " -benchmarkRefit <scene.obj|scene.pbrt> <frames>\n"
+              << "       " << program << " -benchmarkObjParsers <scene.obj>\n";
+}
+
+// Reads the optional image dimensions starting at argv[first], which default to the sample's window size
+bool ParseDimensions(int argc, char* argv[], int first, uint32_t& width, uint32_t& height)
+{
+    if (argc != first && argc != first + 2)
+    {
+        return false;
+    }
+    width   = argc == first + 2 ? static_cast<uint32_t>(std::strtoul(argv[first], nullptr, 10)) : 1280;
+    height  = argc == first + 2 ? static_cast<uint32_t>(std::strtoul(argv[first + 1], nullptr, 10)) : 720;
+    return true;
+}
+
+CpuRT::Renderer::Constants DefaultConstants(uint32_t width, uint32_t height)
+{
+    return CpuRT::Renderer::Constants::LookAt(CpuRT::View::Default(), static_cast<float>(width) / static_cast<float>(height));
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::strcmp(argv[1], "-benchmarkObjParsers") == 0)
+    {
+        if (argc != 3)
+        {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        LoadScene::benchmark_obj_parsers(argv[2]);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "-benchmarkRefit") == 0)
+    {
+        const uint32_t frames = argc == 4 ? static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)) : 0;
+        if (frames == 0)
+        {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        CpuRT::BenchmarkRefit(LoadScene::load_scene(argv[2]), argv[2], frames);
+        return EXIT_SUCCESS;
+    }
+
+    const bool benchmarkRaySorting = argc > 1 && std::strcmp(argv[1], "-benchmarkRaySorting") == 0;
+    uint32_t width  = 0;
+    uint32_t height = 0;
+    if (argc < 3 || !ParseDimensions(argc, argv, 3, width, height))
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (width == 0 || height == 0)
+    {
+        std::cerr << "The image dimensions must be positive.\n";
+        return EXIT_FAILURE;
+    }
+
+    const std::string scenePath     = benchmarkRaySorting ? argv[2] : argv[1];
+    LoadScene::LoadedObj loaded_obj = LoadScene::load_scene(scenePath);
+    if (benchmarkRaySorting)
+    {
+        CpuRT::BenchmarkRaySorting(loaded_obj, scenePath, DefaultConstants(width, height), width, height);
+        return EXIT_SUCCESS;
+    }
+
+    const std::string outputPath = argv[2];
+    if (!CpuRT::RenderToFile(loaded_obj, scenePath, DefaultConstants(width, height), width, height, outputPath))
+    {
+        std::cerr << "Failed to write " << outputPath << ".\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
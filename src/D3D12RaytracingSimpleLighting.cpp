@@ -10,7 +10,10 @@
 //*********************************************************
 
 #include "utils/stdafx.h"
+#include <chrono>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
 
 #include "D3D12RaytracingSimpleLighting.h"
 #include "DirectXRaytracingHelper.h"
@@ -24,6 +27,93 @@ const wchar_t* D3D12RaytracingSimpleLighting::c_raygenShaderName = L"MyRaygenSha
 const wchar_t* D3D12RaytracingSimpleLighting::c_closestHitShaderName = L"MyClosestHitShader";
 const wchar_t* D3D12RaytracingSimpleLighting::c_missShaderName = L"MyMissShader";
 
+namespace {
+// Rotates an object to world transform about the vertical axis through the given world space point
+XMFLOAT3X4 RotateAboutVerticalAxis(const XMFLOAT3X4& transform, const XMFLOAT3& center, float angle)
+{
+    const float c               = cosf(angle);
+    const float s               = sinf(angle);
+    const float rotation[3][3]  = { { c, 0.0f, s }, { 0.0f, 1.0f, 0.0f }, { -s, 0.0f, c } };
+    const float pivot[3]        = { center.x, center.y, center.z };
+    XMFLOAT3X4 rotated;
+    for (int row = 0; row < 3; row++) {
+        rotated.m[row][3] = pivot[row];
+        for (int column = 0; column < 3; column++) {
+            rotated.m[row][column]  = rotation[row][0] * transform.m[0][column] + rotation[row][1] * transform.m[1][column] + rotation[row][2] * transform.m[2][column];
+            rotated.m[row][3]       += rotation[row][column] * (transform.m[column][3] - pivot[column]);
+        }
+    }
+    return rotated;
+}
+
+D3D12_RAYTRACING_INSTANCE_DESC InstanceDesc(const LoadScene::ObjectInstance& instance, D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAccelerationStructure)
+{
+    D3D12_RAYTRACING_INSTANCE_DESC desc = {};
+    memcpy(desc.Transform, instance.transform.m, sizeof(desc.Transform));
+    desc.InstanceMask           = 1;
+    desc.AccelerationStructure  = bottomLevelAccelerationStructure;
+    desc.InstanceID             = instance.object; // This value will be used to reference the instanced object's geometry in HLSL shader code
+    return desc;
+}
+
+// Camera and default material of the scene constants for the CPU renderer
+CpuRT::Renderer::Constants CpuRendererConstants(const SceneConstantBuffer& sceneCB)
+{
+    CpuRT::Renderer::Constants constants;
+    XMFLOAT4X4 projectionToWorld;
+    XMStoreFloat4x4(&projectionToWorld, sceneCB.projectionToWorld);
+    memcpy(constants.projectionToWorld, projectionToWorld.m, sizeof(constants.projectionToWorld));
+    constants.cameraPosition            = { XMVectorGetX(sceneCB.cameraPosition), XMVectorGetY(sceneCB.cameraPosition), XMVectorGetZ(sceneCB.cameraPosition) };
+    constants.defaultMaterial.albedo    = XMFLOAT3(sceneCB.defaultAlbedo.x, sceneCB.defaultAlbedo.y, sceneCB.defaultAlbedo.z);
+    constants.defaultMaterial.metallic  = sceneCB.defaultMetalAndRoughness.x;
+    constants.defaultMaterial.roughness = sceneCB.defaultMetalAndRoughness.y;
+    return constants;
+}
+
+// Object space bounds of every object of the scene
+std::vector<InstanceList::Bounds> ObjectBounds(const LoadScene::LoadedObj& loaded_obj)
+{
+    std::vector<InstanceList::Bounds> objectBounds(loaded_obj.object_count());
+    for (size_t i = 0ULL; i < objectBounds.size(); i++) {
+        InstanceList::Bounds& bounds = objectBounds[i];
+        bounds = { XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+        for (const Vertex& vertex : loaded_obj.object_vertices(i)) {
+            bounds.lower = { (std::min)(bounds.lower.x, vertex.position.x), (std::min)(bounds.lower.y, vertex.position.y), (std::min)(bounds.lower.z, vertex.position.z) };
+            bounds.upper = { (std::max)(bounds.upper.x, vertex.position.x), (std::max)(bounds.upper.y, vertex.position.y), (std::max)(bounds.upper.z, vertex.position.z) };
+        }
+    }
+    return objectBounds;
+}
+
+// Mark the objects of the visible instances as in use, and pass on the distance of every object's closest instance to the eye
+void UseVisibleObjects(ResidencyPolicy& policy, const InstanceList& instances, const std::vector<uint32_t>& visible, const XMFLOAT3& eye,
+                       std::vector<float>& distances)
+{
+    std::span<const LoadScene::ObjectInstance> allInstances = instances.Instances();
+    distances.assign(policy.ObjectCount(), FLT_MAX);
+    for (const LoadScene::ObjectInstance& instance : allInstances) {
+        const float distanceSquared = InstanceList::DistanceSquared(instances.WorldBounds(instance.object, instance.transform), eye);
+        distances[instance.object]  = (std::min)(distances[instance.object], distanceSquared);
+    }
+    for (uint32_t object = 0; object < static_cast<uint32_t>(distances.size()); object++) {
+        policy.SetDistance(object, sqrtf(distances[object]));
+    }
+    for (uint32_t i : visible) {
+        policy.Use(allInstances[i].object);
+    }
+}
+
+#if COMPACT_VERTICES
+// BLAS geometry transform mapping quantized positions back to object space
+XMFLOAT3X4 DequantizationTransform(const LoadScene::PositionDequantization& dq)
+{
+    return XMFLOAT3X4(dq.scale.x, 0.0f, 0.0f, dq.offset.x,
+                      0.0f, dq.scale.y, 0.0f, dq.offset.y,
+                      0.0f, 0.0f, dq.scale.z, dq.offset.z);
+}
+#endif
+}
+
 D3D12RaytracingSimpleLighting::D3D12RaytracingSimpleLighting(UINT width, UINT height, std::wstring name) :
     DXSample(width, height, name),
     m_curRotationAngleRad(0.0f)
@@ -59,82 +149,609 @@ void D3D12RaytracingSimpleLighting::OnInit()
     CreateWindowSizeDependentResources();
 }
 
-// Update camera matrices passed into the shader.
-void D3D12RaytracingSimpleLighting::UpdateCameraMatrices()
+// Parse sample specific command line args in addition to the ones handled by DXSample.
+_Use_decl_annotations_
+void D3D12RaytracingSimpleLighting::ParseCommandLineArgs(WCHAR* argv[], int argc)
 {
-    auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
+    DXSample::ParseCommandLineArgs(argv, argc);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        // -benchmarkObjParsers [path]
+        // Compares the single-threaded and parallel OBJ parsers on the given file and exits without creating a window
+        if (_wcsnicmp(argv[i], L"-benchmarkObjParsers", wcslen(argv[i])) == 0 ||
+            _wcsnicmp(argv[i], L"/benchmarkObjParsers", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            LoadScene::benchmark_obj_parsers(std::filesystem::path(argv[i + 1]).string());
+            exit(EXIT_SUCCESS);
+        }
+        // -measureVertexCompression [path]
+        // Reports the per-object error of the compact vertex encodings for the given OBJ or pbrt-v3 scene and exits without creating a window
+        else if (_wcsnicmp(argv[i], L"-measureVertexCompression", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/measureVertexCompression", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            LoadScene::report_vertex_compression_error(LoadScene::load_scene(std::filesystem::path(argv[i + 1]).string()));
+            exit(EXIT_SUCCESS);
+        }
+        // -scene [path]
+        // Renders the given OBJ or pbrt-v3 scene instead of the default Cornell box
+        else if (_wcsnicmp(argv[i], L"-scene", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/scene", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_scenePath = argv[++i];
+        }
+        // -benchmarkRaySorting
+        // Traces the secondary rays of the scene in batches with and without sorting them for coherence first, and exits without creating a window
+        else if (_wcsnicmp(argv[i], L"-benchmarkRaySorting", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/benchmarkRaySorting", wcslen(argv[i])) == 0)
+        {
+            m_benchmarkRaySorting = true;
+        }
+        // -buildPreference [fastTrace|balanced|fastBuild]
+        // Builds the acceleration structures of all objects with the given trade-off between build time and trace performance
+        else if (_wcsnicmp(argv[i], L"-buildPreference", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/buildPreference", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            const WCHAR* preference = argv[++i];
+            if (_wcsicmp(preference, L"fastTrace") == 0)
+            {
+                m_buildPreference = LoadScene::BuildPreference::FastTrace;
+            }
+            else if (_wcsicmp(preference, L"balanced") == 0)
+            {
+                m_buildPreference = LoadScene::BuildPreference::Balanced;
+            }
+            else
+            {
+                ThrowIfFalse(_wcsicmp(preference, L"fastBuild") == 0, L"Unknown build preference, expected fastTrace, balanced or fastBuild.");
+                m_buildPreference = LoadScene::BuildPreference::FastBuild;
+            }
+        }
+        // -benchmarkRefit [frames]
+        // Deforms the scene's objects for the given number of frames, refitting their CPU BVHs every frame, and exits without creating a window
+        else if (_wcsnicmp(argv[i], L"-benchmarkRefit", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/benchmarkRefit", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_refitBenchmarkFrames = static_cast<UINT>(_wtoi(argv[++i]));
+            ThrowIfFalse(m_refitBenchmarkFrames > 0, L"The number of frames to benchmark refitting for has to be positive.");
+        }
+        // -deformObjects
+        // Deforms all objects every frame, and updates their BLASes in place instead of rebuilding them while they remain good enough
+        else if (_wcsnicmp(argv[i], L"-deformObjects", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/deformObjects", wcslen(argv[i])) == 0)
+        {
+            m_deformObjects = true;
+        }
+        // -animateInstances
+        // Spins every instance about its vertical axis, which rebuilds the TLAS every frame
+        else if (_wcsnicmp(argv[i], L"-animateInstances", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/animateInstances", wcslen(argv[i])) == 0)
+        {
+            m_animateInstances = true;
+        }
+        // -cullInstances
+        // Leaves instances outside the view frustum out of the TLAS, which is rebuilt every frame. They no longer cast shadows or show up in reflections.
+        else if (_wcsnicmp(argv[i], L"-cullInstances", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/cullInstances", wcslen(argv[i])) == 0)
+        {
+            m_cullInstances = true;
+        }
+        // -maxInstanceDistance [distance]
+        // Culls instances farther away from the camera than the given distance as well, implies -cullInstances
+        else if (_wcsnicmp(argv[i], L"-maxInstanceDistance", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/maxInstanceDistance", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_maxInstanceDistance = static_cast<float>(_wtof(argv[++i]));
+            ThrowIfFalse(m_maxInstanceDistance > 0.0f, L"The maximum instance distance has to be positive.");
+            m_cullInstances = true;
+        }
+        // -manageResidency [lru|distance]
+        // Evicts objects whose instances have been out of view for a while from video memory when the scene exceeds the budget, least recently
+        // seen or farthest from the camera first, implies -cullInstances
+        else if (_wcsnicmp(argv[i], L"-manageResidency", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/manageResidency", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            const WCHAR* order = argv[++i];
+            if (_wcsicmp(order, L"lru") == 0)
+            {
+                m_residencyOrder = ResidencyPolicy::Order::LeastRecentlyUsed;
+            }
+            else
+            {
+                ThrowIfFalse(_wcsicmp(order, L"distance") == 0, L"Unknown residency order, expected lru or distance.");
+                m_residencyOrder = ResidencyPolicy::Order::Farthest;
+            }
+        }
+        // -residencyBudget [megabytes]
+        // Caps the video memory budget of -manageResidency at the given size to exercise eviction, implies -manageResidency lru unless another order is given
+        else if (_wcsnicmp(argv[i], L"-residencyBudget", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/residencyBudget", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_residencyBudgetLimit = static_cast<UINT64>(_wtoi64(argv[++i])) * 1024ULL * 1024ULL;
+            ThrowIfFalse(m_residencyBudgetLimit > 0, L"The residency budget has to be positive.");
+        }
+        // -noCompaction
+        // Keeps the BLASes at their maximum size instead of compacting them after they have been built
+        else if (_wcsnicmp(argv[i], L"-noCompaction", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/noCompaction", wcslen(argv[i])) == 0)
+        {
+            m_compactAccelerationStructures = false;
+        }
+        // -memoryStats [path]
+        // Writes the memory allocator's statistics, including how fragmented the heaps of the scene buffers are, to the given JSON file once the scene has been built
+        else if (_wcsnicmp(argv[i], L"-memoryStats", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/memoryStats", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_memoryStatsPath = argv[++i];
+        }
+        // -defragment [megabytes]
+        // Compacts the heaps of the scene buffers and BLASes while rendering once they are fragmented, moving at most the given size per frame
+        else if (_wcsnicmp(argv[i], L"-defragment", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/defragment", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_defragmentationBudget = static_cast<UINT64>(_wtoi64(argv[++i])) * 1024ULL * 1024ULL;
+            ThrowIfFalse(m_defragmentationBudget > 0, L"The defragmentation budget has to be positive.");
+        }
+        // -benchmarkDefragmentation
+        // Simulates defragmenting the scene's buffers and BLASes after half of them have been freed under a range of per-frame budgets, and
+        // exits without creating a window
+        else if (_wcsnicmp(argv[i], L"-benchmarkDefragmentation", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/benchmarkDefragmentation", wcslen(argv[i])) == 0)
+        {
+            m_benchmarkDefragmentation = true;
+        }
+        // -benchmarkBuildBatching
+        // Packs the scene's BLAS builds into batches under a range of simulated scratch budgets, and exits without creating a window
+        else if (_wcsnicmp(argv[i], L"-benchmarkBuildBatching", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/benchmarkBuildBatching", wcslen(argv[i])) == 0)
+        {
+            m_benchmarkBuildBatching = true;
+        }
+        // -benchmarkResidency [frames]
+        // Orbits the camera around the scene for the given number of frames, deciding which objects to evict and restore under a range of
+        // mock budgets, and exits without creating a window
+        else if (_wcsnicmp(argv[i], L"-benchmarkResidency", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/benchmarkResidency", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_residencyBenchmarkFrames = static_cast<UINT>(_wtoi(argv[++i]));
+            ThrowIfFalse(m_residencyBenchmarkFrames > 0, L"The number of frames to benchmark residency management for has to be positive.");
+        }
+        // -cpuRender [path]
+        // Renders the scene with the CPU reference renderer, writes the image to the given PPM file, and exits without creating a window
+        else if (_wcsnicmp(argv[i], L"-cpuRender", wcslen(argv[i])) == 0 ||
+                 _wcsnicmp(argv[i], L"/cpuRender", wcslen(argv[i])) == 0)
+        {
+            ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+            m_cpuRenderPath = argv[++i];
+        }
+    }
+
+    // Residency is decided by which instances are in view, deforming objects are updated every frame whether they are in view or not
+    if (m_residencyBudgetLimit > 0 && !m_residencyOrder)
+    {
+        m_residencyOrder = ResidencyPolicy::Order::LeastRecentlyUsed;
+    }
+    if (m_residencyOrder)
+    {
+        ThrowIfFalse(!m_deformObjects, L"-manageResidency can't be combined with -deformObjects.");
+        m_cullInstances = true;
+    }
+
+    // Only render once all arguments are known, -scene may come after -cpuRender
+    if (!m_cpuRenderPath.empty())
+    {
+        RenderOnCpu();
+    }
+    if (m_benchmarkRaySorting)
+    {
+        BenchmarkRaySorting();
+    }
+    if (m_refitBenchmarkFrames > 0)
+    {
+        BenchmarkRefit();
+    }
+    if (m_benchmarkBuildBatching)
+    {
+        BenchmarkBuildBatching();
+    }
+    if (m_residencyBenchmarkFrames > 0)
+    {
+        BenchmarkResidency();
+    }
+    if (m_benchmarkDefragmentation)
+    {
+        BenchmarkDefragmentation();
+    }
+    if (!m_cpuRenderPath.empty() || m_benchmarkRaySorting || m_refitBenchmarkFrames > 0 || m_benchmarkBuildBatching || m_residencyBenchmarkFrames > 0 ||
+        m_benchmarkDefragmentation)
+    {
+        exit(EXIT_SUCCESS);
+    }
+}
+
+// Load m_scenePath, with the build preferences of its objects overridden from the command line.
+LoadScene::LoadedObj D3D12RaytracingSimpleLighting::LoadSelectedScene() const
+{
+    LoadScene::LoadedObj loaded_obj = LoadScene::load_scene(m_scenePath.string());
+    if (m_buildPreference)
+    {
+        loaded_obj.build_preferences.assign(loaded_obj.object_count(), *m_buildPreference);
+    }
+    return loaded_obj;
+}
+
+// Render the first frame with the CPU reference renderer instead of DXR and write it to m_cpuRenderPath.
+void D3D12RaytracingSimpleLighting::RenderOnCpu()
+{
+    InitializeScene();
+    LoadScene::LoadedObj loaded_obj = LoadSelectedScene();
+
+    ThrowIfFalse(CpuRT::RenderToFile(loaded_obj, m_scenePath.string(), CpuRendererConstants(m_sceneCB[0]), m_width, m_height, m_cpuRenderPath.string()),
+                 L"Failed to write the CPU rendered image.\n");
+}
+
+// Trace the secondary rays of the first frame with the CPU intersector, once in the order the pixels generate them and once sorted for coherence.
+void D3D12RaytracingSimpleLighting::BenchmarkRaySorting()
+{
+    InitializeScene();
+    LoadScene::LoadedObj loaded_obj = LoadSelectedScene();
+    CpuRT::BenchmarkRaySorting(loaded_obj, m_scenePath.string(), CpuRendererConstants(m_sceneCB[0]), m_width, m_height);
+}
+
+// Deform the scene's objects like -deformObjects does for m_refitBenchmarkFrames frames at 60 Hz, refitting the CPU BVHs after every frame,
+// and compare with building them from scratch.
+void D3D12RaytracingSimpleLighting::BenchmarkRefit()
+{
+    LoadScene::LoadedObj loaded_obj = LoadSelectedScene();
+    CpuRT::BenchmarkRefit(loaded_obj, m_scenePath.string(), m_refitBenchmarkFrames);
+}
+
+// Pack the scene's BLAS builds into batches under a range of scratch budgets and report the batches and scratch memory they need.
+// There is no device to get prebuild info from, so scratch sizes are simulated from the objects' triangle counts.
+void D3D12RaytracingSimpleLighting::BenchmarkBuildBatching()
+{
+    using Clock = std::chrono::steady_clock;
+    LoadScene::LoadedObj loaded_obj = LoadSelectedScene();
+
+    // A rough estimate of what drivers ask for, the packing itself only depends on the relative sizes
+    const UINT64 scratchBytesPerTriangle    = 64;
+    const UINT64 scratchBytesPerBuild       = 64 * 1024;
+    std::vector<UINT64> scratchSizes(loaded_obj.object_count());
+    size_t triangles = 0ULL;
+    for (size_t i = 0ULL; i < scratchSizes.size(); i++)
+    {
+        const size_t objectTriangles    = loaded_obj.object_indices(i).size() / 3;
+        scratchSizes[i]                 = scratchBytesPerBuild + objectTriangles * scratchBytesPerTriangle;
+        triangles                       += objectTriangles;
+    }
+
+    const double megabyte = 1024.0 * 1024.0;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Build batching benchmark: " << m_scenePath.string() << " (" << scratchSizes.size() << " BLASes, " << triangles << " triangles)\n";
+    for (UINT64 budget = 1ULL << 20; budget <= 1ULL << 30; budget <<= 2)
+    {
+        BuildBatcher batcher(budget);
+        for (UINT64 scratchSize : scratchSizes)
+        {
+            batcher.Add(scratchSize);
+        }
+        Clock::time_point start                     = Clock::now();
+        std::vector<BuildBatcher::Batch> batches    = batcher.Pack();
+        const double seconds                        = std::chrono::duration<double>(Clock::now() - start).count();
+
+        BuildBatcher::Stats stats = batcher.ComputeStats(batches);
+        std::cout << "    " << budget / megabyte << " MB budget: " << stats.batches << " batches instead of " << stats.builds << " barriers, "
+                  << stats.scratchBufferSize / megabyte << " MB scratch buffer instead of " << stats.separateScratch / megabyte << " MB, "
+                  << 100.0 * stats.Utilization() << "% utilized, packed in " << 1e3 * seconds << " ms\n";
+    }
+    std::cout << std::flush;
+}
 
-    m_sceneCB[frameIndex].cameraPosition = m_eye;
-    float fovAngleY = 45.0f;
+// Decide which objects to evict and restore while the camera orbits the scene like it does when rendering at 60 fps. The budget is a mock
+// that only fits a share of the scene, and usage is exactly what the resident objects take up, so the results are deterministic.
+void D3D12RaytracingSimpleLighting::BenchmarkResidency()
+{
+    LoadScene::LoadedObj loaded_obj = LoadSelectedScene();
+
+    // An object takes up its geometry and a BLAS of roughly 64 bytes per triangle
+    const UINT64 blasBytesPerTriangle = 64;
+    std::vector<UINT64> footprints(loaded_obj.object_count());
+    UINT64 sceneBytes = 0;
+    for (size_t i = 0ULL; i < footprints.size(); i++)
+    {
+        footprints[i]   = loaded_obj.object_indices(i).size_bytes() + loaded_obj.object_vertices(i).size() * sizeof(DeviceVertex)
+                        + loaded_obj.object_material_indices(i).size_bytes() + loaded_obj.object_indices(i).size() / 3 * blasBytesPerTriangle;
+        sceneBytes      += footprints[i];
+    }
+    InstanceList instances;
+    instances.SetObjectBounds(ObjectBounds(loaded_obj));
+    for (const LoadScene::ObjectInstance& instance : loaded_obj.object_instances())
+    {
+        instances.Add(instance.object, instance.transform);
+    }
+
+    const double megabyte = 1024.0 * 1024.0;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Residency benchmark: " << m_scenePath.string() << " (" << footprints.size() << " objects, " << instances.Size() << " instances, "
+              << sceneBytes / megabyte << " MB) over " << m_residencyBenchmarkFrames << " frames\n";
+    const std::pair<ResidencyPolicy::Order, const char*> orders[] = {
+        { ResidencyPolicy::Order::LeastRecentlyUsed, "LRU" },
+        { ResidencyPolicy::Order::Farthest, "farthest" }
+    };
+    std::vector<uint32_t> visible;
+    std::vector<float> distances;
+    for (const auto& [order, orderName] : orders)
+    {
+        for (UINT share = 25; share <= 75; share += 25)
+        {
+            ResidencyPolicy policy(order, FrameCount);
+            for (UINT64 footprint : footprints)
+            {
+                policy.AddObject(footprint);
+            }
+            const UINT64 budgetBytes    = sceneBytes * share / 100;
+            UINT64 peakResidentBytes    = 0;
+            UINT64 missingInstances     = 0;    // Visible instances left out of the TLAS because their object stayed evicted
+            UINT64 visibleInstances     = 0;
+
+            // Orbit the camera at the speed of OnUpdate() from where InitializeScene() puts it
+            InitializeScene();
+            XMMATRIX rotate = XMMatrixRotationY(XMConvertToRadians(360.0f / (24.0f * 60.0f)));
+            for (UINT frame = 1; frame <= m_residencyBenchmarkFrames; frame++)
+            {
+                m_eye   = XMVector3Transform(m_eye, rotate);
+                m_up    = XMVector3Transform(m_up, rotate);
+                m_at    = XMVector3Transform(m_at, rotate);
+                UpdateCameraMatrices(m_sceneCB[0]);
+                XMFLOAT3 eye;
+                XMStoreFloat3(&eye, m_eye);
+                instances.Cull(InstanceList::MakeFrustum(m_viewProj, eye, m_maxInstanceDistance), visible);
+
+                UseVisibleObjects(policy, instances, visible, eye, distances);
+                policy.Update(frame, { policy.ResidentBytes(), budgetBytes });
+                peakResidentBytes = (std::max)(peakResidentBytes, policy.ResidentBytes());
+                for (uint32_t i : visible)
+                {
+                    missingInstances += policy.IsResident(instances.Instances()[i].object) ? 0 : 1;
+                }
+                visibleInstances += visible.size();
+            }
+
+            const ResidencyPolicy::Stats& stats = policy.GetStats();
+            std::cout << "    " << orderName << ", budget " << share << "% (" << budgetBytes / megabyte << " MB): " << stats.evictions << " evictions ("
+                      << stats.evictedBytes / megabyte << " MB), " << stats.restores << " restores (" << stats.restoredBytes / megabyte << " MB), peak "
+                      << peakResidentBytes / megabyte << " MB resident, " << missingInstances << " of " << visibleInstances
+                      << " visible instances missing\n";
+        }
+    }
+    std::cout << std::flush;
+}
+
+// Simulate defragmenting a pool that holds the scene's geometry buffers and BLASes after every other one has been freed, in a VirtualBlock
+// instead of heaps, under a range of per-frame budgets.
+void D3D12RaytracingSimpleLighting::BenchmarkDefragmentation()
+{
+    LoadScene::LoadedObj loaded_obj = LoadSelectedScene();
+
+    // Buffers are placed at 64KB boundaries, and a BLAS takes up roughly 64 bytes per triangle
+    const UINT64 blasBytesPerTriangle = 64;
+    std::vector<UINT64> sizes;
+    for (size_t i = 0ULL; i < loaded_obj.object_count(); i++)
+    {
+        const UINT64 objectSizes[] = {
+            loaded_obj.object_indices(i).size_bytes(),
+            loaded_obj.object_vertices(i).size() * sizeof(DeviceVertex),
+            loaded_obj.object_material_indices(i).size_bytes(),
+            loaded_obj.object_indices(i).size() / 3 * blasBytesPerTriangle
+        };
+        for (UINT64 size : objectSizes)
+        {
+            sizes.push_back(UploadLayout::AlignUp((std::max)(size, 1ULL), D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+        }
+    }
+    UINT64 blockSize = 0;
+    for (UINT64 size : sizes)
+    {
+        blockSize += size;
+    }
+
+    struct Allocation
+    {
+        D3D12MA::VirtualAllocation  allocation;
+        UINT64                      offset;
+        UINT64                      size;
+    };
+    auto allocate = [](D3D12MA::VirtualBlock* block, UINT64 size, Allocation& allocation) {
+        D3D12MA::VIRTUAL_ALLOCATION_DESC desc   = {};
+        desc.Flags                              = D3D12MA::VIRTUAL_ALLOCATION_FLAG_STRATEGY_MIN_OFFSET;
+        desc.Size                               = size;
+        desc.Alignment                          = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+        allocation.size                         = size;
+        return SUCCEEDED(block->Allocate(&desc, &allocation.allocation, &allocation.offset));
+    };
+    auto usage = [](D3D12MA::VirtualBlock* block) {
+        D3D12MA::DetailedStatistics stats = {};
+        block->CalculateStatistics(&stats);
+        return DefragmentationService::PoolUsage(stats);
+    };
+
+    const double megabyte = 1024.0 * 1024.0;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Defragmentation benchmark: " << m_scenePath.string() << " (" << sizes.size() << " buffers and BLASes, " << blockSize / megabyte
+              << " MB), every other one freed\n";
+    std::vector<Allocation> allocations;
+    std::vector<Allocation> proposals;
+    std::vector<size_t> proposed;
+    std::vector<UINT64> moveSizes;
+    std::vector<uint8_t> perform;
+    for (UINT64 budgetMegabytes : { 1ULL, 4ULL, 16ULL, 64ULL })
+    {
+        // Fill the block and free every other allocation
+        D3D12MA::VIRTUAL_BLOCK_DESC blockDesc = {};
+        blockDesc.Size = blockSize;
+        ComPtr<D3D12MA::VirtualBlock> block;
+        ThrowIfFailed(D3D12MA::CreateVirtualBlock(&blockDesc, &block));
+        allocations.resize(sizes.size());
+        for (size_t i = 0ULL; i < sizes.size(); i++)
+        {
+            ThrowIfFalse(allocate(block.Get(), sizes[i], allocations[i]));
+        }
+        for (size_t i = 1ULL; i < allocations.size(); i += 2)
+        {
+            block->FreeAllocation(allocations[i].allocation);
+        }
+        const size_t kept = (allocations.size() + 1) / 2;
+        for (size_t i = 0ULL; i < kept; i++)
+        {
+            allocations[i] = allocations[2 * i];
+        }
+        allocations.resize(kept);
+
+        const DefragScheduler::Usage fragmented = usage(block.Get());
+        DefragScheduler scheduler({ budgetMegabytes * 1024ULL * 1024ULL, DefragmentationMovesPerFrame });
+        std::cout << "    budget " << budgetMegabytes << " MB per frame: ";
+        if (!scheduler.BeginRun(fragmented))
+        {
+            std::cout << "fragmentation " << DefragScheduler::Fragmentation(fragmented) << " is below the threshold\n";
+            block->Clear();
+            continue;
+        }
+
+        // Like the allocator, every pass proposes to move the allocations at the highest offsets to the lowest places they fit, which are
+        // reserved until the pass ends, up to the budget
+        for (;;)
+        {
+            std::sort(allocations.begin(), allocations.end(), [](const Allocation& a, const Allocation& b) { return a.offset > b.offset; });
+            proposals.clear();
+            proposed.clear();
+            UINT64 proposedBytes = 0;
+            for (size_t i = 0ULL; i < allocations.size() && proposals.size() < DefragmentationMovesPerFrame; i++)
+            {
+                Allocation destination;
+                if (proposedBytes + allocations[i].size > scheduler.GetBudget().maxBytesPerFrame && !proposals.empty())
+                {
+                    break;
+                }
+                if (!allocate(block.Get(), allocations[i].size, destination))
+                {
+                    continue;
+                }
+                if (destination.offset >= allocations[i].offset)
+                {
+                    block->FreeAllocation(destination.allocation);
+                    continue;
+                }
+                proposals.push_back(destination);
+                proposed.push_back(i);
+                proposedBytes += allocations[i].size;
+            }
+            if (proposals.empty())
+            {
+                break;
+            }
+
+            moveSizes.resize(proposals.size());
+            for (size_t i = 0ULL; i < proposals.size(); i++)
+            {
+                moveSizes[i] = proposals[i].size;
+            }
+            scheduler.SelectMoves(moveSizes, perform);
+            for (size_t i = 0ULL; i < proposals.size(); i++)
+            {
+                Allocation& source = allocations[proposed[i]];
+                block->FreeAllocation(perform[i] ? source.allocation : proposals[i].allocation);
+                if (perform[i])
+                {
+                    source = proposals[i];
+                }
+            }
+        }
+        const DefragScheduler::Usage defragmented = usage(block.Get());
+        scheduler.EndRun(defragmented);
+        block->Clear();
+
+        const DefragScheduler::Stats& stats = scheduler.GetStats();
+        std::cout << stats.passes << " passes, " << stats.moves << " moves (" << stats.bytesMoved / megabyte << " MB), peak "
+                  << stats.peakBytesPerFrame / megabyte << " MB per frame, " << stats.deferredMoves << " deferred moves, fragmentation "
+                  << DefragScheduler::Fragmentation(fragmented) << " -> " << DefragScheduler::Fragmentation(defragmented) << "\n";
+    }
+    std::cout << std::flush;
+}
+
+// Update camera matrices passed into the shader.
+void D3D12RaytracingSimpleLighting::UpdateCameraMatrices(SceneConstantBuffer& sceneCB)
+{
+    const CpuRT::View defaultView = CpuRT::View::Default();
+    sceneCB.cameraPosition = m_eye;
     XMMATRIX view = XMMatrixLookAtLH(m_eye, m_at, m_up);
-    XMMATRIX proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(fovAngleY), m_aspectRatio, 1.0f, 125.0f);
+    XMMATRIX proj = XMMatrixPerspectiveFovLH(defaultView.fovAngleY, m_aspectRatio, defaultView.nearZ, defaultView.farZ);
     XMMATRIX viewProj = view * proj;
 
-    m_sceneCB[frameIndex].projectionToWorld = XMMatrixInverse(nullptr, viewProj);
+    sceneCB.projectionToWorld = XMMatrixInverse(nullptr, viewProj);
+    m_viewProj = viewProj;
 }
 
-// Initialize scene rendering parameters.
+// Initialize scene rendering parameters. This does not depend on the device, so the CPU renderer can use it as well.
 void D3D12RaytracingSimpleLighting::InitializeScene()
 {
-    auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
+    SceneConstantBuffer& initialSceneCB = m_sceneCB[0];
+    // Same view as the CPU tools, see CpuRT::View::Default()
+    const CpuRT::View defaultView = CpuRT::View::Default();
 
     // Setup materials.
     // TODO: Get these from a GUI and update them every frame
     {
-        UINT frameIndex                                 = m_deviceResources->GetCurrentFrameIndex();
-        m_sceneCB[frameIndex].defaultAlbedo             = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-        m_sceneCB[frameIndex].defaultMetalAndRoughness  = XMFLOAT4(0.1f, 0.8f, 0.0f, 0.0f);
+        const MaterialPBR& material             = defaultView.defaultMaterial;
+        initialSceneCB.defaultAlbedo            = XMFLOAT4(material.albedo.x, material.albedo.y, material.albedo.z, 1.0f);
+        initialSceneCB.defaultMetalAndRoughness = XMFLOAT4(material.metallic, material.roughness, 0.0f, 0.0f);
     }
 
     // Setup camera.
     {
         // Initialize the view and projection inverse matrices.
-        m_eye = { 0.0f, 1.5f, -4.0f, 1.0f };
-        m_at = { 0.0f, 0.8f, 0.0f, 1.0f };
-        XMVECTOR right = { 1.0f, 0.0f, 0.0f, 0.0f };
+        m_eye = { defaultView.eye.x, defaultView.eye.y, defaultView.eye.z, 1.0f };
+        m_at = { defaultView.at.x, defaultView.at.y, defaultView.at.z, 1.0f };
+        m_up = { defaultView.up.x, defaultView.up.y, defaultView.up.z, 0.0f };
 
-        XMVECTOR direction = XMVector4Normalize(m_at - m_eye);
-        m_up = XMVector3Normalize(XMVector3Cross(direction, right));
-
-        // Rotate camera around Y axis.
-        XMMATRIX rotate = XMMatrixRotationY(XMConvertToRadians(45.0f));
-        m_eye = XMVector3Transform(m_eye, rotate);
-        m_up = XMVector3Transform(m_up, rotate);
-        
-        UpdateCameraMatrices();
+        UpdateCameraMatrices(initialSceneCB);
     }
 
     // Apply the initial values to all frames' buffer instances.
     for (auto& sceneCB : m_sceneCB)
     {
-        sceneCB = m_sceneCB[frameIndex];
+        sceneCB = initialSceneCB;
     }
 }
 
-// Create constant buffers.
-void D3D12RaytracingSimpleLighting::CreateConstantBuffers()
+// Create the ring that per-frame data is uploaded from.
+void D3D12RaytracingSimpleLighting::CreateFrameUploadRing()
 {
-    ID3D12Device* device            = m_deviceResources->GetD3DDevice();
-    D3D12MA::Allocator* allocator   = m_deviceResources->GetD3DMAllocator();
-    UINT frameCount                 = m_deviceResources->GetBackBufferCount();
-    
-    // Allocate one constant buffer per frame, since it gets updated every frame
-    D3D12MA::ALLOCATION_DESC allocationDesc             = {};
-    allocationDesc.HeapType                             = D3D12_HEAP_TYPE_UPLOAD;
-    const size_t cbSize                                 = frameCount * sizeof(AlignedSceneConstantBuffer);
-    const D3D12_RESOURCE_DESC constantBufferDesc        = CD3DX12_RESOURCE_DESC::Buffer(cbSize);
-    ThrowIfFailed(allocator->CreateResource(
-        &allocationDesc,
-        &constantBufferDesc,
-        D3D12_RESOURCE_STATE_GENERIC_READ,
-        nullptr,
-        &m_perFrameConstants.allocation,
-        IID_PPV_ARGS(&m_perFrameConstants.resource)));
-
-    // Map the constant buffer and cache its heap pointers.
-    // We don't unmap this until the app closes. Keeping buffer mapped for the lifetime of the resource is okay.
-    CD3DX12_RANGE readRange(0, 0);        // We do not intend to read from this resource on the CPU.
-    ThrowIfFailed(m_perFrameConstants.resource->Map(0, nullptr, reinterpret_cast<void**>(&m_mappedConstantData)));
+    // Constants are written every frame, so they are suballocated from a persistently mapped ring that recycles a frame's memory once
+    // the GPU has finished that frame
+    m_frameUploadRing = std::make_unique<FrameUploadRing>(m_deviceResources.get(), FrameUploadRingSize);
 }
 
 // Create resources that depend on the device.
@@ -154,26 +771,48 @@ void D3D12RaytracingSimpleLighting::CreateDeviceDependentResources()
     // Create a heap for descriptors.
     CreateDescriptorHeap();
 
-    // Build light sources buffers to be used for lighting
-    BuildLightBuffers();
+    // Load the scene
+    LoadScene::LoadedObj loaded_obj = LoadSelectedScene();
 
-    // Build geometry and materials to be used.
-    std::filesystem::path cornell_path  = "C:\\Users\\willy\\Documents\\Random Bullshit\\dx12-rt\\scenes\\obj\\CornellBox-Mirror-Rotated.obj";
-    LoadScene::LoadedObj loaded_obj     = LoadScene::load_obj(cornell_path.string());
-    BuildMaterials(loaded_obj);
-    BuildGeometry(loaded_obj);
+    // Build the light, material, and geometry buffers to be used.
+    BuildSceneBuffers(loaded_obj);
+    m_instances.Clear();
+    m_instances.SetObjectBounds(ObjectBounds(loaded_obj));
+    m_restInstances = loaded_obj.object_instances();
+    for (const LoadScene::ObjectInstance& instance : m_restInstances) {
+        m_instances.Add(instance.object, instance.transform);
+    }
+    m_buildPreferences.resize(loaded_obj.object_count());
+    for (size_t i = 0ULL; i < m_buildPreferences.size(); i++) {
+        m_buildPreferences[i] = loaded_obj.object_build_preference(i);
+    }
+
+    // Deforming objects keep their rest pose, and the CPU BVHs standing in for their BLASes
+    if (m_deformObjects) {
+        m_restPose      = std::move(loaded_obj);
+        m_deformedScene = std::make_unique<CpuRT::Scene>(m_restPose);
+        m_blasStandIns  = std::make_unique<CpuRT::BvhIntersector>(*m_deformedScene);
+    }
 
     // Build raytracing acceleration structures from the generated geometry.
     BuildAccelerationStructures();
+    if (m_residencyOrder) {
+        CreateResidencyManager();
+    }
+    if (m_defragmentationBudget > 0) {
+        CreateDefragmentationService();
+    }
 
-    // Create constant buffers for the geometry and the scene.
-    CreateConstantBuffers();
+    // Create the upload ring for the scene constants and other per-frame data.
+    CreateFrameUploadRing();
 
     // Build shader tables, which define shaders and their local root arguments.
     BuildShaderTables();
 
     // Create an output 2D texture to store the raytracing result to.
     CreateRaytracingOutputResource();
+
+    ReportMemoryStats();
 }
 
 void D3D12RaytracingSimpleLighting::SerializeAndCreateVersionedRootSignature(D3D12_VERSIONED_ROOT_SIGNATURE_DESC& desc, ComPtr<ID3D12RootSignature>* rootSig)
@@ -300,7 +939,7 @@ void D3D12RaytracingSimpleLighting::CreateRaytracingOutputResource()
     D3D12_UNORDERED_ACCESS_VIEW_DESC UAVDesc    = {};
     UAVDesc.ViewDimension                       = D3D12_UAV_DIMENSION_TEXTURE2D;
     device->CreateUnorderedAccessView(m_raytracingOutput.resource.Get(), nullptr, &UAVDesc, uavDescriptorHandle);
-    m_raytracingOutputResourceUAVGpuDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_descriptorHeap->GetGPUDescriptorHandleForHeapStart(), DescriptorHeapSlots::OutputRenderTarget, m_descriptorSize);
+    PublishDescriptor(DescriptorHeapSlots::OutputRenderTarget);
 }
 
 void D3D12RaytracingSimpleLighting::CreateDescriptorHeap()
@@ -315,92 +954,230 @@ void D3D12RaytracingSimpleLighting::CreateDescriptorHeap()
     device->CreateDescriptorHeap(&descriptorHeapDesc, IID_PPV_ARGS(&m_descriptorHeap));
     NAME_D3D12_OBJECT(m_descriptorHeap);
 
+    // Shader visible heaps are slow to read from on the CPU and cannot be copied from
+    descriptorHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+    device->CreateDescriptorHeap(&descriptorHeapDesc, IID_PPV_ARGS(&m_cpuDescriptorHeap));
+    NAME_D3D12_OBJECT(m_cpuDescriptorHeap);
+
     m_descriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 }
 
+// Create the custom pool that all scene buffers are placed in.
+void D3D12RaytracingSimpleLighting::CreateSceneBufferPool()
+{
+    D3D12MA::Allocator* allocator   = m_deviceResources->GetD3DMAllocator();
+
+    // Heaps of a fixed size that only hold buffers. A buffer too large for a heap falls back to a committed resource in the pool.
+    D3D12MA::POOL_DESC poolDesc     = {};
+    poolDesc.HeapProperties.Type    = D3D12_HEAP_TYPE_DEFAULT;
+    poolDesc.HeapFlags              = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+    poolDesc.BlockSize              = SceneBufferPoolBlockSize;
+    ThrowIfFailed(allocator->CreatePool(&poolDesc, &m_sceneBufferPool));
+    m_sceneBufferPool->SetName(L"SceneBuffers");
+}
+
+// Create the custom pool that BLASes are placed in, which can be defragmented without touching any other resources.
+void D3D12RaytracingSimpleLighting::CreateAccelerationStructurePool()
+{
+    D3D12MA::Allocator* allocator   = m_deviceResources->GetD3DMAllocator();
+
+    // Acceleration structures are buffers as well, and they use heaps of the same size as the scene buffers
+    D3D12MA::POOL_DESC poolDesc     = {};
+    poolDesc.HeapProperties.Type    = D3D12_HEAP_TYPE_DEFAULT;
+    poolDesc.HeapFlags              = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+    poolDesc.BlockSize              = SceneBufferPoolBlockSize;
+    ThrowIfFailed(allocator->CreatePool(&poolDesc, &m_accelerationStructurePool));
+    m_accelerationStructurePool->SetName(L"AccelerationStructures");
+}
+
+// Upload all scene buffers (lights, materials, and geometry) in a single batch.
+void D3D12RaytracingSimpleLighting::BuildSceneBuffers(const LoadScene::LoadedObj& loaded_obj)
+{
+    auto device                     = m_deviceResources->GetD3DDevice();
+    D3D12MA::Allocator* allocator   = m_deviceResources->GetD3DMAllocator();
+    CreateSceneBufferPool();
+
+    // Use the scene's lights if it has any, otherwise fall back to a pair of dummy lights
+    std::vector<PointLight> pointLights = loaded_obj.point_lights();
+
+    // Plan the staging layout of every buffer up front, in the same order the copies are queued below.
+    // Scenes that fit into a single staging chunk are uploaded from one arena of exactly the required size with one submission and
+    // one wait. Larger scenes are streamed through a ring of chunks, which bounds staging memory at the cost of more submissions.
+    UploadLayout layout(SceneStagingChunkSize);
+    auto planBuffer = [&layout](UINT64 size) {
+        while (size > 0) {
+            size -= layout.Allocate(size).size;
+        }
+    };
+    planBuffer(pointLights.size() * sizeof(PointLight));
+    planBuffer(loaded_obj.material_data().size_bytes());
+    for (size_t i = 0ULL; i < loaded_obj.object_count(); i++) {
+        planBuffer(loaded_obj.object_indices(i).size_bytes());
+        planBuffer(loaded_obj.object_vertices(i).size() * sizeof(DeviceVertex));
+        planBuffer(loaded_obj.object_material_indices(i).size_bytes());
+    }
+#if PACKED_GEOMETRY_BUFFERS
+    planBuffer(loaded_obj.object_count() * sizeof(GeometryRecord));
+#endif
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    planBuffer(loaded_obj.object_count() * sizeof(XMFLOAT3X4));
+#endif
+    bool singleArena        = layout.ChunkCount() <= 1ULL;
+    UINT64 stagingChunkSize = singleArena ? (std::max)(layout.TotalSize(), UploadLayout::DefaultAlignment) : SceneStagingChunkSize;
+    UINT stagingChunkCount  = singleArena ? 1U : SceneStagingChunkCount;
+    StagingUploader uploader(device, allocator, m_deviceResources->GetCommandQueue(), m_deviceResources->GetCommandList(), stagingChunkSize, stagingChunkCount);
+
+    BuildLightBuffers(uploader, pointLights);
+    BuildMaterials(uploader, loaded_obj);
+    BuildGeometry(uploader, loaded_obj);
+
+    // Submit the remaining copies and wait for the GPU to finish as the staging memory is released once we go out of scope
+    uploader.Finish();
+
+    const StagingRing::Stats& stats = uploader.GetStats();
+    char buff[256] = {};
+    sprintf_s(buff, "BuildSceneBuffers: staged %llu bytes in %u submissions, peak staging memory %llu bytes, %u waits\n",
+        stats.bytesAllocated, stats.submissions, stats.peakBytesInFlight, stats.waits);
+    OutputDebugStringA(buff);
+}
+
+// Report how fragmented the heaps of the scene buffers are, and write the allocator's statistics to m_memoryStatsPath if it is set.
+void D3D12RaytracingSimpleLighting::ReportMemoryStats()
+{
+    // Unused memory only helps a new buffer if it is contiguous, so fragmentation is measured like the defragmentation service does
+    D3D12MA::DetailedStatistics poolStats = {};
+    m_sceneBufferPool->CalculateStatistics(&poolStats);
+    const DefragScheduler::Usage usage = DefragmentationService::PoolUsage(poolStats);
+    char buff[256] = {};
+    sprintf_s(buff, "Scene buffer pool: %u allocations in %u blocks, %llu of %llu bytes used, %u unused ranges of up to %llu bytes, fragmentation %.2f\n",
+        poolStats.Stats.AllocationCount, poolStats.Stats.BlockCount, usage.allocationBytes, usage.blockBytes,
+        poolStats.UnusedRangeCount, usage.largestUnusedRange, DefragScheduler::Fragmentation(usage));
+    OutputDebugStringA(buff);
+
+    if (m_memoryStatsPath.empty()) {
+        return;
+    }
+
+    // The JSON lists every heap type and custom pool along with a detailed map of the allocations in their blocks
+    D3D12MA::Allocator* allocator   = m_deviceResources->GetD3DMAllocator();
+    WCHAR* statsString              = nullptr;
+    allocator->BuildStatsString(&statsString, TRUE);
+    // The string is UTF-16, convert it to UTF-8 explicitly since resource and pool names need not be representable in the ANSI code page
+    const int wideLength    = static_cast<int>(wcslen(statsString));
+    const int length        = WideCharToMultiByte(CP_UTF8, 0, statsString, wideLength, nullptr, 0, nullptr, nullptr);
+    std::string statsJson(static_cast<size_t>(length), '\0');
+    WideCharToMultiByte(CP_UTF8, 0, statsString, wideLength, statsJson.data(), length, nullptr, nullptr);
+    allocator->FreeStatsString(statsString);
+    std::ofstream statsFile(m_memoryStatsPath);
+    statsFile << statsJson;
+    ThrowIfFalse(statsFile.good(), L"Failed to write the memory statistics.\n");
+}
+
 // Build geometry used in the sample.
-void D3D12RaytracingSimpleLighting::BuildGeometry(LoadScene::LoadedObj loaded_obj)
+void D3D12RaytracingSimpleLighting::BuildGeometry(StagingUploader& uploader, const LoadScene::LoadedObj& loaded_obj)
 {
     D3D12MA::Allocator* allocator               = m_deviceResources->GetD3DMAllocator();
-    ID3D12GraphicsCommandList* commandList      = m_deviceResources->GetCommandList();
-    ID3D12CommandAllocator* commandAllocator    = m_deviceResources->GetCommandAllocator();
-    const size_t num_objects                    = loaded_obj.indices_per_object.size();
-
-    // Reset the command list so we can issue copy command and resource transitions for staging buffer copies
-    commandList->Reset(commandAllocator, nullptr);
+    const size_t num_objects                    = loaded_obj.object_count();
+
+#if COMPACT_VERTICES
+    // Vertices are encoded one object at a time right before they are copied into staging memory
+    std::vector<CompactVertex> compactVertices;
+    std::vector<XMFLOAT3X4> dequantizationTransforms(num_objects);
+    auto objectVertices = [&](size_t i) {
+        LoadScene::PositionDequantization dq = LoadScene::encode_vertices(loaded_obj.object_vertices(i), LoadScene::DevicePositionEncoding, compactVertices);
+        dequantizationTransforms[i] = DequantizationTransform(dq);
+        return std::span<const DeviceVertex>(compactVertices);
+    };
+#else
+    auto objectVertices = [&](size_t i) { return loaded_obj.object_vertices(i); };
+#endif
 
-    // These staging buffers will be automatically free'd when these vectors go out of scope after the method is done executing
-    std::vector<D3DBuffer> indexStagingBuffers(num_objects);
-    std::vector<D3DBuffer> vertexStagingBuffers(num_objects);
-    std::vector<D3DBuffer> materialIndexStagingBuffers(num_objects);
+#if PACKED_GEOMETRY_BUFFERS
+    // Lay out all objects back to back in the packed buffers
+    m_geometryPacker.Clear();
+    for (size_t i = 0ULL; i < num_objects; i++) {
+        m_geometryPacker.Add(loaded_obj.object_indices(i).size(), loaded_obj.object_vertices(i).size());
+    }
+    ThrowIfFalse(m_geometryPacker.FitsShaderAddressing(), L"Scene geometry exceeds the 32 bit addressing of the packed geometry buffers.\n");
+    const std::vector<GeometryRecord>& records = m_geometryPacker.Records();
+
+    // Create the device-side buffers and their SRVs, which occupy a fixed number of descriptor slots regardless of the object count
+    size_t indicesSize          = m_geometryPacker.IndexCount() * sizeof(Index);
+    size_t verticesSize         = m_geometryPacker.VertexCount() * sizeof(DeviceVertex);
+    size_t materialIndicesSize  = m_geometryPacker.TriangleCount() * sizeof(MaterialIndex);
+    size_t recordsSize          = records.size() * sizeof(GeometryRecord);
+    AllocateDeviceBuffer(allocator, indicesSize, &m_packedIndexBuffer.resource.resource, &m_packedIndexBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"PackedIndices", m_sceneBufferPool.Get());
+    AllocateDeviceBuffer(allocator, verticesSize, &m_packedVertexBuffer.resource.resource, &m_packedVertexBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"PackedVertices", m_sceneBufferPool.Get());
+    AllocateDeviceBuffer(allocator, materialIndicesSize, &m_packedMaterialIndexBuffer.resource.resource, &m_packedMaterialIndexBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"PackedMaterialIndices", m_sceneBufferPool.Get());
+    AllocateDeviceBuffer(allocator, recordsSize, &m_geometryRecordsBuffer.resource.resource, &m_geometryRecordsBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"GeometryRecords", m_sceneBufferPool.Get());
+    CreateBufferSRV(&m_packedIndexBuffer, static_cast<UINT>(m_geometryPacker.IndexCount()), 0, DescriptorHeapSlots::PackedIndicesBuffer);
+    CreateBufferSRV(&m_packedVertexBuffer, static_cast<UINT>(m_geometryPacker.VertexCount()), sizeof(DeviceVertex), DescriptorHeapSlots::PackedVerticesBuffer);
+    CreateBufferSRV(&m_packedMaterialIndexBuffer, static_cast<UINT>(m_geometryPacker.TriangleCount()), 0, DescriptorHeapSlots::PackedMaterialIndicesBuffer);
+    CreateBufferSRV(&m_geometryRecordsBuffer, static_cast<UINT>(records.size()), sizeof(GeometryRecord), DescriptorHeapSlots::GeometryRecordsBuffer);
+
+    // Queue copies of every object's data into its range of the packed buffers, indices are copied unchanged
+    for (size_t i = 0ULL; i < num_objects; i++) {
+        std::span<const Index> object_indices           = loaded_obj.object_indices(i);
+        std::span<const DeviceVertex> object_vertices   = objectVertices(i);
+        std::span<const Index> object_material_indices  = loaded_obj.object_material_indices(i);
+        uploader.CopyToBuffer(m_packedIndexBuffer.resource.resource.Get(), records[i].firstIndex * sizeof(Index), object_indices.data(), object_indices.size_bytes());
+        uploader.CopyToBuffer(m_packedVertexBuffer.resource.resource.Get(), records[i].firstVertex * sizeof(DeviceVertex), object_vertices.data(), object_vertices.size_bytes());
+        uploader.CopyToBuffer(m_packedMaterialIndexBuffer.resource.resource.Get(), records[i].firstTriangle * sizeof(MaterialIndex), object_material_indices.data(), object_material_indices.size_bytes());
+    }
+    uploader.CopyToBuffer(m_geometryRecordsBuffer.resource.resource.Get(), 0, records.data(), recordsSize);
+#else
+    // Every object needs a tuple of index, vertex, and material index SRVs after the fixed descriptor slots
+    ThrowIfFalse(DescriptorHeapSlots::IndexVertexMaterialBuffersBegin + num_objects * 3ULL <= m_descriptorHeap->GetDesc().NumDescriptors,
+        L"Scene contains more objects than the descriptor heap can hold.\n");
 
     m_indexBuffers.resize(num_objects);
     m_vertexBuffers.resize(num_objects);
     m_materialIndexBuffers.resize(num_objects);
     for (size_t i = 0ULL; i < num_objects; i++) {
         // Retrieve raw data
-        Indices& object_indices             = loaded_obj.indices_per_object[i];
-        Vertices& object_vertices           = loaded_obj.vertices_per_object[i];
-        Indices& object_material_indices    = loaded_obj.material_indices_per_object[i];
-
-        // Create staging and device-side buffers
-        size_t indicesSize          = object_indices.size() * sizeof(Index);
-        size_t verticesSize         = object_vertices.size() * sizeof(Vertex);
-        size_t materialIndicesSize  = object_material_indices.size() * sizeof(Index);
-        AllocateUploadBuffer(allocator, object_indices.data(), indicesSize, &indexStagingBuffers[i].resource.resource, &indexStagingBuffers[i].resource.allocation, L"IndicesStaging");
-        AllocateUploadBuffer(allocator, object_vertices.data(), verticesSize, &vertexStagingBuffers[i].resource.resource, &vertexStagingBuffers[i].resource.allocation, L"VerticesStaging");
-        AllocateUploadBuffer(allocator, object_material_indices.data(), materialIndicesSize, &materialIndexStagingBuffers[i].resource.resource, &materialIndexStagingBuffers[i].resource.allocation, L"MaterialIndicesStaging");
-        AllocateDeviceBuffer(allocator, indicesSize, &m_indexBuffers[i].resource.resource, &m_indexBuffers[i].resource.allocation, false, D3D12_RESOURCE_STATE_COPY_DEST, L"Indices");
-        AllocateDeviceBuffer(allocator, verticesSize, &m_vertexBuffers[i].resource.resource, &m_vertexBuffers[i].resource.allocation, false, D3D12_RESOURCE_STATE_COPY_DEST, L"Vertices");
-        AllocateDeviceBuffer(allocator, materialIndicesSize, &m_materialIndexBuffers[i].resource.resource, &m_materialIndexBuffers[i].resource.allocation, false, D3D12_RESOURCE_STATE_COPY_DEST, L"MaterialIndicess");
+        std::span<const Index> object_indices           = loaded_obj.object_indices(i);
+        std::span<const DeviceVertex> object_vertices   = objectVertices(i);
+        std::span<const Index> object_material_indices  = loaded_obj.object_material_indices(i);
+
+        // Create device-side buffers
+        size_t indicesSize          = object_indices.size_bytes();
+        size_t verticesSize         = object_vertices.size_bytes();
+        size_t materialIndicesSize  = object_material_indices.size_bytes();
+        AllocateDeviceBuffer(allocator, indicesSize, &m_indexBuffers[i].resource.resource, &m_indexBuffers[i].resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"Indices", m_sceneBufferPool.Get(), EvictableAllocationFlags());
+        AllocateDeviceBuffer(allocator, verticesSize, &m_vertexBuffers[i].resource.resource, &m_vertexBuffers[i].resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"Vertices", m_sceneBufferPool.Get(), EvictableAllocationFlags());
+        AllocateDeviceBuffer(allocator, materialIndicesSize, &m_materialIndexBuffers[i].resource.resource, &m_materialIndexBuffers[i].resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"MaterialIndicess", m_sceneBufferPool.Get(), EvictableAllocationFlags());
 
         // Create SRVs for device-side buffers
         UINT object_srv_idx_base = DescriptorHeapSlots::IndexVertexMaterialBuffersBegin + (static_cast<UINT>(i) * 3U);
         CreateBufferSRV(&m_indexBuffers[i], static_cast<UINT>(object_indices.size()), 0, object_srv_idx_base);
-        CreateBufferSRV(&m_vertexBuffers[i], static_cast<UINT>(object_vertices.size()), sizeof(Vertex), object_srv_idx_base + 1U);
+        CreateBufferSRV(&m_vertexBuffers[i], static_cast<UINT>(object_vertices.size()), sizeof(DeviceVertex), object_srv_idx_base + 1U);
         CreateBufferSRV(&m_materialIndexBuffers[i], static_cast<UINT>(object_material_indices.size()), 0, object_srv_idx_base + 2U);
 
-        // Queue copies from staging buffer copies and transitions to SRV state
-        commandList->CopyResource(m_indexBuffers[i].resource.resource.Get(), indexStagingBuffers[i].resource.resource.Get());
-        commandList->CopyResource(m_vertexBuffers[i].resource.resource.Get(), vertexStagingBuffers[i].resource.resource.Get());
-        commandList->CopyResource(m_materialIndexBuffers[i].resource.resource.Get(), materialIndexStagingBuffers[i].resource.resource.Get());
-        CD3DX12_RESOURCE_BARRIER srvTransitions[3] = {
-            CD3DX12_RESOURCE_BARRIER::Transition(m_indexBuffers[i].resource.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_vertexBuffers[i].resource.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_materialIndexBuffers[i].resource.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)
-        };
-        commandList->ResourceBarrier(3, srvTransitions);
+        // Pack the data into staging memory and queue copies to the device-side buffers
+        uploader.CopyToBuffer(m_indexBuffers[i].resource.resource.Get(), 0, object_indices.data(), indicesSize);
+        uploader.CopyToBuffer(m_vertexBuffers[i].resource.resource.Get(), 0, object_vertices.data(), verticesSize);
+        uploader.CopyToBuffer(m_materialIndexBuffers[i].resource.resource.Get(), 0, object_material_indices.data(), materialIndicesSize);
     }
+#endif
 
-    // Kick off staging buffers copy and wait for GPU to finish as the locally created temporary GPU resources will get released once we go out of scope
-    m_deviceResources->ExecuteCommandList();
-    m_deviceResources->WaitForGpu();
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    // BLAS builds read quantized positions as SNORMs in [-1, 1] and map them back to object space through these transforms
+    size_t transformsSize = dequantizationTransforms.size() * sizeof(XMFLOAT3X4);
+    AllocateDeviceBuffer(allocator, transformsSize, &m_positionDequantizationTransforms.resource, &m_positionDequantizationTransforms.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"PositionDequantizationTransforms", m_sceneBufferPool.Get());
+    uploader.CopyToBuffer(m_positionDequantizationTransforms.resource.Get(), 0, dequantizationTransforms.data(), transformsSize);
+#endif
 }
 
-void D3D12RaytracingSimpleLighting::BuildMaterials(LoadScene::LoadedObj loaded_obj)
+void D3D12RaytracingSimpleLighting::BuildMaterials(StagingUploader& uploader, const LoadScene::LoadedObj& loaded_obj)
 {
-    D3D12MA::Allocator* allocator               = m_deviceResources->GetD3DMAllocator();
-    ID3D12GraphicsCommandList* commandList      = m_deviceResources->GetCommandList();
-    ID3D12CommandAllocator* commandAllocator    = m_deviceResources->GetCommandAllocator();
-
-    // Reset the command list so we can issue copy command and resource transitions for staging buffer copies
-    commandList->Reset(commandAllocator, nullptr);
-
-    // Create device buffer, staging buffer, and an SRV for the device buffer
-    D3DBuffer materialsStagingBuffer;
-    size_t materialsSize = loaded_obj.materials.size() * sizeof(MaterialPBR);
-    AllocateUploadBuffer(allocator, loaded_obj.materials.data(), materialsSize, &materialsStagingBuffer.resource.resource, &materialsStagingBuffer.resource.allocation, L"MaterialsStaging");
-    AllocateDeviceBuffer(allocator, materialsSize, &m_materialsBuffer.resource.resource, &m_materialsBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COPY_DEST, L"Materials");
-    CreateBufferSRV(&m_materialsBuffer, static_cast<UINT>(loaded_obj.materials.size()), sizeof(MaterialPBR), DescriptorHeapSlots::MaterialsBuffer);
-
-    // Queue copies from staging buffer copies and transitions to SRV state
-    commandList->CopyResource(m_materialsBuffer.resource.resource.Get(), materialsStagingBuffer.resource.resource.Get());
-    CD3DX12_RESOURCE_BARRIER srvTransition = CD3DX12_RESOURCE_BARRIER::Transition(m_materialsBuffer.resource.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-    commandList->ResourceBarrier(1, &srvTransition);
-
-    // Kick off staging buffer copy and wait for GPU to finish as the locally created temporary GPU resources will get released once we go out of scope
-    m_deviceResources->ExecuteCommandList();
-    m_deviceResources->WaitForGpu();
+    D3D12MA::Allocator* allocator = m_deviceResources->GetD3DMAllocator();
+
+    // Create device buffer and an SRV for it, then queue the copy from staging memory
+    std::span<const MaterialPBR> materials = loaded_obj.material_data();
+    size_t materialsSize = materials.size_bytes();
+    AllocateDeviceBuffer(allocator, materialsSize, &m_materialsBuffer.resource.resource, &m_materialsBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"Materials", m_sceneBufferPool.Get());
+    CreateBufferSRV(&m_materialsBuffer, static_cast<UINT>(materials.size()), sizeof(MaterialPBR), DescriptorHeapSlots::MaterialsBuffer);
+    uploader.CopyToBuffer(m_materialsBuffer.resource.resource.Get(), 0, materials.data(), materialsSize);
 }
 
 // Build acceleration structures needed for raytracing.
@@ -409,7 +1186,11 @@ void D3D12RaytracingSimpleLighting::BuildAccelerationStructures()
     D3D12MA::Allocator* allocator               = m_deviceResources->GetD3DMAllocator();
     ID3D12GraphicsCommandList* commandList      = m_deviceResources->GetCommandList();
     ID3D12CommandAllocator* commandAllocator    = m_deviceResources->GetCommandAllocator();
+#if PACKED_GEOMETRY_BUFFERS
+    const size_t num_objects                    = m_geometryPacker.ObjectCount();
+#else
     const size_t num_objects                    = m_indexBuffers.size();
+#endif
 
     // Reset the command list for the acceleration structure construction.
     commandList->Reset(commandAllocator, nullptr);
@@ -419,19 +1200,37 @@ void D3D12RaytracingSimpleLighting::BuildAccelerationStructures()
     baseGeometryDesc.Type                                   = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
     baseGeometryDesc.Triangles.IndexFormat                  = DXGI_FORMAT_R32_UINT;
     baseGeometryDesc.Triangles.Transform3x4                 = 0;
+#if !COMPACT_VERTICES
     baseGeometryDesc.Triangles.VertexFormat                 = DXGI_FORMAT_R32G32B32_FLOAT;
-    baseGeometryDesc.Triangles.VertexBuffer.StrideInBytes   = sizeof(Vertex);
+#elif COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    baseGeometryDesc.Triangles.VertexFormat                 = DXGI_FORMAT_R16G16B16A16_SNORM; // The A component (zero) is ignored
+#else
+    baseGeometryDesc.Triangles.VertexFormat                 = DXGI_FORMAT_R16G16B16A16_FLOAT; // The A component (zero) is ignored
+#endif
+    baseGeometryDesc.Triangles.VertexBuffer.StrideInBytes   = sizeof(DeviceVertex);
     baseGeometryDesc.Flags                                  = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE; // TODO: Change this if we ever decide to support transparent geometry
-    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> blasDescs(num_objects, baseGeometryDesc);
+    m_blasGeometryDescs.assign(num_objects, baseGeometryDesc);
+    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC>& blasDescs = m_blasGeometryDescs;
     for (size_t i = 0ULL; i < num_objects; i++) {
-        blasDescs[i].Triangles.VertexBuffer.StartAddress    = m_vertexBuffers[i].resource.resource->GetGPUVirtualAddress();
-        blasDescs[i].Triangles.VertexCount                  = static_cast<UINT>(m_vertexBuffers[i].resource.resource->GetDesc().Width) / sizeof(Vertex);
-        blasDescs[i].Triangles.IndexBuffer                  = m_indexBuffers[i].resource.resource->GetGPUVirtualAddress();
+#if PACKED_GEOMETRY_BUFFERS
+        blasDescs[i].Triangles.VertexCount                  = static_cast<UINT>(m_geometryPacker.ObjectVertexCount(i));
+        blasDescs[i].Triangles.IndexCount                   = static_cast<UINT>(m_geometryPacker.ObjectIndexCount(i));
+#else
+        blasDescs[i].Triangles.VertexCount                  = static_cast<UINT>(m_vertexBuffers[i].resource.resource->GetDesc().Width) / sizeof(DeviceVertex);
         blasDescs[i].Triangles.IndexCount                   = static_cast<UINT>(m_indexBuffers[i].resource.resource->GetDesc().Width) / sizeof(Index);
+#endif
     }
+    SetBlasGeometryAddresses();
 
-    // For both BLASes and TLASes, we would like a slow build in exchange for fast tracing
+    // The TLAS is small, so we would like a slow build in exchange for fast tracing. BLASes follow their object's build preference.
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+    auto blasBuildFlags = [](LoadScene::BuildPreference preference) {
+        switch (preference) {
+        case LoadScene::BuildPreference::Balanced:  return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+        case LoadScene::BuildPreference::FastBuild: return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD;
+        default:                                    return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+        }
+    };
     
     // Get prebuild info for the BLASes
     D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC baseBlasBuildDesc    = {};
@@ -440,32 +1239,49 @@ void D3D12RaytracingSimpleLighting::BuildAccelerationStructures()
     baseBlasBuildDesc.Inputs.NumDescs                                       = 1;
     baseBlasBuildDesc.Inputs.Type                                           = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
     std::vector<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO> blasPrebuildInfos(num_objects);
-    std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC> blasBuildDescs(num_objects, baseBlasBuildDesc);
+    m_blasBuildDescs.assign(num_objects, baseBlasBuildDesc);
+    std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC>& blasBuildDescs = m_blasBuildDescs;
     for (size_t i = 0ULL; i < blasPrebuildInfos.size(); i++) {
         blasBuildDescs[i].Inputs.pGeometryDescs = &blasDescs[i];
+        blasBuildDescs[i].Inputs.Flags          = blasBuildFlags(m_buildPreferences[i]);
+        if (m_deformObjects) {
+            blasBuildDescs[i].Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+        }
+        else if (m_compactAccelerationStructures) {
+            blasBuildDescs[i].Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+        }
         m_dxrDevice->GetRaytracingAccelerationStructurePrebuildInfo(&blasBuildDescs[i].Inputs, &blasPrebuildInfos[i]);
         ThrowIfFalse(blasPrebuildInfos[i].ResultDataMaxSizeInBytes > 0);
     }
     
     // Get prebuild info for the TLAS
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC tlasBuildDesc    = {};
+    m_tlasBuildDesc                                                     = {};
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC& tlasBuildDesc   = m_tlasBuildDesc;
     tlasBuildDesc.Inputs.DescsLayout                                    = D3D12_ELEMENTS_LAYOUT_ARRAY;
     tlasBuildDesc.Inputs.Flags                                          = buildFlags;
-    tlasBuildDesc.Inputs.NumDescs                                       = static_cast<UINT>(num_objects);
+    tlasBuildDesc.Inputs.NumDescs                                       = static_cast<UINT>(m_instances.Size());
     tlasBuildDesc.Inputs.pGeometryDescs                                 = nullptr;
     tlasBuildDesc.Inputs.Type                                           = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO topLevelPrebuildInfo = {};
     m_dxrDevice->GetRaytracingAccelerationStructurePrebuildInfo(&tlasBuildDesc.Inputs, &topLevelPrebuildInfo);
     ThrowIfFalse(topLevelPrebuildInfo.ResultDataMaxSizeInBytes > 0);
 
-    // Allocate scratch space for BLAS builds
-    std::vector<D3DResource> scratchResourcesBlas(num_objects);
+    // BLASes are built in batches that share one scratch buffer, so the builds of a batch can overlap on the GPU and only need a single
+    // barrier. Deforming objects keep the buffer and the batches for their updates and rebuilds.
+    BuildBatcher buildBatcher(BlasBuildScratchBudget);
     for (size_t i = 0ULL; i < num_objects; i++) {
-        AllocateDeviceBuffer(allocator, blasPrebuildInfos[i].ScratchDataSizeInBytes, &scratchResourcesBlas[i].resource, &scratchResourcesBlas[i].allocation, true);
+        UINT64 scratchSize = blasPrebuildInfos[i].ScratchDataSizeInBytes;
+        if (m_deformObjects) {
+            scratchSize = (std::max)(scratchSize, blasPrebuildInfos[i].UpdateScratchDataSizeInBytes);
+        }
+        buildBatcher.Add(scratchSize);
     }
+    m_blasBuildBatches                  = buildBatcher.Pack();
+    D3DResource& scratchResourceBlas    = m_blasScratchResource;
+    AllocateDeviceBuffer(allocator, (std::max)(BuildBatcher::ScratchBufferSize(m_blasBuildBatches), BuildBatcher::ScratchAlignment), &scratchResourceBlas.resource, &scratchResourceBlas.allocation, true);
     
     // Allocate scratch space for TLAS build
-    D3DResource scratchResourceTlas;
+    D3DResource& scratchResourceTlas = m_tlasScratchResource;
     AllocateDeviceBuffer(allocator, topLevelPrebuildInfo.ScratchDataSizeInBytes, &scratchResourceTlas.resource, &scratchResourceTlas.allocation, true);
 
     // Acceleration structures can only be placed in resources that are created in the default heap (or custom heap equivalent). 
@@ -476,89 +1292,395 @@ void D3D12RaytracingSimpleLighting::BuildAccelerationStructures()
     D3D12_RESOURCE_STATES initialResourceState = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
         
     // Allocate buffers for the actual BLASes and TLAS
+    if (m_defragmentationBudget > 0) {
+        CreateAccelerationStructurePool();
+    }
     m_bottomLevelAccelerationStructures.resize(num_objects);
     for (size_t i = 0ULL; i < num_objects; i++) {
-        AllocateDeviceBuffer(allocator, blasPrebuildInfos[i].ResultDataMaxSizeInBytes, &m_bottomLevelAccelerationStructures[i].resource, &m_bottomLevelAccelerationStructures[i].allocation, true, initialResourceState);
+        AllocateDeviceBuffer(allocator, blasPrebuildInfos[i].ResultDataMaxSizeInBytes, &m_bottomLevelAccelerationStructures[i].resource, &m_bottomLevelAccelerationStructures[i].allocation, true, initialResourceState,
+                             nullptr, m_accelerationStructurePool.Get(), EvictableAllocationFlags());
     }
     AllocateDeviceBuffer(allocator, topLevelPrebuildInfo.ResultDataMaxSizeInBytes, &m_topLevelAccelerationStructure.resource, &m_topLevelAccelerationStructure.allocation, true, initialResourceState);
     
-    // Create an instance for each BLAS
-    D3D12_RAYTRACING_INSTANCE_DESC baseInstanceDesc = {};
-    baseInstanceDesc.Transform[0][0] = baseInstanceDesc.Transform[1][1] = baseInstanceDesc.Transform[2][2] = 1;
-    baseInstanceDesc.InstanceMask                   = 1;
-    std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescs(num_objects, baseInstanceDesc);
+    // Update BLAS build descriptions with GPU-allocated resources, every build uses its batch's region of the scratch buffer
+    for (const BuildBatcher::Batch& batch : m_blasBuildBatches) {
+        for (const BuildBatcher::Placement& placement : batch.builds) {
+            blasBuildDescs[placement.build].ScratchAccelerationStructureData = scratchResourceBlas.resource->GetGPUVirtualAddress() + placement.scratchOffset;
+        }
+    }
     for (size_t i = 0ULL; i < num_objects; i++) {
-        instanceDescs[i].AccelerationStructure  = m_bottomLevelAccelerationStructures[i].resource->GetGPUVirtualAddress();
-        instanceDescs[i].InstanceID             = static_cast<UINT>(i); // This value will be used to reference this instance in HLSL shader code
+        blasBuildDescs[i].DestAccelerationStructureData = m_bottomLevelAccelerationStructures[i].resource->GetGPUVirtualAddress();
     }
-    D3DResource blasInstanceDescsBuffer;
-    AllocateUploadBuffer(allocator, instanceDescs.data(), instanceDescs.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), &blasInstanceDescsBuffer.resource, &blasInstanceDescsBuffer.allocation, L"InstanceDescs");
 
-    // Update BLAS build descriptions with GPU-allocated resources
-    for (size_t i = 0ULL; i < num_objects; i++) {
-        blasBuildDescs[i].ScratchAccelerationStructureData  = scratchResourcesBlas[i].resource->GetGPUVirtualAddress();
-        blasBuildDescs[i].DestAccelerationStructureData     = m_bottomLevelAccelerationStructures[i].resource->GetGPUVirtualAddress();
+    // Build acceleration structures.
+    // BLASes, which emit their compacted size if they are going to be compacted
+    std::unique_ptr<AccelerationStructureCompactor> compactor;
+    if (m_compactAccelerationStructures && !m_deformObjects) {
+        compactor = std::make_unique<AccelerationStructureCompactor>(m_deviceResources.get(), m_dxrCommandList.Get(), m_bottomLevelAccelerationStructures, AccelerationStructureCompactionBudget,
+                                                                 m_accelerationStructurePool.Get(), EvictableAllocationFlags());
+    }
+    for (const BuildBatcher::Batch& batch : m_blasBuildBatches) {
+        for (const BuildBatcher::Placement& placement : batch.builds) {
+            if (compactor) {
+                D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildInfoDesc = compactor->PostbuildInfoDesc(placement.build);
+                m_dxrCommandList->BuildRaytracingAccelerationStructure(&blasBuildDescs[placement.build], 1, &postbuildInfoDesc);
+            }
+            else {
+                m_dxrCommandList->BuildRaytracingAccelerationStructure(&blasBuildDescs[placement.build], 0, nullptr);
+            }
+        }
+        // The next batch reuses the scratch buffer, and the last one's BLASes are read by the TLAS build, so one barrier on all UAV
+        // accesses covers both
+        CD3DX12_RESOURCE_BARRIER batch_uav = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+        m_dxrCommandList->ResourceBarrier(1, &batch_uav);
     }
 
+    // Compaction needs the compacted sizes on the CPU, so the BLAS builds have to complete before the copies can be recorded.
+    // Compacted BLASes live at new addresses, which is why the instances are only created afterwards.
+    if (compactor) {
+        compactor->RecordSizeReadback();
+        m_deviceResources->ExecuteCommandList();
+        m_deviceResources->WaitForGpu();
+        m_blasScratchResource = {};
+
+        const CompactionPlanner::Stats& stats = compactor->Compact();
+        char buff[256] = {};
+        sprintf_s(buff, "BuildAccelerationStructures: compacted %u BLASes (%u skipped) in %u batches from %llu to %llu bytes, peak %llu bytes\n",
+            stats.compacted, stats.skipped, stats.batches, stats.originalBytes, stats.compactedBytes, stats.peakBytes);
+        OutputDebugStringA(buff);
+        compactor.reset();
+
+        commandList->Reset(commandAllocator, nullptr);
+    }
+
+    // Create the scene's instances of the BLASes, the CPU renderer's TLAS uses the same transforms and IDs
+    std::span<const LoadScene::ObjectInstance> instances = m_instances.Instances();
+    std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescs(instances.size());
+    for (size_t i = 0ULL; i < instances.size(); i++) {
+        instanceDescs[i] = InstanceDesc(instances[i], m_bottomLevelAccelerationStructures[instances[i].object].resource->GetGPUVirtualAddress());
+    }
+    D3DResource& blasInstanceDescsBuffer = m_instanceDescsBuffer;
+    AllocateUploadBuffer(allocator, instanceDescs.data(), instanceDescs.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), &blasInstanceDescsBuffer.resource, &blasInstanceDescsBuffer.allocation, L"InstanceDescs");
+
     // Update TLAS build description with GPU-allocated resources
     tlasBuildDesc.DestAccelerationStructureData     = m_topLevelAccelerationStructure.resource->GetGPUVirtualAddress();
     tlasBuildDesc.ScratchAccelerationStructureData  = scratchResourceTlas.resource->GetGPUVirtualAddress();
     tlasBuildDesc.Inputs.InstanceDescs              = blasInstanceDescsBuffer.resource->GetGPUVirtualAddress();
 
-    // Build acceleration structures.
-    // BLASes
-    for (size_t i = 0ULL; i < num_objects; i++) {
-        m_dxrCommandList->BuildRaytracingAccelerationStructure(&blasBuildDescs[i], 0, nullptr);
-        CD3DX12_RESOURCE_BARRIER bvh_uav = CD3DX12_RESOURCE_BARRIER::UAV(m_bottomLevelAccelerationStructures[i].resource.Get());
-        m_dxrCommandList->ResourceBarrier(1, &bvh_uav);
-    }
     // TLAS
     m_dxrCommandList->BuildRaytracingAccelerationStructure(&tlasBuildDesc, 0, nullptr);
     
     // Kick off acceleration structure construction.
     m_deviceResources->ExecuteCommandList();
 
-    // Wait for GPU to finish as the locally created temporary GPU resources will get released once we go out of scope.
+    // Wait for GPU to finish as the scratch resources will get released, unless there are acceleration structures to rebuild every frame.
     m_deviceResources->WaitForGpu();
+    m_instanceDescsBuffer = {};
+    if (!KeepsTopLevelBuildState()) {
+        m_blasScratchResource = {};
+        m_blasBuildBatches.clear();
+        m_tlasScratchResource = {};
+        return;
+    }
+
+    // The TLAS is rebuilt from instance descs written to the frame upload ring every frame, or after defragmentation has moved BLASes
+    m_tlasInstanceCapacity = tlasBuildDesc.Inputs.NumDescs;
+    if (!m_deformObjects) {
+        m_blasScratchResource = {};
+        m_blasBuildBatches.clear();
+        return;
+    }
+
+    // Deformed vertices are copied to the geometry buffers through a persistently mapped upload buffer, which has a slice for every frame
+    // in flight
+    m_deformedVertexSliceSize = 0;
+    for (size_t i = 0ULL; i < num_objects; i++) {
+        m_deformedVertexSliceSize += m_restPose.object_vertices(i).size() * sizeof(DeviceVertex);
+    }
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    m_deformedVertexSliceSize += num_objects * sizeof(XMFLOAT3X4);
+#endif
+    AllocateUploadBuffer(allocator, nullptr, (std::max)(m_deformedVertexSliceSize, 1ULL) * FrameCount, &m_deformedVertexUpload.resource, &m_deformedVertexUpload.allocation, L"DeformedVertices");
+    CD3DX12_RANGE readRange(0, 0); // We do not intend to read from this resource on the CPU.
+    ThrowIfFailed(m_deformedVertexUpload.resource->Map(0, &readRange, reinterpret_cast<void**>(&m_mappedDeformedVertices)));
 }
 
-void D3D12RaytracingSimpleLighting::BuildLightBuffers()
+// Point the BLAS geometry descriptions at the current places of the geometry buffers.
+void D3D12RaytracingSimpleLighting::SetBlasGeometryAddresses()
 {
-    D3D12MA::Allocator* allocator               = m_deviceResources->GetD3DMAllocator();
-    ID3D12GraphicsCommandList* commandList      = m_deviceResources->GetCommandList();
-    ID3D12CommandAllocator* commandAllocator    = m_deviceResources->GetCommandAllocator();
-
-    // Reset the command list so we can issue copy command and resource transitions for staging buffer copies
-    commandList->Reset(commandAllocator, nullptr);
+    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC>& blasDescs = m_blasGeometryDescs;
+    for (size_t i = 0ULL; i < blasDescs.size(); i++) {
+#if PACKED_GEOMETRY_BUFFERS
+        // Every BLAS is built from its object's range of the packed buffers, so its indices remain relative to its first vertex
+        const GeometryRecord& record                        = m_geometryPacker.Records()[i];
+        blasDescs[i].Triangles.VertexBuffer.StartAddress    = m_packedVertexBuffer.resource.resource->GetGPUVirtualAddress() + record.firstVertex * sizeof(DeviceVertex);
+        blasDescs[i].Triangles.IndexBuffer                  = m_packedIndexBuffer.resource.resource->GetGPUVirtualAddress() + record.firstIndex * sizeof(Index);
+#else
+        blasDescs[i].Triangles.VertexBuffer.StartAddress    = m_vertexBuffers[i].resource.resource->GetGPUVirtualAddress();
+        blasDescs[i].Triangles.IndexBuffer                  = m_indexBuffers[i].resource.resource->GetGPUVirtualAddress();
+#endif
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+        blasDescs[i].Triangles.Transform3x4                 = m_positionDequantizationTransforms.resource->GetGPUVirtualAddress() + i * sizeof(XMFLOAT3X4);
+#endif
+    }
+}
 
-    // TODO: Acquire these in a programmatic manner instead of just creating dummies
-    std::vector<PointLight> pointLights;
-    PointLight p0 = {
-        .position = { 0.5f, 1.0f, -0.3f },
-        .color = { 0.35f, 0.35f, 0.35f }
+// Deform all objects, copy their vertices to the geometry buffers, and update their BLASes on the current frame's command list.
+void D3D12RaytracingSimpleLighting::UpdateDeformedObjects()
+{
+    ID3D12GraphicsCommandList* commandList  = m_deviceResources->GetCommandList();
+    const UINT frameIndex                   = m_deviceResources->GetCurrentFrameIndex();
+    const float time                        = static_cast<float>(m_timer.GetTotalSeconds());
+    const size_t num_objects                = m_restPose.object_count();
+
+    // Copy the deformed vertices through this frame's slice of the upload buffer, which the GPU is done with
+    ID3D12Resource* upload  = m_deformedVertexUpload.resource.Get();
+    UINT64 uploadOffset     = frameIndex * m_deformedVertexSliceSize;
+    auto copyToBuffer = [&](ID3D12Resource* destination, UINT64 destinationOffset, const void* data, UINT64 size) {
+        if (size == 0) {
+            return;
+        }
+        memcpy(m_mappedDeformedVertices + uploadOffset, data, size);
+        commandList->CopyBufferRegion(destination, destinationOffset, upload, uploadOffset, size);
+        uploadOffset += size;
     };
-    PointLight p1 = {
-        .position = { -0.5f, 1.0f, 0.2f },
-        .color = { 0.65f, 0.65f, 0.65f }
+    std::vector<Vertex> vertices;
+#if COMPACT_VERTICES
+    std::vector<CompactVertex> compactVertices;
+#endif
+    std::vector<uint32_t> objects(num_objects);
+    for (size_t i = 0ULL; i < num_objects; i++) {
+        objects[i] = static_cast<uint32_t>(i);
+        CpuRT::DeformVertices(m_restPose.object_vertices(i), time, vertices);
+        m_deformedScene->SetObjectVertices(i, vertices);
+#if COMPACT_VERTICES
+        LoadScene::PositionDequantization dq = LoadScene::encode_vertices(vertices, LoadScene::DevicePositionEncoding, compactVertices);
+        std::span<const DeviceVertex> deviceVertices(compactVertices);
+#else
+        std::span<const DeviceVertex> deviceVertices(vertices);
+#endif
+#if PACKED_GEOMETRY_BUFFERS
+        copyToBuffer(m_packedVertexBuffer.resource.resource.Get(), m_geometryPacker.Records()[i].firstVertex * sizeof(DeviceVertex), deviceVertices.data(), deviceVertices.size_bytes());
+#else
+        copyToBuffer(m_vertexBuffers[i].resource.resource.Get(), 0, deviceVertices.data(), deviceVertices.size_bytes());
+#endif
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+        // The bounds the positions are quantized in change with the deformation
+        const XMFLOAT3X4 transform = DequantizationTransform(dq);
+        copyToBuffer(m_positionDequantizationTransforms.resource.Get(), i * sizeof(XMFLOAT3X4), &transform, sizeof(transform));
+#endif
+    }
+
+    // The copies promoted the buffers from the common state, which they decay to again at the end of every frame
+    std::vector<CD3DX12_RESOURCE_BARRIER> barriers;
+#if PACKED_GEOMETRY_BUFFERS
+    barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_packedVertexBuffer.resource.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+#else
+    for (size_t i = 0ULL; i < num_objects; i++) {
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_vertexBuffers[i].resource.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+    }
+#endif
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_positionDequantizationTransforms.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+#endif
+    commandList->ResourceBarrier(static_cast<UINT>(barriers.size()), barriers.data());
+
+    // Refit the stand-ins, which rebuild themselves once refitting has degraded them too far. Their BLASes are rebuilt along with them,
+    // and all others are updated in place.
+    CpuRT::RefitStats refitStats = m_blasStandIns->RefitObjects(objects);
+    std::vector<uint8_t> rebuild(num_objects, 0);
+    for (uint32_t object : refitStats.rebuiltObjects) {
+        rebuild[object] = 1;
+    }
+    for (const BuildBatcher::Batch& batch : m_blasBuildBatches) {
+        for (const BuildBatcher::Placement& placement : batch.builds) {
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = m_blasBuildDescs[placement.build];
+            buildDesc.Inputs.pGeometryDescs = &m_blasGeometryDescs[placement.build];
+            if (!rebuild[placement.build]) {
+                buildDesc.Inputs.Flags                      |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+                buildDesc.SourceAccelerationStructureData   = buildDesc.DestAccelerationStructureData;
+            }
+            m_dxrCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
+        }
+        CD3DX12_RESOURCE_BARRIER batch_uav = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+        m_dxrCommandList->ResourceBarrier(1, &batch_uav);
+    }
+}
+
+// Reallocate the TLAS and its scratch memory for at least the given number of instances. The GPU must be idle.
+void D3D12RaytracingSimpleLighting::GrowTopLevelAccelerationStructure(UINT instanceCount)
+{
+    D3D12MA::Allocator* allocator = m_deviceResources->GetD3DMAllocator();
+
+    // Capacity grows geometrically, so adding instances one at a time does not reallocate every frame
+    m_tlasInstanceCapacity = (std::max)(instanceCount, 2 * m_tlasInstanceCapacity);
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = m_tlasBuildDesc.Inputs;
+    inputs.NumDescs = m_tlasInstanceCapacity;
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+    m_dxrDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &prebuildInfo);
+    ThrowIfFalse(prebuildInfo.ResultDataMaxSizeInBytes > 0);
+
+    AllocateDeviceBuffer(allocator, prebuildInfo.ScratchDataSizeInBytes, &m_tlasScratchResource.resource, &m_tlasScratchResource.allocation, true);
+    AllocateDeviceBuffer(allocator, prebuildInfo.ResultDataMaxSizeInBytes, &m_topLevelAccelerationStructure.resource, &m_topLevelAccelerationStructure.allocation, true, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
+    m_tlasBuildDesc.DestAccelerationStructureData       = m_topLevelAccelerationStructure.resource->GetGPUVirtualAddress();
+    m_tlasBuildDesc.ScratchAccelerationStructureData    = m_tlasScratchResource.resource->GetGPUVirtualAddress();
+}
+
+// Rebuild the TLAS from the instances that survive culling on the current frame's command list. Their descs are written to the
+// frame upload ring.
+void D3D12RaytracingSimpleLighting::UpdateTopLevelAccelerationStructure()
+{
+    if (m_cullInstances) {
+        XMFLOAT3 eye;
+        XMStoreFloat3(&eye, m_eye);
+        InstanceList::Frustum frustum = InstanceList::MakeFrustum(m_viewProj, eye, m_maxInstanceDistance);
+        m_instances.Cull(frustum, m_visibleInstances);
+    }
+    else {
+        m_visibleInstances.resize(m_instances.Size());
+        for (uint32_t i = 0; i < static_cast<uint32_t>(m_visibleInstances.size()); i++) {
+            m_visibleInstances[i] = i;
+        }
+    }
+    if (m_residencyManager) {
+        UpdateResidency();
+    }
+
+    const UINT instanceCount = static_cast<UINT>(m_visibleInstances.size());
+    if (instanceCount > m_tlasInstanceCapacity) {
+        m_deviceResources->WaitForGpu();
+        GrowTopLevelAccelerationStructure(instanceCount);
+    }
+
+    FrameUploadRing::Allocation instanceDescsAllocation     = m_frameUploadRing->Allocate((std::max)(instanceCount, 1U) * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), D3D12_RAYTRACING_INSTANCE_DESCS_BYTE_ALIGNMENT);
+    std::span<const LoadScene::ObjectInstance> instances    = m_instances.Instances();
+    D3D12_RAYTRACING_INSTANCE_DESC* instanceDescs           = static_cast<D3D12_RAYTRACING_INSTANCE_DESC*>(instanceDescsAllocation.cpuAddress);
+    for (UINT i = 0; i < instanceCount; i++) {
+        const LoadScene::ObjectInstance& instance = instances[m_visibleInstances[i]];
+        instanceDescs[i] = InstanceDesc(instance, m_bottomLevelAccelerationStructures[instance.object].resource->GetGPUVirtualAddress());
+    }
+
+    // The TLAS is small, so it is rebuilt rather than updated
+    m_tlasBuildDesc.Inputs.NumDescs         = instanceCount;
+    m_tlasBuildDesc.Inputs.InstanceDescs    = instanceDescsAllocation.gpuAddress;
+    m_dxrCommandList->BuildRaytracingAccelerationStructure(&m_tlasBuildDesc, 0, nullptr);
+    CD3DX12_RESOURCE_BARRIER tlas_uav = CD3DX12_RESOURCE_BARRIER::UAV(m_topLevelAccelerationStructure.resource.Get());
+    m_dxrCommandList->ResourceBarrier(1, &tlas_uav);
+}
+
+// Register every object with the residency manager, along with the resources that are evicted with it.
+void D3D12RaytracingSimpleLighting::CreateResidencyManager() {
+    m_residencyManager = std::make_unique<ResidencyManager>(m_deviceResources.get(), *m_residencyOrder, m_residencyBudgetLimit);
+    std::vector<const D3DResource*> objectResources;
+    std::vector<ID3D12Resource*> resources;
+    for (size_t i = 0ULL; i < m_bottomLevelAccelerationStructures.size(); i++) {
+        // Geometry packed into buffers shared by all objects stays resident, only per-object buffers go along with the BLAS
+        objectResources = { &m_bottomLevelAccelerationStructures[i] };
+#if !PACKED_GEOMETRY_BUFFERS
+        objectResources.insert(objectResources.end(), { &m_indexBuffers[i].resource, &m_vertexBuffers[i].resource, &m_materialIndexBuffers[i].resource });
+#endif
+        UINT64 footprint = 0;
+        resources.clear();
+        for (const D3DResource* resource : objectResources) {
+            resources.push_back(resource->resource.Get());
+            footprint += resource->allocation->GetSize();
+        }
+        m_residencyManager->AddObject(resources, footprint);
+    }
+}
+
+// Let the residency manager evict and restore objects by which instances are in view, and leave the instances of objects that are not
+// resident out of the TLAS.
+void D3D12RaytracingSimpleLighting::UpdateResidency() {
+    XMFLOAT3 eye;
+    XMStoreFloat3(&eye, m_eye);
+    UseVisibleObjects(m_residencyManager->Policy(), m_instances, m_visibleInstances, eye, m_objectDistances);
+    m_residencyManager->Update();
+
+    std::span<const LoadScene::ObjectInstance> instances = m_instances.Instances();
+    m_visibleInstances.erase(std::remove_if(m_visibleInstances.begin(), m_visibleInstances.end(),
+                                            [&](uint32_t i) { return !m_residencyManager->IsResident(instances[i].object); }),
+                             m_visibleInstances.end());
+}
+
+// Let the defragmentation service compact the pools of the scene buffers and BLASes while rendering. Objects whose residency is managed
+// have committed resources, which are never moved, so the residency manager's resources stay valid.
+void D3D12RaytracingSimpleLighting::CreateDefragmentationService()
+{
+    m_defragmentationService = std::make_unique<DefragmentationService>(m_deviceResources.get(), m_dxrCommandList.Get(),
+                                                                        DefragScheduler::Budget{ m_defragmentationBudget, DefragmentationMovesPerFrame });
+    m_defragmentationService->AddPool(m_sceneBufferPool.Get(), DefragmentationService::Contents::Buffers);
+    m_defragmentationService->AddPool(m_accelerationStructurePool.Get(), DefragmentationService::Contents::AccelerationStructures);
+}
+
+// Switch everything that refers to resources defragmentation has moved over to their new places. Frames in flight may still read the
+// old resources, which the defragmentation service keeps alive until they have completed.
+void D3D12RaytracingSimpleLighting::RelocateMovedResources()
+{
+    // Buffers get their SRVs recreated in the same descriptor slots, of a new shader visible heap since frames in flight read the old one
+    bool descriptorHeapSwitched = false;
+    auto relocateBuffer = [this, &descriptorHeapSwitched](D3DBuffer& buffer) {
+        if (RelocateResource(buffer.resource)) {
+            if (!descriptorHeapSwitched) {
+                SwitchDescriptorHeap();
+                descriptorHeapSwitched = true;
+            }
+            CreateBufferSRV(&buffer, buffer.numElements, buffer.elementSize, buffer.descriptorIndex);
+        }
     };
-    pointLights.push_back(p0);
-    pointLights.push_back(p1);
+    relocateBuffer(m_pointLightsBuffer);
+    relocateBuffer(m_materialsBuffer);
+#if PACKED_GEOMETRY_BUFFERS
+    for (D3DBuffer* buffer : { &m_packedIndexBuffer, &m_packedVertexBuffer, &m_packedMaterialIndexBuffer, &m_geometryRecordsBuffer }) {
+        relocateBuffer(*buffer);
+    }
+#else
+    for (size_t i = 0ULL; i < m_indexBuffers.size(); i++) {
+        relocateBuffer(m_indexBuffers[i]);
+        relocateBuffer(m_vertexBuffers[i]);
+        relocateBuffer(m_materialIndexBuffers[i]);
+    }
+#endif
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    RelocateResource(m_positionDequantizationTransforms);
+#endif
 
-    // Create device buffer, staging buffer, and an SRV for the device buffer
-    D3DBuffer pointLightsStaging;
-    size_t pointLightsSize = pointLights.size() * sizeof(PointLight);
-    AllocateUploadBuffer(allocator, pointLights.data(), pointLightsSize, &pointLightsStaging.resource.resource, &pointLightsStaging.resource.allocation, L"PointLightsStaging");
-    AllocateDeviceBuffer(allocator, pointLightsSize, &m_pointLightsBuffer.resource.resource, &m_pointLightsBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COPY_DEST, L"PointLights");
-    CreateBufferSRV(&m_pointLightsBuffer, static_cast<UINT>(pointLights.size()), sizeof(PointLight), DescriptorHeapSlots::PointLightsBuffer);
+    // A BLAS only reads its geometry while it is built or updated, so the geometry descriptions are all that refers to the buffers. The
+    // builds and updates of deforming objects write to the BLASes' current places as well.
+    SetBlasGeometryAddresses();
+    bool blasesMoved = false;
+    for (size_t i = 0ULL; i < m_bottomLevelAccelerationStructures.size(); i++) {
+        if (RelocateResource(m_bottomLevelAccelerationStructures[i])) {
+            m_blasBuildDescs[i].DestAccelerationStructureData = m_bottomLevelAccelerationStructures[i].resource->GetGPUVirtualAddress();
+            blasesMoved = true;
+        }
+    }
 
-    // Queue copies from staging buffer copies and transitions to SRV state
-    commandList->CopyResource(m_pointLightsBuffer.resource.resource.Get(), pointLightsStaging.resource.resource.Get());
-    CD3DX12_RESOURCE_BARRIER srvTransition = CD3DX12_RESOURCE_BARRIER::Transition(m_pointLightsBuffer.resource.resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-    commandList->ResourceBarrier(1, &srvTransition);
+    // Instances refer to their BLAS by address, a TLAS that is rebuilt every frame picks up the new addresses anyway
+    if (blasesMoved && !RebuildsTopLevelEveryFrame()) {
+        m_rebuildTopLevel = true;
+    }
+}
 
-    // Kick off staging buffer copy and wait for GPU to finish as the locally created temporary GPU resources will get released once we go out of scope
-    m_deviceResources->ExecuteCommandList();
-    m_deviceResources->WaitForGpu();
+// Replace a resource that defragmentation has moved with the new resource of its allocation, and return whether it has moved.
+bool D3D12RaytracingSimpleLighting::RelocateResource(D3DResource& resource)
+{
+    if (!resource.allocation || resource.allocation->GetResource() == resource.resource.Get()) {
+        return false;
+    }
+    resource.resource = resource.allocation->GetResource();
+    return true;
+}
+
+void D3D12RaytracingSimpleLighting::BuildLightBuffers(StagingUploader& uploader, const std::vector<PointLight>& pointLights)
+{
+    D3D12MA::Allocator* allocator = m_deviceResources->GetD3DMAllocator();
+
+    // Create device buffer and an SRV for it, then queue the copy from staging memory
+    size_t pointLightsSize = pointLights.size() * sizeof(PointLight);
+    AllocateDeviceBuffer(allocator, pointLightsSize, &m_pointLightsBuffer.resource.resource, &m_pointLightsBuffer.resource.allocation, false, D3D12_RESOURCE_STATE_COMMON, L"PointLights", m_sceneBufferPool.Get());
+    CreateBufferSRV(&m_pointLightsBuffer, static_cast<UINT>(pointLights.size()), sizeof(PointLight), DescriptorHeapSlots::PointLightsBuffer);
+    uploader.CopyToBuffer(m_pointLightsBuffer.resource.resource.Get(), 0, pointLights.data(), pointLightsSize);
 }
 
 // Build shader tables.
@@ -633,7 +1755,21 @@ void D3D12RaytracingSimpleLighting::OnUpdate()
         m_eye = XMVector3Transform(m_eye, rotate);
         m_up = XMVector3Transform(m_up, rotate);
         m_at = XMVector3Transform(m_at, rotate);
-        UpdateCameraMatrices();
+        UpdateCameraMatrices(m_sceneCB[frameIndex]);
+    }
+
+    // Spin every instance about the vertical axis through its center, each at its own speed
+    if (m_animateInstances)
+    {
+        const float time = static_cast<float>(m_timer.GetTotalSeconds());
+        for (InstanceList::Handle instance = 0; instance < static_cast<InstanceList::Handle>(m_restInstances.size()); instance++)
+        {
+            const LoadScene::ObjectInstance& rest   = m_restInstances[instance];
+            const InstanceList::Bounds bounds       = m_instances.WorldBounds(rest.object, rest.transform);
+            const XMFLOAT3 center                   = { 0.5f * (bounds.lower.x + bounds.upper.x), 0.5f * (bounds.lower.y + bounds.upper.y), 0.5f * (bounds.lower.z + bounds.upper.z) };
+            const float secondsToRotateAround       = 8.0f + (instance % 5);
+            m_instances.SetTransform(instance, RotateAboutVerticalAxis(rest.transform, center, XM_2PI * time / secondsToRotateAround));
+        }
     }
 }
 
@@ -665,8 +1801,7 @@ void D3D12RaytracingSimpleLighting::DoRaytracing()
     commandList->SetComputeRootSignature(m_raytracingGlobalRootSignature.Get());
 
     // Copy the updated scene constant buffer to GPU and bind it
-    memcpy(&m_mappedConstantData[frameIndex].constants, &m_sceneCB[frameIndex], sizeof(m_sceneCB[frameIndex]));
-    auto cbGpuAddress = m_perFrameConstants.resource->GetGPUVirtualAddress() + frameIndex * sizeof(m_mappedConstantData[0]);
+    auto cbGpuAddress = m_frameUploadRing->Upload(&m_sceneCB[frameIndex], sizeof(m_sceneCB[frameIndex]), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
     commandList->SetComputeRootConstantBufferView(BoundResourceSlots::SceneCB, cbGpuAddress);
    
     // Bind the acceleration structure and dispatch rays.
@@ -705,7 +1840,7 @@ void D3D12RaytracingSimpleLighting::CopyRaytracingOutputToBackbuffer()
 void D3D12RaytracingSimpleLighting::CreateWindowSizeDependentResources()
 {
     CreateRaytracingOutputResource(); 
-    UpdateCameraMatrices();
+    UpdateCameraMatrices(m_sceneCB[m_deviceResources->GetCurrentFrameIndex()]);
 }
 
 // Release resources that are dependent on the size of the main window.
@@ -724,26 +1859,56 @@ void D3D12RaytracingSimpleLighting::ReleaseDeviceDependentResources()
     m_dxrCommandList.Reset();
     m_dxrStateObject.Reset();
     m_descriptorHeap.Reset();
+    m_cpuDescriptorHeap.Reset();
+    m_retiredDescriptorHeaps.clear();
     m_descriptorsAllocated = 0;
 
+    m_defragmentationService.reset();   // Before the resources its pass in flight may be moving
+    m_rebuildTopLevel = false;
     m_pointLightsBuffer.resource.resource.Reset();
     m_pointLightsBuffer.resource.allocation.Reset();
-    m_perFrameConstants.resource.Reset();
-    m_perFrameConstants.allocation.Reset();
+    m_frameUploadRing.reset();
     m_rayGenShaderTable.resource.Reset();
     m_rayGenShaderTable.allocation.Reset();
     m_missShaderTable.resource.Reset();
     m_missShaderTable.allocation.Reset();
     m_hitGroupShaderTable.resource.Reset();
     m_hitGroupShaderTable.allocation.Reset();
-    for (size_t i = 0ULL; i < m_indexBuffers.size(); i++) {
-        m_indexBuffers[i].resource.resource.Reset();
-        m_vertexBuffers[i].resource.allocation.Reset();
+#if PACKED_GEOMETRY_BUFFERS
+    for (D3DBuffer* buffer : { &m_packedIndexBuffer, &m_packedVertexBuffer, &m_packedMaterialIndexBuffer, &m_geometryRecordsBuffer }) {
+        buffer->resource.resource.Reset();
+        buffer->resource.allocation.Reset();
+    }
+    m_geometryPacker.Clear();
+#else
+    m_indexBuffers.clear();
+    m_vertexBuffers.clear();
+    m_materialIndexBuffers.clear();
+#endif
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    m_positionDequantizationTransforms.resource.Reset();
+    m_positionDequantizationTransforms.allocation.Reset();
+#endif
+    m_materialsBuffer.resource.resource.Reset();
+    m_materialsBuffer.resource.allocation.Reset();
+    m_sceneBufferPool.Reset();  // Only once all scene buffers placed in it are gone
+    for (size_t i = 0ULL; i < m_bottomLevelAccelerationStructures.size(); i++) {
         m_bottomLevelAccelerationStructures[i].resource.Reset();
         m_bottomLevelAccelerationStructures[i].allocation.Reset();
     }
+    m_accelerationStructurePool.Reset();
     m_topLevelAccelerationStructure.resource.Reset();
     m_topLevelAccelerationStructure.allocation.Reset();
+    m_blasScratchResource = {};
+    m_blasBuildBatches.clear();
+    m_tlasScratchResource = {};
+    m_instanceDescsBuffer = {};
+    m_tlasInstanceCapacity = 0;
+    m_residencyManager.reset();
+    m_deformedVertexUpload = {};
+    m_mappedDeformedVertices = nullptr;
+    m_blasStandIns.reset();
+    m_deformedScene.reset();
 }
 
 void D3D12RaytracingSimpleLighting::RecreateD3D()
@@ -769,9 +1934,23 @@ void D3D12RaytracingSimpleLighting::OnRender()
     }
 
     m_deviceResources->Prepare();
+    if (m_defragmentationService && m_defragmentationService->Update() > 0)
+    {
+        RelocateMovedResources();
+    }
+    if (m_deformObjects)
+    {
+        UpdateDeformedObjects();
+    }
+    if (RebuildsTopLevelEveryFrame() || m_rebuildTopLevel)
+    {
+        UpdateTopLevelAccelerationStructure();
+        m_rebuildTopLevel = false;
+    }
     DoRaytracing();
     CopyRaytracingOutputToBackbuffer();
 
+    m_frameUploadRing->EndFrame();
     m_deviceResources->Present(D3D12_RESOURCE_STATE_PRESENT);
 }
 
@@ -819,6 +1998,23 @@ void D3D12RaytracingSimpleLighting::CalculateFrameStats()
         windowText << setprecision(2) << fixed
             << L"    fps: " << fps << L"     ~Million Primary Rays/s: " << MRaysPerSecond
             << L"    GPU[" << m_deviceResources->GetAdapterID() << L"]: " << m_deviceResources->GetAdapterDescription();
+        if (m_residencyManager)
+        {
+            const ResidencyManager::Stats& stats = m_residencyManager->GetStats();
+            windowText << L"    resident: " << stats.residentObjects << L"/" << m_bottomLevelAccelerationStructures.size() << L" objects, "
+                << stats.usageBytes / (1024.0 * 1024.0) << L"/" << stats.budgetBytes / (1024.0 * 1024.0) << L" MB";
+        }
+        if (m_defragmentationService)
+        {
+            UINT64 bytesMoved   = 0;
+            UINT moves          = 0;
+            for (UINT pool = 0; pool < m_defragmentationService->PoolCount(); pool++)
+            {
+                bytesMoved  += m_defragmentationService->GetStats(pool).bytesMoved;
+                moves       += m_defragmentationService->GetStats(pool).moves;
+            }
+            windowText << L"    defragmented: " << bytesMoved / (1024.0 * 1024.0) << L" MB in " << moves << L" moves";
+        }
         SetCustomWindowText(windowText.str().c_str());
     }
 }
@@ -837,12 +2033,12 @@ void D3D12RaytracingSimpleLighting::OnSizeChanged(UINT width, UINT height, bool
     CreateWindowSizeDependentResources();
 }
 
-// Allocate a descriptor and return its index. 
+// Allocate a descriptor in the CPU heap and return its index, the view created there reaches shaders once it is published.
 // If the passed descriptorIndexToUse is valid, it will be used instead of allocating a new one.
 UINT D3D12RaytracingSimpleLighting::AllocateDescriptor(D3D12_CPU_DESCRIPTOR_HANDLE* cpuDescriptor, UINT descriptorIndexToUse)
 {
-    auto descriptorHeapCpuBase = m_descriptorHeap->GetCPUDescriptorHandleForHeapStart();
-    if (descriptorIndexToUse >= m_descriptorHeap->GetDesc().NumDescriptors)
+    auto descriptorHeapCpuBase = m_cpuDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+    if (descriptorIndexToUse >= m_cpuDescriptorHeap->GetDesc().NumDescriptors)
     {
         descriptorIndexToUse = m_descriptorsAllocated++;
     }
@@ -850,6 +2046,41 @@ UINT D3D12RaytracingSimpleLighting::AllocateDescriptor(D3D12_CPU_DESCRIPTOR_HAND
     return descriptorIndexToUse;
 }
 
+// Copy a descriptor from the CPU heap to the same slot of the shader visible heap.
+void D3D12RaytracingSimpleLighting::PublishDescriptor(UINT descriptorIndex)
+{
+    CD3DX12_CPU_DESCRIPTOR_HANDLE destination(m_descriptorHeap->GetCPUDescriptorHandleForHeapStart(), descriptorIndex, m_descriptorSize);
+    CD3DX12_CPU_DESCRIPTOR_HANDLE source(m_cpuDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), descriptorIndex, m_descriptorSize);
+    m_deviceResources->GetD3DDevice()->CopyDescriptorsSimple(1, destination, source, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+}
+
+// Replace the shader visible heap, which frames in flight may read, with a copy of the CPU heap. Old heaps are reused once the frames
+// that bound them have completed.
+void D3D12RaytracingSimpleLighting::SwitchDescriptorHeap()
+{
+    auto device                         = m_deviceResources->GetD3DDevice();
+    const UINT64 completedFenceValue    = m_deviceResources->GetFence()->GetCompletedValue();
+    const D3D12_DESCRIPTOR_HEAP_DESC descriptorHeapDesc = m_descriptorHeap->GetDesc();
+
+    ComPtr<ID3D12DescriptorHeap> descriptorHeap;
+    auto completed = std::find_if(m_retiredDescriptorHeaps.begin(), m_retiredDescriptorHeaps.end(),
+                                  [completedFenceValue](const RetiredDescriptorHeap& retired) { return retired.fenceValue <= completedFenceValue; });
+    if (completed != m_retiredDescriptorHeaps.end())
+    {
+        descriptorHeap = std::move(completed->heap);
+        m_retiredDescriptorHeaps.erase(completed);
+    }
+    else
+    {
+        ThrowIfFailed(device->CreateDescriptorHeap(&descriptorHeapDesc, IID_PPV_ARGS(&descriptorHeap)));
+        descriptorHeap->SetName(L"m_descriptorHeap");
+    }
+    m_retiredDescriptorHeaps.push_back({ std::move(m_descriptorHeap), m_deviceResources->GetCurrentFenceValue() });
+    m_descriptorHeap = std::move(descriptorHeap);
+    device->CopyDescriptorsSimple(descriptorHeapDesc.NumDescriptors, m_descriptorHeap->GetCPUDescriptorHandleForHeapStart(),
+                                  m_cpuDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+}
+
 // Create SRV for a buffer.
 UINT D3D12RaytracingSimpleLighting::CreateBufferSRV(D3DBuffer* buffer, UINT numElements, UINT elementSize, UINT descriptorIndexToUse)
 {
@@ -874,6 +2105,9 @@ UINT D3D12RaytracingSimpleLighting::CreateBufferSRV(D3DBuffer* buffer, UINT numE
     }
     UINT descriptorIndex = AllocateDescriptor(&buffer->cpuDescriptorHandle, descriptorIndexToUse);
     device->CreateShaderResourceView(buffer->resource.resource.Get(), &srvDesc, buffer->cpuDescriptorHandle);
-    buffer->gpuDescriptorHandle = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_descriptorHeap->GetGPUDescriptorHandleForHeapStart(), descriptorIndex, m_descriptorSize);
+    PublishDescriptor(descriptorIndex);
+    buffer->descriptorIndex = descriptorIndex;
+    buffer->numElements = numElements;
+    buffer->elementSize = elementSize;
     return descriptorIndex;
 }
\ No newline at end of file
@@ -12,10 +12,26 @@
 #pragma once
 
 #include "DXSample.h"
+#include "AccelerationStructureCompactor.h"
+#include "DefragmentationService.h"
+#include "FrameUploadRing.h"
+#include "ResidencyManager.h"
 #include "hlsl/RaytracingHlslCompat.h"
+#include "StagingUploader.h"
+#include "cpurt/Bvh.h"
+#include "cpurt/Bvh8.h"
+#include "cpurt/Renderer.h"
+#include "cpurt/Tools.h"
+#include "utils/BuildBatcher.h"
+#include "utils/GeometryPacker.h"
+#include "utils/InstanceList.h"
 #include "utils/LoadScene.h"
+#include "utils/VertexCompression.h"
 #include "utils/StepTimer.h"
 
+#include <filesystem>
+#include <optional>
+
 enum BoundResourceSlots {
     TLAS = 0,
     SceneCB,
@@ -39,20 +55,32 @@ public:
     virtual void OnSizeChanged(UINT width, UINT height, bool minimized);
     virtual void OnDestroy();
     virtual IDXGISwapChain* GetSwapchain() { return m_deviceResources->GetSwapChain(); }
+    virtual void ParseCommandLineArgs(_In_reads_(argc) WCHAR* argv[], int argc) override;
 
 private:
     static const UINT FrameCount = 3;
 
-    // We'll allocate space for several of these and they will need to be padded for alignment.
-    static_assert(sizeof(SceneConstantBuffer) < D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, "Checking the size here.");
+    // Scene buffers are uploaded from a single staging arena if they fit into one chunk, and streamed through a ring of
+    // SceneStagingChunkCount chunks otherwise, which caps staging memory at 32MB
+    static const UINT64 SceneStagingChunkSize   = 8ULL * 1024ULL * 1024ULL;
+    static const UINT SceneStagingChunkCount    = 4;
 
-    union AlignedSceneConstantBuffer
-    {
-        SceneConstantBuffer constants;
-        uint8_t alignmentPadding[D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT];
-    };
-    AlignedSceneConstantBuffer* m_mappedConstantData;
-    DX::D3DResource             m_perFrameConstants;
+    // BLASes are compacted in batches whose compacted copies take up at most this much memory on top of the uncompacted BLASes
+    static const UINT64 AccelerationStructureCompactionBudget = 64ULL * 1024ULL * 1024ULL;
+
+    // BLAS builds are packed into batches whose regions of the shared scratch buffer take up at most this much memory
+    static const UINT64 BlasBuildScratchBudget = 64ULL * 1024ULL * 1024ULL;
+
+    // Scene buffers are placed in heaps of this size, buffers that are larger get committed resources of their own
+    static const UINT64 SceneBufferPoolBlockSize = 32ULL * 1024ULL * 1024ULL;
+
+    // Initial size of the ring that per-frame constants and instance descs are allocated from, it grows if a frame needs more
+    static const UINT64 FrameUploadRingSize = 4ULL * 1024ULL * 1024ULL;
+
+    // Defragmentation moves at most this many allocations per frame, on top of the per-frame byte budget given on the command line
+    static const UINT DefragmentationMovesPerFrame = 64;
+
+    std::unique_ptr<DX::FrameUploadRing> m_frameUploadRing;
 
     // DirectX Raytracing (DXR) attributes
     ComPtr<ID3D12Device5> m_dxrDevice;
@@ -62,8 +90,15 @@ private:
     // Root signature
     ComPtr<ID3D12RootSignature> m_raytracingGlobalRootSignature;
 
-    // Descriptors
+    // Descriptors. Views are created in the CPU heap and copied to the shader visible heap, which shaders index by slot. Rewriting views
+    // that frames in flight read switches to a new copy of the CPU heap, the old one is kept until those frames have completed.
+    struct RetiredDescriptorHeap {
+        ComPtr<ID3D12DescriptorHeap> heap;
+        UINT64 fenceValue;
+    };
     ComPtr<ID3D12DescriptorHeap> m_descriptorHeap;
+    ComPtr<ID3D12DescriptorHeap> m_cpuDescriptorHeap;
+    std::vector<RetiredDescriptorHeap> m_retiredDescriptorHeaps;
     UINT m_descriptorsAllocated;
     UINT m_descriptorSize;
     
@@ -73,26 +108,78 @@ private:
     struct D3DBuffer {
         DX::D3DResource resource;
         D3D12_CPU_DESCRIPTOR_HANDLE cpuDescriptorHandle;
-        D3D12_GPU_DESCRIPTOR_HANDLE gpuDescriptorHandle;
+        // The SRV's parameters, so it can be recreated once defragmentation has moved the buffer
+        UINT descriptorIndex;
+        UINT numElements;
+        UINT elementSize;
     };
 
-    // Scene data buffers
+    // Scene data buffers, which are all placed in m_sceneBufferPool. That way the many small buffers of per-object geometry share a few
+    // large heaps, and the pool's statistics show how fragmented they are.
+    ComPtr<D3D12MA::Pool> m_sceneBufferPool;
+#if PACKED_GEOMETRY_BUFFERS
+    // Geometry of all objects packed into global buffers, the packer knows every object's range within them
+    GeometryPacker m_geometryPacker;
+    D3DBuffer m_packedIndexBuffer;
+    D3DBuffer m_packedVertexBuffer;
+    D3DBuffer m_packedMaterialIndexBuffer;
+    D3DBuffer m_geometryRecordsBuffer;
+#else
     // The following vectors have an entry for each object/BLAS
     std::vector<D3DBuffer> m_indexBuffers;
     std::vector<D3DBuffer> m_vertexBuffers;
     std::vector<D3DBuffer> m_materialIndexBuffers;
+#endif
+#if COMPACT_VERTICES && COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16
+    // Per-object 3x4 transforms which map quantized positions back to object space during BLAS builds
+    DX::D3DResource m_positionDequantizationTransforms;
+#endif
     D3DBuffer m_materialsBuffer;
     D3DBuffer m_pointLightsBuffer;
 
-    // Acceleration structures
+    // Acceleration structures, with one BLAS per object and one TLAS instance per entry of m_instances
+    InstanceList m_instances;
+    std::vector<LoadScene::BuildPreference> m_buildPreferences;    // One per object, selects the BLAS build flags
     std::vector<DX::D3DResource> m_bottomLevelAccelerationStructures;
     DX::D3DResource m_topLevelAccelerationStructure;
+    // Build inputs are kept, so BLASes can be updated in place. Scratch memory is only kept if there is anything to update.
+    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> m_blasGeometryDescs;
+    std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC> m_blasBuildDescs;
+    std::vector<BuildBatcher::Batch> m_blasBuildBatches;    // BLAS builds (and updates) are batched to share m_blasScratchResource
+    DX::D3DResource m_blasScratchResource;
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC m_tlasBuildDesc;
+    DX::D3DResource m_tlasScratchResource;
+    DX::D3DResource m_instanceDescsBuffer;
+    // With defragmentation, BLASes are placed in a pool of their own, which the holes left behind by compaction fragment
+    ComPtr<D3D12MA::Pool> m_accelerationStructurePool;
+
+    // Dynamic instances: when instances move or get culled, the TLAS is rebuilt every frame from the visible instances, whose descs are
+    // allocated from m_frameUploadRing. The TLAS and its scratch memory have room for m_tlasInstanceCapacity instances.
+    bool m_animateInstances = false;
+    bool m_cullInstances = false;
+    float m_maxInstanceDistance = FLT_MAX;
+    std::vector<LoadScene::ObjectInstance> m_restInstances;     // Instances as loaded, the handles of m_instances index into it
+    std::vector<uint32_t> m_visibleInstances;
+    UINT m_tlasInstanceCapacity = 0;
     D3D12_CPU_DESCRIPTOR_HANDLE m_tlasCpuDescriptorHandle;
     D3D12_GPU_DESCRIPTOR_HANDLE m_tlasGpuDescriptorHandle;
 
+    // Residency management: when the scene exceeds the video memory budget, objects whose instances have been out of view for a while
+    // are evicted, and restored once they come back into view. Their BLASes (and per-object geometry buffers) are committed resources
+    // then, so they can be evicted on their own, and instances of evicted objects are left out of the TLAS.
+    std::optional<ResidencyPolicy::Order> m_residencyOrder;     // Set to manage residency
+    UINT64 m_residencyBudgetLimit = 0;
+    std::unique_ptr<DX::ResidencyManager> m_residencyManager;
+    std::vector<float> m_objectDistances;                       // Distance of every object's closest instance to the camera
+
+    // Defragmentation: the scene buffer and BLAS pools are compacted while rendering, a few allocations per frame. Moved buffers get their
+    // SRVs recreated and their addresses patched into the BLAS build inputs, and moved BLASes are picked up by a rebuild of the TLAS.
+    UINT64 m_defragmentationBudget = 0;                         // Bytes moved per frame, set to defragment
+    std::unique_ptr<DX::DefragmentationService> m_defragmentationService;
+    bool m_rebuildTopLevel = false;                             // Set once BLASes have moved, for a TLAS that is not rebuilt every frame
+
     // Raytracing output
     DX::D3DResource m_raytracingOutput;
-    D3D12_GPU_DESCRIPTOR_HANDLE m_raytracingOutputResourceUAVGpuDescriptor;
 
     // Shader tables
     static const wchar_t* c_hitGroupName;
@@ -109,12 +196,41 @@ private:
     XMVECTOR m_eye;
     XMVECTOR m_at;
     XMVECTOR m_up;
+    XMMATRIX m_viewProj;
+    std::filesystem::path m_scenePath = "C:\\Users\\willy\\Documents\\Random Bullshit\\dx12-rt\\scenes\\obj\\CornellBox-Mirror-Rotated.obj";
+    std::filesystem::path m_cpuRenderPath;  // Set to render with the CPU reference renderer only
+    bool m_benchmarkRaySorting = false;
+    std::optional<LoadScene::BuildPreference> m_buildPreference;  // Set to override the build preference of every object
+    UINT m_refitBenchmarkFrames = 0;    // Set to benchmark refitting the CPU BVHs of deforming objects only
+    bool m_benchmarkBuildBatching = false;
+    UINT m_residencyBenchmarkFrames = 0;    // Set to simulate residency management against a mock budget only
+    bool m_benchmarkDefragmentation = false;
+    bool m_compactAccelerationStructures = true;    // Deforming objects are never compacted, their BLASes are rebuilt in place
+    std::filesystem::path m_memoryStatsPath;  // Set to write the allocator's statistics once the scene has been built
+
+    // Deforming objects: every frame the vertices of all objects are deformed on the CPU and copied to the geometry buffers, and the
+    // BLASes are updated in place, or rebuilt once refitting has degraded them too far. The driver's BLASes can't be inspected, so
+    // CPU BVHs over the same triangles, which are refitted alongside and degrade alike, stand in for them.
+    bool m_deformObjects = false;
+    LoadScene::LoadedObj m_restPose;
+    std::unique_ptr<CpuRT::Scene> m_deformedScene;
+    std::unique_ptr<CpuRT::BvhIntersector> m_blasStandIns;
+    DX::D3DResource m_deformedVertexUpload;     // FrameCount slices of m_deformedVertexSliceSize bytes, persistently mapped
+    uint8_t* m_mappedDeformedVertices = nullptr;
+    UINT64 m_deformedVertexSliceSize = 0;
 
-    void UpdateCameraMatrices();
+    void UpdateCameraMatrices(SceneConstantBuffer& sceneCB);
     void InitializeScene();
+    LoadScene::LoadedObj LoadSelectedScene() const;
+    void RenderOnCpu();
+    void BenchmarkRaySorting();
+    void BenchmarkRefit();
+    void BenchmarkBuildBatching();
+    void BenchmarkResidency();
+    void BenchmarkDefragmentation();
     void RecreateD3D();
     void DoRaytracing();
-    void CreateConstantBuffers();
+    void CreateFrameUploadRing();
     void CreateDeviceDependentResources();
     void CreateWindowSizeDependentResources();
     void ReleaseDeviceDependentResources();
@@ -125,14 +241,32 @@ private:
     void CreateRaytracingPipelineStateObject();
     void CreateDescriptorHeap();
     void CreateRaytracingOutputResource();
-    void BuildLightBuffers();
-    void BuildMaterials(LoadScene::LoadedObj loaded_obj);
-    void BuildGeometry(LoadScene::LoadedObj loaded_obj);
+    void CreateSceneBufferPool();
+    void CreateAccelerationStructurePool();
+    void BuildSceneBuffers(const LoadScene::LoadedObj& loaded_obj);
+    void ReportMemoryStats();
+    void BuildLightBuffers(DX::StagingUploader& uploader, const std::vector<PointLight>& pointLights);
+    void BuildMaterials(DX::StagingUploader& uploader, const LoadScene::LoadedObj& loaded_obj);
+    void BuildGeometry(DX::StagingUploader& uploader, const LoadScene::LoadedObj& loaded_obj);
     void BuildAccelerationStructures();
+    void SetBlasGeometryAddresses();
+    void UpdateDeformedObjects();
+    bool RebuildsTopLevelEveryFrame() const { return m_deformObjects || m_animateInstances || m_cullInstances; }
+    bool KeepsTopLevelBuildState() const { return RebuildsTopLevelEveryFrame() || m_defragmentationBudget > 0; }
+    void GrowTopLevelAccelerationStructure(UINT instanceCount);
+    void UpdateTopLevelAccelerationStructure();
+    D3D12MA::ALLOCATION_FLAGS EvictableAllocationFlags() const { return m_residencyOrder ? D3D12MA::ALLOCATION_FLAG_COMMITTED : D3D12MA::ALLOCATION_FLAG_NONE; }
+    void CreateResidencyManager();
+    void UpdateResidency();
+    void CreateDefragmentationService();
+    void RelocateMovedResources();
+    bool RelocateResource(DX::D3DResource& resource);
     void BuildShaderTables();
     void UpdateForSizeChange(UINT clientWidth, UINT clientHeight);
     void CopyRaytracingOutputToBackbuffer();
     void CalculateFrameStats();
     UINT AllocateDescriptor(D3D12_CPU_DESCRIPTOR_HANDLE* cpuDescriptor, UINT descriptorIndexToUse = UINT_MAX);
+    void PublishDescriptor(UINT descriptorIndex);
+    void SwitchDescriptorHeap();
     UINT CreateBufferSRV(D3DBuffer* buffer, UINT numElements, UINT elementSize, UINT descriptorIndexToUse = UINT_MAX);
 };
@@ -0,0 +1,198 @@
+//
+// DefragmentationService.cpp - Compacts custom pools incrementally while rendering by moving their allocations a few at a time
+//
+
+#include "utils/stdafx.h"
+#include "DefragmentationService.h"
+
+using namespace DX;
+
+DefragmentationService::DefragmentationService(DeviceResources* deviceResources, ID3D12GraphicsCommandList4* commandList, const DefragScheduler::Budget& budget) :
+    m_deviceResources(deviceResources),
+    m_commandList(commandList),
+    m_budget(budget),
+    m_nextPool(0),
+    m_runPool(0),
+    m_pass{},
+    m_passInFlight(false),
+    m_passFenceValue(0),
+    m_runStartFragmentedBytes(0)
+{
+}
+
+DefragmentationService::~DefragmentationService()
+{
+    // Abandon the pass in flight, which frees the places reserved for its moves along with the resources created there
+    if (m_passInFlight)
+    {
+        m_deviceResources->WaitForGpu();
+        for (UINT i = 0; i < m_pass.MoveCount; i++)
+        {
+            m_pass.pMoves[i].Operation = D3D12MA::DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+        }
+        m_context->EndPass(&m_pass);
+    }
+}
+
+UINT DefragmentationService::AddPool(D3D12MA::Pool* pool, Contents contents)
+{
+    m_pools.push_back({ pool, contents, DefragScheduler(m_budget) });
+    return static_cast<UINT>(m_pools.size() - 1);
+}
+
+DefragScheduler::Usage DefragmentationService::PoolUsage(const D3D12MA::DetailedStatistics& stats)
+{
+    return { stats.Stats.BlockBytes, stats.Stats.AllocationBytes, stats.UnusedRangeCount > 0 ? stats.UnusedRangeSizeMax : 0 };
+}
+
+UINT DefragmentationService::Update()
+{
+    const UINT64 completedFenceValue = m_deviceResources->GetFence()->GetCompletedValue();
+    m_retiredResources.erase(std::remove_if(m_retiredResources.begin(), m_retiredResources.end(),
+                                            [completedFenceValue](const RetiredResource& retired) { return retired.fenceValue <= completedFenceValue; }),
+                             m_retiredResources.end());
+    if (m_passInFlight)
+    {
+        return completedFenceValue >= m_passFenceValue ? EndPass() : 0;
+    }
+
+    if (!m_context)
+    {
+        // Check one pool per frame, gathering detailed statistics walks all of its allocations
+        if (m_pools.empty())
+        {
+            return 0;
+        }
+        Pool& pool                          = m_pools[m_nextPool];
+        D3D12MA::DetailedStatistics stats   = {};
+        pool.pool->CalculateStatistics(&stats);
+        const DefragScheduler::Usage usage  = PoolUsage(stats);
+        if (!pool.scheduler.BeginRun(usage))
+        {
+            m_nextPool = (m_nextPool + 1) % m_pools.size();
+            return 0;
+        }
+        m_runPool                   = m_nextPool;
+        m_nextPool                  = (m_nextPool + 1) % m_pools.size();
+        m_runStartFragmentedBytes   = DefragScheduler::FragmentedBytes(usage);
+
+        // The allocator limits the moves it reserves places for to the budget as well, so few of them have to be skipped
+        D3D12MA::DEFRAGMENTATION_DESC desc  = {};
+        desc.Flags                          = D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED;
+        desc.MaxBytesPerPass                = m_budget.maxBytesPerFrame;
+        desc.MaxAllocationsPerPass          = m_budget.maxMovesPerFrame;
+        ThrowIfFailed(pool.pool->BeginDefragmentation(&desc, &m_context));
+    }
+    BeginPass();
+    return 0;
+}
+
+void DefragmentationService::BeginPass()
+{
+    HRESULT hr = m_context->BeginPass(&m_pass);
+    ThrowIfFailed(hr);
+    if (hr == S_OK)
+    {
+        EndRun();
+        return;
+    }
+
+    m_moveSizes.resize(m_pass.MoveCount);
+    for (UINT i = 0; i < m_pass.MoveCount; i++)
+    {
+        m_moveSizes[i] = m_pass.pMoves[i].pSrcAllocation->GetSize();
+    }
+    m_pools[m_runPool].scheduler.SelectMoves(m_moveSizes, m_performMoves);
+
+    // Recreate the resources at their new places and copy their contents. Buffers are promoted to copy states from the common state and
+    // are transitioned back right away, so work recorded later in the frame can promote them again.
+    ID3D12Device* device                    = m_deviceResources->GetD3DDevice();
+    const bool accelerationStructures       = m_pools[m_runPool].contents == Contents::AccelerationStructures;
+    const D3D12_RESOURCE_STATES initialState = accelerationStructures ? D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE : D3D12_RESOURCE_STATE_COMMON;
+    m_barriers.clear();
+    for (UINT i = 0; i < m_pass.MoveCount; i++)
+    {
+        D3D12MA::DEFRAGMENTATION_MOVE& move = m_pass.pMoves[i];
+        if (!m_performMoves[i])
+        {
+            move.Operation = D3D12MA::DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        ID3D12Resource* source                  = move.pSrcAllocation->GetResource();
+        const D3D12_RESOURCE_DESC resourceDesc  = source->GetDesc();
+        ComPtr<ID3D12Resource> destination;
+        ThrowIfFailed(device->CreatePlacedResource(move.pDstTmpAllocation->GetHeap(), move.pDstTmpAllocation->GetOffset(), &resourceDesc,
+                                                   initialState, nullptr, IID_PPV_ARGS(&destination)));
+        move.pDstTmpAllocation->SetResource(destination.Get());
+
+        if (accelerationStructures)
+        {
+            m_commandList->CopyRaytracingAccelerationStructure(destination->GetGPUVirtualAddress(), source->GetGPUVirtualAddress(),
+                                                               D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_CLONE);
+        }
+        else
+        {
+            m_commandList->CopyBufferRegion(destination.Get(), 0, source, 0, resourceDesc.Width);
+            m_barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(source, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON));
+            m_barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(destination.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+        }
+    }
+
+    // Acceleration structures stay in their state, work that updates the sources in place later in the frame has to wait for the clones
+    if (accelerationStructures)
+    {
+        m_barriers.push_back(CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+    }
+    if (!m_barriers.empty())
+    {
+        m_commandList->ResourceBarrier(static_cast<UINT>(m_barriers.size()), m_barriers.data());
+    }
+    m_passInFlight      = true;
+    m_passFenceValue    = m_deviceResources->GetCurrentFenceValue();
+}
+
+UINT DefragmentationService::EndPass()
+{
+    // The copies have completed, but the frames recorded after them may still read the old resources, which the allocator releases
+    // along with the old places. Frames execute in order, so new allocations in the old places are only written once those frames
+    // have completed.
+    const UINT64 fenceValue = m_deviceResources->GetCurrentFenceValue();
+    UINT moved              = 0;
+    for (UINT i = 0; i < m_pass.MoveCount; i++)
+    {
+        const D3D12MA::DEFRAGMENTATION_MOVE& move = m_pass.pMoves[i];
+        if (move.Operation == D3D12MA::DEFRAGMENTATION_MOVE_OPERATION_COPY)
+        {
+            m_retiredResources.push_back({ move.pSrcAllocation->GetResource(), move.pSrcAllocation->GetHeap(), fenceValue });
+            moved++;
+        }
+    }
+    HRESULT hr = m_context->EndPass(&m_pass);
+    ThrowIfFailed(hr);
+    m_passInFlight = false;
+    if (hr == S_OK)
+    {
+        EndRun();
+    }
+    return moved;
+}
+
+void DefragmentationService::EndRun()
+{
+    D3D12MA::DEFRAGMENTATION_STATS runStats = {};
+    m_context->GetStats(&runStats);
+    m_context.Reset();
+
+    D3D12MA::Pool* pool                 = m_pools[m_runPool].pool;
+    D3D12MA::DetailedStatistics stats   = {};
+    pool->CalculateStatistics(&stats);
+    const DefragScheduler::Usage usage  = PoolUsage(stats);
+    m_pools[m_runPool].scheduler.EndRun(usage);
+
+    char buff[256] = {};
+    sprintf_s(buff, "Defragmented pool %ls: moved %u allocations (%llu bytes), freed %u heaps (%llu bytes), fragmented bytes %llu -> %llu\n",
+        pool->GetName() ? pool->GetName() : L"", runStats.AllocationsMoved, runStats.BytesMoved, runStats.HeapsFreed,
+        runStats.BytesFreed, m_runStartFragmentedBytes, DefragScheduler::FragmentedBytes(usage));
+    OutputDebugStringA(buff);
+}
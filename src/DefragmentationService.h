@@ -0,0 +1,85 @@
+//
+// DefragmentationService.h - Compacts custom pools incrementally while rendering by moving their allocations a few at a time
+//
+
+#pragma once
+
+#include "DeviceResources.h"
+#include "utils/DefragScheduler.h"
+
+namespace DX
+{
+    // Defragments custom pools with D3D12MA, one pool at a time and each paced by a DefragScheduler. A pass moves the allocations it selects
+    // by recreating their resources at the new places and recording copies on the frame's command list. Once the frame has completed the
+    // pass ends without draining the GPU: the frames recorded since then may still read the old resources, so those are kept alive until
+    // the current frame has completed, like FrameUploadRing's retired buffers. Owners of the moved allocations then have to replace their
+    // resource with the allocation's new one and update everything that refers to it, without overwriting views that frames in flight
+    // read, while the resource contents stay the same. Committed allocations are never moved.
+    class DefragmentationService
+    {
+    public:
+        // What a pool holds, which decides how its resources are copied
+        enum class Contents
+        {
+            Buffers,
+            AccelerationStructures
+        };
+
+        DefragmentationService(DeviceResources* deviceResources, ID3D12GraphicsCommandList4* commandList, const DefragScheduler::Budget& budget);
+        ~DefragmentationService();
+
+        DefragmentationService(DefragmentationService&&) = delete;
+        DefragmentationService& operator= (DefragmentationService&&) = delete;
+
+        DefragmentationService(DefragmentationService const&) = delete;
+        DefragmentationService& operator= (DefragmentationService const&) = delete;
+
+        // Register a pool, which must outlive the service, and return its index
+        UINT AddPool(D3D12MA::Pool* pool, Contents contents);
+
+        // Call once per frame on the frame's open command list, before recording any work that uses the pools' resources. Returns the
+        // number of allocations whose resource has been replaced, i.e. for which allocation->GetResource() differs from the owner's.
+        UINT Update();
+
+        UINT PoolCount() const { return static_cast<UINT>(m_pools.size()); }
+        const DefragScheduler::Stats& GetStats(UINT pool) const { return m_pools[pool].scheduler.GetStats(); }
+
+        // Usage of a pool's or a VirtualBlock's memory as seen by the scheduler
+        static DefragScheduler::Usage PoolUsage(const D3D12MA::DetailedStatistics& stats);
+
+    private:
+        struct Pool
+        {
+            D3D12MA::Pool*  pool;
+            Contents        contents;
+            DefragScheduler scheduler;
+        };
+
+        struct RetiredResource
+        {
+            ComPtr<ID3D12Resource>  resource;
+            ComPtr<ID3D12Heap>      heap;       // The allocator may free a heap once its last allocation has moved out
+            UINT64                  fenceValue;
+        };
+
+        void BeginPass();
+        UINT EndPass();
+        void EndRun();
+
+        DeviceResources*                                m_deviceResources;
+        ID3D12GraphicsCommandList4*                     m_commandList;
+        DefragScheduler::Budget                         m_budget;
+        std::vector<Pool>                               m_pools;
+        size_t                                          m_nextPool;         // Pool to check next while no run is in progress
+        size_t                                          m_runPool;          // Pool of the run in progress
+        ComPtr<D3D12MA::DefragmentationContext>         m_context;
+        D3D12MA::DEFRAGMENTATION_PASS_MOVE_INFO         m_pass;
+        bool                                            m_passInFlight;
+        UINT64                                          m_passFenceValue;   // Signaled once the pass's copies have completed
+        UINT64                                          m_runStartFragmentedBytes;
+        std::vector<UINT64>                             m_moveSizes;        // Scratch space of BeginPass()
+        std::vector<uint8_t>                            m_performMoves;
+        std::vector<D3D12_RESOURCE_BARRIER>             m_barriers;
+        std::vector<RetiredResource>                    m_retiredResources; // Moved out of, released once the frames reading them complete
+    };
+}
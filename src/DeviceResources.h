@@ -94,6 +94,8 @@ namespace DX
         ID3D12CommandQueue*         GetCommandQueue() const { return m_commandQueue.Get(); }
         ID3D12CommandAllocator*     GetCommandAllocator() const { return m_commandAllocators[m_backBufferIndex].Get(); }
         ID3D12GraphicsCommandList*  GetCommandList() const { return m_commandList.Get(); }
+        ID3D12Fence*                GetFence() const { return m_fence.Get(); }
+        UINT64                      GetCurrentFenceValue() const { return m_fenceValues[m_backBufferIndex]; }   // Signaled once the current frame completes
         DXGI_FORMAT                 GetBackBufferFormat() const { return m_backBufferFormat; }
         DXGI_FORMAT                 GetDepthBufferFormat() const { return m_depthBufferFormat; }
         D3D12_VIEWPORT              GetScreenViewport() const { return m_screenViewport; }
@@ -130,7 +130,7 @@ void DefineExports(T* obj, LPCWSTR(&Exports)[N][M])
 }
 
 
-inline void AllocateUploadBuffer(D3D12MA::Allocator* pAllocator, void *pData, UINT64 datasize, ID3D12Resource **ppResource, D3D12MA::Allocation** ppAllocation,
+inline void AllocateUploadBuffer(D3D12MA::Allocator* pAllocator, const void *pData, UINT64 datasize, ID3D12Resource **ppResource, D3D12MA::Allocation** ppAllocation,
                                  const wchar_t* resourceName = nullptr) {
     D3D12MA::ALLOCATION_DESC allocationDesc = {};
     allocationDesc.HeapType                 = D3D12_HEAP_TYPE_UPLOAD;
@@ -154,9 +154,12 @@ inline void AllocateUploadBuffer(D3D12MA::Allocator* pAllocator, void *pData, UI
 }
 
 inline void AllocateDeviceBuffer(D3D12MA::Allocator* pAllocator, UINT64 size, ID3D12Resource** ppResource, D3D12MA::Allocation** ppAllocation, bool allow_uav,
-                                 D3D12_RESOURCE_STATES initialState = D3D12_RESOURCE_STATE_COMMON, const wchar_t* resourceName = nullptr) {
+                                 D3D12_RESOURCE_STATES initialState = D3D12_RESOURCE_STATE_COMMON, const wchar_t* resourceName = nullptr,
+                                 D3D12MA::Pool* pPool = nullptr, D3D12MA::ALLOCATION_FLAGS allocationFlags = D3D12MA::ALLOCATION_FLAG_NONE) {
     D3D12MA::ALLOCATION_DESC allocationDesc = {};
+    allocationDesc.Flags                    = allocationFlags;
     allocationDesc.HeapType                 = D3D12_HEAP_TYPE_DEFAULT;
+    allocationDesc.CustomPool               = pPool;    // A custom pool's heap properties take precedence over HeapType
     auto bufferDesc                         = CD3DX12_RESOURCE_DESC::Buffer(size, allow_uav ? D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS : D3D12_RESOURCE_FLAG_NONE);
     ThrowIfFailed(pAllocator->CreateResource(
         &allocationDesc,
@@ -170,6 +173,23 @@ inline void AllocateDeviceBuffer(D3D12MA::Allocator* pAllocator, UINT64 size, ID
     }
 }
 
+inline void AllocateReadbackBuffer(D3D12MA::Allocator* pAllocator, UINT64 size, ID3D12Resource** ppResource, D3D12MA::Allocation** ppAllocation,
+                                   const wchar_t* resourceName = nullptr) {
+    D3D12MA::ALLOCATION_DESC allocationDesc = {};
+    allocationDesc.HeapType                 = D3D12_HEAP_TYPE_READBACK;
+    auto bufferDesc                         = CD3DX12_RESOURCE_DESC::Buffer(size);
+    ThrowIfFailed(pAllocator->CreateResource(
+        &allocationDesc,
+        &bufferDesc,
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        ppAllocation,
+        IID_PPV_ARGS(ppResource)));
+    if (resourceName) {
+        (*ppResource)->SetName(resourceName);
+    }
+}
+
 // Pretty-print a state object tree.
 inline void PrintStateObjectDesc(const D3D12_STATE_OBJECT_DESC* desc)
 {
@@ -0,0 +1,79 @@
+//
+// FrameUploadRing.cpp - Per-frame suballocation of upload memory for constants and other data the CPU writes every frame
+//
+
+#include "utils/stdafx.h"
+#include "FrameUploadRing.h"
+#include "DirectXRaytracingHelper.h"
+
+using namespace DX;
+
+FrameUploadRing::FrameUploadRing(DeviceResources* deviceResources, UINT64 capacity) :
+    m_deviceResources(deviceResources),
+    m_mappedData(nullptr),
+    m_ring(*this, capacity)
+{
+    m_fenceEvent.Attach(CreateEvent(nullptr, FALSE, FALSE, nullptr));
+    if (!m_fenceEvent.IsValid())
+    {
+        ThrowIfFailed(E_FAIL, L"CreateEvent failed.\n");
+    }
+    CreateBuffer(capacity);
+}
+
+FrameUploadRing::~FrameUploadRing()
+{
+    m_buffer.resource->Unmap(0, nullptr);
+}
+
+void FrameUploadRing::CreateBuffer(UINT64 capacity)
+{
+    // The buffer stays mapped for its lifetime, upload heaps do not need to be unmapped before use
+    AllocateUploadBuffer(m_deviceResources->GetD3DMAllocator(), nullptr, capacity, &m_buffer.resource, &m_buffer.allocation, L"FrameUploadRing");
+    CD3DX12_RANGE readRange(0, 0); // We do not intend to read from this resource on the CPU.
+    ThrowIfFailed(m_buffer.resource->Map(0, &readRange, reinterpret_cast<void**>(&m_mappedData)));
+}
+
+FrameUploadRing::Allocation FrameUploadRing::Allocate(UINT64 size, UINT64 alignment)
+{
+    UploadRing::Allocation allocation;
+    if (!m_ring.Allocate(size, alignment, allocation))
+    {
+        // The current frame needs more than the whole ring. Its earlier allocations stay in the old buffer, which is released once
+        // the frame has completed.
+        const UINT64 capacity = (std::max)(2 * m_ring.Capacity(), 2 * (m_ring.CurrentFrameBytes() + size + alignment));
+        m_retiredBuffers.push_back({ std::move(m_buffer), m_deviceResources->GetCurrentFenceValue() });
+        CreateBuffer(capacity);
+        m_ring.Reset(capacity);
+        ThrowIfFalse(m_ring.Allocate(size, alignment, allocation), L"FrameUploadRing allocation failed.\n");
+    }
+    return { m_mappedData + allocation.offset, m_buffer.resource->GetGPUVirtualAddress() + allocation.offset };
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS FrameUploadRing::Upload(const void* data, UINT64 size, UINT64 alignment)
+{
+    Allocation allocation = Allocate(size, alignment);
+    memcpy(allocation.cpuAddress, data, size);
+    return allocation.gpuAddress;
+}
+
+void FrameUploadRing::EndFrame()
+{
+    m_ring.EndFrame(m_deviceResources->GetCurrentFenceValue());
+
+    const UINT64 completedFenceValue = CompletedFenceValue();
+    m_retiredBuffers.erase(std::remove_if(m_retiredBuffers.begin(), m_retiredBuffers.end(),
+                                          [completedFenceValue](const RetiredBuffer& retired) { return retired.fenceValue <= completedFenceValue; }),
+                           m_retiredBuffers.end());
+}
+
+uint64_t FrameUploadRing::CompletedFenceValue()
+{
+    return m_deviceResources->GetFence()->GetCompletedValue();
+}
+
+void FrameUploadRing::WaitForFenceValue(uint64_t fenceValue)
+{
+    ThrowIfFailed(m_deviceResources->GetFence()->SetEventOnCompletion(fenceValue, m_fenceEvent.Get()));
+    WaitForSingleObjectEx(m_fenceEvent.Get(), INFINITE, FALSE);
+}
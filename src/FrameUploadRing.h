@@ -0,0 +1,63 @@
+//
+// FrameUploadRing.h - Per-frame suballocation of upload memory for constants and other data the CPU writes every frame
+//
+
+#pragma once
+
+#include "DeviceResources.h"
+#include "utils/UploadRing.h"
+
+namespace DX
+{
+    // Hands out aligned regions of a persistently mapped upload buffer that stay valid until the end of the current frame.
+    // EndFrame() must be called once per frame before presenting; the frame's regions are then recycled once the device's frame fence
+    // has passed its end (see UploadRing). If the current frame alone outgrows the buffer, a buffer of twice the size takes over, and
+    // the old one is kept alive until the frame that last used it has completed.
+    class FrameUploadRing : private UploadFence
+    {
+    public:
+        struct Allocation
+        {
+            void*                       cpuAddress;
+            D3D12_GPU_VIRTUAL_ADDRESS   gpuAddress;
+        };
+
+        FrameUploadRing(DeviceResources* deviceResources, UINT64 capacity);
+        ~FrameUploadRing();
+
+        FrameUploadRing(FrameUploadRing&&) = delete;
+        FrameUploadRing& operator= (FrameUploadRing&&) = delete;
+
+        FrameUploadRing(FrameUploadRing const&) = delete;
+        FrameUploadRing& operator= (FrameUploadRing const&) = delete;
+
+        Allocation Allocate(UINT64 size, UINT64 alignment);
+
+        // Allocate a copy of size bytes of data and return its GPU address
+        D3D12_GPU_VIRTUAL_ADDRESS Upload(const void* data, UINT64 size, UINT64 alignment);
+
+        void EndFrame();
+
+        const UploadRing::Stats& GetStats() const { return m_ring.GetStats(); }
+
+    private:
+        // UploadFence
+        uint64_t CompletedFenceValue() override;
+        void WaitForFenceValue(uint64_t fenceValue) override;
+
+        void CreateBuffer(UINT64 capacity);
+
+        struct RetiredBuffer
+        {
+            D3DResource buffer;
+            UINT64      fenceValue;
+        };
+
+        DeviceResources*                    m_deviceResources;
+        Microsoft::WRL::Wrappers::Event     m_fenceEvent;
+        D3DResource                         m_buffer;
+        UINT8*                              m_mappedData;
+        std::vector<RetiredBuffer>          m_retiredBuffers;
+        UploadRing                          m_ring;
+    };
+}
@@ -0,0 +1,64 @@
+//
+// ResidencyManager.cpp - Keeps the scene within the video memory budget by evicting and restoring whole objects
+//
+
+#include "utils/stdafx.h"
+#include "ResidencyManager.h"
+
+using namespace DX;
+
+ResidencyManager::ResidencyManager(DeviceResources* deviceResources, ResidencyPolicy::Order order, UINT64 budgetLimit) :
+    m_deviceResources(deviceResources),
+    m_budgetLimit(budgetLimit),
+    m_frame(0),
+    m_policy(order, deviceResources->GetBackBufferCount()),
+    m_firstPageables(1, 0)
+{
+}
+
+UINT ResidencyManager::AddObject(const std::vector<ID3D12Resource*>& resources, UINT64 footprint)
+{
+    m_pageables.insert(m_pageables.end(), resources.begin(), resources.end());
+    m_firstPageables.push_back(static_cast<UINT>(m_pageables.size()));
+    return m_policy.AddObject(footprint);
+}
+
+void ResidencyManager::Update()
+{
+    // A new frame index makes D3D12MA fetch the current budget from the OS
+    D3D12MA::Allocator* allocator = m_deviceResources->GetD3DMAllocator();
+    m_frame++;
+    allocator->SetCurrentFrameIndex(static_cast<UINT>(m_frame));
+    D3D12MA::Budget localBudget = {};
+    allocator->GetBudget(&localBudget, nullptr);
+    m_stats.usageBytes  = localBudget.UsageBytes;
+    m_stats.budgetBytes = m_budgetLimit > 0 ? (std::min)(localBudget.BudgetBytes, m_budgetLimit) : localBudget.BudgetBytes;
+
+    const ResidencyPolicy::Decisions& decisions = m_policy.Update(m_frame, { m_stats.usageBytes, m_stats.budgetBytes });
+    ID3D12Device* device = m_deviceResources->GetD3DDevice();
+    if (!decisions.evict.empty())
+    {
+        GatherPageables(decisions.evict);
+        ThrowIfFailed(device->Evict(static_cast<UINT>(m_batch.size()), m_batch.data()));
+    }
+    if (!decisions.restore.empty())
+    {
+        GatherPageables(decisions.restore);
+        ThrowIfFailed(device->MakeResident(static_cast<UINT>(m_batch.size()), m_batch.data()));
+    }
+
+    m_stats.residentObjects = 0;
+    for (UINT i = 0; i < static_cast<UINT>(m_policy.ObjectCount()); i++)
+    {
+        m_stats.residentObjects += m_policy.IsResident(i) ? 1 : 0;
+    }
+}
+
+void ResidencyManager::GatherPageables(const std::vector<uint32_t>& objects)
+{
+    m_batch.clear();
+    for (uint32_t object : objects)
+    {
+        m_batch.insert(m_batch.end(), m_pageables.begin() + m_firstPageables[object], m_pageables.begin() + m_firstPageables[object + 1]);
+    }
+}
@@ -0,0 +1,57 @@
+//
+// ResidencyManager.h - Keeps the scene within the video memory budget by evicting and restoring whole objects
+//
+
+#pragma once
+
+#include "DeviceResources.h"
+#include "utils/ResidencyPolicy.h"
+
+namespace DX
+{
+    // Evicts and restores objects as decided by a ResidencyPolicy against the local memory budget that D3D12MA reports. Every object
+    // owns a set of pageable resources, which have to be committed resources since placed ones can't be evicted on their own.
+    // Objects are only evicted once they have been idle for as many frames as there are back buffers, so no frame in flight can still
+    // reference them. Restoring is synchronous, restored objects can be used right after Update().
+    class ResidencyManager
+    {
+    public:
+        struct Stats
+        {
+            UINT64 usageBytes       = 0;
+            UINT64 budgetBytes      = 0;    // After applying the budget limit
+            UINT   residentObjects  = 0;
+        };
+
+        // A budgetLimit other than zero caps the budget, e.g. to exercise eviction on a GPU with plenty of memory
+        ResidencyManager(DeviceResources* deviceResources, ResidencyPolicy::Order order, UINT64 budgetLimit);
+
+        ResidencyManager(ResidencyManager&&) = delete;
+        ResidencyManager& operator= (ResidencyManager&&) = delete;
+
+        ResidencyManager(ResidencyManager const&) = delete;
+        ResidencyManager& operator= (ResidencyManager const&) = delete;
+
+        // Register a resident object whose footprint is the size of the given resources, which must outlive the manager
+        UINT AddObject(const std::vector<ID3D12Resource*>& resources, UINT64 footprint);
+
+        // Mark objects as in use (see ResidencyPolicy) and call once per frame before recording any work that uses them
+        ResidencyPolicy& Policy() { return m_policy; }
+        void Update();
+
+        bool IsResident(UINT object) const { return m_policy.IsResident(object); }
+        const Stats& GetStats() const { return m_stats; }
+
+    private:
+        void GatherPageables(const std::vector<uint32_t>& objects);
+
+        DeviceResources*                m_deviceResources;
+        UINT64                          m_budgetLimit;
+        UINT64                          m_frame;
+        ResidencyPolicy                 m_policy;
+        std::vector<UINT>               m_firstPageables;   // One entry per object plus one, indices into m_pageables
+        std::vector<ID3D12Pageable*>    m_pageables;
+        std::vector<ID3D12Pageable*>    m_batch;
+        Stats                           m_stats;
+    };
+}
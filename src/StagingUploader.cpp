@@ -0,0 +1,92 @@
+//
+// StagingUploader.cpp - Streams buffer data to the GPU through a bounded staging ring
+//
+
+#include "utils/stdafx.h"
+#include "StagingUploader.h"
+#include "DirectXRaytracingHelper.h"
+
+using namespace DX;
+
+StagingUploader::StagingUploader(ID3D12Device* device, D3D12MA::Allocator* allocator, ID3D12CommandQueue* commandQueue,
+                                 ID3D12GraphicsCommandList* commandList, UINT64 chunkSize, UINT chunkCount) :
+    m_commandQueue(commandQueue),
+    m_commandList(commandList),
+    m_commandAllocators(chunkCount),
+    m_fenceValue(0),
+    m_mappedStagingData(nullptr),
+    m_ring(*this, chunkSize, chunkCount)
+{
+    for (UINT n = 0; n < chunkCount; n++)
+    {
+        ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_commandAllocators[n])));
+    }
+
+    ThrowIfFailed(device->CreateFence(m_fenceValue, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence)));
+    m_fence->SetName(L"StagingUploaderFence");
+    m_fenceEvent.Attach(CreateEvent(nullptr, FALSE, FALSE, nullptr));
+    if (!m_fenceEvent.IsValid())
+    {
+        ThrowIfFailed(E_FAIL, L"CreateEvent failed.\n");
+    }
+
+    // The staging buffer stays mapped for the lifetime of the uploader, upload heaps do not need to be unmapped before use
+    AllocateUploadBuffer(allocator, nullptr, chunkSize * chunkCount, &m_stagingBuffer.resource, &m_stagingBuffer.allocation, L"StagingRing");
+    CD3DX12_RANGE readRange(0, 0);
+    ThrowIfFailed(m_stagingBuffer.resource->Map(0, &readRange, reinterpret_cast<void**>(&m_mappedStagingData)));
+}
+
+StagingUploader::~StagingUploader()
+{
+    // Copies may still be reading from the staging buffer
+    m_ring.Finish();
+    m_stagingBuffer.resource->Unmap(0, nullptr);
+}
+
+void StagingUploader::CopyToBuffer(ID3D12Resource* destination, UINT64 destinationOffset, const void* data, UINT64 size)
+{
+    const UINT8* source = static_cast<const UINT8*>(data);
+    while (size > 0)
+    {
+        // Data larger than a chunk is split across several chunks
+        StagingRing::Allocation allocation = m_ring.Allocate(size);
+        memcpy(m_mappedStagingData + allocation.offset, source, allocation.size);
+        m_commandList->CopyBufferRegion(destination, destinationOffset, m_stagingBuffer.resource.Get(), allocation.offset, allocation.size);
+
+        source              += allocation.size;
+        destinationOffset   += allocation.size;
+        size                -= allocation.size;
+    }
+}
+
+void StagingUploader::Finish()
+{
+    m_ring.Finish();
+}
+
+void StagingUploader::BeginChunk(uint32_t chunk)
+{
+    // The ring guarantees that the chunk's previous submission has completed, so its allocator can be reset
+    ThrowIfFailed(m_commandAllocators[chunk]->Reset());
+    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[chunk].Get(), nullptr));
+}
+
+uint64_t StagingUploader::SubmitChunk(uint32_t)
+{
+    ThrowIfFailed(m_commandList->Close());
+    ID3D12CommandList* commandLists[] = { m_commandList };
+    m_commandQueue->ExecuteCommandLists(ARRAYSIZE(commandLists), commandLists);
+    ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), ++m_fenceValue));
+    return m_fenceValue;
+}
+
+uint64_t StagingUploader::CompletedFenceValue()
+{
+    return m_fence->GetCompletedValue();
+}
+
+void StagingUploader::WaitForFenceValue(uint64_t fenceValue)
+{
+    ThrowIfFailed(m_fence->SetEventOnCompletion(fenceValue, m_fenceEvent.Get()));
+    WaitForSingleObjectEx(m_fenceEvent.Get(), INFINITE, FALSE);
+}
@@ -0,0 +1,53 @@
+//
+// StagingUploader.h - Streams buffer data to the GPU through a bounded staging ring
+//
+
+#pragma once
+
+#include "DeviceResources.h"
+#include "utils/StagingRing.h"
+
+namespace DX
+{
+    // Copies data into default heap buffers through a persistently mapped upload buffer of ChunkSize * ChunkCount bytes.
+    // Copies are recorded on the given command list and submitted on the given queue one chunk at a time; every chunk has its
+    // own command allocator and is only reused once the uploader's fence has passed its last submission (see StagingRing).
+    class StagingUploader : private StagingQueue
+    {
+    public:
+        StagingUploader(ID3D12Device* device, D3D12MA::Allocator* allocator, ID3D12CommandQueue* commandQueue,
+                        ID3D12GraphicsCommandList* commandList, UINT64 chunkSize, UINT chunkCount);
+        ~StagingUploader();
+
+        StagingUploader(StagingUploader&&) = delete;
+        StagingUploader& operator= (StagingUploader&&) = delete;
+
+        StagingUploader(StagingUploader const&) = delete;
+        StagingUploader& operator= (StagingUploader const&) = delete;
+
+        // Queue a copy of size bytes from data into destination, which must be in (or promotable to) the COPY_DEST state
+        void CopyToBuffer(ID3D12Resource* destination, UINT64 destinationOffset, const void* data, UINT64 size);
+
+        // Submit everything that is still pending and wait for the GPU to complete all copies
+        void Finish();
+
+        const StagingRing::Stats& GetStats() const { return m_ring.GetStats(); }
+
+    private:
+        // StagingQueue
+        void BeginChunk(uint32_t chunk) override;
+        uint64_t SubmitChunk(uint32_t chunk) override;
+        uint64_t CompletedFenceValue() override;
+        void WaitForFenceValue(uint64_t fenceValue) override;
+
+        ID3D12CommandQueue*                                 m_commandQueue;
+        ID3D12GraphicsCommandList*                          m_commandList;
+        std::vector<ComPtr<ID3D12CommandAllocator>>         m_commandAllocators;
+        ComPtr<ID3D12Fence>                                 m_fence;
+        UINT64                                              m_fenceValue;
+        Microsoft::WRL::Wrappers::Event                     m_fenceEvent;
+        D3DResource                                         m_stagingBuffer;
+        UINT8*                                              m_mappedStagingData;
+        StagingRing                                         m_ring;
+    };
+}
@@ -0,0 +1,1095 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <omp.h>
+
+using namespace CpuRT;
+
+namespace {
+// Nodes with at least this many primitives are binned by all threads. Only the top levels of large builds get there.
+constexpr uint32_t ParallelBinningThreshold = Bvh::ParallelBuildThreshold;
+// Subtrees built by a single thread have at least this many primitives, unless they are leaves already
+constexpr uint32_t MinSubtreeSize = 1u << 12;
+
+constexpr float TraversalCost       = 1.0f;
+constexpr float IntersectionCost    = 1.0f;
+
+struct Bin
+{
+    Aabb bounds;
+    uint32_t count = 0;
+};
+
+struct Bins
+{
+    Bin bins[3][Bvh::BinCount];
+
+    void Merge(const Bins& other)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (uint32_t b = 0; b < Bvh::BinCount; b++)
+            {
+                bins[axis][b].bounds.Grow(other.bins[axis][b].bounds);
+                bins[axis][b].count += other.bins[axis][b].count;
+            }
+        }
+    }
+};
+
+// Bounds of a primitive and its index in the span the BVH is built from. These are reordered in place while splitting nodes, so the
+// primitives of a node are always next to each other.
+struct BuildPrimitive
+{
+    Aabb bounds;
+    uint32_t index;
+
+    float3 Centroid() const { return (bounds.lower + bounds.upper) * 0.5f; }
+};
+
+// Primitives [begin, end) of the builder, covered by nodes[node]
+struct BuildRange
+{
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t depth;
+};
+
+// Maps primitive centroids to bins along each axis of a node's centroid bounds
+struct Binning
+{
+    float3 lower;
+    float3 scale;   // 0 for axes without extent, which all centroids share
+
+    Binning(const Aabb& centroidBounds)
+    {
+        lower = centroidBounds.lower;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent    = centroidBounds.upper[axis] - centroidBounds.lower[axis];
+            scale[axis]     = extent > 0.0f ? Bvh::BinCount / extent : 0.0f;
+        }
+    }
+
+    uint32_t BinIndex(const float3& centroid, int axis) const
+    {
+        return (std::min)(Bvh::BinCount - 1, static_cast<uint32_t>((centroid[axis] - lower[axis]) * scale[axis]));
+    }
+};
+
+// Top down builder splitting nodes with the binned SAH
+class SahBuilder
+{
+public:
+    explicit SahBuilder(std::span<const Aabb> primitiveBounds);
+
+    std::vector<BuildPrimitive>& Primitives() { return m_primitives; }
+
+    // Turns nodes[range.node] into a leaf, or into an interior node whose children are appended to nodes and returned as ranges.
+    // Only reorders the primitives within the range, so disjoint ranges can be split concurrently.
+    bool SplitNode(const BuildRange& range, std::vector<Bvh::Node>& nodes, BuildRange& left, BuildRange& right);
+
+private:
+    void ComputeBounds(const BuildRange& range, Aabb& bounds, Aabb& centroidBounds) const;
+    void ComputeBins(const BuildRange& range, const Binning& binning, Bins& bins) const;
+    uint32_t SplitAtMedian(const BuildRange& range, int axis);
+
+    std::vector<BuildPrimitive> m_primitives;
+};
+
+SahBuilder::SahBuilder(std::span<const Aabb> primitiveBounds) :
+    m_primitives(primitiveBounds.size())
+{
+    for (size_t i = 0ULL; i < primitiveBounds.size(); i++)
+    {
+        m_primitives[i] = { primitiveBounds[i], static_cast<uint32_t>(i) };
+    }
+}
+
+// Runs function(begin, end, result) over the range and merges the results of all threads, which only pays off for large ranges as it
+// starts a parallel region.
+template <typename Result, typename Function>
+void ParallelReduce(const BuildRange& range, Result& result, Function function)
+{
+    if (range.end - range.begin < ParallelBinningThreshold)
+    {
+        function(range.begin, range.end, result);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        const uint64_t count    = range.end - range.begin;
+        const uint64_t thread   = omp_get_thread_num();
+        const uint64_t threads  = omp_get_num_threads();
+        Result threadResult;
+        function(range.begin + static_cast<uint32_t>(count * thread / threads), range.begin + static_cast<uint32_t>(count * (thread + 1) / threads), threadResult);
+        #pragma omp critical
+        result.Merge(threadResult);
+    }
+}
+
+struct NodeBounds
+{
+    Aabb bounds;
+    Aabb centroidBounds;
+
+    void Merge(const NodeBounds& other)
+    {
+        bounds.Grow(other.bounds);
+        centroidBounds.Grow(other.centroidBounds);
+    }
+};
+
+void SahBuilder::ComputeBounds(const BuildRange& range, Aabb& bounds, Aabb& centroidBounds) const
+{
+    NodeBounds nodeBounds;
+    ParallelReduce(range, nodeBounds, [&](uint32_t begin, uint32_t end, NodeBounds& result) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            result.bounds.Grow(m_primitives[i].bounds);
+            result.centroidBounds.Grow(m_primitives[i].Centroid());
+        }
+    });
+    bounds          = nodeBounds.bounds;
+    centroidBounds  = nodeBounds.centroidBounds;
+}
+
+void SahBuilder::ComputeBins(const BuildRange& range, const Binning& binning, Bins& bins) const
+{
+    ParallelReduce(range, bins, [&](uint32_t begin, uint32_t end, Bins& result) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const float3 centroid = m_primitives[i].Centroid();
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Bin& bin = result.bins[axis][binning.BinIndex(centroid, axis)];
+                bin.bounds.Grow(m_primitives[i].bounds);
+                bin.count++;
+            }
+        }
+    });
+}
+
+uint32_t SahBuilder::SplitAtMedian(const BuildRange& range, int axis)
+{
+    const uint32_t mid = range.begin + (range.end - range.begin) / 2;
+    std::nth_element(m_primitives.begin() + range.begin, m_primitives.begin() + mid, m_primitives.begin() + range.end,
+        [&](const BuildPrimitive& a, const BuildPrimitive& b) { return a.Centroid()[axis] < b.Centroid()[axis]; });
+    return mid;
+}
+
+bool SahBuilder::SplitNode(const BuildRange& range, std::vector<Bvh::Node>& nodes, BuildRange& left, BuildRange& right)
+{
+    const uint32_t count = range.end - range.begin;
+    Aabb bounds;
+    Aabb centroidBounds;
+    ComputeBounds(range, bounds, centroidBounds);
+    nodes[range.node].bounds = bounds;
+
+    auto makeLeaf = [&]() {
+        nodes[range.node].leftOrFirst   = range.begin;
+        nodes[range.node].count         = count;
+        return false;
+    };
+    if (count == 1)
+    {
+        return makeLeaf();
+    }
+
+    int largestAxis = 0;
+    float3 centroidExtent = centroidBounds.upper - centroidBounds.lower;
+    for (int axis = 1; axis < 3; axis++)
+    {
+        largestAxis = centroidExtent[axis] > centroidExtent[largestAxis] ? axis : largestAxis;
+    }
+
+    uint32_t mid;
+    if (centroidExtent[largestAxis] <= 0.0f)
+    {
+        // All centroids coincide, so no plane separates the primitives
+        if (count <= Bvh::MaxLeafSize)
+        {
+            return makeLeaf();
+        }
+        mid = range.begin + count / 2;
+    }
+    else if (range.depth >= Bvh::MaxSahDepth)
+    {
+        if (count <= Bvh::MaxLeafSize)
+        {
+            return makeLeaf();
+        }
+        mid = SplitAtMedian(range, largestAxis);
+    }
+    else
+    {
+        Binning binning(centroidBounds);
+        Bins bins;
+        ComputeBins(range, binning, bins);
+
+        // Sweep the planes between bins from both sides to find the one with the lowest SAH cost
+        float bestCost  = FLT_MAX;
+        int bestAxis    = -1;
+        uint32_t bestPlane = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (binning.scale[axis] == 0.0f)
+            {
+                continue;
+            }
+            const Bin* axisBins = bins.bins[axis];
+            float rightCosts[Bvh::BinCount];
+            Aabb rightBounds;
+            uint32_t rightCount = 0;
+            for (uint32_t plane = Bvh::BinCount - 1; plane > 0; plane--)
+            {
+                rightBounds.Grow(axisBins[plane].bounds);
+                rightCount += axisBins[plane].count;
+                rightCosts[plane] = rightBounds.HalfArea() * rightCount;
+            }
+            Aabb leftBounds;
+            uint32_t leftCount = 0;
+            for (uint32_t plane = 1; plane < Bvh::BinCount; plane++)
+            {
+                leftBounds.Grow(axisBins[plane - 1].bounds);
+                leftCount += axisBins[plane - 1].count;
+                float cost = leftBounds.HalfArea() * leftCount + rightCosts[plane];
+                if (leftCount != 0 && leftCount != count && cost < bestCost)
+                {
+                    bestCost    = cost;
+                    bestAxis    = axis;
+                    bestPlane   = plane;
+                }
+            }
+        }
+
+        const float nodeArea = bounds.HalfArea();
+        const float splitCost = TraversalCost + (nodeArea > 0.0f ? IntersectionCost * bestCost / nodeArea : 0.0f);
+        if (count <= Bvh::MaxLeafSize && (bestAxis < 0 || splitCost >= IntersectionCost * count))
+        {
+            return makeLeaf();
+        }
+
+        if (bestAxis >= 0)
+        {
+            mid = static_cast<uint32_t>(std::partition(m_primitives.begin() + range.begin, m_primitives.begin() + range.end,
+                [&](const BuildPrimitive& primitive) { return binning.BinIndex(primitive.Centroid(), bestAxis) < bestPlane; }) - m_primitives.begin());
+        }
+        else
+        {
+            // Every primitive landed in the same bin
+            mid = SplitAtMedian(range, largestAxis);
+        }
+    }
+
+    const uint32_t child = static_cast<uint32_t>(nodes.size());
+    nodes[range.node].leftOrFirst   = child;
+    nodes[range.node].count         = 0;
+    nodes.resize(nodes.size() + 2);
+    left    = { child, range.begin, mid, range.depth + 1 };
+    right   = { child + 1, mid, range.end, range.depth + 1 };
+    return true;
+}
+
+// Sorts items by their upper 32 bits with a least significant digit first radix sort, with all threads for large inputs
+void RadixSortByUpperBits(std::vector<uint64_t>& items)
+{
+    constexpr uint32_t DigitBits    = 8;
+    constexpr uint32_t DigitCount   = 1u << DigitBits;
+    const int maxThreads            = items.size() >= ParallelBinningThreshold ? omp_get_max_threads() : 1;
+    std::vector<uint64_t> buffer(items.size());
+    std::vector<std::array<uint32_t, DigitCount>> histograms(maxThreads);
+    for (uint32_t shift = 32; shift < 64; shift += DigitBits)
+    {
+        #pragma omp parallel num_threads(maxThreads)
+        {
+            const int thread        = omp_get_thread_num();
+            const int threads       = omp_get_num_threads();
+            const size_t begin      = items.size() * thread / threads;
+            const size_t end        = items.size() * (thread + 1) / threads;
+            std::array<uint32_t, DigitCount>& histogram = histograms[thread];
+            histogram.fill(0);
+            for (size_t i = begin; i < end; i++)
+            {
+                histogram[(items[i] >> shift) & (DigitCount - 1)]++;
+            }
+            #pragma omp barrier
+
+            // Every thread scatters its items to the offsets following those of the same digit from earlier threads, which keeps the sort stable
+            #pragma omp single
+            {
+                uint32_t offset = 0;
+                for (uint32_t digit = 0; digit < DigitCount; digit++)
+                {
+                    for (int t = 0; t < threads; t++)
+                    {
+                        const uint32_t digitCount   = histograms[t][digit];
+                        histograms[t][digit]        = offset;
+                        offset                      += digitCount;
+                    }
+                }
+            }
+            for (size_t i = begin; i < end; i++)
+            {
+                buffer[histogram[(items[i] >> shift) & (DigitCount - 1)]++] = items[i];
+            }
+        }
+        items.swap(buffer);
+    }
+}
+
+// Builder emitting the hierarchy of a linear BVH: primitives are sorted along a Morton curve through their centroids, and every node is
+// split where the Morton codes of its primitives first differ. Splitting only takes a binary search, so leaves don't know their bounds
+// yet, and interior nodes get theirs in ComputeInteriorBounds() once all nodes exist.
+class LbvhBuilder
+{
+public:
+    explicit LbvhBuilder(std::span<const Aabb> primitiveBounds);
+
+    std::vector<BuildPrimitive>& Primitives() { return m_primitives; }
+
+    // Same contract as SahBuilder::SplitNode(), but only leaves get their bounds
+    bool SplitNode(const BuildRange& range, std::vector<Bvh::Node>& nodes, BuildRange& left, BuildRange& right);
+
+private:
+    std::vector<BuildPrimitive> m_primitives;   // In Morton order
+    std::vector<uint32_t>       m_mortonCodes;
+};
+
+LbvhBuilder::LbvhBuilder(std::span<const Aabb> primitiveBounds) :
+    m_primitives(primitiveBounds.size()),
+    m_mortonCodes(primitiveBounds.size())
+{
+    struct CentroidBounds
+    {
+        Aabb bounds;
+
+        void Merge(const CentroidBounds& other) { bounds.Grow(other.bounds); }
+    };
+    CentroidBounds centroidBounds;
+    ParallelReduce(BuildRange{ 0, 0, static_cast<uint32_t>(primitiveBounds.size()), 0 }, centroidBounds, [&](uint32_t begin, uint32_t end, CentroidBounds& result) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            result.bounds.Grow((primitiveBounds[i].lower + primitiveBounds[i].upper) * 0.5f);
+        }
+    });
+
+    // Morton codes go to the upper half of the sort keys and primitive indices to the lower half, which also orders primitives with the
+    // same Morton code deterministically
+    const float cells       = static_cast<float>(1u << MortonBitsPerAxis);
+    const float3 lower      = centroidBounds.bounds.lower;
+    const float3 extent     = centroidBounds.bounds.upper - lower;
+    const float3 scale      = { extent.x > 0.0f ? cells / extent.x : 0.0f, extent.y > 0.0f ? cells / extent.y : 0.0f, extent.z > 0.0f ? cells / extent.z : 0.0f };
+    const int numPrimitives = static_cast<int>(primitiveBounds.size());
+    std::vector<uint64_t> keys(primitiveBounds.size());
+    #pragma omp parallel for if(numPrimitives >= static_cast<int>(ParallelBinningThreshold))
+    for (int i = 0; i < numPrimitives; i++)
+    {
+        const float3 cell       = ((primitiveBounds[i].lower + primitiveBounds[i].upper) * 0.5f - lower) * scale;
+        const uint32_t maxCell  = (1u << MortonBitsPerAxis) - 1;
+        const uint32_t code     = MortonCode((std::min)(static_cast<uint32_t>(cell.x), maxCell), (std::min)(static_cast<uint32_t>(cell.y), maxCell),
+                                             (std::min)(static_cast<uint32_t>(cell.z), maxCell));
+        keys[i]                 = (static_cast<uint64_t>(code) << 32) | static_cast<uint32_t>(i);
+    }
+    RadixSortByUpperBits(keys);
+
+    #pragma omp parallel for if(numPrimitives >= static_cast<int>(ParallelBinningThreshold))
+    for (int i = 0; i < numPrimitives; i++)
+    {
+        const uint32_t index    = static_cast<uint32_t>(keys[i]);
+        m_primitives[i]         = { primitiveBounds[index], index };
+        m_mortonCodes[i]        = static_cast<uint32_t>(keys[i] >> 32);
+    }
+}
+
+bool LbvhBuilder::SplitNode(const BuildRange& range, std::vector<Bvh::Node>& nodes, BuildRange& left, BuildRange& right)
+{
+    const uint32_t count        = range.end - range.begin;
+    const uint32_t firstCode    = m_mortonCodes[range.begin];
+    const uint32_t lastCode     = m_mortonCodes[range.end - 1];
+    if (count <= Bvh::LbvhMaxLeafSize || (firstCode == lastCode && count <= Bvh::MaxLeafSize))
+    {
+        Aabb bounds;
+        for (uint32_t i = range.begin; i < range.end; i++)
+        {
+            bounds.Grow(m_primitives[i].bounds);
+        }
+        nodes[range.node] = { bounds, range.begin, count };
+        return false;
+    }
+
+    uint32_t mid;
+    if (firstCode == lastCode)
+    {
+        // Primitives in the same Morton cell are split in the middle
+        mid = range.begin + count / 2;
+    }
+    else
+    {
+        // Binary search for the last primitive sharing more leading bits with the first one than the last one does
+        const int commonPrefix  = std::countl_zero(firstCode ^ lastCode);
+        uint32_t split          = range.begin;
+        uint32_t step           = count - 1;
+        do
+        {
+            step                    = (step + 1) / 2;
+            const uint32_t newSplit = split + step;
+            if (newSplit < range.end - 1 && std::countl_zero(firstCode ^ m_mortonCodes[newSplit]) > commonPrefix)
+            {
+                split = newSplit;
+            }
+        } while (step > 1);
+        mid = split + 1;
+    }
+
+    const uint32_t child = static_cast<uint32_t>(nodes.size());
+    nodes[range.node].leftOrFirst   = child;
+    nodes[range.node].count         = 0;
+    nodes.resize(nodes.size() + 2);
+    left    = { child, range.begin, mid, range.depth + 1 };
+    right   = { child + 1, mid, range.end, range.depth + 1 };
+    return true;
+}
+
+// Builds the whole subtree below nodes[range.node] on the calling thread
+template <typename Builder>
+void BuildSubtree(Builder& builder, const BuildRange& range, std::vector<Bvh::Node>& nodes)
+{
+    std::vector<BuildRange> stack = { range };
+    while (!stack.empty())
+    {
+        BuildRange current = stack.back();
+        stack.pop_back();
+        BuildRange left, right;
+        if (builder.SplitNode(current, nodes, left, right))
+        {
+            // Left subtrees are built first, so they end up next to their parents
+            stack.push_back(right);
+            stack.push_back(left);
+        }
+    }
+}
+
+// Nodes [begin, end) of a BVH
+struct NodeRange
+{
+    uint32_t begin;
+    uint32_t end;
+};
+
+// Builds the nodes over all primitives of the builder, with children always stored after their parents. Returns where the subtrees built
+// in parallel ended up: every one of them is a contiguous range of nodes below its root, which precedes all of them.
+template <typename Builder>
+std::vector<NodeRange> BuildNodes(Builder& builder, std::vector<Bvh::Node>& nodes)
+{
+    const uint32_t primitiveCount = static_cast<uint32_t>(builder.Primitives().size());
+    nodes.resize(1);
+
+    // Split the top levels breadth first with all threads binning each node, until there are enough subtrees to keep every thread busy.
+    // OpenMP 2.0 has no tasks, so the subtrees are then built by a dynamically scheduled parallel loop.
+    const uint32_t subtreeSize = (std::max)(MinSubtreeSize, static_cast<uint32_t>(primitiveCount / (8ULL * omp_get_max_threads())));
+    std::vector<BuildRange> topLevel = { { 0, 0, primitiveCount, 0 } };
+    std::vector<BuildRange> subtrees;
+    for (size_t i = 0ULL; i < topLevel.size(); i++)
+    {
+        const BuildRange range = topLevel[i];
+        if (range.end - range.begin <= subtreeSize)
+        {
+            subtrees.push_back(range);
+            continue;
+        }
+        BuildRange left, right;
+        if (builder.SplitNode(range, nodes, left, right))
+        {
+            topLevel.push_back(left);
+            topLevel.push_back(right);
+        }
+    }
+
+    // Every subtree is built into its own node array, with the subtree's root at index 0
+    std::vector<std::vector<Bvh::Node>> subtreeNodes(subtrees.size());
+    const int numSubtrees = static_cast<int>(subtrees.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < numSubtrees; i++)
+    {
+        subtreeNodes[i].resize(1);
+        BuildSubtree(builder, { 0, subtrees[i].begin, subtrees[i].end, subtrees[i].depth }, subtreeNodes[i]);
+    }
+
+    // Append the subtrees to the top levels, replacing the subtree roots' placeholders
+    std::vector<NodeRange> subtreeRanges(subtrees.size());
+    for (size_t i = 0ULL; i < subtrees.size(); i++)
+    {
+        const uint32_t base = static_cast<uint32_t>(nodes.size()) - 1;
+        for (Bvh::Node& node : subtreeNodes[i])
+        {
+            node.leftOrFirst += node.IsLeaf() ? 0 : base;
+        }
+        nodes[subtrees[i].node] = subtreeNodes[i].front();
+        nodes.insert(nodes.end(), subtreeNodes[i].begin() + 1, subtreeNodes[i].end());
+        subtreeRanges[i] = { base + 1, static_cast<uint32_t>(nodes.size()) };
+        std::vector<Bvh::Node>().swap(subtreeNodes[i]);
+    }
+    return subtreeRanges;
+}
+
+// Children are always stored after their parents, so a reverse sweep visits them first
+void ComputeInteriorBounds(std::vector<Bvh::Node>& nodes)
+{
+    for (size_t i = nodes.size(); i-- > 0ULL;)
+    {
+        if (!nodes[i].IsLeaf())
+        {
+            nodes[i].bounds = nodes[nodes[i].leftOrFirst].bounds;
+            nodes[i].bounds.Grow(nodes[nodes[i].leftOrFirst + 1].bounds);
+        }
+    }
+}
+
+// Treelet reoptimization (Karras and Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies"). The treelet below a
+// node is formed by repeatedly expanding its leaf with the largest surface area, up to TreeletSize leaves, and is then replaced by the
+// topology with the lowest SAH cost over the same leaves, found by dynamic programming over all subsets of them. The treelet's nodes keep
+// their slots, so nodes may end up before their parents, and subtrees don't reference contiguous primitives anymore until Relayout().
+class TreeletOptimizer
+{
+public:
+    explicit TreeletOptimizer(std::vector<Bvh::Node>& nodes);
+
+    // Optimizes the treelets below nodes [begin, end), which have to contain all of their descendants
+    void OptimizeRange(uint32_t begin, uint32_t end);
+
+private:
+    static constexpr uint32_t SubsetCount = 1u << Bvh::TreeletSize;
+
+    void Optimize(uint32_t root);
+
+    std::vector<Bvh::Node>& m_nodes;
+    // SAH cost without normalization by the root area, height, and primitive count of every node's subtree
+    std::vector<float>      m_costs;
+    std::vector<uint32_t>   m_heights;
+    std::vector<uint32_t>   m_primitiveCounts;
+};
+
+TreeletOptimizer::TreeletOptimizer(std::vector<Bvh::Node>& nodes) :
+    m_nodes(nodes),
+    m_costs(nodes.size()),
+    m_heights(nodes.size()),
+    m_primitiveCounts(nodes.size())
+{
+    for (size_t i = nodes.size(); i-- > 0ULL;)
+    {
+        const Bvh::Node& node = nodes[i];
+        if (node.IsLeaf())
+        {
+            m_costs[i]              = IntersectionCost * node.bounds.HalfArea() * node.count;
+            m_heights[i]            = 1;
+            m_primitiveCounts[i]    = node.count;
+        }
+        else
+        {
+            m_costs[i]              = TraversalCost * node.bounds.HalfArea() + m_costs[node.leftOrFirst] + m_costs[node.leftOrFirst + 1];
+            m_heights[i]            = 1 + (std::max)(m_heights[node.leftOrFirst], m_heights[node.leftOrFirst + 1]);
+            m_primitiveCounts[i]    = m_primitiveCounts[node.leftOrFirst] + m_primitiveCounts[node.leftOrFirst + 1];
+        }
+    }
+}
+
+void TreeletOptimizer::OptimizeRange(uint32_t begin, uint32_t end)
+{
+    // Descendants are stored after their ancestors, and optimizing a treelet only moves nodes between the slots of its descendants
+    for (uint32_t i = end; i-- > begin;)
+    {
+        Optimize(i);
+    }
+}
+
+void TreeletOptimizer::Optimize(uint32_t root)
+{
+    if (m_nodes[root].IsLeaf() || m_primitiveCounts[root] < Bvh::MinTreeletPrimitives)
+    {
+        return;
+    }
+
+    // Form the treelet. Every expanded node contributes the slots of its children, which the optimized topology reuses.
+    uint32_t leaves[Bvh::TreeletSize]           = { m_nodes[root].leftOrFirst, m_nodes[root].leftOrFirst + 1 };
+    uint32_t childSlots[Bvh::TreeletSize - 1]   = { m_nodes[root].leftOrFirst };
+    uint32_t leafCount                          = 2;
+    while (leafCount < Bvh::TreeletSize)
+    {
+        int largest         = -1;
+        float largestArea   = -1.0f;
+        for (uint32_t i = 0; i < leafCount; i++)
+        {
+            if (!m_nodes[leaves[i]].IsLeaf() && m_nodes[leaves[i]].bounds.HalfArea() > largestArea)
+            {
+                largest     = static_cast<int>(i);
+                largestArea = m_nodes[leaves[i]].bounds.HalfArea();
+            }
+        }
+        if (largest < 0)
+        {
+            break;
+        }
+        const uint32_t expanded         = leaves[largest];
+        childSlots[leafCount - 1]       = m_nodes[expanded].leftOrFirst;
+        leaves[largest]                 = m_nodes[expanded].leftOrFirst;
+        leaves[leafCount++]             = m_nodes[expanded].leftOrFirst + 1;
+    }
+    if (leafCount < 3)
+    {
+        return;
+    }
+
+    // Lowest cost of every subset of the leaves, processed in increasing order so the subsets of a subset come first. Every split of a
+    // subset is considered once, by keeping its lowest leaf on the left.
+    Aabb bounds[SubsetCount];
+    float costs[SubsetCount];
+    uint32_t heights[SubsetCount];
+    uint32_t primitiveCounts[SubsetCount];
+    uint8_t lefts[SubsetCount];
+    const uint32_t fullSet = (1u << leafCount) - 1;
+    for (uint32_t subset = 1; subset <= fullSet; subset++)
+    {
+        const uint32_t lowest = subset & (0u - subset);
+        if (subset == lowest)
+        {
+            const uint32_t leaf     = leaves[std::countr_zero(subset)];
+            bounds[subset]          = m_nodes[leaf].bounds;
+            costs[subset]           = m_costs[leaf];
+            heights[subset]         = m_heights[leaf];
+            primitiveCounts[subset] = m_primitiveCounts[leaf];
+            continue;
+        }
+
+        bounds[subset] = bounds[lowest];
+        bounds[subset].Grow(bounds[subset ^ lowest]);
+        const uint32_t rest = subset ^ lowest;
+        float bestCost      = FLT_MAX;
+        uint32_t bestLeft   = lowest;
+        uint32_t others     = rest;
+        do
+        {
+            others                  = (others - 1) & rest;
+            const uint32_t left     = lowest | others;
+            const float cost        = costs[left] + costs[subset ^ left];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestLeft = left;
+            }
+        } while (others != 0);
+        costs[subset]           = TraversalCost * bounds[subset].HalfArea() + bestCost;
+        heights[subset]         = 1 + (std::max)(heights[bestLeft], heights[subset ^ bestLeft]);
+        primitiveCounts[subset] = primitiveCounts[bestLeft] + primitiveCounts[subset ^ bestLeft];
+        lefts[subset]           = static_cast<uint8_t>(bestLeft);
+    }
+
+    // Keep the treelet unless the new topology is cheaper without being taller, which keeps the BVH as shallow as the LBVH and bounds
+    // the traversal stack
+    if (costs[fullSet] >= m_costs[root] || heights[fullSet] > m_heights[root])
+    {
+        return;
+    }
+
+    Bvh::Node leafNodes[Bvh::TreeletSize];
+    for (uint32_t i = 0; i < leafCount; i++)
+    {
+        leafNodes[i] = m_nodes[leaves[i]];
+    }
+    uint32_t nextChildSlots = 0;
+    std::pair<uint32_t, uint32_t> stack[Bvh::TreeletSize]   = { { fullSet, root } };
+    uint32_t stackSize                                      = 1;
+    while (stackSize > 0)
+    {
+        const auto [subset, slot]   = stack[--stackSize];
+        m_costs[slot]               = costs[subset];
+        m_heights[slot]             = heights[subset];
+        m_primitiveCounts[slot]     = primitiveCounts[subset];
+        if ((subset & (subset - 1)) == 0)
+        {
+            m_nodes[slot] = leafNodes[std::countr_zero(subset)];
+            continue;
+        }
+        const uint32_t children = childSlots[nextChildSlots++];
+        m_nodes[slot]           = { bounds[subset], children, 0 };
+        stack[stackSize++]      = { lefts[subset], children };
+        stack[stackSize++]      = { subset ^ lefts[subset], children + 1 };
+    }
+}
+
+// Stores the nodes depth first with left children first, and the primitives in the resulting leaf order, which restores the layout the
+// builders produce
+void Relayout(std::vector<Bvh::Node>& nodes, std::vector<BuildPrimitive>& primitives)
+{
+    std::vector<Bvh::Node> relaidNodes = { nodes[0] };
+    std::vector<BuildPrimitive> relaidPrimitives;
+    relaidNodes.reserve(nodes.size());
+    relaidPrimitives.reserve(primitives.size());
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 0 } };
+    while (!stack.empty())
+    {
+        const auto [node, relaidNode] = stack.back();
+        stack.pop_back();
+        if (nodes[node].IsLeaf())
+        {
+            relaidNodes[relaidNode].leftOrFirst = static_cast<uint32_t>(relaidPrimitives.size());
+            relaidPrimitives.insert(relaidPrimitives.end(), primitives.begin() + nodes[node].leftOrFirst, primitives.begin() + nodes[node].leftOrFirst + nodes[node].count);
+            continue;
+        }
+        const uint32_t child                = nodes[node].leftOrFirst;
+        const uint32_t relaidChild          = static_cast<uint32_t>(relaidNodes.size());
+        relaidNodes[relaidNode].leftOrFirst = relaidChild;
+        relaidNodes.push_back(nodes[child]);
+        relaidNodes.push_back(nodes[child + 1]);
+        stack.push_back({ child + 1, relaidChild + 1 });
+        stack.push_back({ child, relaidChild });
+    }
+    nodes       = std::move(relaidNodes);
+    primitives  = std::move(relaidPrimitives);
+}
+}
+
+Bvh::Bvh(std::span<const Aabb> primitiveBounds, BvhBuilder builder)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    if (primitiveBounds.empty())
+    {
+        return;
+    }
+
+    std::vector<BuildPrimitive> primitives;
+    if (builder == BvhBuilder::BinnedSah)
+    {
+        SahBuilder sahBuilder(primitiveBounds);
+        BuildNodes(sahBuilder, m_nodes);
+        primitives = std::move(sahBuilder.Primitives());
+    }
+    else
+    {
+        LbvhBuilder lbvhBuilder(primitiveBounds);
+        const std::vector<NodeRange> subtreeRanges = BuildNodes(lbvhBuilder, m_nodes);
+        primitives = std::move(lbvhBuilder.Primitives());
+        ComputeInteriorBounds(m_nodes);
+
+        if (builder == BvhBuilder::LbvhTreelets)
+        {
+            // The subtrees are optimized in parallel, and then the top levels above them
+            TreeletOptimizer optimizer(m_nodes);
+            const int numSubtrees = static_cast<int>(subtreeRanges.size());
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < numSubtrees; i++)
+            {
+                optimizer.OptimizeRange(subtreeRanges[i].begin, subtreeRanges[i].end);
+            }
+            optimizer.OptimizeRange(0, subtreeRanges.empty() ? static_cast<uint32_t>(m_nodes.size()) : subtreeRanges.front().begin);
+            Relayout(m_nodes, primitives);
+        }
+    }
+
+    m_primitiveIndices.resize(primitiveBounds.size());
+    for (size_t i = 0ULL; i < primitiveBounds.size(); i++)
+    {
+        m_primitiveIndices[i] = primitives[i].index;
+    }
+
+    m_buildStats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    ComputeBuildStats();
+}
+
+void Bvh::Refit(std::span<const Aabb> primitiveBounds)
+{
+    if (m_nodes.empty())
+    {
+        return;
+    }
+
+    // Leaves are independent of each other, and interior nodes follow from their children
+    const int numNodes = static_cast<int>(m_nodes.size());
+    #pragma omp parallel for if(numNodes >= static_cast<int>(ParallelBinningThreshold))
+    for (int i = 0; i < numNodes; i++)
+    {
+        Node& node = m_nodes[i];
+        if (node.IsLeaf())
+        {
+            node.bounds = Aabb();
+            for (uint32_t j = node.leftOrFirst; j < node.leftOrFirst + node.count; j++)
+            {
+                node.bounds.Grow(primitiveBounds[m_primitiveIndices[j]]);
+            }
+        }
+    }
+    ComputeInteriorBounds(m_nodes);
+
+    const double seconds    = m_buildStats.seconds;
+    m_buildStats            = BuildStats();
+    m_buildStats.seconds    = seconds;
+    ComputeBuildStats();
+}
+
+void Bvh::ComputeBuildStats()
+{
+    m_buildStats.nodes  = static_cast<uint32_t>(m_nodes.size());
+    const float rootArea = Bounds().HalfArea();
+
+    double sahCost          = 0.0;
+    uint64_t leafPrimitives = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 1 } };
+    while (!stack.empty())
+    {
+        auto [nodeIndex, depth] = stack.back();
+        stack.pop_back();
+        const Node& node = m_nodes[nodeIndex];
+        const double area = rootArea > 0.0f ? node.bounds.HalfArea() / rootArea : 1.0;
+        m_buildStats.maxDepth = (std::max)(m_buildStats.maxDepth, depth);
+        if (node.IsLeaf())
+        {
+            m_buildStats.leaves++;
+            leafPrimitives  += node.count;
+            sahCost         += area * IntersectionCost * node.count;
+        }
+        else
+        {
+            sahCost += area * TraversalCost;
+            stack.push_back({ node.leftOrFirst, depth + 1 });
+            stack.push_back({ node.leftOrFirst + 1, depth + 1 });
+        }
+    }
+    m_buildStats.sahCost            = sahCost;
+    m_buildStats.averageLeafSize    = static_cast<double>(leafPrimitives) / m_buildStats.leaves;
+}
+
+BvhBuilder CpuRT::ObjectBvhBuilder(const Scene& scene, size_t object)
+{
+    switch (scene.GetLoadedObj().object_build_preference(object))
+    {
+    case LoadScene::BuildPreference::Balanced:  return BvhBuilder::LbvhTreelets;
+    case LoadScene::BuildPreference::FastBuild: return BvhBuilder::Lbvh;
+    default:                                    return BvhBuilder::BinnedSah;
+    }
+}
+
+std::vector<Aabb> CpuRT::TriangleBounds(std::span<const Triangle> triangles)
+{
+    std::vector<Aabb> triangleBounds(triangles.size());
+    const int numTriangles = static_cast<int>(triangles.size());
+    #pragma omp parallel for if(numTriangles >= static_cast<int>(ParallelBinningThreshold))
+    for (int i = 0; i < numTriangles; i++)
+    {
+        triangleBounds[i].Grow(triangles[i].v0);
+        triangleBounds[i].Grow(triangles[i].v1);
+        triangleBounds[i].Grow(triangles[i].v2);
+    }
+    return triangleBounds;
+}
+
+TriangleBvh::TriangleBvh(std::span<const Triangle> triangles, BvhBuilder builder) :
+    m_bvh(TriangleBounds(triangles), builder)
+{
+    // Copy the triangles in leaf order
+    const int numTriangles = static_cast<int>(triangles.size());
+    m_triangles.resize(triangles.size());
+    #pragma omp parallel for if(numTriangles >= static_cast<int>(ParallelBinningThreshold))
+    for (int i = 0; i < numTriangles; i++)
+    {
+        m_triangles[i] = triangles[m_bvh.PrimitiveIndices()[i]];
+    }
+}
+
+void TriangleBvh::Refit(std::span<const Triangle> triangles)
+{
+    const int numTriangles = static_cast<int>(triangles.size());
+    #pragma omp parallel for if(numTriangles >= static_cast<int>(ParallelBinningThreshold))
+    for (int i = 0; i < numTriangles; i++)
+    {
+        m_triangles[i] = triangles[m_bvh.PrimitiveIndices()[i]];
+    }
+    m_bvh.Refit(TriangleBounds(triangles));
+}
+
+bool TriangleBvh::Intersect(const Ray& ray, uint32_t rayFlags, float& t, float2& barycentrics, uint32_t& triangleIndex) const
+{
+    Ray closestRay  = ray;
+    bool found      = false;
+    m_bvh.Traverse(closestRay, [&](uint32_t i, Ray& traversalRay) {
+        float triangleT;
+        float2 triangleBarycentrics;
+        if (!IntersectTriangle(traversalRay, m_triangles[i], rayFlags, triangleT, triangleBarycentrics))
+        {
+            return false;
+        }
+
+        // Later hits have to be closer than this one
+        traversalRay.tMax   = triangleT;
+        t                   = triangleT;
+        barycentrics        = triangleBarycentrics;
+        triangleIndex       = m_bvh.PrimitiveIndices()[i];
+        found               = true;
+        return (rayFlags & RayFlagAcceptFirstHitAndEndSearch) != 0;
+    });
+    return found;
+}
+
+bool TriangleBvh::Occluded(const Ray& ray, uint32_t rayFlags) const
+{
+    Ray traversalRay    = ray;
+    bool occluded       = false;
+    m_bvh.Traverse(traversalRay, [&](uint32_t i, Ray& objectRay) {
+        float t;
+        float2 barycentrics;
+        occluded = IntersectTriangle(objectRay, m_triangles[i], rayFlags, t, barycentrics);
+        return occluded;
+    });
+    return occluded;
+}
+
+Bvh::BuildStats CpuRT::CombineBuildStats(std::span<const Bvh::BuildStats> stats, std::span<const size_t> primitiveCounts)
+{
+    Bvh::BuildStats combined;
+    uint64_t primitives     = 0;
+    double weightedSahCost  = 0.0;
+    for (size_t i = 0ULL; i < stats.size(); i++)
+    {
+        combined.nodes      += stats[i].nodes;
+        combined.leaves     += stats[i].leaves;
+        combined.maxDepth   = (std::max)(combined.maxDepth, stats[i].maxDepth);
+        primitives          += primitiveCounts[i];
+        weightedSahCost     += stats[i].sahCost * primitiveCounts[i];
+    }
+    combined.averageLeafSize    = combined.leaves > 0 ? static_cast<double>(primitives) / combined.leaves : 0.0;
+    combined.sahCost            = primitives > 0 ? weightedSahCost / primitives : 0.0;
+    return combined;
+}
+
+Aabb CpuRT::TransformAabb(const Aabb& bounds, const float3x4& transform)
+{
+    Aabb transformed;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        const float3 p = {
+            (corner & 1) ? bounds.upper.x : bounds.lower.x,
+            (corner & 2) ? bounds.upper.y : bounds.lower.y,
+            (corner & 4) ? bounds.upper.z : bounds.lower.z
+        };
+        transformed.Grow(transformPoint(transform, p));
+    }
+    return transformed;
+}
+
+BvhIntersector::BvhIntersector(const Scene& scene) :
+    m_scene(scene),
+    m_bottomLevel(scene.ObjectCount()),
+    m_refitMonitors(scene.ObjectCount())
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    BuildObjects(scene, [&](size_t i) { m_bottomLevel[i] = TriangleBvh(scene.ObjectTriangles(i), ObjectBvhBuilder(scene, i)); });
+
+    std::vector<Bvh::BuildStats> stats(m_bottomLevel.size());
+    std::vector<size_t> triangleCounts(m_bottomLevel.size());
+    for (size_t i = 0ULL; i < m_bottomLevel.size(); i++)
+    {
+        stats[i]            = m_bottomLevel[i].GetBvh().GetBuildStats();
+        triangleCounts[i]   = scene.ObjectTriangles(i).size();
+        m_refitMonitors[i].OnBuild(stats[i].sahCost);
+    }
+    m_bottomLevelStats          = CombineBuildStats(stats, triangleCounts);
+    m_bottomLevelStats.seconds  = std::chrono::duration<double>(Clock::now() - start).count();
+
+    BuildTopLevel();
+}
+
+RefitStats BvhIntersector::RefitObjects(std::span<const uint32_t> objects)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    std::vector<uint8_t> rebuilt(m_bottomLevel.size(), 0);
+    BuildObjects(m_scene, objects, [&](size_t i) {
+        m_bottomLevel[i].Refit(m_scene.ObjectTriangles(i));
+        if (m_refitMonitors[i].OnRefit(m_bottomLevel[i].GetBvh().GetBuildStats().sahCost))
+        {
+            m_bottomLevel[i] = TriangleBvh(m_scene.ObjectTriangles(i), ObjectBvhBuilder(m_scene, i));
+            m_refitMonitors[i].OnBuild(m_bottomLevel[i].GetBvh().GetBuildStats().sahCost);
+            rebuilt[i] = 1;
+        }
+    });
+    BuildTopLevel();
+
+    RefitStats stats;
+    for (uint32_t object : objects)
+    {
+        stats.refits++;
+        if (rebuilt[object])
+        {
+            stats.rebuiltObjects.push_back(object);
+        }
+        else
+        {
+            stats.maxDegradation = (std::max)(stats.maxDegradation, m_refitMonitors[object].Degradation());
+        }
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return stats;
+}
+
+// The top level is built over the world space bounds of the instances' bottom level BVHs
+void BvhIntersector::BuildTopLevel()
+{
+    std::span<const Instance> instances = m_scene.Instances();
+    std::vector<Aabb> instanceBounds;
+    m_topLevelInstances.clear();
+    for (size_t i = 0ULL; i < instances.size(); i++)
+    {
+        const Aabb objectBounds = m_bottomLevel[instances[i].instanceID].GetBvh().Bounds();
+        if (!objectBounds.IsEmpty())
+        {
+            instanceBounds.push_back(TransformAabb(objectBounds, instances[i].objectToWorld));
+            m_topLevelInstances.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    m_topLevel = Bvh(instanceBounds);
+}
+
+bool BvhIntersector::Intersect(const Ray& ray, uint32_t rayFlags, Hit& hit) const
+{
+    Ray closestRay  = ray;
+    bool found      = false;
+    m_topLevel.Traverse(closestRay, [&](uint32_t i, Ray& worldRay) {
+        const uint32_t instanceIndex    = m_topLevelInstances[m_topLevel.PrimitiveIndices()[i]];
+        const Instance& instance        = m_scene.Instances()[instanceIndex];
+        float t;
+        float2 barycentrics;
+        uint32_t primitiveIndex;
+        if (!m_bottomLevel[instance.instanceID].Intersect(ObjectRay(worldRay, instance), rayFlags, t, barycentrics, primitiveIndex))
+        {
+            return false;
+        }
+
+        // The object space distance is the world space one, as the ray direction is transformed without normalizing it
+        worldRay.tMax   = t;
+        hit             = { t, barycentrics, instanceIndex, instance.instanceID, primitiveIndex };
+        found           = true;
+        return (rayFlags & RayFlagAcceptFirstHitAndEndSearch) != 0;
+    });
+    return found;
+}
+
+bool BvhIntersector::Occluded(const Ray& ray, uint32_t rayFlags) const
+{
+    Ray traversalRay    = ray;
+    bool occluded       = false;
+    m_topLevel.Traverse(traversalRay, [&](uint32_t i, Ray& worldRay) {
+        const Instance& instance = m_scene.Instances()[m_topLevelInstances[m_topLevel.PrimitiveIndices()[i]]];
+        occluded = m_bottomLevel[instance.instanceID].Occluded(ObjectRay(worldRay, instance), rayFlags);
+        return occluded;
+    });
+    return occluded;
+}
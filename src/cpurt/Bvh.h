@@ -0,0 +1,326 @@
+#pragma once
+
+#include "Intersector.h"
+
+#include <cfloat>
+#include <span>
+#include <vector>
+
+namespace CpuRT {
+struct Aabb
+{
+    float3 lower = make_float3(FLT_MAX);
+    float3 upper = make_float3(-FLT_MAX);
+
+    void Grow(const float3& p) { lower = min3(lower, p); upper = max3(upper, p); }
+    void Grow(const Aabb& b) { lower = min3(lower, b.lower); upper = max3(upper, b.upper); }
+    bool IsEmpty() const { return lower.x > upper.x; }
+
+    // Half of the surface area, which is all the SAH needs as only ratios of areas matter
+    float HalfArea() const
+    {
+        if (IsEmpty())
+        {
+            return 0.0f;
+        }
+        float3 e = upper - lower;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+// Slab test, returns where the ray enters the box if it does so within [ray.tMin, ray.tMax]
+inline bool IntersectAabb(const Aabb& bounds, const Ray& ray, const float3& invDirection, float& tEntry)
+{
+    float3 t0       = (bounds.lower - ray.origin) * invDirection;
+    float3 t1       = (bounds.upper - ray.origin) * invDirection;
+    float3 tNear    = min3(t0, t1);
+    float3 tFar     = max3(t0, t1);
+    tEntry          = (std::max)((std::max)(tNear.x, tNear.y), (std::max)(tNear.z, ray.tMin));
+    float tExit     = (std::min)((std::min)(tFar.x, tFar.y), (std::min)(tFar.z, ray.tMax));
+    // Widen the interval by a few ulps, so rounding can't miss triangles lying on the faces of their boxes
+    return tEntry <= tExit * 1.0000004f;
+}
+
+constexpr uint32_t MortonBitsPerAxis = 10;
+
+// Interleaves the lower MortonBitsPerAxis bits of x, y and z, with the bits of x highest
+inline uint32_t MortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    auto spreadBits = [](uint32_t v) {
+        v = (v | (v << 16)) & 0x030000FFu;
+        v = (v | (v << 8))  & 0x0300F00Fu;
+        v = (v | (v << 4))  & 0x030C30C3u;
+        v = (v | (v << 2))  & 0x09249249u;
+        return v;
+    };
+    return (spreadBits(x) << 2) | (spreadBits(y) << 1) | spreadBits(z);
+}
+
+// How a BVH is built, trading build time for trace performance like the build flags of a DXR acceleration structure
+enum class BvhBuilder
+{
+    BinnedSah,      // Best trace performance, the counterpart of PREFER_FAST_TRACE
+    Lbvh,           // Linear BVH: Morton codes sorted with a radix sort, fastest to build, the counterpart of PREFER_FAST_BUILD
+    LbvhTreelets    // Linear BVH with treelet reoptimization, in between the other two
+};
+
+// Builder for the BVH of one of the scene's objects, following the object's build preference
+BvhBuilder ObjectBvhBuilder(const Scene& scene, size_t object);
+
+// Binary BVH over a set of primitive bounds. The two children of an interior node are stored after their parent and next to each
+// other, and every leaf references a contiguous range of the primitives in leaf order, as do all subtrees.
+// Large builds first split the top levels with all threads binning each node, and then build the remaining subtrees in parallel.
+class Bvh
+{
+public:
+    struct Node
+    {
+        Aabb bounds;
+        uint32_t leftOrFirst;   // Interior nodes: index of the left child, the right child follows it. Leaves: first primitive.
+        uint32_t count;         // Number of primitives in a leaf, 0 for interior nodes
+
+        bool IsLeaf() const { return count != 0; }
+    };
+
+    struct BuildStats
+    {
+        double seconds          = 0.0;
+        uint32_t nodes          = 0;
+        uint32_t leaves         = 0;
+        uint32_t maxDepth       = 0;
+        double averageLeafSize  = 0.0;
+        double sahCost          = 0.0;  // Expected cost of tracing a ray through the tree, with node traversals and primitive tests costing 1
+    };
+
+    static constexpr uint32_t BinCount          = 16;
+    static constexpr uint32_t MaxLeafSize       = 8;    // Larger nodes are split even if the SAH prefers a leaf
+    static constexpr uint32_t MaxSahDepth       = 64;   // Deeper nodes are split at the median, which keeps the traversal stack bounded
+    static constexpr uint32_t TraversalStackSize = 128;
+    // Nodes with at least this many primitives are binned by all threads, so smaller BVHs are best built in parallel with each other
+    static constexpr uint32_t ParallelBuildThreshold = 1u << 16;
+    static constexpr uint32_t LbvhMaxLeafSize   = 4;    // Linear BVH nodes with more primitives are split unless they share a Morton code
+    static constexpr uint32_t TreeletSize       = 7;    // Leaves of the treelets the linear BVH is reoptimized in
+    static constexpr uint32_t MinTreeletPrimitives = 16;
+
+    Bvh() = default;
+    explicit Bvh(std::span<const Aabb> primitiveBounds, BvhBuilder builder = BvhBuilder::BinnedSah);
+
+    // Recomputes the bounds of all nodes after the primitives have moved, keeping the topology, and updates the SAH cost of the build
+    // stats. primitiveBounds is indexed like the span the BVH was built from.
+    void Refit(std::span<const Aabb> primitiveBounds);
+
+    // Visits the primitives of the leaves the ray enters, nearer nodes first. intersectPrimitive(i, ray) is called with the position of
+    // a primitive in leaf order, may shorten ray.tMax to skip farther nodes, and returns true to end the traversal.
+    template <typename IntersectPrimitive>
+    void Traverse(Ray& ray, IntersectPrimitive intersectPrimitive) const;
+
+    Aabb Bounds() const { return m_nodes.empty() ? Aabb() : m_nodes.front().bounds; }
+    const std::vector<Node>& Nodes() const { return m_nodes; }
+    // Index of every primitive in leaf order in the span the BVH was built from
+    const std::vector<uint32_t>& PrimitiveIndices() const { return m_primitiveIndices; }
+    const BuildStats& GetBuildStats() const { return m_buildStats; }
+
+private:
+    void ComputeBuildStats();
+
+    std::vector<Node>       m_nodes;
+    std::vector<uint32_t>   m_primitiveIndices;
+    BuildStats              m_buildStats;
+};
+
+// Decides when a refitted BVH has to be rebuilt. Refits keep the topology of the last build, which fits the primitives worse the more they
+// move relative to each other, so the SAH cost after every refit is compared to the one right after the build.
+class RefitMonitor
+{
+public:
+    static constexpr double DefaultMaxSahDegradation = 1.3;
+
+    explicit RefitMonitor(double maxSahDegradation = DefaultMaxSahDegradation) : m_maxSahDegradation(maxSahDegradation) {}
+
+    void OnBuild(double sahCost) { m_builtSahCost = sahCost; m_sahCost = sahCost; m_refits = 0; }
+    // Returns whether the BVH should be rebuilt
+    bool OnRefit(double sahCost) { m_sahCost = sahCost; m_refits++; return NeedsRebuild(); }
+
+    bool NeedsRebuild() const { return m_sahCost > m_builtSahCost * m_maxSahDegradation; }
+    double Degradation() const { return m_builtSahCost > 0.0 ? m_sahCost / m_builtSahCost : 1.0; }
+    uint32_t RefitsSinceBuild() const { return m_refits; }
+
+private:
+    double      m_maxSahDegradation;
+    double      m_builtSahCost  = 0.0;
+    double      m_sahCost       = 0.0;
+    uint32_t    m_refits        = 0;
+};
+
+// Outcome of refitting the bottom levels of a two-level BVH for deformed objects
+struct RefitStats
+{
+    uint32_t refits                         = 0;
+    std::vector<uint32_t> rebuiltObjects;           // Refitted objects whose BVH had degraded too far, and was rebuilt
+    double maxDegradation                   = 1.0;  // Highest SAH cost relative to the last build over the objects which were not rebuilt
+    double seconds                          = 0.0;  // Including the top level rebuild
+};
+
+// Totals over several BVHs, such as the bottom levels of a scene, with the SAH cost averaged weighted by primitive count. The build time
+// is left to the caller, as the BVHs may have been built in parallel.
+Bvh::BuildStats CombineBuildStats(std::span<const Bvh::BuildStats> stats, std::span<const size_t> primitiveCounts);
+
+// World space bounds of an instance with the given object space bounds
+Aabb TransformAabb(const Aabb& bounds, const float3x4& transform);
+
+// Bounds of every triangle, the primitive bounds of a triangle BVH
+std::vector<Aabb> TriangleBounds(std::span<const Triangle> triangles);
+
+// Calls buildObject(i) for the given objects of the scene. Large objects are built one after the other with all threads available to
+// them, and small objects in parallel with each other.
+template <typename BuildObject>
+void BuildObjects(const Scene& scene, std::span<const uint32_t> objects, BuildObject buildObject)
+{
+    const int numObjects = static_cast<int>(objects.size());
+    for (int i = 0; i < numObjects; i++)
+    {
+        if (scene.ObjectTriangles(objects[i]).size() >= Bvh::ParallelBuildThreshold)
+        {
+            buildObject(objects[i]);
+        }
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < numObjects; i++)
+    {
+        if (scene.ObjectTriangles(objects[i]).size() < Bvh::ParallelBuildThreshold)
+        {
+            buildObject(objects[i]);
+        }
+    }
+}
+
+// Calls buildObject(i) for every object of the scene
+template <typename BuildObject>
+void BuildObjects(const Scene& scene, BuildObject buildObject)
+{
+    std::vector<uint32_t> objects(scene.ObjectCount());
+    for (size_t i = 0ULL; i < objects.size(); i++)
+    {
+        objects[i] = static_cast<uint32_t>(i);
+    }
+    BuildObjects(scene, objects, buildObject);
+}
+
+// BVH over the triangles of one object, the counterpart of a BLAS. The triangles are copied in leaf order.
+class TriangleBvh
+{
+public:
+    TriangleBvh() = default;
+    explicit TriangleBvh(std::span<const Triangle> triangles, BvhBuilder builder = BvhBuilder::BinnedSah);
+
+    // Closest hit in [ray.tMin, ray.tMax] (or any hit with RayFlagAcceptFirstHitAndEndSearch), returns the index of the hit triangle in
+    // the span the BVH was built from
+    bool Intersect(const Ray& ray, uint32_t rayFlags, float& t, float2& barycentrics, uint32_t& triangleIndex) const;
+    // Whether there is any hit in [ray.tMin, ray.tMax]
+    bool Occluded(const Ray& ray, uint32_t rayFlags) const;
+
+    // Refits the BVH to the moved vertices of the same triangles
+    void Refit(std::span<const Triangle> triangles);
+
+    const Bvh& GetBvh() const { return m_bvh; }
+
+private:
+    Bvh                     m_bvh;
+    std::vector<Triangle>   m_triangles;
+};
+
+// Two-level acceleration structure mirroring the BLAS/TLAS split of the GPU renderer: a TriangleBvh per object, built as the object
+// prefers, and a binned SAH BVH over the world space bounds of the scene's instances. Rays are transformed into the space of every instance they reach, so instances share
+// their object's BVH.
+class BvhIntersector : public Intersector
+{
+public:
+    explicit BvhIntersector(const Scene& scene);
+
+    bool Intersect(const Ray& ray, uint32_t rayFlags, Hit& hit) const override;
+    bool Occluded(const Ray& ray, uint32_t rayFlags) const override;
+    const char* Name() const override { return "two-level BVH"; }
+
+    // Updates the bottom levels of objects whose vertices have moved in the scene (without changing the triangles they form) by refitting
+    // them, or by rebuilding those whose RefitMonitor says they have degraded too far, and then rebuilds the top level
+    RefitStats RefitObjects(std::span<const uint32_t> objects);
+
+    // Totals over all bottom level BVHs, with the SAH cost averaged weighted by triangle count
+    const Bvh::BuildStats& GetBottomLevelStats() const { return m_bottomLevelStats; }
+    const Bvh::BuildStats& GetTopLevelStats() const { return m_topLevel.GetBuildStats(); }
+
+private:
+    void BuildTopLevel();
+
+    const Scene&                m_scene;
+    std::vector<TriangleBvh>    m_bottomLevel;          // One per object
+    std::vector<RefitMonitor>   m_refitMonitors;        // One per object
+    Bvh                         m_topLevel;             // Over the instances in m_topLevelInstances
+    std::vector<uint32_t>       m_topLevelInstances;    // Indices of the scene's instances, without those of empty objects
+    Bvh::BuildStats             m_bottomLevelStats;
+};
+
+template <typename IntersectPrimitive>
+void Bvh::Traverse(Ray& ray, IntersectPrimitive intersectPrimitive) const
+{
+    const float3 invDirection = make_float3(1.0f) / ray.direction;
+    float tEntry;
+    if (m_nodes.empty() || !IntersectAabb(m_nodes[0].bounds, ray, invDirection, tEntry))
+    {
+        return;
+    }
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float tEntry;
+    };
+    StackEntry stack[TraversalStackSize];
+    uint32_t stackSize  = 0;
+    uint32_t nodeIndex  = 0;
+    for (;;)
+    {
+        const Node& node = m_nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                if (intersectPrimitive(i, ray))
+                {
+                    return;
+                }
+            }
+        }
+        else
+        {
+            // Visit the nearer child first and come back to the other one unless a closer hit has been found by then
+            float tLeft, tRight;
+            const bool hitLeft  = IntersectAabb(m_nodes[node.leftOrFirst].bounds, ray, invDirection, tLeft);
+            const bool hitRight = IntersectAabb(m_nodes[node.leftOrFirst + 1].bounds, ray, invDirection, tRight);
+            if (hitLeft && hitRight)
+            {
+                const bool leftFirst        = tLeft <= tRight;
+                stack[stackSize++]          = { leftFirst ? node.leftOrFirst + 1 : node.leftOrFirst, leftFirst ? tRight : tLeft };
+                nodeIndex                   = leftFirst ? node.leftOrFirst : node.leftOrFirst + 1;
+                continue;
+            }
+            if (hitLeft || hitRight)
+            {
+                nodeIndex = hitLeft ? node.leftOrFirst : node.leftOrFirst + 1;
+                continue;
+            }
+        }
+
+        // Pop the next node that may still contain a closer hit
+        do
+        {
+            if (stackSize == 0)
+            {
+                return;
+            }
+            stackSize--;
+        } while (stack[stackSize].tEntry > ray.tMax);
+        nodeIndex = stack[stackSize].node;
+    }
+}
+}
@@ -0,0 +1,894 @@
+#include "Bvh8.h"
+
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace CpuRT;
+
+bool Bvh8Intersector::IsSupported()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    // AVX has to be supported by the CPU and enabled by the OS, which then saves the upper halves of the YMM registers on context switches
+    __cpuid(info, 1);
+    const bool osxsave  = (info[2] & (1 << 27)) != 0;
+    const bool avx      = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    // Also checks that the OS saves the YMM registers
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// Everything below IsSupported() is only reached through a Bvh8Intersector, which is only created on CPUs with AVX2, while the rest of
+// the application has to keep running on CPUs without it. MSVC compiles AVX2 intrinsics in any function, GCC and Clang only in
+// functions that target AVX2, so only the code below targets it. Functions defined in the headers above keep the baseline target.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace {
+// Widens box intervals by a few ulps, like IntersectAabb
+const float IntervalScale = 1.0000004f;
+
+__m256 LaneMask(uint32_t count)
+{
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+}
+
+float HorizontalMin(__m256 v)
+{
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+float HorizontalMax(__m256 v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+// 8 vectors side by side, one per lane
+struct float3x8
+{
+    __m256 x, y, z;
+};
+
+float3x8 Load(const float (&v)[3][Bvh8::Width])
+{
+    return { _mm256_load_ps(v[0]), _mm256_load_ps(v[1]), _mm256_load_ps(v[2]) };
+}
+
+float3x8 Broadcast(const float3& v)
+{
+    return { _mm256_set1_ps(v.x), _mm256_set1_ps(v.y), _mm256_set1_ps(v.z) };
+}
+
+// Lane i of an SoA array
+float3x8 Broadcast(const float (&v)[3][Bvh8::Width], uint32_t i)
+{
+    return { _mm256_set1_ps(v[0][i]), _mm256_set1_ps(v[1][i]), _mm256_set1_ps(v[2][i]) };
+}
+
+// Same operations in the same order as the scalar math in HlslMath.h, so the SIMD ray/triangle test produces the same results as IntersectTriangle
+__m256 Dot(const float3x8& a, const float3x8& b)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z));
+}
+
+float3x8 Cross(const float3x8& a, const float3x8& b)
+{
+    return {
+        _mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(a.z, b.y)),
+        _mm256_sub_ps(_mm256_mul_ps(a.z, b.x), _mm256_mul_ps(a.x, b.z)),
+        _mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(a.y, b.x))
+    };
+}
+
+float3x8 Sub(const float3x8& a, const float3x8& b)
+{
+    return { _mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z) };
+}
+
+// Moeller-Trumbore for 8 ray/triangle pairs, see IntersectTriangle. Returns the lanes with a hit in [tMin, tMax].
+__m256 IntersectTriangles(const float3x8& origin, const float3x8& direction, const float3x8& v0, const float3x8& e1, const float3x8& e2,
+                          __m256 tMin, __m256 tMax, uint32_t rayFlags, __m256 valid, __m256& t, __m256& u, __m256& v)
+{
+    const __m256 zero   = _mm256_setzero_ps();
+    const __m256 one    = _mm256_set1_ps(1.0f);
+    float3x8 p          = Cross(direction, e2);
+    __m256 det          = Dot(e1, p);
+    valid = _mm256_and_ps(valid, (rayFlags & RayFlagCullBackFacingTriangles) ? _mm256_cmp_ps(det, zero, _CMP_GT_OQ) : _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+
+    __m256 inverseDet   = _mm256_div_ps(one, det);
+    float3x8 s          = Sub(origin, v0);
+    u                   = _mm256_mul_ps(Dot(s, p), inverseDet);
+    valid               = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+    float3x8 q          = Cross(s, e1);
+    v                   = _mm256_mul_ps(Dot(direction, q), inverseDet);
+    valid               = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+    t                   = _mm256_mul_ps(Dot(e2, q), inverseDet);
+    return _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, tMin, _CMP_GE_OQ), _mm256_cmp_ps(t, tMax, _CMP_LE_OQ)));
+}
+
+// A single ray broadcast to all lanes, intersected with the 8 children of a node or the 8 triangles of a leaf at once
+struct SingleRay
+{
+    float3x8 origin;
+    float3x8 direction;
+    float3x8 invDirection;
+    uint32_t nearRow[3];    // Row of Bvh8::Node::bounds the ray enters a child's slab through on every axis, the far row follows or precedes it
+    float tMin;
+    float tMax;
+
+    explicit SingleRay(const Ray& ray)
+    {
+        const float3 invDir = make_float3(1.0f) / ray.direction;
+        origin          = Broadcast(ray.origin);
+        direction       = Broadcast(ray.direction);
+        invDirection    = Broadcast(invDir);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            nearRow[axis] = 2 * axis + (invDir[axis] < 0.0f ? 1 : 0);
+        }
+        tMin = ray.tMin;
+        tMax = ray.tMax;
+    }
+};
+
+// Returns the children of the node the ray enters within [tMin, tMax] and where it enters them
+uint32_t IntersectChildren(const Bvh8::Node& node, const SingleRay& ray, __m256& tEntry)
+{
+    const __m256 nearX  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearRow[0]]), ray.origin.x), ray.invDirection.x);
+    const __m256 nearY  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearRow[1]]), ray.origin.y), ray.invDirection.y);
+    const __m256 nearZ  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearRow[2]]), ray.origin.z), ray.invDirection.z);
+    const __m256 farX   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearRow[0] ^ 1]), ray.origin.x), ray.invDirection.x);
+    const __m256 farY   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearRow[1] ^ 1]), ray.origin.y), ray.invDirection.y);
+    const __m256 farZ   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearRow[2] ^ 1]), ray.origin.z), ray.invDirection.z);
+    tEntry              = _mm256_max_ps(_mm256_max_ps(nearX, nearY), _mm256_max_ps(nearZ, _mm256_set1_ps(ray.tMin)));
+    __m256 tExit        = _mm256_min_ps(_mm256_min_ps(farX, farY), _mm256_min_ps(farZ, _mm256_set1_ps(ray.tMax)));
+    tExit               = _mm256_mul_ps(tExit, _mm256_set1_ps(IntervalScale));
+    const uint32_t hits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ)));
+    return hits & ((1u << node.childCount) - 1);
+}
+
+struct StackEntry
+{
+    uint32_t child;     // Node index, or Bvh8::LeafFlag | leaf index
+    float tEntry;
+};
+
+// Pushes the hit children of a node, farthest first so the nearest one is popped next
+void PushChildren(const Bvh8::Node& node, uint32_t hits, const float* tEntry, StackEntry* stack, uint32_t& stackSize)
+{
+    const uint32_t first = stackSize;
+    for (; hits != 0; hits &= hits - 1)
+    {
+        const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hits));
+        StackEntry entry    = { node.children[lane], tEntry[lane] };
+        uint32_t i          = stackSize++;
+        for (; i > first && stack[i - 1].tEntry < entry.tEntry; i--)
+        {
+            stack[i] = stack[i - 1];
+        }
+        stack[i] = entry;
+    }
+}
+
+// Visits the leaves the ray enters, nearer ones first. intersectLeaf(leaf, ray) may shorten ray.tMax and returns true to end the traversal.
+template <typename IntersectLeaf>
+void Traverse(const Bvh8& bvh, SingleRay& ray, IntersectLeaf intersectLeaf)
+{
+    if (bvh.Nodes().empty())
+    {
+        return;
+    }
+
+    StackEntry stack[Bvh8::TraversalStackSize];
+    uint32_t stackSize  = 0;
+    stack[stackSize++]  = { 0, ray.tMin };
+    while (stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.tEntry > ray.tMax)
+        {
+            continue;
+        }
+        if (entry.child & Bvh8::LeafFlag)
+        {
+            if (intersectLeaf(entry.child & ~Bvh8::LeafFlag, ray))
+            {
+                return;
+            }
+            continue;
+        }
+
+        const Bvh8::Node& node = bvh.Nodes()[entry.child];
+        __m256 tEntry;
+        const uint32_t hits = IntersectChildren(node, ray, tEntry);
+        alignas(32) float tEntries[Bvh8::Width];
+        _mm256_store_ps(tEntries, tEntry);
+        PushChildren(node, hits, tEntries, stack, stackSize);
+    }
+}
+
+// Up to 8 rays, one per lane, traced together through the nodes any of them enter
+struct Packet
+{
+    float3x8 origin;
+    float3x8 direction;
+    float3x8 invDirection;
+    __m256 tMin;
+    __m256 tMax;
+    __m256 active;      // Lanes which still look for hits
+
+    // Hits, tMax is the distance of the hit
+    __m256 hit;
+    __m256 u, v;
+    __m256i primitiveIndex;
+    __m256i instanceIndex;
+};
+
+void SetRays(Packet& packet, const float3x8& origin, const float3x8& direction)
+{
+    packet.origin       = origin;
+    packet.direction    = direction;
+    const __m256 one    = _mm256_set1_ps(1.0f);
+    packet.invDirection = { _mm256_div_ps(one, direction.x), _mm256_div_ps(one, direction.y), _mm256_div_ps(one, direction.z) };
+}
+
+// Packet of up to 8 rays without hits. Unused lanes repeat the first ray, so they compute the same (valid) values but stay inactive.
+Packet LoadPacket(const Ray* rays, uint32_t count)
+{
+    alignas(32) float origins[3][Bvh8::Width], directions[3][Bvh8::Width], tMins[Bvh8::Width], tMaxs[Bvh8::Width];
+    for (uint32_t i = 0; i < Bvh8::Width; i++)
+    {
+        const Ray& ray = rays[i < count ? i : 0];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            origins[axis][i]    = ray.origin[axis];
+            directions[axis][i] = ray.direction[axis];
+        }
+        tMins[i] = ray.tMin;
+        tMaxs[i] = ray.tMax;
+    }
+
+    Packet packet;
+    SetRays(packet, Load(origins), Load(directions));
+    packet.tMin             = _mm256_load_ps(tMins);
+    packet.tMax             = _mm256_load_ps(tMaxs);
+    packet.active           = LaneMask(count);
+    packet.hit              = _mm256_setzero_ps();
+    packet.u                = _mm256_setzero_ps();
+    packet.v                = _mm256_setzero_ps();
+    packet.primitiveIndex   = _mm256_setzero_si256();
+    packet.instanceIndex    = _mm256_setzero_si256();
+    return packet;
+}
+
+// The packet in the object space of an instance, transformed like ObjectRay() so the distances along the rays stay the same
+Packet ObjectPacket(const Packet& worldPacket, const Instance& instance)
+{
+    const float (*m)[4] = instance.worldToObject.m;
+    float3x8 origin, direction;
+    __m256* originRows      = &origin.x;
+    __m256* directionRows   = &direction.x;
+    for (int r = 0; r < 3; r++)
+    {
+        const __m256 m0     = _mm256_set1_ps(m[r][0]);
+        const __m256 m1     = _mm256_set1_ps(m[r][1]);
+        const __m256 m2     = _mm256_set1_ps(m[r][2]);
+        originRows[r]       = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, worldPacket.origin.x), _mm256_mul_ps(m1, worldPacket.origin.y)),
+                                                          _mm256_mul_ps(m2, worldPacket.origin.z)), _mm256_set1_ps(m[r][3]));
+        directionRows[r]    = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, worldPacket.direction.x), _mm256_mul_ps(m1, worldPacket.direction.y)),
+                                            _mm256_mul_ps(m2, worldPacket.direction.z));
+    }
+    Packet objectPacket = worldPacket;
+    SetRays(objectPacket, origin, direction);
+    return objectPacket;
+}
+
+// Visits the leaves any active ray enters, nearer ones first. intersectLeaf(leaf, packet) may shorten tMax and deactivate lanes,
+// the traversal ends once no lane is active.
+template <typename IntersectLeaf>
+void TraversePacket(const Bvh8& bvh, Packet& packet, IntersectLeaf intersectLeaf)
+{
+    if (bvh.Nodes().empty())
+    {
+        return;
+    }
+
+    const __m256 infinity       = _mm256_set1_ps(INFINITY);
+    const __m256 minusInfinity  = _mm256_set1_ps(-INFINITY);
+    StackEntry stack[Bvh8::TraversalStackSize];
+    uint32_t stackSize  = 0;
+    stack[stackSize++]  = { 0, HorizontalMin(_mm256_blendv_ps(infinity, packet.tMin, packet.active)) };
+    while (stackSize > 0)
+    {
+        // Skip nodes that all active rays have found closer hits than
+        const StackEntry entry = stack[--stackSize];
+        if (_mm256_movemask_ps(packet.active) == 0)
+        {
+            return;
+        }
+        if (entry.tEntry > HorizontalMax(_mm256_blendv_ps(minusInfinity, packet.tMax, packet.active)))
+        {
+            continue;
+        }
+        if (entry.child & Bvh8::LeafFlag)
+        {
+            intersectLeaf(entry.child & ~Bvh8::LeafFlag, packet);
+            continue;
+        }
+
+        // Test the packet against one child after the other, ordering them by the nearest entry of any ray
+        const Bvh8::Node& node = bvh.Nodes()[entry.child];
+        alignas(32) float tEntries[Bvh8::Width];
+        uint32_t hits = 0;
+        for (uint32_t i = 0; i < node.childCount; i++)
+        {
+            const __m256 t0x    = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[0][i]), packet.origin.x), packet.invDirection.x);
+            const __m256 t1x    = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[1][i]), packet.origin.x), packet.invDirection.x);
+            const __m256 t0y    = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[2][i]), packet.origin.y), packet.invDirection.y);
+            const __m256 t1y    = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[3][i]), packet.origin.y), packet.invDirection.y);
+            const __m256 t0z    = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[4][i]), packet.origin.z), packet.invDirection.z);
+            const __m256 t1z    = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[5][i]), packet.origin.z), packet.invDirection.z);
+            const __m256 tEntry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), packet.tMin));
+            __m256 tExit        = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), packet.tMax));
+            tExit               = _mm256_mul_ps(tExit, _mm256_set1_ps(IntervalScale));
+            const __m256 hit    = _mm256_and_ps(packet.active, _mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ));
+            if (_mm256_movemask_ps(hit) != 0)
+            {
+                hits        |= 1u << i;
+                tEntries[i] = HorizontalMin(_mm256_blendv_ps(infinity, tEntry, hit));
+            }
+        }
+        PushChildren(node, hits, tEntries, stack, stackSize);
+    }
+}
+
+// Intersects a single ray with the triangles of a leaf, shortening ray.tMax to the closest hit
+bool IntersectBlock(const TriangleBvh8::TriangleBlock& block, uint32_t count, SingleRay& ray, uint32_t rayFlags, float& t, float2& barycentrics, uint32_t& triangleIndex)
+{
+    __m256 tHit, u, v;
+    const __m256 hits   = IntersectTriangles(ray.origin, ray.direction, Load(block.v0), Load(block.e1), Load(block.e2),
+                                             _mm256_set1_ps(ray.tMin), _mm256_set1_ps(ray.tMax), rayFlags, LaneMask(count), tHit, u, v);
+    uint32_t mask       = static_cast<uint32_t>(_mm256_movemask_ps(hits));
+    if (mask == 0)
+    {
+        return false;
+    }
+
+    alignas(32) float tHits[Bvh8::Width], us[Bvh8::Width], vs[Bvh8::Width];
+    _mm256_store_ps(tHits, tHit);
+    _mm256_store_ps(us, u);
+    _mm256_store_ps(vs, v);
+    uint32_t closest = static_cast<uint32_t>(std::countr_zero(mask));
+    for (mask &= mask - 1; mask != 0; mask &= mask - 1)
+    {
+        const uint32_t lane = static_cast<uint32_t>(std::countr_zero(mask));
+        closest             = tHits[lane] < tHits[closest] ? lane : closest;
+    }
+    ray.tMax        = tHits[closest];
+    t               = tHits[closest];
+    barycentrics    = { us[closest], vs[closest] };
+    triangleIndex   = block.triangleIndices[closest];
+    return true;
+}
+
+// Intersects the active rays of a packet with the triangles of a leaf one triangle at a time, returns the lanes that found closer hits
+__m256 IntersectBlock(const TriangleBvh8::TriangleBlock& block, uint32_t count, Packet& packet, uint32_t rayFlags)
+{
+    __m256 blockHits = _mm256_setzero_ps();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        __m256 tHit, u, v;
+        const __m256 hits = IntersectTriangles(packet.origin, packet.direction, Broadcast(block.v0, i), Broadcast(block.e1, i), Broadcast(block.e2, i),
+                                               packet.tMin, packet.tMax, rayFlags, packet.active, tHit, u, v);
+        if (_mm256_movemask_ps(hits) == 0)
+        {
+            continue;
+        }
+        packet.tMax             = _mm256_blendv_ps(packet.tMax, tHit, hits);
+        packet.u                = _mm256_blendv_ps(packet.u, u, hits);
+        packet.v                = _mm256_blendv_ps(packet.v, v, hits);
+        packet.primitiveIndex   = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(packet.primitiveIndex),
+                                                                       _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(block.triangleIndices[i]))), hits));
+        blockHits               = _mm256_or_ps(blockHits, hits);
+        if (rayFlags & RayFlagAcceptFirstHitAndEndSearch)
+        {
+            packet.active = _mm256_andnot_ps(hits, packet.active);
+        }
+    }
+    return blockHits;
+}
+
+// Whether a single ray hits any of the triangles of a leaf, without finding the closest one or its barycentrics
+bool OccludedBlock(const TriangleBvh8::TriangleBlock& block, uint32_t count, const SingleRay& ray, uint32_t rayFlags)
+{
+    __m256 t, u, v;
+    const __m256 hits = IntersectTriangles(ray.origin, ray.direction, Load(block.v0), Load(block.e1), Load(block.e2),
+                                           _mm256_set1_ps(ray.tMin), _mm256_set1_ps(ray.tMax), rayFlags, LaneMask(count), t, u, v);
+    return _mm256_movemask_ps(hits) != 0;
+}
+
+// Deactivates the lanes of a packet whose rays hit any of the triangles of a leaf
+void OccludeBlock(const TriangleBvh8::TriangleBlock& block, uint32_t count, Packet& packet, uint32_t rayFlags)
+{
+    for (uint32_t i = 0; i < count && _mm256_movemask_ps(packet.active) != 0; i++)
+    {
+        __m256 t, u, v;
+        const __m256 hits = IntersectTriangles(packet.origin, packet.direction, Broadcast(block.v0, i), Broadcast(block.e1, i), Broadcast(block.e2, i),
+                                               packet.tMin, packet.tMax, rayFlags, packet.active, t, u, v);
+        packet.active = _mm256_andnot_ps(hits, packet.active);
+    }
+}
+}
+
+Bvh8::Bvh8(const Bvh& bvh)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    const std::vector<Bvh::Node>& nodes = bvh.Nodes();
+    if (nodes.empty())
+    {
+        return;
+    }
+    m_bounds = nodes[0].bounds;
+
+    // Primitive range of every binary subtree. Children are always stored after their parents, so a reverse sweep visits them first.
+    std::vector<Leaf> subtreeRanges(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0ULL;)
+    {
+        if (nodes[i].IsLeaf())
+        {
+            subtreeRanges[i] = { nodes[i].leftOrFirst, nodes[i].count };
+        }
+        else
+        {
+            const Leaf& left    = subtreeRanges[nodes[i].leftOrFirst];
+            const Leaf& right   = subtreeRanges[nodes[i].leftOrFirst + 1];
+            subtreeRanges[i]    = { left.first, left.count + right.count };
+        }
+    }
+    Collapse(bvh, 0, subtreeRanges);
+
+    uint64_t children   = 0;
+    uint64_t primitives = 0;
+    for (const Node& node : m_nodes)
+    {
+        children += node.childCount;
+    }
+    for (const Leaf& leaf : m_leaves)
+    {
+        primitives += leaf.count;
+    }
+    m_buildStats.seconds            = std::chrono::duration<double>(Clock::now() - start).count();
+    m_buildStats.nodes              = static_cast<uint32_t>(m_nodes.size());
+    m_buildStats.leaves             = static_cast<uint32_t>(m_leaves.size());
+    m_buildStats.averageChildCount  = static_cast<double>(children) / m_nodes.size();
+    m_buildStats.averageLeafSize    = static_cast<double>(primitives) / m_leaves.size();
+    ComputeSahCost();
+}
+
+void Bvh8::Refit(std::span<const Aabb> leafBounds)
+{
+    // Children are always stored after their parents, so a reverse sweep visits them first
+    std::vector<Aabb> nodeBounds(m_nodes.size());
+    for (size_t i = m_nodes.size(); i-- > 0ULL;)
+    {
+        Node& node = m_nodes[i];
+        for (uint32_t c = 0; c < node.childCount; c++)
+        {
+            const Aabb& bounds = (node.children[c] & LeafFlag) ? leafBounds[node.children[c] & ~LeafFlag] : nodeBounds[node.children[c]];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                node.bounds[2 * axis][c]        = bounds.lower[axis];
+                node.bounds[2 * axis + 1][c]    = bounds.upper[axis];
+            }
+            nodeBounds[i].Grow(bounds);
+        }
+    }
+    m_bounds = nodeBounds.empty() ? Aabb() : nodeBounds[0];
+    ComputeSahCost();
+}
+
+void Bvh8::ComputeSahCost()
+{
+    // Every node's children are tested when it is traversed, which happens with the probability of hitting the node's bounds, and
+    // every leaf's triangles when the leaf is entered
+    const float rootArea = m_bounds.HalfArea();
+    double sahCost = m_nodes.empty() ? 0.0 : 1.0;
+    for (const Node& node : m_nodes)
+    {
+        for (uint32_t c = 0; c < node.childCount; c++)
+        {
+            Aabb bounds;
+            bounds.lower = { node.bounds[0][c], node.bounds[2][c], node.bounds[4][c] };
+            bounds.upper = { node.bounds[1][c], node.bounds[3][c], node.bounds[5][c] };
+            const double area = rootArea > 0.0f ? bounds.HalfArea() / rootArea : 1.0;
+            sahCost += (node.children[c] & LeafFlag) ? area * m_leaves[node.children[c] & ~LeafFlag].count : area;
+        }
+    }
+    m_buildStats.sahCost = sahCost;
+}
+
+// Turns a binary subtree into a node whose children are the binary nodes reached by repeatedly opening up the child with the largest
+// surface area, until there are Width children or all of them become leaves
+uint32_t Bvh8::Collapse(const Bvh& bvh, uint32_t binaryNode, const std::vector<Leaf>& subtreeRanges)
+{
+    const std::vector<Bvh::Node>& nodes = bvh.Nodes();
+    auto becomesLeaf = [&](uint32_t n) { return nodes[n].IsLeaf() || subtreeRanges[n].count <= Width; };
+
+    uint32_t children[Width]    = { binaryNode };
+    uint32_t childCount         = 1;
+    while (childCount < Width)
+    {
+        int largest         = -1;
+        float largestArea   = -1.0f;
+        for (uint32_t i = 0; i < childCount; i++)
+        {
+            if (!becomesLeaf(children[i]) && nodes[children[i]].bounds.HalfArea() > largestArea)
+            {
+                largest     = static_cast<int>(i);
+                largestArea = nodes[children[i]].bounds.HalfArea();
+            }
+        }
+        if (largest < 0)
+        {
+            break;
+        }
+        const uint32_t opened       = children[largest];
+        children[largest]           = nodes[opened].leftOrFirst;
+        children[childCount++]      = nodes[opened].leftOrFirst + 1;
+    }
+
+    const uint32_t nodeIndex = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back({});
+    m_nodes[nodeIndex].childCount = childCount;
+    for (uint32_t i = 0; i < childCount; i++)
+    {
+        const Aabb& bounds = nodes[children[i]].bounds;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            m_nodes[nodeIndex].bounds[2 * axis][i]      = bounds.lower[axis];
+            m_nodes[nodeIndex].bounds[2 * axis + 1][i]  = bounds.upper[axis];
+        }
+        if (becomesLeaf(children[i]))
+        {
+            m_nodes[nodeIndex].children[i] = LeafFlag | static_cast<uint32_t>(m_leaves.size());
+            m_leaves.push_back(subtreeRanges[children[i]]);
+        }
+        else
+        {
+            const uint32_t child = Collapse(bvh, children[i], subtreeRanges);
+            m_nodes[nodeIndex].children[i] = child;
+        }
+    }
+    return nodeIndex;
+}
+
+TriangleBvh8::TriangleBvh8(std::span<const Triangle> triangles, BvhBuilder builder)
+{
+    const Bvh bvh(TriangleBounds(triangles), builder);
+    m_binaryBuildStats  = bvh.GetBuildStats();
+    m_bvh               = Bvh8(bvh);
+
+    m_blocks.resize(m_bvh.Leaves().size());
+    const int numLeaves = static_cast<int>(m_blocks.size());
+    #pragma omp parallel for if(triangles.size() >= Bvh::ParallelBuildThreshold)
+    for (int i = 0; i < numLeaves; i++)
+    {
+        const Bvh8::Leaf& leaf  = m_bvh.Leaves()[i];
+        TriangleBlock& block    = m_blocks[i];
+        for (uint32_t j = 0; j < leaf.count; j++)
+        {
+            const uint32_t triangleIndex    = bvh.PrimitiveIndices()[leaf.first + j];
+            const Triangle& triangle        = triangles[triangleIndex];
+            const float3 e1                 = triangle.v1 - triangle.v0;
+            const float3 e2                 = triangle.v2 - triangle.v0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                block.v0[axis][j] = triangle.v0[axis];
+                block.e1[axis][j] = e1[axis];
+                block.e2[axis][j] = e2[axis];
+            }
+            block.triangleIndices[j] = triangleIndex;
+        }
+    }
+}
+
+void TriangleBvh8::Refit(std::span<const Triangle> triangles)
+{
+    std::vector<Aabb> leafBounds(m_blocks.size());
+    const int numLeaves = static_cast<int>(m_blocks.size());
+    #pragma omp parallel for if(triangles.size() >= Bvh::ParallelBuildThreshold)
+    for (int i = 0; i < numLeaves; i++)
+    {
+        TriangleBlock& block = m_blocks[i];
+        for (uint32_t j = 0; j < m_bvh.Leaves()[i].count; j++)
+        {
+            const Triangle& triangle    = triangles[block.triangleIndices[j]];
+            const float3 e1             = triangle.v1 - triangle.v0;
+            const float3 e2             = triangle.v2 - triangle.v0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                block.v0[axis][j] = triangle.v0[axis];
+                block.e1[axis][j] = e1[axis];
+                block.e2[axis][j] = e2[axis];
+            }
+            leafBounds[i].Grow(triangle.v0);
+            leafBounds[i].Grow(triangle.v1);
+            leafBounds[i].Grow(triangle.v2);
+        }
+    }
+    m_bvh.Refit(leafBounds);
+}
+
+Bvh8Intersector::Bvh8Intersector(const Scene& scene) :
+    m_scene(scene),
+    m_bottomLevel(scene.ObjectCount()),
+    m_refitMonitors(scene.ObjectCount())
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    BuildObjects(scene, [&](size_t i) { m_bottomLevel[i] = TriangleBvh8(scene.ObjectTriangles(i), ObjectBvhBuilder(scene, i)); });
+
+    std::vector<Bvh::BuildStats> stats(m_bottomLevel.size());
+    std::vector<size_t> triangleCounts(m_bottomLevel.size());
+    uint64_t children = 0;
+    for (size_t i = 0ULL; i < m_bottomLevel.size(); i++)
+    {
+        const Bvh8::BuildStats& bvh8Stats   = m_bottomLevel[i].GetBvh().GetBuildStats();
+        stats[i]                            = m_bottomLevel[i].GetBinaryBuildStats();
+        triangleCounts[i]                   = scene.ObjectTriangles(i).size();
+        m_refitMonitors[i].OnBuild(bvh8Stats.sahCost);
+        m_bottomLevelBvh8Stats.nodes        += bvh8Stats.nodes;
+        m_bottomLevelBvh8Stats.leaves       += bvh8Stats.leaves;
+        children                            += static_cast<uint64_t>(bvh8Stats.averageChildCount * bvh8Stats.nodes + 0.5);
+    }
+    m_bottomLevelStats                          = CombineBuildStats(stats, triangleCounts);
+    m_bottomLevelStats.seconds                  = std::chrono::duration<double>(Clock::now() - start).count();
+    m_bottomLevelBvh8Stats.seconds              = m_bottomLevelStats.seconds;
+    m_bottomLevelBvh8Stats.averageChildCount    = m_bottomLevelBvh8Stats.nodes > 0 ? static_cast<double>(children) / m_bottomLevelBvh8Stats.nodes : 0.0;
+    m_bottomLevelBvh8Stats.averageLeafSize      = m_bottomLevelBvh8Stats.leaves > 0 ? static_cast<double>(scene.TriangleCount()) / m_bottomLevelBvh8Stats.leaves : 0.0;
+
+    BuildTopLevel();
+}
+
+RefitStats Bvh8Intersector::RefitObjects(std::span<const uint32_t> objects)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    std::vector<uint8_t> rebuilt(m_bottomLevel.size(), 0);
+    BuildObjects(m_scene, objects, [&](size_t i) {
+        m_bottomLevel[i].Refit(m_scene.ObjectTriangles(i));
+        if (m_refitMonitors[i].OnRefit(m_bottomLevel[i].GetBvh().GetBuildStats().sahCost))
+        {
+            m_bottomLevel[i] = TriangleBvh8(m_scene.ObjectTriangles(i), ObjectBvhBuilder(m_scene, i));
+            m_refitMonitors[i].OnBuild(m_bottomLevel[i].GetBvh().GetBuildStats().sahCost);
+            rebuilt[i] = 1;
+        }
+    });
+    BuildTopLevel();
+
+    RefitStats stats;
+    for (uint32_t object : objects)
+    {
+        stats.refits++;
+        if (rebuilt[object])
+        {
+            stats.rebuiltObjects.push_back(object);
+        }
+        else
+        {
+            stats.maxDegradation = (std::max)(stats.maxDegradation, m_refitMonitors[object].Degradation());
+        }
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return stats;
+}
+
+// The top level is built over the world space bounds of the instances' bottom level BVHs, and its leaves reference them in the binary
+// BVH's leaf order
+void Bvh8Intersector::BuildTopLevel()
+{
+    std::span<const Instance> instances = m_scene.Instances();
+    std::vector<Aabb> instanceBounds;
+    std::vector<uint32_t> instanceIndices;
+    for (size_t i = 0ULL; i < instances.size(); i++)
+    {
+        const Aabb objectBounds = m_bottomLevel[instances[i].instanceID].GetBvh().Bounds();
+        if (!objectBounds.IsEmpty())
+        {
+            instanceBounds.push_back(TransformAabb(objectBounds, instances[i].objectToWorld));
+            instanceIndices.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    const Bvh topLevel(instanceBounds);
+    m_topLevelStats = topLevel.GetBuildStats();
+    m_topLevel      = Bvh8(topLevel);
+    m_topLevelInstances.clear();
+    for (uint32_t i : topLevel.PrimitiveIndices())
+    {
+        m_topLevelInstances.push_back(instanceIndices[i]);
+    }
+}
+
+// Single-ray mode, meant for incoherent rays such as shadow rays
+bool Bvh8Intersector::Intersect(const Ray& ray, uint32_t rayFlags, Hit& hit) const
+{
+    SingleRay worldRay(ray);
+    bool found = false;
+    Traverse(m_topLevel, worldRay, [&](uint32_t topLevelLeaf, SingleRay& traversalRay) {
+        const Bvh8::Leaf& leaf = m_topLevel.Leaves()[topLevelLeaf];
+        for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++)
+        {
+            const uint32_t instanceIndex    = m_topLevelInstances[i];
+            const Instance& instance        = m_scene.Instances()[instanceIndex];
+            const TriangleBvh8& bottomLevel = m_bottomLevel[instance.instanceID];
+            Ray objectRay                   = ObjectRay(ray, instance);
+            objectRay.tMax                  = traversalRay.tMax;
+
+            // The object space distance is the world space one, as the ray direction is transformed without normalizing it
+            SingleRay objectSpaceRay(objectRay);
+            bool stop = false;
+            Traverse(bottomLevel.GetBvh(), objectSpaceRay, [&](uint32_t bottomLevelLeaf, SingleRay& objectTraversalRay) {
+                uint32_t primitiveIndex;
+                if (!IntersectBlock(bottomLevel.Blocks()[bottomLevelLeaf], bottomLevel.GetBvh().Leaves()[bottomLevelLeaf].count,
+                                    objectTraversalRay, rayFlags, hit.t, hit.barycentrics, primitiveIndex))
+                {
+                    return false;
+                }
+                traversalRay.tMax   = objectTraversalRay.tMax;
+                hit.instanceIndex   = instanceIndex;
+                hit.instanceID      = instance.instanceID;
+                hit.primitiveIndex  = primitiveIndex;
+                found               = true;
+                stop                = (rayFlags & RayFlagAcceptFirstHitAndEndSearch) != 0;
+                return stop;
+            });
+            if (stop)
+            {
+                return true;
+            }
+        }
+        return false;
+    });
+    return found;
+}
+
+// Packet mode, meant for coherent rays such as primary rays
+uint32_t Bvh8Intersector::IntersectPacket(const Ray* rays, uint32_t count, uint32_t rayFlags, Hit* hits) const
+{
+    Packet worldPacket = LoadPacket(rays, count);
+    TraversePacket(m_topLevel, worldPacket, [&](uint32_t topLevelLeaf, Packet& packet) {
+        const Bvh8::Leaf& leaf = m_topLevel.Leaves()[topLevelLeaf];
+        for (uint32_t i = leaf.first; i < leaf.first + leaf.count && _mm256_movemask_ps(packet.active) != 0; i++)
+        {
+            const uint32_t instanceIndex    = m_topLevelInstances[i];
+            const Instance& instance        = m_scene.Instances()[instanceIndex];
+            const TriangleBvh8& bottomLevel = m_bottomLevel[instance.instanceID];
+            Packet objectPacket             = ObjectPacket(packet, instance);
+
+            __m256 instanceHits = _mm256_setzero_ps();
+            TraversePacket(bottomLevel.GetBvh(), objectPacket, [&](uint32_t bottomLevelLeaf, Packet& objectTraversalPacket) {
+                instanceHits = _mm256_or_ps(instanceHits, IntersectBlock(bottomLevel.Blocks()[bottomLevelLeaf], bottomLevel.GetBvh().Leaves()[bottomLevelLeaf].count,
+                                                                         objectTraversalPacket, rayFlags));
+            });
+
+            packet.tMax             = objectPacket.tMax;
+            packet.active           = objectPacket.active;
+            packet.hit              = _mm256_or_ps(packet.hit, instanceHits);
+            packet.u                = objectPacket.u;
+            packet.v                = objectPacket.v;
+            packet.primitiveIndex   = objectPacket.primitiveIndex;
+            packet.instanceIndex    = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(packet.instanceIndex),
+                                                                           _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(instanceIndex))), instanceHits));
+        }
+    });
+
+    alignas(32) float ts[Bvh8::Width], us[Bvh8::Width], vs[Bvh8::Width];
+    alignas(32) uint32_t primitiveIndices[Bvh8::Width], instanceIndices[Bvh8::Width];
+    _mm256_store_ps(ts, worldPacket.tMax);
+    _mm256_store_ps(us, worldPacket.u);
+    _mm256_store_ps(vs, worldPacket.v);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(primitiveIndices), worldPacket.primitiveIndex);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(instanceIndices), worldPacket.instanceIndex);
+    const uint32_t hitMask = static_cast<uint32_t>(_mm256_movemask_ps(worldPacket.hit));
+    for (uint32_t mask = hitMask; mask != 0; mask &= mask - 1)
+    {
+        const uint32_t i    = static_cast<uint32_t>(std::countr_zero(mask));
+        hits[i]             = { ts[i], { us[i], vs[i] }, instanceIndices[i], m_scene.Instances()[instanceIndices[i]].instanceID, primitiveIndices[i] };
+    }
+    return hitMask;
+}
+
+bool Bvh8Intersector::Occluded(const Ray& ray, uint32_t rayFlags) const
+{
+    SingleRay worldRay(ray);
+    bool occluded = false;
+    Traverse(m_topLevel, worldRay, [&](uint32_t topLevelLeaf, SingleRay&) {
+        const Bvh8::Leaf& leaf = m_topLevel.Leaves()[topLevelLeaf];
+        for (uint32_t i = leaf.first; i < leaf.first + leaf.count && !occluded; i++)
+        {
+            const Instance& instance        = m_scene.Instances()[m_topLevelInstances[i]];
+            const TriangleBvh8& bottomLevel = m_bottomLevel[instance.instanceID];
+            SingleRay objectRay(ObjectRay(ray, instance));
+            Traverse(bottomLevel.GetBvh(), objectRay, [&](uint32_t bottomLevelLeaf, SingleRay& objectTraversalRay) {
+                occluded = OccludedBlock(bottomLevel.Blocks()[bottomLevelLeaf], bottomLevel.GetBvh().Leaves()[bottomLevelLeaf].count, objectTraversalRay, rayFlags);
+                return occluded;
+            });
+        }
+        return occluded;
+    });
+    return occluded;
+}
+
+// Rays of a batch are expected to be coherent in groups of 8, like the shadow rays of neighbouring pixels towards the same light, and
+// are traced as packets
+void Bvh8Intersector::OccludedBatch(std::span<const Ray> rays, uint32_t rayFlags, bool* occluded) const
+{
+    for (size_t first = 0ULL; first < rays.size(); first += Bvh8::Width)
+    {
+        const uint32_t count            = static_cast<uint32_t>((std::min)(rays.size() - first, static_cast<size_t>(Bvh8::Width)));
+        const uint32_t occludedMask     = OccludedPacket(rays.data() + first, count, rayFlags);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            occluded[first + i] = (occludedMask & (1u << i)) != 0;
+        }
+    }
+}
+
+uint32_t Bvh8Intersector::OccludedPacket(const Ray* rays, uint32_t count, uint32_t rayFlags) const
+{
+    // Lanes are deactivated as soon as their ray hits anything, the occluded rays are the ones that were active to begin with
+    Packet worldPacket = LoadPacket(rays, count);
+    TraversePacket(m_topLevel, worldPacket, [&](uint32_t topLevelLeaf, Packet& packet) {
+        const Bvh8::Leaf& leaf = m_topLevel.Leaves()[topLevelLeaf];
+        for (uint32_t i = leaf.first; i < leaf.first + leaf.count && _mm256_movemask_ps(packet.active) != 0; i++)
+        {
+            const Instance& instance        = m_scene.Instances()[m_topLevelInstances[i]];
+            const TriangleBvh8& bottomLevel = m_bottomLevel[instance.instanceID];
+            Packet objectPacket             = ObjectPacket(packet, instance);
+            TraversePacket(bottomLevel.GetBvh(), objectPacket, [&](uint32_t bottomLevelLeaf, Packet& objectTraversalPacket) {
+                OccludeBlock(bottomLevel.Blocks()[bottomLevelLeaf], bottomLevel.GetBvh().Leaves()[bottomLevelLeaf].count, objectTraversalPacket, rayFlags);
+            });
+            packet.active = objectPacket.active;
+        }
+    });
+    return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_andnot_ps(worldPacket.active, LaneMask(count))));
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Bvh.h"
+
+namespace CpuRT {
+// 8-wide BVH collapsed from a binary Bvh. Every node stores the bounds of its up to 8 children in SoA form, so a single AVX2 slab test
+// covers all of them. Subtrees with at most Width primitives become leaves, which reference a contiguous range of the binary BVH's
+// primitives in leaf order.
+class Bvh8
+{
+public:
+    static constexpr uint32_t Width     = 8;
+    static constexpr uint32_t LeafFlag  = 0x80000000u;
+
+    struct alignas(32) Node
+    {
+        float bounds[6][Width];     // Lower x, upper x, lower y, upper y, lower z, and upper z of every child
+        uint32_t children[Width];   // Index of an interior child node, or LeafFlag | the index of a leaf
+        uint32_t childCount;        // Children are stored in the first childCount slots
+    };
+
+    struct Leaf
+    {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    struct BuildStats
+    {
+        double seconds              = 0.0;  // Collapsing only, on top of the binary build
+        uint32_t nodes              = 0;
+        uint32_t leaves             = 0;
+        double averageChildCount    = 0.0;
+        double averageLeafSize      = 0.0;
+        double sahCost              = 0.0;  // Like Bvh::BuildStats::sahCost, with a node traversal testing all children
+    };
+
+    // Every child pushes at most Width - 1 siblings, and the collapsed tree is no deeper than the binary one
+    static constexpr uint32_t TraversalStackSize = (Width - 1) * Bvh::TraversalStackSize;
+
+    Bvh8() = default;
+    explicit Bvh8(const Bvh& bvh);
+
+    // Recomputes the bounds of all children after the primitives have moved, keeping the topology, and updates the SAH cost of the build
+    // stats. leafBounds has an entry per leaf.
+    void Refit(std::span<const Aabb> leafBounds);
+
+    Aabb Bounds() const { return m_bounds; }
+    const std::vector<Node>& Nodes() const { return m_nodes; }
+    const std::vector<Leaf>& Leaves() const { return m_leaves; }
+    const BuildStats& GetBuildStats() const { return m_buildStats; }
+
+private:
+    uint32_t Collapse(const Bvh& bvh, uint32_t binaryNode, const std::vector<Leaf>& subtreeRanges);
+    void ComputeSahCost();
+
+    Aabb                m_bounds;
+    std::vector<Node>   m_nodes;
+    std::vector<Leaf>   m_leaves;
+    BuildStats          m_buildStats;
+};
+
+// 8-wide BVH over the triangles of one object, the counterpart of a BLAS. The triangles of every leaf are stored in a block, as
+// the first vertex and two edges of each in SoA form for the 8-wide ray/triangle test. Unused lanes are zero.
+class TriangleBvh8
+{
+public:
+    struct alignas(32) TriangleBlock
+    {
+        float v0[3][Bvh8::Width];
+        float e1[3][Bvh8::Width];
+        float e2[3][Bvh8::Width];
+        uint32_t triangleIndices[Bvh8::Width];  // Index of every triangle in the span the BVH was built from
+    };
+
+    TriangleBvh8() = default;
+    explicit TriangleBvh8(std::span<const Triangle> triangles, BvhBuilder builder = BvhBuilder::BinnedSah);
+
+    // Refits the BVH to the moved vertices of the same triangles
+    void Refit(std::span<const Triangle> triangles);
+
+    const Bvh8& GetBvh() const { return m_bvh; }
+    const Bvh::BuildStats& GetBinaryBuildStats() const { return m_binaryBuildStats; }
+    const std::vector<TriangleBlock>& Blocks() const { return m_blocks; }    // One per leaf
+
+private:
+    Bvh8                        m_bvh;
+    Bvh::BuildStats             m_binaryBuildStats;
+    std::vector<TriangleBlock>  m_blocks;
+};
+
+// Two-level acceleration structure like BvhIntersector, with 8-wide BVHs on both levels and AVX2 traversal kernels. Single rays (such
+// as shadow rays) test the 8 children of a node and the 8 triangles of a leaf at once, while packets of coherent rays (such as primary
+// rays) trace 8 rays side by side through the nodes they share. Only usable if IsSupported().
+class Bvh8Intersector : public Intersector
+{
+public:
+    // Whether the CPU and OS support the AVX2 instructions the kernels are built from
+    static bool IsSupported();
+
+    explicit Bvh8Intersector(const Scene& scene);
+
+    bool Intersect(const Ray& ray, uint32_t rayFlags, Hit& hit) const override;
+    uint32_t IntersectPacket(const Ray* rays, uint32_t count, uint32_t rayFlags, Hit* hits) const override;
+    bool Occluded(const Ray& ray, uint32_t rayFlags) const override;
+    void OccludedBatch(std::span<const Ray> rays, uint32_t rayFlags, bool* occluded) const override;
+    const char* Name() const override { return "two-level BVH8, AVX2"; }
+
+    // Same as BvhIntersector::RefitObjects(), with the RefitMonitors watching the SAH cost of the BVH8s
+    RefitStats RefitObjects(std::span<const uint32_t> objects);
+
+    // Build stats of the binary BVHs which have been collapsed, totals over all objects for the bottom levels
+    const Bvh::BuildStats& GetBottomLevelStats() const { return m_bottomLevelStats; }
+    const Bvh::BuildStats& GetTopLevelStats() const { return m_topLevelStats; }
+    // Totals over all bottom level BVH8s
+    const Bvh8::BuildStats& GetBottomLevelBvh8Stats() const { return m_bottomLevelBvh8Stats; }
+    const Bvh8::BuildStats& GetTopLevelBvh8Stats() const { return m_topLevel.GetBuildStats(); }
+
+private:
+    // Returns a mask with bit i set if rays[i] is occluded
+    uint32_t OccludedPacket(const Ray* rays, uint32_t count, uint32_t rayFlags) const;
+    void BuildTopLevel();
+
+    const Scene&                m_scene;
+    std::vector<TriangleBvh8>   m_bottomLevel;          // One per object
+    std::vector<RefitMonitor>   m_refitMonitors;        // One per object
+    Bvh8                        m_topLevel;             // Over the instances in m_topLevelInstances, in the binary BVH's leaf order
+    std::vector<uint32_t>       m_topLevelInstances;
+    Bvh::BuildStats             m_bottomLevelStats;
+    Bvh::BuildStats             m_topLevelStats;
+    Bvh8::BuildStats            m_bottomLevelBvh8Stats;
+};
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../hlsl/SceneHlslCompat.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Minimal HLSL style vector math, so code ported from the shaders can stay close to the original
+namespace CpuRT {
+struct float2
+{
+    float x, y;
+};
+
+struct float3
+{
+    float x, y, z;
+
+    float& operator[](int i) { return (&x)[i]; }
+    float operator[](int i) const { return (&x)[i]; }
+};
+
+// Affine transform applied to column vectors, row major with the translation in the last column like ObjectToWorld3x4()
+struct float3x4
+{
+    float m[3][4];
+};
+
+inline float3 make_float3(const XMFLOAT3& v) { return { v.x, v.y, v.z }; }
+inline float3 make_float3(float s) { return { s, s, s }; }
+
+inline float3 operator+(const float3& a, const float3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline float3 operator-(const float3& a, const float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline float3 operator*(const float3& a, const float3& b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+inline float3 operator/(const float3& a, const float3& b) { return { a.x / b.x, a.y / b.y, a.z / b.z }; }
+inline float3 operator*(const float3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+inline float3 operator*(float s, const float3& a) { return a * s; }
+inline float3 operator/(const float3& a, float s) { return { a.x / s, a.y / s, a.z / s }; }
+inline float3 operator-(const float3& a) { return { -a.x, -a.y, -a.z }; }
+inline float3& operator+=(float3& a, const float3& b) { a = a + b; return a; }
+inline float3& operator-=(float3& a, const float3& b) { a = a - b; return a; }
+inline float3& operator*=(float3& a, float s) { a = a * s; return a; }
+
+inline float dot(const float3& a, const float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float3 cross(const float3& a, const float3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+inline float length(const float3& v) { return std::sqrt(dot(v, v)); }
+inline float3 normalize(const float3& v) { return v / length(v); }
+inline float3 lerp(const float3& a, const float3& b, float t) { return a + (b - a) * t; }
+inline float3 reflect(const float3& i, const float3& n) { return i - 2.0f * dot(n, i) * n; }
+inline float saturate(float v) { return std::clamp(v, 0.0f, 1.0f); }
+inline float3 saturate(const float3& v) { return { saturate(v.x), saturate(v.y), saturate(v.z) }; }
+inline float3 min3(const float3& a, const float3& b) { return { (std::min)(a.x, b.x), (std::min)(a.y, b.y), (std::min)(a.z, b.z) }; }
+inline float3 max3(const float3& a, const float3& b) { return { (std::max)(a.x, b.x), (std::max)(a.y, b.y), (std::max)(a.z, b.z) }; }
+
+inline float3 transformPoint(const float3x4& t, const float3& p)
+{
+    return {
+        t.m[0][0] * p.x + t.m[0][1] * p.y + t.m[0][2] * p.z + t.m[0][3],
+        t.m[1][0] * p.x + t.m[1][1] * p.y + t.m[1][2] * p.z + t.m[1][3],
+        t.m[2][0] * p.x + t.m[2][1] * p.y + t.m[2][2] * p.z + t.m[2][3]
+    };
+}
+
+inline float3 transformVector(const float3x4& t, const float3& v)
+{
+    return {
+        t.m[0][0] * v.x + t.m[0][1] * v.y + t.m[0][2] * v.z,
+        t.m[1][0] * v.x + t.m[1][1] * v.y + t.m[1][2] * v.z,
+        t.m[2][0] * v.x + t.m[2][1] * v.y + t.m[2][2] * v.z
+    };
+}
+
+// mul(v, (float3x3)t): the row vector v times the upper 3x3 of t, i.e. v transformed by its transpose
+inline float3 mul3x3(const float3& v, const float3x4& t)
+{
+    return {
+        v.x * t.m[0][0] + v.y * t.m[1][0] + v.z * t.m[2][0],
+        v.x * t.m[0][1] + v.y * t.m[1][1] + v.z * t.m[2][1],
+        v.x * t.m[0][2] + v.y * t.m[1][2] + v.z * t.m[2][2]
+    };
+}
+
+// Inverse of an affine transform, whose upper 3x3 has to be invertible
+inline float3x4 inverse(const float3x4& t)
+{
+    const float (*m)[4] = t.m;
+    float3x4 result;
+    result.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    result.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    result.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    result.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    result.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    result.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    result.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    result.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    result.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+    const float inverseDeterminant = 1.0f / (m[0][0] * result.m[0][0] + m[0][1] * result.m[1][0] + m[0][2] * result.m[2][0]);
+    for (int r = 0; r < 3; r++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            result.m[r][c] *= inverseDeterminant;
+        }
+    }
+    for (int r = 0; r < 3; r++)
+    {
+        result.m[r][3] = -(result.m[r][0] * m[0][3] + result.m[r][1] * m[1][3] + result.m[r][2] * m[2][3]);
+    }
+    return result;
+}
+}
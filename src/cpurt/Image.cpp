@@ -0,0 +1,30 @@
+#include "Image.h"
+
+#include <fstream>
+
+using namespace CpuRT;
+
+Image::Image(uint32_t width, uint32_t height) :
+    m_width(width),
+    m_height(height),
+    m_pixels(static_cast<size_t>(width) * height, make_float3(0.0f))
+{
+}
+
+bool Image::WritePPM(const std::string& path) const
+{
+    std::vector<uint8_t> bytes(m_pixels.size() * 3);
+    for (size_t i = 0ULL; i < m_pixels.size(); i++)
+    {
+        float3 color = saturate(m_pixels[i]);
+        for (int c = 0; c < 3; c++)
+        {
+            bytes[3 * i + c] = static_cast<uint8_t>(color[c] * 255.0f + 0.5f);
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file << "P6\n" << m_width << " " << m_height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return static_cast<bool>(file);
+}
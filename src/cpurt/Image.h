@@ -0,0 +1,30 @@
+#pragma once
+
+#include "HlslMath.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CpuRT {
+// RGB float image, the counterpart of the raytracing output UAV
+class Image
+{
+public:
+    Image(uint32_t width, uint32_t height);
+
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+
+    float3& At(uint32_t x, uint32_t y) { return m_pixels[static_cast<size_t>(y) * m_width + x]; }
+    const float3& At(uint32_t x, uint32_t y) const { return m_pixels[static_cast<size_t>(y) * m_width + x]; }
+
+    // Writes a binary PPM, converting colors like a store to the R8G8B8A8_UNORM output does (clamped, no gamma)
+    bool WritePPM(const std::string& path) const;
+
+private:
+    uint32_t            m_width;
+    uint32_t            m_height;
+    std::vector<float3> m_pixels;
+};
+}
@@ -0,0 +1,59 @@
+#include "Intersector.h"
+
+using namespace CpuRT;
+
+uint32_t Intersector::IntersectPacket(const Ray* rays, uint32_t count, uint32_t rayFlags, Hit* hits) const
+{
+    uint32_t hitMask = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        hitMask |= Intersect(rays[i], rayFlags, hits[i]) ? 1u << i : 0u;
+    }
+    return hitMask;
+}
+
+bool Intersector::Occluded(const Ray& ray, uint32_t rayFlags) const
+{
+    Hit hit;
+    return Intersect(ray, rayFlags | RayFlagAcceptFirstHitAndEndSearch, hit);
+}
+
+void Intersector::OccludedBatch(std::span<const Ray> rays, uint32_t rayFlags, bool* occluded) const
+{
+    for (size_t i = 0ULL; i < rays.size(); i++)
+    {
+        occluded[i] = Occluded(rays[i], rayFlags);
+    }
+}
+
+bool BruteForceIntersector::Intersect(const Ray& ray, uint32_t rayFlags, Hit& hit) const
+{
+    Ray closestRay  = ray;
+    bool found      = false;
+    std::span<const Instance> instances = m_scene.Instances();
+    for (size_t instance = 0ULL; instance < instances.size(); instance++)
+    {
+        const uint32_t object               = instances[instance].instanceID;
+        const Ray objectRay                 = ObjectRay(closestRay, instances[instance]);
+        std::span<const Triangle> triangles = m_scene.ObjectTriangles(object);
+        for (size_t i = 0ULL; i < triangles.size(); i++)
+        {
+            float t;
+            float2 barycentrics;
+            if (!IntersectTriangle({ objectRay.origin, objectRay.tMin, objectRay.direction, closestRay.tMax }, triangles[i], rayFlags, t, barycentrics))
+            {
+                continue;
+            }
+
+            // Later hits have to be closer than this one
+            closestRay.tMax = t;
+            hit             = { t, barycentrics, static_cast<uint32_t>(instance), object, static_cast<uint32_t>(i) };
+            found           = true;
+            if (rayFlags & RayFlagAcceptFirstHitAndEndSearch)
+            {
+                return true;
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Scene.h"
+
+namespace CpuRT {
+// Acceleration structure the CPU renderer traces rays against, the counterpart of the TLAS bound to the raytracing pipeline
+class Intersector
+{
+public:
+    static constexpr uint32_t PacketSize = 8;
+
+    virtual ~Intersector() = default;
+
+    // Like TraceRay: finds the closest hit in [ray.tMin, ray.tMax], or any hit if rayFlags contains RayFlagAcceptFirstHitAndEndSearch
+    virtual bool Intersect(const Ray& ray, uint32_t rayFlags, Hit& hit) const = 0;
+
+    // Intersects up to PacketSize rays which are expected to be coherent, like the primary rays of neighbouring pixels. Returns a mask
+    // with bit i set if rays[i] hit something, in which case hits[i] is written. Traces the rays one by one unless overridden.
+    virtual uint32_t IntersectPacket(const Ray* rays, uint32_t count, uint32_t rayFlags, Hit* hits) const;
+
+    // Like TraceRay with RayFlagAcceptFirstHitAndEndSearch for a payload that only records whether anything was hit, as for shadow
+    // rays: returns whether there is any hit in [ray.tMin, ray.tMax] without working out which one or where. Calls Intersect() unless
+    // overridden.
+    virtual bool Occluded(const Ray& ray, uint32_t rayFlags) const;
+
+    // Occluded() for a batch of rays, such as the shadow rays of a tile towards one light, setting occluded[i] for rays[i]. Traces the
+    // rays one by one unless overridden.
+    virtual void OccludedBatch(std::span<const Ray> rays, uint32_t rayFlags, bool* occluded) const;
+
+    virtual const char* Name() const = 0;
+};
+
+// Tests every ray against every triangle of the scene. Slow, but trivially correct, which makes it the reference for all other intersectors.
+class BruteForceIntersector : public Intersector
+{
+public:
+    explicit BruteForceIntersector(const Scene& scene) : m_scene(scene) {}
+
+    bool Intersect(const Ray& ray, uint32_t rayFlags, Hit& hit) const override;
+    const char* Name() const override { return "brute force"; }
+
+private:
+    const Scene& m_scene;
+};
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "HlslMath.h"
+
+// CPU versions of the BRDF terms in shaders/Materials.hlsl, keep both in sync
+namespace CpuRT {
+constexpr float PI = 3.14159265359f;
+
+inline float3 fresnelSchlick(float cosTheta, const float3& F0) {
+    return F0 + (make_float3(1.0f) - F0) * std::pow(std::clamp(1.0f - cosTheta, 0.0f, 1.0f), 5.0f);
+}
+
+inline float DistributionGGX(const float3& N, const float3& H, float roughness) {
+    float a         = roughness * roughness;
+    float a2        = a * a;
+    float NdotH     = (std::max)(dot(N, H), 0.0f);
+    float NdotH2    = NdotH * NdotH;
+
+    float num   = a2;
+    float denom = (NdotH2 * (a2 - 1.0f) + 1.0f);
+    denom       = PI * denom * denom;
+    return num / denom;
+}
+
+inline float GeometrySchlickGGX(float NdotV, float roughness) {
+    float r     = (roughness + 1.0f);
+    float k     = (r * r) / 8.0f;
+    float num   = NdotV;
+    float denom = NdotV * (1.0f - k) + k;
+    return num / denom;
+}
+
+inline float GeometrySmith(const float3& N, const float3& V, const float3& L, float roughness) {
+    float NdotV = (std::max)(dot(N, V), 0.0f);
+    float NdotL = (std::max)(dot(N, L), 0.0f);
+    float ggx2  = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1  = GeometrySchlickGGX(NdotL, roughness);
+    return ggx1 * ggx2;
+}
+}
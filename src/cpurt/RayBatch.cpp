@@ -0,0 +1,137 @@
+#include "RayBatch.h"
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+using namespace CpuRT;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+}
+
+RayBatch::RayBatch(std::span<const Ray> rays) :
+    m_rays(rays.begin(), rays.end()),
+    m_order(rays.size())
+{
+    for (size_t i = 0ULL; i < m_order.size(); i++)
+    {
+        m_order[i] = static_cast<uint32_t>(i);
+    }
+}
+
+void RayBatch::Add(const Ray& ray)
+{
+    m_order.push_back(static_cast<uint32_t>(m_rays.size()));
+    m_rays.push_back(ray);
+}
+
+double RayBatch::Sort()
+{
+    Clock::time_point start = Clock::now();
+
+    float3 lower = make_float3(FLT_MAX);
+    float3 upper = make_float3(-FLT_MAX);
+    for (const Ray& ray : m_rays)
+    {
+        lower = min3(lower, ray.origin);
+        upper = max3(upper, ray.origin);
+    }
+
+    // The key's upper bits hold the direction octant, followed by the origin's Morton code and the ray's position in the batch, so
+    // sorting the keys sorts the rays
+    const float cells       = static_cast<float>(1u << MortonBitsPerAxis);
+    const float3 extent     = upper - lower;
+    const float3 scale      = { extent.x > 0.0f ? cells / extent.x : 0.0f, extent.y > 0.0f ? cells / extent.y : 0.0f, extent.z > 0.0f ? cells / extent.z : 0.0f };
+    const int numRays       = static_cast<int>(m_rays.size());
+    std::vector<uint64_t> keys(m_rays.size());
+    #pragma omp parallel for
+    for (int i = 0; i < numRays; i++)
+    {
+        const Ray& ray          = m_rays[i];
+        const float3 cell       = (ray.origin - lower) * scale;
+        const uint32_t maxCell  = (1u << MortonBitsPerAxis) - 1;
+        const uint32_t morton   = MortonCode((std::min)(static_cast<uint32_t>(cell.x), maxCell), (std::min)(static_cast<uint32_t>(cell.y), maxCell),
+                                             (std::min)(static_cast<uint32_t>(cell.z), maxCell));
+        const uint32_t octant   = (ray.direction.x < 0.0f ? 4u : 0u) | (ray.direction.y < 0.0f ? 2u : 0u) | (ray.direction.z < 0.0f ? 1u : 0u);
+        keys[i]                 = (static_cast<uint64_t>((octant << (3 * MortonBitsPerAxis)) | morton) << 32) | static_cast<uint32_t>(i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<Ray> rays(m_rays.size());
+    std::vector<uint32_t> order(m_order.size());
+    for (size_t i = 0ULL; i < keys.size(); i++)
+    {
+        const uint32_t previousIndex    = static_cast<uint32_t>(keys[i]);
+        rays[i]                         = m_rays[previousIndex];
+        order[i]                        = m_order[previousIndex];
+    }
+    m_rays  = std::move(rays);
+    m_order = std::move(order);
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+RayBatch::Stats RayBatch::Intersect(const Intersector& intersector, uint32_t rayFlags)
+{
+    m_hitFlags.assign(m_rays.size(), 0);
+    m_hits.resize(m_rays.size());
+    Clock::time_point start = Clock::now();
+
+    const int numChunks = static_cast<int>((m_rays.size() + ChunkSize - 1) / ChunkSize);
+    uint64_t hits       = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+: hits)
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        const size_t end = (std::min)(static_cast<size_t>(chunk + 1) * ChunkSize, m_rays.size());
+        for (size_t first = static_cast<size_t>(chunk) * ChunkSize; first < end; first += Intersector::PacketSize)
+        {
+            const uint32_t count = static_cast<uint32_t>((std::min)(end - first, static_cast<size_t>(Intersector::PacketSize)));
+            Hit packetHits[Intersector::PacketSize];
+            const uint32_t hitMask = intersector.IntersectPacket(m_rays.data() + first, count, rayFlags, packetHits);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                if (hitMask & (1u << i))
+                {
+                    m_hitFlags[m_order[first + i]]  = 1;
+                    m_hits[m_order[first + i]]      = packetHits[i];
+                    hits++;
+                }
+            }
+        }
+    }
+
+    Stats stats;
+    stats.seconds   = std::chrono::duration<double>(Clock::now() - start).count();
+    stats.rays      = m_rays.size();
+    stats.hits      = hits;
+    return stats;
+}
+
+RayBatch::Stats RayBatch::Occluded(const Intersector& intersector, uint32_t rayFlags)
+{
+    m_hitFlags.assign(m_rays.size(), 0);
+    Clock::time_point start = Clock::now();
+
+    const int numChunks = static_cast<int>((m_rays.size() + ChunkSize - 1) / ChunkSize);
+    uint64_t hits       = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+: hits)
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        const size_t first = static_cast<size_t>(chunk) * ChunkSize;
+        const size_t count = (std::min)(m_rays.size() - first, static_cast<size_t>(ChunkSize));
+        bool occluded[ChunkSize];
+        intersector.OccludedBatch(std::span<const Ray>(m_rays.data() + first, count), rayFlags, occluded);
+        for (size_t i = 0ULL; i < count; i++)
+        {
+            m_hitFlags[m_order[first + i]] = occluded[i] ? 1 : 0;
+            hits += occluded[i] ? 1 : 0;
+        }
+    }
+
+    Stats stats;
+    stats.seconds   = std::chrono::duration<double>(Clock::now() - start).count();
+    stats.rays      = m_rays.size();
+    stats.hits      = hits;
+    return stats;
+}
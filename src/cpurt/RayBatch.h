@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Intersector.h"
+
+#include <span>
+#include <vector>
+
+namespace CpuRT {
+// Rays traced together through an Intersector, in chunks of ChunkSize consecutive rays handed out to all threads. Secondary rays are
+// incoherent, so the batch can be reordered first: rays are binned by direction octant, and sorted along a Morton curve through the
+// bounds of their origins within each octant. Rays traced one after the other (and in the same packets) then start close to each other
+// and head the same way, so they visit the same nodes. Results are reported in the order the rays were added either way.
+class RayBatch
+{
+public:
+    struct Stats
+    {
+        uint64_t rays   = 0;
+        uint64_t hits   = 0;
+        double seconds  = 0.0;
+
+        double HitRate() const { return rays > 0 ? static_cast<double>(hits) / rays : 0.0; }
+        double MraysPerSecond() const { return seconds > 0.0 ? rays / seconds * 1e-6 : 0.0; }
+    };
+
+    static constexpr uint32_t ChunkSize = 256;
+
+    RayBatch() = default;
+    explicit RayBatch(std::span<const Ray> rays);
+
+    void Add(const Ray& ray);
+    size_t Size() const { return m_rays.size(); }
+
+    // Reorders the rays by direction octant and origin Morton code, returns the time taken in seconds
+    double Sort();
+
+    // Finds the closest hits of all rays (or any hits with RayFlagAcceptFirstHitAndEndSearch) with Intersector::IntersectPacket()
+    Stats Intersect(const Intersector& intersector, uint32_t rayFlags);
+    // Finds out which rays hit anything at all with Intersector::OccludedBatch()
+    Stats Occluded(const Intersector& intersector, uint32_t rayFlags);
+
+    // Results of the last Intersect() or Occluded() call for the i-th ray added. Hits are only written by Intersect().
+    bool IsHit(size_t i) const { return m_hitFlags[i] != 0; }
+    const Hit& GetHit(size_t i) const { return m_hits[i]; }
+
+private:
+    std::vector<Ray>        m_rays;
+    std::vector<uint32_t>   m_order;        // Index every ray was added with
+    std::vector<uint8_t>    m_hitFlags;
+    std::vector<Hit>        m_hits;
+};
+}
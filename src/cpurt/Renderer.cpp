@@ -0,0 +1,333 @@
+#include "Renderer.h"
+#include "Materials.h"
+
+#include <chrono>
+#include <cmath>
+
+using namespace CpuRT;
+
+namespace {
+const float3 Background     = { 0.0f, 0.2f, 0.4f };
+const float3 Ambient        = { 0.1f, 0.1f, 0.1f };
+
+// Retrieve attribute at a hit position interpolated from vertex attributes using the hit's barycentrics.
+float3 HitAttribute(const float3 vertexAttribute[3], const float2& barycentrics) {
+    return vertexAttribute[0] +
+        barycentrics.x * (vertexAttribute[1] - vertexAttribute[0]) +
+        barycentrics.y * (vertexAttribute[2] - vertexAttribute[0]);
+}
+
+// Generate a ray in world space for a camera pixel, the projection matrix is applied to row vectors as the shaders are compiled with /Zpr.
+void GenerateCameraRay(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const float projectionToWorld[4][4], const float3& cameraPosition,
+                       float3& origin, float3& direction) {
+    float2 xy           = { x + 0.5f, y + 0.5f }; // center in the middle of the pixel.
+    float2 screenPos    = { xy.x / width * 2.0f - 1.0f, xy.y / height * 2.0f - 1.0f };
+
+    // Invert Y for DirectX-style coordinates.
+    screenPos.y = -screenPos.y;
+
+    // Unproject the pixel coordinate into a ray.
+    float world[4];
+    for (int j = 0; j < 4; j++) {
+        world[j] = screenPos.x * projectionToWorld[0][j] + screenPos.y * projectionToWorld[1][j] + projectionToWorld[3][j];
+    }
+
+    origin      = cameraPosition;
+    direction   = normalize(float3{ world[0] / world[3], world[1] / world[3], world[2] / world[3] } - origin);
+}
+
+float3 LightingPBR(const float3& hitPosition, const float3& cameraDirection, const float3& normal,
+                   const MaterialPBR& material, const float3& F0,
+                   const float3& lightSamplePosition, const float3& lightSampleColor) {
+    // Unit vectors used throughout the method
+    float3 L = normalize(lightSamplePosition - hitPosition);
+    float3 H = normalize(cameraDirection + L);
+
+    // Radiance and geometry terms
+    float distance      = length(lightSamplePosition - hitPosition);
+    float attenuation   = 1.0f / (distance * distance);
+    float3 radiance     = lightSampleColor * attenuation;
+
+    // Cook-Torrence BRDF
+    float NDF   = DistributionGGX(normal, H, material.roughness);
+    float G     = GeometrySmith(normal, cameraDirection, L, material.roughness);
+    float3 F    = fresnelSchlick((std::max)(dot(H, cameraDirection), 0.0f), F0);
+
+    // Diffuse
+    float3 kS   = F;
+    float3 kD   = make_float3(1.0f) - kS;
+    kD          *= 1.0f - material.metallic;
+
+    // Specular
+    float3 numerator    = NDF * G * F;
+    float denominator   = 4.0f * (std::max)(dot(normal, cameraDirection), 0.0f) * (std::max)(dot(normal, L), 0.0f) + 0.0001f;
+    float3 specular     = numerator / denominator;
+
+    // Compute outgoing irradiance
+    float NdotL = (std::max)(dot(normal, L), 0.0f);
+    return (kD * make_float3(material.albedo) / PI + specular) * radiance * NdotL;
+}
+}
+
+Renderer::Renderer(const Scene& scene, const Intersector& intersector, std::vector<PointLight> pointLights) :
+    m_scene(scene),
+    m_intersector(intersector),
+    m_pointLights(std::move(pointLights))
+{
+}
+
+View View::Default()
+{
+    // Looking down at the origin, then orbited by 45 degrees around the Y axis like XMMatrixRotationY() does, except for the target
+    const float angle       = PI / 4.0f;
+    auto rotateY            = [angle](const float3& v) -> float3 {
+        return { v.x * std::cos(angle) + v.z * std::sin(angle), v.y, v.z * std::cos(angle) - v.x * std::sin(angle) };
+    };
+    const float3 eye        = { 0.0f, 1.5f, -4.0f };
+    const float3 at         = { 0.0f, 0.8f, 0.0f };
+    const float3 right      = { 1.0f, 0.0f, 0.0f };
+    const float3 up         = normalize(cross(normalize(at - eye), right));
+
+    View view;
+    view.eye                        = rotateY(eye);
+    view.at                         = at;
+    view.up                         = rotateY(up);
+    view.fovAngleY                  = PI / 4.0f;
+    view.nearZ                      = 1.0f;
+    view.farZ                       = 125.0f;
+    view.defaultMaterial.albedo     = XMFLOAT3(1.0f, 1.0f, 1.0f);
+    view.defaultMaterial.metallic   = 0.1f;
+    view.defaultMaterial.roughness  = 0.8f;
+    return view;
+}
+
+Renderer::Constants Renderer::Constants::LookAt(const View& view, float aspectRatio)
+{
+    // The inverse of the view matrix has the camera's axes and position as its rows
+    const float3 zAxis              = normalize(view.at - view.eye);
+    const float3 xAxis              = normalize(cross(view.up, zAxis));
+    const float3 yAxis              = cross(zAxis, xAxis);
+    const float viewToWorld[4][4]   = {
+        { xAxis.x, xAxis.y, xAxis.z, 0.0f },
+        { yAxis.x, yAxis.y, yAxis.z, 0.0f },
+        { zAxis.x, zAxis.y, zAxis.z, 0.0f },
+        { view.eye.x, view.eye.y, view.eye.z, 1.0f }
+    };
+
+    // The inverse of the projection only has to undo the scaling of x and y and the mapping of the view space depth
+    const float height                  = 1.0f / std::tan(0.5f * view.fovAngleY);
+    const float range                   = view.farZ / (view.farZ - view.nearZ);
+    const float projectionToView[4][4]  = {
+        { aspectRatio / height, 0.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f / height, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 0.0f, -1.0f / (range * view.nearZ) },
+        { 0.0f, 0.0f, 1.0f, 1.0f / view.nearZ }
+    };
+
+    Constants constants = {};
+    for (int row = 0; row < 4; row++)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                constants.projectionToWorld[row][column] += projectionToView[row][i] * viewToWorld[i][column];
+            }
+        }
+    }
+    constants.cameraPosition    = view.eye;
+    constants.defaultMaterial   = view.defaultMaterial;
+    return constants;
+}
+
+Renderer::Stats Renderer::Render(const Constants& constants, Image& image) const
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    // Tiles are handed out dynamically as their cost varies a lot with the geometry they cover
+    const uint32_t width        = image.Width();
+    const uint32_t height       = image.Height();
+    const uint32_t tilesX       = (width + TileSize - 1) / TileSize;
+    const uint32_t tilesY       = (height + TileSize - 1) / TileSize;
+    const int numTiles          = static_cast<int>(tilesX * tilesY);
+    uint64_t primaryRays        = 0;
+    uint64_t shadowRays         = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+: primaryRays, shadowRays)
+    for (int tile = 0; tile < numTiles; tile++)
+    {
+        const uint32_t x0 = (tile % tilesX) * TileSize;
+        const uint32_t y0 = (tile / tilesX) * TileSize;
+        RayCounts rayCounts;
+        std::vector<ShadingPoint> shadingPoints;
+        shadingPoints.reserve(TileSize * TileSize);
+        for (uint32_t y = y0; y < (std::min)(y0 + TileSize, height); y += PacketHeight)
+        {
+            for (uint32_t x = x0; x < (std::min)(x0 + TileSize, width); x += PacketWidth)
+            {
+                RayGen(x, y, constants, image, shadingPoints, rayCounts);
+            }
+        }
+        CalculateLighting(shadingPoints, rayCounts);
+        for (const ShadingPoint& shadingPoint : shadingPoints)
+        {
+            image.At(shadingPoint.x, shadingPoint.y) = shadingPoint.color + Ambient; // Add a constant ambient term
+        }
+        primaryRays += rayCounts.primary;
+        shadowRays  += rayCounts.shadow;
+    }
+
+    Stats stats;
+    stats.seconds       = std::chrono::duration<double>(Clock::now() - start).count();
+    stats.primaryRays   = primaryRays;
+    stats.shadowRays    = shadowRays;
+    stats.tiles         = static_cast<uint32_t>(numTiles);
+    return stats;
+}
+
+void Renderer::GenerateSecondaryRays(const Constants& constants, uint32_t width, uint32_t height, std::vector<Ray>& shadowRays, std::vector<Ray>& reflectionRays) const
+{
+    std::vector<std::vector<Ray>> rowShadowRays(height);
+    std::vector<std::vector<Ray>> rowReflectionRays(height);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int y = 0; y < static_cast<int>(height); y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            Ray ray;
+            GenerateCameraRay(x, static_cast<uint32_t>(y), width, height, constants.projectionToWorld, constants.cameraPosition, ray.origin, ray.direction);
+            ray.tMin = 0.001f;
+            ray.tMax = 10000.0f;
+            Hit hit;
+            if (!m_intersector.Intersect(ray, RayFlagCullBackFacingTriangles, hit))
+            {
+                continue;
+            }
+
+            const ShadingPoint shadingPoint = ClosestHit(ray, hit, constants);
+            for (const PointLight& pointLight : m_pointLights)
+            {
+                rowShadowRays[y].push_back({ shadingPoint.hitPosition, 0.001f, make_float3(pointLight.position) - shadingPoint.hitPosition, 1.0f });
+            }
+            rowReflectionRays[y].push_back({ shadingPoint.hitPosition, 0.001f, reflect(ray.direction, shadingPoint.normal), 10000.0f });
+        }
+    }
+
+    shadowRays.clear();
+    reflectionRays.clear();
+    for (uint32_t y = 0; y < height; y++)
+    {
+        shadowRays.insert(shadowRays.end(), rowShadowRays[y].begin(), rowShadowRays[y].end());
+        reflectionRays.insert(reflectionRays.end(), rowReflectionRays[y].begin(), rowReflectionRays[y].end());
+    }
+}
+
+// MyRaygenShader for the pixels of a PacketWidth x PacketHeight block within the image, whose primary rays are traced as a packet. Misses
+// are written to the image, while hits are appended to shadingPoints to be lit along with the rest of the tile.
+void Renderer::RayGen(uint32_t x0, uint32_t y0, const Constants& constants, Image& image, std::vector<ShadingPoint>& shadingPoints, RayCounts& rayCounts) const
+{
+    // Generate a ray for every camera pixel corresponding to an index from the dispatched 2D grid.
+    const uint32_t width    = image.Width();
+    const uint32_t height   = image.Height();
+    // Packets at the edges of the image are partial, the unused rays are value initialized so the packet can be loaded as a whole
+    Ray rays[Intersector::PacketSize] = {};
+    uint32_t pixels[Intersector::PacketSize][2];
+    uint32_t count = 0;
+    for (uint32_t y = y0; y < (std::min)(y0 + PacketHeight, height); y++)
+    {
+        for (uint32_t x = x0; x < (std::min)(x0 + PacketWidth, width); x++)
+        {
+            Ray& ray = rays[count];
+            GenerateCameraRay(x, y, width, height, constants.projectionToWorld, constants.cameraPosition, ray.origin, ray.direction);
+            ray.tMin            = 0.001f;
+            ray.tMax            = 10000.0f;
+            pixels[count][0]    = x;
+            pixels[count][1]    = y;
+            count++;
+        }
+    }
+
+    rayCounts.primary += count;
+    Hit hits[Intersector::PacketSize] = {};
+    const uint32_t hitMask = m_intersector.IntersectPacket(rays, count, RayFlagCullBackFacingTriangles, hits);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!(hitMask & (1u << i)))
+        {
+            image.At(pixels[i][0], pixels[i][1]) = Background; // MyMissShader
+            continue;
+        }
+        shadingPoints.push_back(ClosestHit(rays[i], hits[i], constants));
+        shadingPoints.back().x = pixels[i][0];
+        shadingPoints.back().y = pixels[i][1];
+    }
+}
+
+// MyClosestHitShader for non-shadow rays, up to the lighting calculation
+Renderer::ShadingPoint Renderer::ClosestHit(const Ray& ray, const Hit& hit, const Constants& constants) const
+{
+    const LoadScene::LoadedObj& loadedObj   = m_scene.GetLoadedObj();
+    std::span<const Index> indices          = loadedObj.object_indices(hit.instanceID);
+    std::span<const Vertex> vertices        = loadedObj.object_vertices(hit.instanceID);
+    std::span<const Index> materialIndices  = loadedObj.object_material_indices(hit.instanceID);
+
+    // Load the corresponding material for the triangle (or the default material if this triangle does not have one).
+    const MaterialIndex materialIndex   = static_cast<MaterialIndex>(materialIndices[hit.primitiveIndex]);
+    const MaterialPBR& triangleMaterial = materialIndex == -1 ? constants.defaultMaterial : loadedObj.material_data()[materialIndex];
+
+    // Retrieve corresponding vertex normals for the triangle vertices.
+    const size_t baseIndex = 3ULL * hit.primitiveIndex;
+    float3 vertexNormals[3] = {
+        make_float3(vertices[indices[baseIndex + 0]].normal),
+        make_float3(vertices[indices[baseIndex + 1]].normal),
+        make_float3(vertices[indices[baseIndex + 2]].normal)
+    };
+
+    // Compute the triangle's normal, and bring it from object to world space with the inverse transpose of the instance's transform.
+    ShadingPoint shadingPoint;
+    shadingPoint.normal             = normalize(mul3x3(HitAttribute(vertexNormals, hit.barycentrics), m_scene.Instances()[hit.instanceIndex].worldToObject));
+    shadingPoint.hitPosition        = ray.origin + hit.t * ray.direction;
+    shadingPoint.cameraDirection    = -ray.direction;
+    shadingPoint.material           = &triangleMaterial;
+    return shadingPoint;
+}
+
+// Full lighting calculation for the shading points of a tile. Their shadow rays towards each light are traced as one batch, and
+// contributions are accumulated in the same order as by the shader.
+void Renderer::CalculateLighting(std::span<ShadingPoint> shadingPoints, RayCounts& rayCounts) const
+{
+    // Constants given the material
+    for (ShadingPoint& shadingPoint : shadingPoints)
+    {
+        shadingPoint.F0     = lerp(make_float3(0.04f), make_float3(shadingPoint.material->albedo), shadingPoint.material->metallic);
+        shadingPoint.color  = make_float3(0.0f);
+    }
+
+    Ray shadowRays[TileSize * TileSize];
+    bool occluded[TileSize * TileSize];
+    const size_t count = shadingPoints.size();
+    for (const PointLight& pointLight : m_pointLights)
+    {
+        // Trace the shadow rays and skip this light's contribution to the points it's obscured from
+        for (size_t i = 0ULL; i < count; i++)
+        {
+            shadowRays[i].origin    = shadingPoints[i].hitPosition;
+            shadowRays[i].direction = make_float3(pointLight.position) - shadingPoints[i].hitPosition;
+            shadowRays[i].tMin      = 0.001f;
+            shadowRays[i].tMax      = 1.0f;
+        }
+        rayCounts.shadow += count;
+        m_intersector.OccludedBatch(std::span<const Ray>(shadowRays, count), RayFlagAcceptFirstHitAndEndSearch, occluded);
+
+        // Compute contribution from this light
+        for (size_t i = 0ULL; i < count; i++)
+        {
+            if (!occluded[i])
+            {
+                ShadingPoint& shadingPoint = shadingPoints[i];
+                shadingPoint.color += LightingPBR(shadingPoint.hitPosition, shadingPoint.cameraDirection, shadingPoint.normal, *shadingPoint.material, shadingPoint.F0,
+                                                  make_float3(pointLight.position), make_float3(pointLight.color));
+            }
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Image.h"
+#include "Intersector.h"
+
+#include <span>
+#include <vector>
+
+namespace CpuRT {
+// Camera and default material of the sample's first frame, shared by D3D12RaytracingSimpleLighting::InitializeScene() and the CPU tools so
+// they render the same view. The camera is left handed like XMMatrixLookAtLH and XMMatrixPerspectiveFovLH.
+struct View
+{
+    float3 eye;
+    float3 at;
+    float3 up;
+    float fovAngleY;    // In radians
+    float nearZ;
+    float farZ;
+    MaterialPBR defaultMaterial;
+
+    static View Default();
+};
+
+// CPU port of shaders/Raytracing.hlsl: MyRaygenShader, MyClosestHitShader, and MyMissShader evaluated for every pixel with the same
+// camera, shadow rays, and lighting, so images rendered without a GPU can serve as a reference. Changes to the shaders need to be
+// mirrored here.
+// The image is split into TileSize x TileSize tiles which are rendered in parallel. The primary rays of every PacketWidth x PacketHeight
+// block of pixels are traced as a packet. Once all primary rays of a tile have been traced, its shadow rays are traced in one batch per
+// light, so consecutive shadow rays start next to each other and end at the same point.
+class Renderer
+{
+public:
+    struct Stats
+    {
+        double seconds          = 0.0;
+        uint64_t primaryRays    = 0;
+        uint64_t shadowRays     = 0;
+        uint32_t tiles          = 0;
+    };
+
+    static constexpr uint32_t TileSize       = 16;
+    static constexpr uint32_t PacketWidth    = 4;
+    static constexpr uint32_t PacketHeight   = 2;
+    static_assert(PacketWidth * PacketHeight <= Intersector::PacketSize && TileSize % PacketWidth == 0 && TileSize % PacketHeight == 0);
+
+    // SceneConstantBuffer in a form that is convenient to use on the CPU, and that does not depend on DirectXMath's SIMD types
+    struct Constants
+    {
+        float projectionToWorld[4][4];  // Row major and applied to row vectors, like XMMATRIX
+        float3 cameraPosition;
+        MaterialPBR defaultMaterial;
+
+        // Camera of XMMatrixLookAtLH(eye, at, up) * XMMatrixPerspectiveFovLH(fovAngleY, aspectRatio, nearZ, farZ), for callers without DirectXMath
+        static Constants LookAt(const View& view, float aspectRatio);
+    };
+
+    Renderer(const Scene& scene, const Intersector& intersector, std::vector<PointLight> pointLights);
+
+    // Renders the whole image, like DispatchRays with the image's dimensions
+    Stats Render(const Constants& constants, Image& image) const;
+
+    // Secondary rays of every pixel whose primary ray hits something, in scanline order: one shadow ray per light as traced by Render(),
+    // and a mirror reflection ray. Used to measure how incoherent rays are traced.
+    void GenerateSecondaryRays(const Constants& constants, uint32_t width, uint32_t height, std::vector<Ray>& shadowRays, std::vector<Ray>& reflectionRays) const;
+
+private:
+
+    struct RayCounts
+    {
+        uint64_t primary    = 0;
+        uint64_t shadow     = 0;
+    };
+
+    // A pixel whose primary ray hit something, with the inputs of its lighting calculation
+    struct ShadingPoint
+    {
+        uint32_t x, y;
+        float3 hitPosition;
+        float3 cameraDirection;
+        float3 normal;
+        const MaterialPBR* material;
+        float3 F0;
+        float3 color;
+    };
+
+    void RayGen(uint32_t x0, uint32_t y0, const Constants& constants, Image& image, std::vector<ShadingPoint>& shadingPoints, RayCounts& rayCounts) const;
+    ShadingPoint ClosestHit(const Ray& ray, const Hit& hit, const Constants& constants) const;
+    void CalculateLighting(std::span<ShadingPoint> shadingPoints, RayCounts& rayCounts) const;
+
+    const Scene&            m_scene;
+    const Intersector&      m_intersector;
+    std::vector<PointLight> m_pointLights;
+};
+}
@@ -0,0 +1,95 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace CpuRT;
+
+bool CpuRT::IntersectTriangle(const Ray& ray, const Triangle& triangle, uint32_t rayFlags, float& t, float2& barycentrics)
+{
+    // Moeller-Trumbore, the determinant is positive for front facing (clockwise) triangles
+    float3 e1   = triangle.v1 - triangle.v0;
+    float3 e2   = triangle.v2 - triangle.v0;
+    float3 p    = cross(ray.direction, e2);
+    float det   = dot(e1, p);
+    if ((rayFlags & RayFlagCullBackFacingTriangles) ? det <= 0.0f : det == 0.0f)
+    {
+        return false;
+    }
+
+    float inverseDet    = 1.0f / det;
+    float3 s            = ray.origin - triangle.v0;
+    float u             = dot(s, p) * inverseDet;
+    if (u < 0.0f || u > 1.0f)
+    {
+        return false;
+    }
+    float3 q    = cross(s, e1);
+    float v     = dot(ray.direction, q) * inverseDet;
+    if (v < 0.0f || u + v > 1.0f)
+    {
+        return false;
+    }
+    float distance = dot(e2, q) * inverseDet;
+    if (distance < ray.tMin || distance > ray.tMax)
+    {
+        return false;
+    }
+
+    t               = distance;
+    barycentrics    = { u, v };
+    return true;
+}
+
+Scene::Scene(const LoadScene::LoadedObj& loadedObj) :
+    m_loadedObj(loadedObj),
+    m_objectFirstTriangle(loadedObj.object_count() + 1, 0)
+{
+    const int numObjects = static_cast<int>(loadedObj.object_count());
+    for (int i = 0; i < numObjects; i++)
+    {
+        m_objectFirstTriangle[i + 1] = m_objectFirstTriangle[i] + static_cast<uint32_t>(loadedObj.object_indices(i).size() / 3);
+    }
+    m_triangles.resize(m_objectFirstTriangle.back());
+
+    // Triangles stay in object space, where rays are intersected with them after being transformed by their instance
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numObjects; i++)
+    {
+        SetObjectVertices(i, loadedObj.object_vertices(i));
+    }
+
+    for (const LoadScene::ObjectInstance& objectInstance : loadedObj.object_instances())
+    {
+        Instance instance;
+        memcpy(instance.objectToWorld.m, objectInstance.transform.m, sizeof(instance.objectToWorld.m));
+        instance.worldToObject  = inverse(instance.objectToWorld);
+        instance.instanceID     = objectInstance.object;
+        m_instances.push_back(instance);
+    }
+}
+
+std::span<const Triangle> Scene::ObjectTriangles(size_t object) const
+{
+    return std::span<const Triangle>(m_triangles).subspan(m_objectFirstTriangle[object], m_objectFirstTriangle[object + 1] - m_objectFirstTriangle[object]);
+}
+
+// Object whose triangles in Triangles() include the given one
+size_t Scene::ObjectOfTriangle(uint32_t triangle) const
+{
+    return std::upper_bound(m_objectFirstTriangle.begin(), m_objectFirstTriangle.end(), triangle) - m_objectFirstTriangle.begin() - 1;
+}
+
+void Scene::SetObjectVertices(size_t object, std::span<const Vertex> vertices)
+{
+    std::span<const Index> indices  = m_loadedObj.object_indices(object);
+    Triangle* triangles             = m_triangles.data() + m_objectFirstTriangle[object];
+    for (size_t j = 0ULL; j < indices.size() / 3; j++)
+    {
+        triangles[j] = {
+            make_float3(vertices[indices[3 * j + 0]].position),
+            make_float3(vertices[indices[3 * j + 1]].position),
+            make_float3(vertices[indices[3 * j + 2]].position)
+        };
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "HlslMath.h"
+#include "../utils/LoadScene.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace CpuRT {
+// Subset of D3D12_RAY_FLAGS honoured by the CPU intersectors, with the same values
+enum RayFlags : uint32_t {
+    RayFlagNone                         = 0x00,
+    RayFlagAcceptFirstHitAndEndSearch   = 0x04,
+    RayFlagCullBackFacingTriangles      = 0x10
+};
+
+// Same semantics as RayDesc: hits are reported for origin + t * direction with t in [tMin, tMax]
+struct Ray
+{
+    float3 origin;
+    float tMin;
+    float3 direction;
+    float tMax;
+};
+
+struct Hit
+{
+    float t;
+    float2 barycentrics;        // Weights of the triangle's second and third vertex, like BuiltInTriangleIntersectionAttributes
+    uint32_t instanceIndex;     // Like InstanceIndex(), the index into Scene::Instances()
+    uint32_t instanceID;        // Like InstanceID(), which is the object index
+    uint32_t primitiveIndex;    // Like PrimitiveIndex(), the triangle index within the object
+};
+
+struct Triangle
+{
+    float3 v0, v1, v2;
+};
+
+// An object placed in the scene, built from the same LoadScene::ObjectInstance as the TLAS instance descs
+struct Instance
+{
+    float3x4 objectToWorld;     // Like ObjectToWorld3x4()
+    float3x4 worldToObject;     // Like WorldToObject3x4()
+    uint32_t instanceID;        // Like InstanceID(), which is the object index
+};
+
+// Ray in the object space of an instance. Directions are not normalized, so distances along the ray are the same in both spaces.
+inline Ray ObjectRay(const Ray& worldRay, const Instance& instance)
+{
+    return { transformPoint(instance.worldToObject, worldRay.origin), worldRay.tMin, transformVector(instance.worldToObject, worldRay.direction), worldRay.tMax };
+}
+
+// Ray/triangle test following the DXR conventions: triangles are front facing if their vertices appear clockwise from the ray origin,
+// and back facing triangles are skipped with RayFlagCullBackFacingTriangles. Returns the hit distance and barycentrics on success.
+bool IntersectTriangle(const Ray& ray, const Triangle& triangle, uint32_t rayFlags, float& t, float2& barycentrics);
+
+// Object space triangles of every object in a LoadedObj and the instances placing them in the world, which the intersectors trace
+// against. Shading attributes (normals and material indices) are read from the LoadedObj itself, which therefore has to outlive the scene.
+class Scene
+{
+public:
+    explicit Scene(const LoadScene::LoadedObj& loadedObj);
+
+    size_t ObjectCount() const { return m_objectFirstTriangle.size() - 1; }
+    size_t TriangleCount() const { return m_triangles.size(); }
+
+    // Triangles of all objects are stored back to back, an object's triangles are indexed by PrimitiveIndex()
+    std::span<const Triangle> Triangles() const { return m_triangles; }
+    std::span<const Triangle> ObjectTriangles(size_t object) const;
+    uint32_t ObjectFirstTriangle(size_t object) const { return m_objectFirstTriangle[object]; }
+    size_t ObjectOfTriangle(uint32_t triangle) const;
+
+    // Moves the vertices of an object, which keeps its triangles as the indices don't change. Intersectors have to be refitted afterwards.
+    void SetObjectVertices(size_t object, std::span<const Vertex> vertices);
+
+    std::span<const Instance> Instances() const { return m_instances; }
+
+    const LoadScene::LoadedObj& GetLoadedObj() const { return m_loadedObj; }
+
+private:
+    const LoadScene::LoadedObj& m_loadedObj;
+    std::vector<Instance>       m_instances;
+    std::vector<Triangle>       m_triangles;
+    std::vector<uint32_t>       m_objectFirstTriangle;  // One entry per object plus the total number of triangles
+};
+}
@@ -0,0 +1,181 @@
+#include "Tools.h"
+#include "Bvh8.h"
+#include "Materials.h"
+#include "RayBatch.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace CpuRT;
+
+namespace {
+void PrintBvhStats(const char* level, const Bvh::BuildStats& stats) {
+    std::cout << "    " << level << " built in " << stats.seconds << " s: " << stats.nodes << " nodes, " << stats.leaves << " leaves with "
+              << stats.averageLeafSize << " primitives on average, depth " << stats.maxDepth << ", SAH cost " << stats.sahCost << "\n";
+}
+
+void PrintBvh8Stats(const char* level, const Bvh8::BuildStats& stats) {
+    std::cout << "    " << level << " collapsed in " << stats.seconds << " s: " << stats.nodes << " nodes with " << stats.averageChildCount
+              << " children on average, " << stats.leaves << " leaves with " << stats.averageLeafSize << " primitives on average\n";
+}
+}
+
+std::unique_ptr<Intersector> CpuRT::MakeIntersector(const Scene& scene)
+{
+    if (Bvh8Intersector::IsSupported())
+    {
+        return std::make_unique<Bvh8Intersector>(scene);
+    }
+    return std::make_unique<BvhIntersector>(scene);
+}
+
+bool CpuRT::RenderToFile(const LoadScene::LoadedObj& loadedObj, const std::string& sceneName, const Renderer::Constants& constants, uint32_t width,
+                         uint32_t height, const std::string& outputPath)
+{
+    Scene scene(loadedObj);
+    std::unique_ptr<Intersector> intersector = MakeIntersector(scene);
+    Renderer renderer(scene, *intersector, loadedObj.point_lights());
+    Image image(width, height);
+    Renderer::Stats stats = renderer.Render(constants, image);
+    if (!image.WritePPM(outputPath))
+    {
+        return false;
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "CPU render: " << sceneName << " (" << scene.TriangleCount() << " triangles, " << intersector->Name() << ")\n"
+              << "    " << scene.ObjectCount() << " objects, " << scene.Instances().size() << " instances\n";
+    if (const Bvh8Intersector* bvh8Intersector = dynamic_cast<const Bvh8Intersector*>(intersector.get()))
+    {
+        PrintBvhStats("Bottom level BVHs", bvh8Intersector->GetBottomLevelStats());
+        PrintBvh8Stats("Bottom level BVH8s", bvh8Intersector->GetBottomLevelBvh8Stats());
+        PrintBvhStats("Top level BVH", bvh8Intersector->GetTopLevelStats());
+        PrintBvh8Stats("Top level BVH8", bvh8Intersector->GetTopLevelBvh8Stats());
+    }
+    else if (const BvhIntersector* bvhIntersector = dynamic_cast<const BvhIntersector*>(intersector.get()))
+    {
+        PrintBvhStats("Bottom level BVHs", bvhIntersector->GetBottomLevelStats());
+        PrintBvhStats("Top level BVH", bvhIntersector->GetTopLevelStats());
+    }
+    std::cout << "    " << width << "x" << height << " in " << stats.tiles << " tiles, " << stats.seconds << " s, "
+              << stats.primaryRays << " primary and " << stats.shadowRays << " shadow rays, "
+              << (stats.primaryRays + stats.shadowRays) / stats.seconds * 1e-6 << " Mrays/s" << std::endl;
+    return true;
+}
+
+void CpuRT::DeformVertices(std::span<const Vertex> restVertices, float time, std::vector<Vertex>& vertices)
+{
+    XMFLOAT3 lower = { FLT_MAX, FLT_MAX, FLT_MAX };
+    XMFLOAT3 upper = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (const Vertex& vertex : restVertices)
+    {
+        lower = { (std::min)(lower.x, vertex.position.x), (std::min)(lower.y, vertex.position.y), (std::min)(lower.z, vertex.position.z) };
+        upper = { (std::max)(upper.x, vertex.position.x), (std::max)(upper.y, vertex.position.y), (std::max)(upper.z, vertex.position.z) };
+    }
+    const float centerX = 0.5f * (lower.x + upper.x);
+    const float centerZ = 0.5f * (lower.z + upper.z);
+    const float height  = (std::max)(upper.y - lower.y, FLT_MIN);
+
+    vertices.assign(restVertices.begin(), restVertices.end());
+    for (Vertex& vertex : vertices)
+    {
+        const float phase   = 2.0f * PI * 2.0f * (vertex.position.y - lower.y) / height - 3.0f * time;
+        const float squeeze = 1.0f - 0.25f * (1.0f + std::sin(phase));
+        vertex.position.x   = centerX + (vertex.position.x - centerX) * squeeze;
+        vertex.position.z   = centerZ + (vertex.position.z - centerZ) * squeeze;
+    }
+}
+
+void CpuRT::BenchmarkRaySorting(const LoadScene::LoadedObj& loadedObj, const std::string& sceneName, const Renderer::Constants& constants, uint32_t width,
+                                uint32_t height)
+{
+    Scene scene(loadedObj);
+    std::unique_ptr<Intersector> intersector = MakeIntersector(scene);
+    Renderer renderer(scene, *intersector, loadedObj.point_lights());
+    std::vector<Ray> shadowRays, reflectionRays;
+    renderer.GenerateSecondaryRays(constants, width, height, shadowRays, reflectionRays);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Ray sorting benchmark: " << sceneName << " (" << scene.TriangleCount() << " triangles, " << intersector->Name() << ")\n";
+    auto benchmark = [&](const char* name, const std::vector<Ray>& rays, bool occlusion) {
+        auto trace = [&](RayBatch& batch) {
+            return occlusion ? batch.Occluded(*intersector, RayFlagAcceptFirstHitAndEndSearch) : batch.Intersect(*intersector, RayFlagCullBackFacingTriangles);
+        };
+        RayBatch unsortedBatch(rays);
+        RayBatch sortedBatch(rays);
+        RayBatch::Stats unsorted    = trace(unsortedBatch);
+        double sortSeconds          = sortedBatch.Sort();
+        RayBatch::Stats sorted      = trace(sortedBatch);
+
+        bool identical = true;
+        for (size_t i = 0ULL; i < rays.size() && identical; i++)
+        {
+            identical = unsortedBatch.IsHit(i) == sortedBatch.IsHit(i) &&
+                        (occlusion || !unsortedBatch.IsHit(i) || memcmp(&unsortedBatch.GetHit(i), &sortedBatch.GetHit(i), sizeof(Hit)) == 0);
+        }
+        std::cout << "    " << name << ": " << rays.size() << " rays, " << 100.0 * unsorted.HitRate() << "% hit\n"
+                  << "        unsorted: " << unsorted.seconds << " s, " << unsorted.MraysPerSecond() << " Mrays/s\n"
+                  << "        sorted:   " << sorted.seconds << " s, " << sorted.MraysPerSecond() << " Mrays/s (" << unsorted.seconds / sorted.seconds << "x), "
+                  << "sorting took " << sortSeconds << " s, " << rays.size() / (sorted.seconds + sortSeconds) * 1e-6 << " Mrays/s including it\n"
+                  << "        results " << (identical ? "identical" : "DIFFER") << "\n";
+    };
+    benchmark("Shadow rays", shadowRays, true);
+    benchmark("Reflection rays", reflectionRays, false);
+    std::cout << std::flush;
+}
+
+void CpuRT::BenchmarkRefit(const LoadScene::LoadedObj& loadedObj, const std::string& sceneName, uint32_t frames)
+{
+    using Clock = std::chrono::steady_clock;
+    Scene scene(loadedObj);
+    std::unique_ptr<Intersector> intersector;
+    auto build = [&]() {
+        Clock::time_point start = Clock::now();
+        intersector             = MakeIntersector(scene);
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+    auto refit = [&](std::span<const uint32_t> objects) {
+        if (Bvh8Intersector* bvh8Intersector = dynamic_cast<Bvh8Intersector*>(intersector.get()))
+        {
+            return bvh8Intersector->RefitObjects(objects);
+        }
+        return static_cast<BvhIntersector&>(*intersector).RefitObjects(objects);
+    };
+    const double initialBuildSeconds = build();
+
+    std::vector<uint32_t> objects(scene.ObjectCount());
+    for (size_t i = 0ULL; i < objects.size(); i++)
+    {
+        objects[i] = static_cast<uint32_t>(i);
+    }
+    std::vector<Vertex> vertices;
+    double refitSeconds     = 0.0;
+    double maxDegradation   = 1.0;
+    size_t rebuilds         = 0;
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        for (uint32_t object : objects)
+        {
+            DeformVertices(loadedObj.object_vertices(object), frame / 60.0f, vertices);
+            scene.SetObjectVertices(object, vertices);
+        }
+        RefitStats refitStats = refit(objects);
+        refitSeconds    += refitStats.seconds;
+        maxDegradation  = (std::max)(maxDegradation, refitStats.maxDegradation);
+        rebuilds        += refitStats.rebuiltObjects.size();
+    }
+    const double rebuildSeconds = build();
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Refit benchmark: " << sceneName << " (" << scene.TriangleCount() << " triangles, " << intersector->Name() << ")\n"
+              << "    " << frames << " frames of " << objects.size() << " deforming objects: " << 1e3 * refitSeconds / frames
+              << " ms per frame, " << rebuilds << " objects rebuilt after degrading by more than "
+              << RefitMonitor::DefaultMaxSahDegradation << "x, the others degraded by up to " << maxDegradation << "x\n"
+              << "    Building from scratch: " << 1e3 * initialBuildSeconds << " ms initially, " << 1e3 * rebuildSeconds << " ms for the last frame" << std::endl;
+}
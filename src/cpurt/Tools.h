@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Intersector.h"
+#include "Renderer.h"
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace CpuRT {
+// The fastest intersector this CPU supports: Bvh8Intersector if it has AVX2, BvhIntersector otherwise
+std::unique_ptr<Intersector> MakeIntersector(const Scene& scene);
+
+// Renders the first frame of a scene with the CPU reference renderer, writes it to outputPath as a PPM, and prints how the acceleration
+// structures were built and how fast the rays were traced. Shared by the sample's -cpuRender and the cpurender tool.
+bool RenderToFile(const LoadScene::LoadedObj& loadedObj, const std::string& sceneName, const Renderer::Constants& constants, uint32_t width,
+                  uint32_t height, const std::string& outputPath);
+
+// Squeezes an object towards its vertical axis by an amount that travels up and down the object over time, which deforms it without
+// changing its topology. The animation of the sample's -deformObjects.
+void DeformVertices(std::span<const Vertex> restVertices, float time, std::vector<Vertex>& vertices);
+
+// Traces the secondary rays of the first frame, once in the order the pixels generate them and once sorted for coherence, and prints how
+// fast either way is and whether they found the same hits
+void BenchmarkRaySorting(const LoadScene::LoadedObj& loadedObj, const std::string& sceneName, const Renderer::Constants& constants, uint32_t width,
+                         uint32_t height);
+
+// Deforms the scene's objects with DeformVertices() for the given number of frames at 60 Hz, refitting the BVHs after every frame, and
+// prints how long that took compared to building them from scratch
+void BenchmarkRefit(const LoadScene::LoadedObj& loadedObj, const std::string& sceneName, uint32_t frames);
+}
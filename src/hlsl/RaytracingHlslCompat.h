@@ -16,17 +16,29 @@
 #include "HlslCompat.h"
 #else
 using namespace DirectX;
+#endif
+
+#include "SceneHlslCompat.h"
 
-// Shader will use byte encoding to access indices.
-typedef UINT32 Index;
-typedef INT32 MaterialIndex;
+// Geometry is either packed into three global index, vertex, and material index buffers that every instance locates its part of through a
+// GeometryRecord (1), keeping the number of descriptors constant, or bound as a separate triple of buffers per object (0)
+#ifndef PACKED_GEOMETRY_BUFFERS
+#define PACKED_GEOMETRY_BUFFERS 1
 #endif
 
 enum DescriptorHeapSlots {
     OutputRenderTarget = 0,
     PointLightsBuffer,
     MaterialsBuffer,
+#if PACKED_GEOMETRY_BUFFERS
+    PackedIndicesBuffer,            // ByteAddressBuffer holding the indices of all objects, relative to each object's first vertex
+    PackedVerticesBuffer,           // StructuredBuffer<DeviceVertex> holding the vertices of all objects
+    PackedMaterialIndicesBuffer,    // ByteAddressBuffer holding the per-triangle material indices of all objects
+    GeometryRecordsBuffer,          // StructuredBuffer<GeometryRecord> indexed by InstanceID()
+    DescriptorHeapSlotsCount
+#else
     IndexVertexMaterialBuffersBegin, // All slots as of this one are tuples of index, vertex, and material index buffers (i.e. ByteAddressBuffer followed by StructuredBuffer<Vertex> followed by ByteAddressBuffer) for each object/BLAS in the scene
+#endif
 };
 
 struct SceneConstantBuffer
@@ -40,23 +52,28 @@ struct SceneConstantBuffer
     XMFLOAT4 defaultMetalAndRoughness;  // R channel encodes metal, G channel encodes roughness, rest is unused
 };
 
-struct Vertex
-{
-    XMFLOAT3 position;
-    XMFLOAT3 normal;
-};
+// Vertices are uploaded either as Vertex (0) or as 12 byte CompactVertex (1), which stores an octahedral normal and a 16 bit
+// position in the encoding selected by COMPACT_VERTEX_POSITIONS (see VertexCompression.h for the encoders)
+#ifndef COMPACT_VERTICES
+#define COMPACT_VERTICES 1
+#endif
+#define COMPACT_POSITIONS_FLOAT16       0   // Half precision object space positions
+#define COMPACT_POSITIONS_AABB_SNORM16  1   // 16 bit SNORM positions relative to the object's bounding box, mapped back by the BLAS transform
+#ifndef COMPACT_VERTEX_POSITIONS
+#define COMPACT_VERTEX_POSITIONS COMPACT_POSITIONS_AABB_SNORM16
+#endif
 
-struct PointLight
+struct CompactVertex
 {
-    XMFLOAT3 position;
-    XMFLOAT3 color;
+    UINT positionXY;    // x in the low and y in the high 16 bits
+    UINT positionZ;     // z in the low 16 bits, the high 16 bits (w) are zero
+    UINT normal;        // Octahedral encoding as two 16 bit SNORMs, x in the low and y in the high 16 bits
 };
 
-struct MaterialPBR
-{
-    XMFLOAT3 albedo;
-    float metallic;
-    float roughness;
-};
+#if COMPACT_VERTICES
+typedef CompactVertex DeviceVertex;
+#else
+typedef Vertex DeviceVertex;
+#endif
 
 #endif // RAYTRACINGHLSLCOMPAT_H
\ No newline at end of file
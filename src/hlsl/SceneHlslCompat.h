@@ -0,0 +1,61 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#ifndef SCENEHLSLCOMPAT_H
+#define SCENEHLSLCOMPAT_H
+
+// Scene data shared by the shaders, the scene loaders, and the CPU renderer. Unlike the rest of RaytracingHlslCompat.h it only needs
+// the storage types of DirectXMath, so it can be used on any platform (see PortableMath.h).
+#if defined(HLSL)
+#include "HlslCompat.h"
+#else
+#include "../utils/PortableMath.h"
+
+#include <cstdint>
+
+using namespace DirectX;
+
+// Shader will use byte encoding to access indices.
+typedef uint32_t Index;
+typedef int32_t MaterialIndex;
+// The Windows SDK's type of the same name, which the structs shared with the shaders are declared with
+typedef uint32_t UINT;
+#endif
+
+struct Vertex
+{
+    XMFLOAT3 position;
+    XMFLOAT3 normal;
+};
+
+struct PointLight
+{
+    XMFLOAT3 position;
+    XMFLOAT3 color;
+};
+
+struct MaterialPBR
+{
+    XMFLOAT3 albedo;
+    float metallic;
+    float roughness;
+};
+
+// Location of an object's geometry within the packed geometry buffers, in elements rather than bytes
+struct GeometryRecord
+{
+    UINT firstIndex;    // First index of the object in the packed index buffer
+    UINT firstVertex;   // Added to the object's indices to address the packed vertex buffer
+    UINT firstTriangle; // First material index of the object in the packed material index buffer
+    UINT padding;
+};
+
+#endif // SCENEHLSLCOMPAT_H
@@ -0,0 +1,125 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+
+namespace
+{
+    std::atomic<uint32_t> openScopes        = 0;
+    std::atomic<uint64_t> allocationCount   = 0;
+    std::atomic<uint64_t> allocatedBytes    = 0;
+
+    void CountAllocation(std::size_t size)
+    {
+        if (openScopes.load(std::memory_order_relaxed) > 0)
+        {
+            allocationCount.fetch_add(1, std::memory_order_relaxed);
+            allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    void* AlignedMalloc(std::size_t size, std::size_t alignment)
+    {
+#ifdef _WIN32
+        return _aligned_malloc(size, alignment);
+#else
+        return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+    }
+
+    void AlignedFree(void* memory)
+    {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        std::free(memory);
+#endif
+    }
+}
+
+// The array and nothrow forms fall back to these. Memory resources like std::pmr::new_delete_resource() may use the aligned forms.
+void* operator new(std::size_t size)
+{
+    CountAllocation(size);
+    if (void* memory = std::malloc(size > 0 ? size : 1))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    CountAllocation(size);
+    if (void* memory = AlignedMalloc(size > 0 ? size : 1, static_cast<std::size_t>(alignment)))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+    AlignedFree(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
+{
+    AlignedFree(memory);
+}
+
+AllocationCounter::Scope::Scope()
+{
+    openScopes.fetch_add(1, std::memory_order_relaxed);
+    m_start = { allocationCount.load(std::memory_order_relaxed), allocatedBytes.load(std::memory_order_relaxed) };
+}
+
+AllocationCounter::Scope::~Scope()
+{
+    openScopes.fetch_sub(1, std::memory_order_relaxed);
+}
+
+AllocationCounter::Counts AllocationCounter::Scope::GetCounts() const
+{
+    return { allocationCount.load(std::memory_order_relaxed) - m_start.allocations, allocatedBytes.load(std::memory_order_relaxed) - m_start.bytes };
+}
+
+AllocationCounter::AllocationCounter(std::pmr::memory_resource* upstream) :
+    m_upstream(upstream)
+{
+    assert(upstream != nullptr);
+}
+
+void* AllocationCounter::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    void* memory = m_upstream->allocate(bytes, alignment);
+    m_counts.allocations++;
+    m_counts.bytes += bytes;
+    return memory;
+}
+
+void AllocationCounter::do_deallocate(void* memory, std::size_t bytes, std::size_t alignment)
+{
+    m_upstream->deallocate(memory, bytes, alignment);
+}
+
+bool AllocationCounter::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
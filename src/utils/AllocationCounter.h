@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+// Memory resource that passes allocations on to an upstream resource and counts them. Placed below an arena such as a
+// std::pmr::monotonic_buffer_resource, it counts how many blocks the arena takes from the heap, e.g. to keep the scratch memory of
+// scene loading in check. Like the arenas it sits below, it is not thread safe.
+class AllocationCounter : public std::pmr::memory_resource
+{
+public:
+    struct Counts
+    {
+        uint64_t allocations    = 0;
+        uint64_t bytes          = 0;
+    };
+
+    // Counts all heap allocations made through the global operator new, by any thread, while it is alive, including those of code
+    // that does not take a memory resource. This translation unit replaces operator new with a thin wrapper around malloc that only
+    // counts while a scope is open, so scope a whole operation such as loading a scene rather than running one all the time.
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator= (const Scope&) = delete;
+
+        // Allocations since the scope was opened, of other threads running at the same time as well
+        Counts GetCounts() const;
+
+    private:
+        Counts m_start;
+    };
+
+    explicit AllocationCounter(std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+
+    const Counts& GetCounts() const { return m_counts; }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* memory, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::pmr::memory_resource*  m_upstream;
+    Counts                      m_counts;
+};
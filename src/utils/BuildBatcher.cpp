@@ -0,0 +1,78 @@
+#include "BuildBatcher.h"
+#include "UploadLayout.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+BuildBatcher::BuildBatcher(uint64_t scratchBudget, uint64_t alignment) :
+    m_scratchBudget(scratchBudget),
+    m_alignment(alignment)
+{
+    assert(scratchBudget > 0 && alignment > 0 && (alignment & (alignment - 1)) == 0);
+}
+
+uint32_t BuildBatcher::Add(uint64_t scratchSize)
+{
+    m_scratchSizes.push_back(scratchSize);
+    return static_cast<uint32_t>(m_scratchSizes.size() - 1);
+}
+
+std::vector<BuildBatcher::Batch> BuildBatcher::Pack() const
+{
+    // First fit decreasing, ties are broken by the order the builds were added in to keep the result deterministic
+    std::vector<uint32_t> order(Size());
+    for (uint32_t i = 0; i < static_cast<uint32_t>(order.size()); i++)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return m_scratchSizes[a] > m_scratchSizes[b]; });
+
+    // Batches without room for the smallest build are full for good, so the search skips the leading ones
+    std::vector<Batch> batches;
+    const uint64_t minSize  = order.empty() ? 0 : UploadLayout::AlignUp(m_scratchSizes[order.back()], m_alignment);
+    size_t firstOpen        = 0;
+    for (uint32_t build : order)
+    {
+        while (firstOpen < batches.size() && batches[firstOpen].scratchBytes + minSize > m_scratchBudget)
+        {
+            firstOpen++;
+        }
+
+        // Regions start at aligned offsets because every region's size is rounded up to the alignment
+        const uint64_t size = UploadLayout::AlignUp(m_scratchSizes[build], m_alignment);
+        auto batch          = std::find_if(batches.begin() + firstOpen, batches.end(), [&](const Batch& b) { return b.scratchBytes + size <= m_scratchBudget; });
+        if (batch == batches.end())
+        {
+            batches.emplace_back();
+            batch = batches.end() - 1;
+        }
+        batch->builds.push_back({ build, batch->scratchBytes });
+        batch->scratchBytes += size;
+    }
+    return batches;
+}
+
+uint64_t BuildBatcher::ScratchBufferSize(const std::vector<Batch>& batches)
+{
+    uint64_t size = 0;
+    for (const Batch& batch : batches)
+    {
+        size = (std::max)(size, batch.scratchBytes);
+    }
+    return size;
+}
+
+BuildBatcher::Stats BuildBatcher::ComputeStats(const std::vector<Batch>& batches) const
+{
+    Stats stats;
+    stats.builds            = static_cast<uint32_t>(Size());
+    stats.batches           = static_cast<uint32_t>(batches.size());
+    stats.scratchBufferSize = ScratchBufferSize(batches);
+    for (uint64_t size : m_scratchSizes)
+    {
+        stats.scratchBytes      += size;
+        stats.separateScratch   += UploadLayout::AlignUp(size, m_alignment);
+    }
+    return stats;
+}
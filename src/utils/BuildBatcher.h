@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packs acceleration structure builds into batches that run concurrently out of one shared scratch buffer.
+// Every build of a batch gets its own region of the scratch buffer, and the batch's regions take up at most ScratchBudget() bytes, so
+// the builds of a batch do not depend on each other and only need a single barrier before the next batch reuses the buffer. Builds
+// are packed first fit in order of decreasing scratch size, which keeps the number of batches (and barriers) close to the minimum.
+// A build that needs more scratch memory than the budget is packed into a batch of its own, and the scratch buffer grows to fit it.
+// This is pure bookkeeping without any device access.
+class BuildBatcher
+{
+public:
+    struct Placement
+    {
+        uint32_t build;
+        uint64_t scratchOffset;
+    };
+
+    struct Batch
+    {
+        std::vector<Placement> builds;
+        uint64_t scratchBytes = 0;      // Including alignment padding
+    };
+
+    struct Stats
+    {
+        uint32_t builds             = 0;
+        uint32_t batches            = 0;
+        uint64_t scratchBufferSize  = 0;    // Size of the shared scratch buffer, the largest scratch size of any batch
+        uint64_t scratchBytes       = 0;    // Sum of all builds' scratch sizes
+        uint64_t separateScratch    = 0;    // Scratch memory needed without sharing, with a buffer per build
+
+        // Fraction of the scratch buffer used by an average batch
+        double Utilization() const { return batches > 0 && scratchBufferSize > 0 ? static_cast<double>(scratchBytes) / (static_cast<double>(batches) * scratchBufferSize) : 0.0; }
+    };
+
+    explicit BuildBatcher(uint64_t scratchBudget, uint64_t alignment = ScratchAlignment);
+
+    // Register a build that needs scratchSize bytes of scratch memory and return its index
+    uint32_t Add(uint64_t scratchSize);
+
+    // Pack all builds added so far, the scratch buffer needs ScratchBufferSize(batches) bytes
+    std::vector<Batch> Pack() const;
+    Stats ComputeStats(const std::vector<Batch>& batches) const;
+    static uint64_t ScratchBufferSize(const std::vector<Batch>& batches);
+
+    // Accessors
+    size_t Size() const { return m_scratchSizes.size(); }
+    uint64_t ScratchBudget() const { return m_scratchBudget; }
+    uint64_t ScratchSize(uint32_t build) const { return m_scratchSizes[build]; }
+
+    // Scratch memory has to be aligned like acceleration structures (D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT)
+    static constexpr uint64_t ScratchAlignment = 256;
+
+private:
+    uint64_t                m_scratchBudget;
+    uint64_t                m_alignment;
+    std::vector<uint64_t>   m_scratchSizes;
+};
@@ -0,0 +1,92 @@
+#include "CompactionPlanner.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+CompactionPlanner::CompactionPlanner(uint64_t batchBudget, uint64_t minSavedBytes) :
+    m_batchBudget(batchBudget),
+    m_minSavedBytes(minSavedBytes)
+{
+    assert(batchBudget > 0);
+}
+
+uint32_t CompactionPlanner::Add(uint64_t originalSize)
+{
+    m_originalSizes.push_back(originalSize);
+    m_compactedSizes.push_back(0);
+    return static_cast<uint32_t>(m_originalSizes.size() - 1);
+}
+
+void CompactionPlanner::SetCompactedSize(uint32_t structure, uint64_t compactedSize)
+{
+    assert(compactedSize > 0);
+    m_compactedSizes[structure] = compactedSize;
+}
+
+bool CompactionPlanner::ShouldCompact(uint32_t structure) const
+{
+    return m_compactedSizes[structure] + m_minSavedBytes <= m_originalSizes[structure];
+}
+
+std::vector<CompactionPlanner::Batch> CompactionPlanner::Plan() const
+{
+    // Batches are filled in order until the next structure would exceed the budget, a structure larger than the budget gets a batch of
+    // its own
+    std::vector<Batch> batches;
+    Batch batch;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(Size()); i++)
+    {
+        if (!ShouldCompact(i))
+        {
+            continue;
+        }
+        if (!batch.structures.empty() && batch.compactedBytes + m_compactedSizes[i] > m_batchBudget)
+        {
+            batches.push_back(std::move(batch));
+            batch = Batch();
+        }
+        batch.structures.push_back(i);
+        batch.compactedBytes += m_compactedSizes[i];
+    }
+    if (!batch.structures.empty())
+    {
+        batches.push_back(std::move(batch));
+    }
+    return batches;
+}
+
+const CompactionPlanner::Stats& CompactionPlanner::Execute(CompactionDevice& device)
+{
+    m_stats = Stats();
+    for (uint32_t i = 0; i < static_cast<uint32_t>(Size()); i++)
+    {
+        assert(m_compactedSizes[i] > 0);
+        m_stats.originalBytes += m_originalSizes[i];
+    }
+
+    // The originals of a batch are only released once its copies have completed, so memory use peaks right before that
+    uint64_t bytesInUse = m_stats.originalBytes;
+    m_stats.peakBytes   = bytesInUse;
+    for (const Batch& batch : Plan())
+    {
+        for (uint32_t structure : batch.structures)
+        {
+            device.CopyCompacted(structure, m_compactedSizes[structure]);
+        }
+        device.ExecuteCopies();
+        bytesInUse          += batch.compactedBytes;
+        m_stats.peakBytes   = (std::max)(m_stats.peakBytes, bytesInUse);
+
+        for (uint32_t structure : batch.structures)
+        {
+            device.ReleaseOriginal(structure);
+            bytesInUse -= m_originalSizes[structure];
+        }
+        m_stats.compacted += static_cast<uint32_t>(batch.structures.size());
+        m_stats.batches++;
+    }
+    m_stats.compactedBytes  = bytesInUse;
+    m_stats.skipped         = static_cast<uint32_t>(Size()) - m_stats.compacted;
+    return m_stats;
+}
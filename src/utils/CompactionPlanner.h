@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Device operations that compacting acceleration structures consists of. The planner only schedules work through this interface,
+// so it can be driven by a D3D12 device as well as by a fake device without any GPU.
+class CompactionDevice
+{
+public:
+    virtual ~CompactionDevice() = default;
+
+    // Allocate a buffer of size bytes for the compacted copy of the given structure and record the copy into it
+    virtual void CopyCompacted(uint32_t structure, uint64_t size) = 0;
+
+    // Submit all copies recorded since the last call and wait for them to complete
+    virtual void ExecuteCopies() = 0;
+
+    // Replace the given structure with its compacted copy and release the original
+    virtual void ReleaseOriginal(uint32_t structure) = 0;
+};
+
+// Plans the compaction of acceleration structures that were allocated at their maximum size.
+// Once the compacted sizes are known, structures are grouped into batches whose compacted copies take up at most BatchBudget() bytes.
+// Every batch is copied in one submission, after which the originals of the batch are released, so compaction never needs more than
+// BatchBudget() bytes on top of the memory that is already in use (a structure larger than the budget is compacted on its own).
+// Structures that would not shrink by at least MinSavedBytes are left alone. This is pure bookkeeping, all device access goes through
+// CompactionDevice.
+class CompactionPlanner
+{
+public:
+    struct Batch
+    {
+        std::vector<uint32_t> structures;
+        uint64_t compactedBytes = 0;
+    };
+
+    struct Stats
+    {
+        uint64_t originalBytes  = 0;    // Memory used by all structures before compaction
+        uint64_t compactedBytes = 0;    // Memory used by all structures after compaction, including ones that were left alone
+        uint64_t peakBytes      = 0;    // Largest amount of memory in use at any point during compaction
+        uint32_t compacted      = 0;
+        uint32_t skipped        = 0;
+        uint32_t batches        = 0;
+
+        uint64_t SavedBytes() const { return originalBytes - compactedBytes; }
+    };
+
+    explicit CompactionPlanner(uint64_t batchBudget = UINT64_MAX, uint64_t minSavedBytes = DefaultMinSavedBytes);
+
+    // Register a structure of originalSize bytes and return its index. Its compacted size is unknown until SetCompactedSize().
+    uint32_t Add(uint64_t originalSize);
+    void SetCompactedSize(uint32_t structure, uint64_t compactedSize);
+
+    // Batches in the order they are executed, structures keep the order they were added in
+    std::vector<Batch> Plan() const;
+
+    // Compact all structures batch by batch, every structure must have its compacted size set
+    const Stats& Execute(CompactionDevice& device);
+
+    // Accessors
+    size_t Size() const { return m_originalSizes.size(); }
+    uint64_t BatchBudget() const { return m_batchBudget; }
+    uint64_t OriginalSize(uint32_t structure) const { return m_originalSizes[structure]; }
+    uint64_t CompactedSize(uint32_t structure) const { return m_compactedSizes[structure]; }
+    const Stats& GetStats() const { return m_stats; }
+
+    // Compacting a structure costs a copy, so tiny savings are not worth it
+    static constexpr uint64_t DefaultMinSavedBytes = 4096;
+
+private:
+    bool ShouldCompact(uint32_t structure) const;
+
+    uint64_t                m_batchBudget;
+    uint64_t                m_minSavedBytes;
+    std::vector<uint64_t>   m_originalSizes;
+    std::vector<uint64_t>   m_compactedSizes;   // 0 until set
+    Stats                   m_stats;
+};
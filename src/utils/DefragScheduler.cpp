@@ -0,0 +1,73 @@
+#include "DefragScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+DefragScheduler::DefragScheduler(const Budget& budget, float fragmentationThreshold, uint64_t minFragmentedBytes) :
+    m_budget(budget),
+    m_fragmentationThreshold(fragmentationThreshold),
+    m_minFragmentedBytes(minFragmentedBytes)
+{
+    assert(budget.maxBytesPerFrame > 0 && budget.maxMovesPerFrame > 0);
+    assert(fragmentationThreshold >= 0.0f && fragmentationThreshold < 1.0f);
+}
+
+double DefragScheduler::Fragmentation(const Usage& usage)
+{
+    const uint64_t unusedBytes = usage.blockBytes - usage.allocationBytes;
+    return unusedBytes > 0 ? static_cast<double>(FragmentedBytes(usage)) / unusedBytes : 0.0;
+}
+
+uint64_t DefragScheduler::FragmentedBytes(const Usage& usage)
+{
+    assert(usage.allocationBytes <= usage.blockBytes);
+    const uint64_t unusedBytes = usage.blockBytes - usage.allocationBytes;
+    return unusedBytes - (std::min)(usage.largestUnusedRange, unusedBytes);
+}
+
+bool DefragScheduler::BeginRun(const Usage& usage)
+{
+    assert(!m_running);
+    const uint64_t fragmentedBytes = FragmentedBytes(usage);
+    if (fragmentedBytes < m_settledFragmentedBytes + m_minFragmentedBytes || Fragmentation(usage) < m_fragmentationThreshold)
+    {
+        return false;
+    }
+    m_running = true;
+    m_stats.runs++;
+    return true;
+}
+
+void DefragScheduler::EndRun(const Usage& usage)
+{
+    assert(m_running);
+    m_running                   = false;
+    m_settledFragmentedBytes    = FragmentedBytes(usage);
+}
+
+uint32_t DefragScheduler::SelectMoves(const std::vector<uint64_t>& moveSizes, std::vector<uint8_t>& perform)
+{
+    assert(m_running);
+    perform.assign(moveSizes.size(), 0);
+    uint64_t bytes  = 0;
+    uint32_t moves  = 0;
+    for (size_t i = 0; i < moveSizes.size(); i++)
+    {
+        // Moves are taken in the order the allocator proposes them, which is the order it packs the blocks in
+        if (moves > 0 && (moves == m_budget.maxMovesPerFrame || bytes + moveSizes[i] > m_budget.maxBytesPerFrame))
+        {
+            break;
+        }
+        perform[i] = 1;
+        bytes += moveSizes[i];
+        moves++;
+    }
+
+    m_stats.passes++;
+    m_stats.moves               += moves;
+    m_stats.deferredMoves       += static_cast<uint32_t>(moveSizes.size()) - moves;
+    m_stats.bytesMoved          += bytes;
+    m_stats.peakBytesPerFrame   = (std::max)(m_stats.peakBytesPerFrame, bytes);
+    return moves;
+}
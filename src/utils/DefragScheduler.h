@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Paces the incremental defragmentation of a pool of memory blocks across frames. A run starts once the pool's unused memory is
+// scattered across enough ranges to be worth compacting, and proceeds in passes of moves proposed by the allocator. SelectMoves()
+// accepts as many of a pass's moves as fit into the per-frame budget, the others are left for later passes. Only one pass is in
+// flight at a time and its copies are recorded in a single frame, so the budget bounds the copies of every frame. The usage and move
+// sizes can come from a D3D12MA pool as well as from a VirtualBlock that simulates one. This is pure bookkeeping without any device access.
+class DefragScheduler
+{
+public:
+    struct Budget
+    {
+        uint64_t maxBytesPerFrame;
+        uint32_t maxMovesPerFrame;
+    };
+
+    // How much of a pool's blocks is in use, see D3D12MA::DetailedStatistics
+    struct Usage
+    {
+        uint64_t blockBytes;
+        uint64_t allocationBytes;
+        uint64_t largestUnusedRange;
+    };
+
+    struct Stats
+    {
+        uint64_t bytesMoved         = 0;
+        uint64_t peakBytesPerFrame  = 0;
+        uint32_t runs               = 0;
+        uint32_t passes             = 0;
+        uint32_t moves              = 0;
+        uint32_t deferredMoves      = 0;    // Proposed moves that did not fit into the budget of their pass
+    };
+
+    // A run only starts if at least this share of the unused memory and this many bytes lie outside of its largest range
+    static constexpr float DefaultFragmentationThreshold    = 0.25f;
+    static constexpr uint64_t DefaultMinFragmentedBytes     = 1024ULL * 1024ULL;
+
+    explicit DefragScheduler(const Budget& budget, float fragmentationThreshold = DefaultFragmentationThreshold,
+                             uint64_t minFragmentedBytes = DefaultMinFragmentedBytes);
+
+    // Share of the unused memory outside of the largest unused range, 0 if all of it is contiguous
+    static double Fragmentation(const Usage& usage);
+    static uint64_t FragmentedBytes(const Usage& usage);
+
+    // Start a run if the pool is fragmented enough, and more so than at the end of its previous run, which leaves pools alone whose
+    // remaining allocations can't be packed any tighter. Returns whether the run has started.
+    bool BeginRun(const Usage& usage);
+    void EndRun(const Usage& usage);
+
+    // Decide which of the moves a pass proposes to perform, in order as long as they fit into the budget, and return how many that is.
+    // The first move is always performed, so a move larger than the budget still makes progress.
+    uint32_t SelectMoves(const std::vector<uint64_t>& moveSizes, std::vector<uint8_t>& perform);
+
+    // Accessors
+    const Budget& GetBudget() const { return m_budget; }
+    bool IsRunning() const { return m_running; }
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    Budget      m_budget;
+    float       m_fragmentationThreshold;
+    uint64_t    m_minFragmentedBytes;
+    uint64_t    m_settledFragmentedBytes = 0;   // Fragmented bytes at the end of the previous run
+    bool        m_running = false;
+    Stats       m_stats;
+};
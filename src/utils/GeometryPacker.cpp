@@ -0,0 +1,47 @@
+#include "GeometryPacker.h"
+
+#include <cassert>
+
+
+size_t GeometryPacker::Add(uint64_t indexCount, uint64_t vertexCount)
+{
+    assert(indexCount % 3 == 0);
+
+    // Offsets are truncated once the packed buffers outgrow 32 bit addressing, which FitsShaderAddressing() reports
+    GeometryRecord record = {};
+    record.firstIndex       = static_cast<UINT>(m_indexCount);
+    record.firstVertex      = static_cast<UINT>(m_vertexCount);
+    record.firstTriangle    = static_cast<UINT>(m_indexCount / 3);
+    m_records.push_back(record);
+
+    m_indexCount    += indexCount;
+    m_vertexCount   += vertexCount;
+    return m_records.size() - 1;
+}
+
+void GeometryPacker::Clear()
+{
+    m_records.clear();
+    m_indexCount    = 0;
+    m_vertexCount   = 0;
+}
+
+uint64_t GeometryPacker::ObjectIndexCount(size_t object) const
+{
+    uint64_t end = object + 1 < m_records.size() ? m_records[object + 1].firstIndex : m_indexCount;
+    return end - m_records[object].firstIndex;
+}
+
+uint64_t GeometryPacker::ObjectVertexCount(size_t object) const
+{
+    uint64_t end = object + 1 < m_records.size() ? m_records[object + 1].firstVertex : m_vertexCount;
+    return end - m_records[object].firstVertex;
+}
+
+bool GeometryPacker::FitsShaderAddressing() const
+{
+    // Indices and material indices are read from ByteAddressBuffers with 32 bit byte addresses, vertices by 32 bit element index
+    return m_indexCount * sizeof(Index) <= UINT32_MAX &&
+           m_vertexCount <= UINT32_MAX &&
+           m_records.size() <= (1ULL << 24); // InstanceID() only has 24 bits
+}
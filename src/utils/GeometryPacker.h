@@ -0,0 +1,40 @@
+#pragma once
+
+#include "../hlsl/SceneHlslCompat.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Plans how the geometry of all objects is packed back to back into three global buffers (indices, vertices, and per-triangle
+// material indices) and produces the GeometryRecord through which shaders locate an object's part of them.
+// Indices stay relative to their object's first vertex, so they can be copied unchanged and BLASes can be built from the object's
+// range of the packed buffers. This is pure bookkeeping without any memory or device access.
+class GeometryPacker
+{
+public:
+    // Append an object with the given number of indices (three per triangle) and vertices, returns the object's index
+    size_t Add(uint64_t indexCount, uint64_t vertexCount);
+
+    void Clear();
+
+    // Per-object ranges
+    size_t ObjectCount() const { return m_records.size(); }
+    const std::vector<GeometryRecord>& Records() const { return m_records; }
+    uint64_t ObjectIndexCount(size_t object) const;
+    uint64_t ObjectVertexCount(size_t object) const;
+    uint64_t ObjectTriangleCount(size_t object) const { return ObjectIndexCount(object) / 3; }
+
+    // Sizes of the packed buffers in elements
+    uint64_t IndexCount() const { return m_indexCount; }
+    uint64_t VertexCount() const { return m_vertexCount; }
+    uint64_t TriangleCount() const { return m_indexCount / 3; }
+
+    // Whether every byte address and element index into the packed buffers fits into the 32 bits that records and shaders use
+    bool FitsShaderAddressing() const;
+
+private:
+    std::vector<GeometryRecord> m_records;
+    uint64_t                    m_indexCount    = 0;
+    uint64_t                    m_vertexCount   = 0;
+};
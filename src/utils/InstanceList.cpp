@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "InstanceList.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+
+InstanceList::Handle InstanceList::Add(uint32_t object, const XMFLOAT3X4& transform)
+{
+    Handle handle;
+    if (m_freeHandles.empty())
+    {
+        handle = static_cast<Handle>(m_denseIndices.size());
+        m_denseIndices.push_back(0);
+    }
+    else
+    {
+        handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+    }
+
+    m_denseIndices[handle] = static_cast<uint32_t>(m_instances.size());
+    m_instances.push_back({ transform, object });
+    m_handles.push_back(handle);
+    return handle;
+}
+
+void InstanceList::Remove(Handle instance)
+{
+    assert(instance < m_denseIndices.size() && m_denseIndices[instance] != InvalidHandle);
+
+    // The last instance takes the removed one's place
+    const uint32_t index                = m_denseIndices[instance];
+    m_instances[index]                  = m_instances.back();
+    m_handles[index]                    = m_handles.back();
+    m_denseIndices[m_handles[index]]    = index;
+    m_instances.pop_back();
+    m_handles.pop_back();
+
+    m_denseIndices[instance] = InvalidHandle;
+    m_freeHandles.push_back(instance);
+}
+
+void InstanceList::SetTransform(Handle instance, const XMFLOAT3X4& transform)
+{
+    assert(instance < m_denseIndices.size() && m_denseIndices[instance] != InvalidHandle);
+    m_instances[m_denseIndices[instance]].transform = transform;
+}
+
+void InstanceList::Clear()
+{
+    m_instances.clear();
+    m_handles.clear();
+    m_denseIndices.clear();
+    m_freeHandles.clear();
+}
+
+InstanceList::Bounds InstanceList::WorldBounds(uint32_t object, const XMFLOAT3X4& transform) const
+{
+    assert(object < m_objectBounds.size());
+
+    // Transform the center and extend the half extent by the absolute values of the rotation and scale
+    const Bounds& bounds    = m_objectBounds[object];
+    const float center[3]   = { 0.5f * (bounds.lower.x + bounds.upper.x), 0.5f * (bounds.lower.y + bounds.upper.y), 0.5f * (bounds.lower.z + bounds.upper.z) };
+    const float extent[3]   = { 0.5f * (bounds.upper.x - bounds.lower.x), 0.5f * (bounds.upper.y - bounds.lower.y), 0.5f * (bounds.upper.z - bounds.lower.z) };
+    float lower[3], upper[3];
+    for (int row = 0; row < 3; row++)
+    {
+        float worldCenter = transform.m[row][3];
+        float worldExtent = 0.0f;
+        for (int column = 0; column < 3; column++)
+        {
+            worldCenter += transform.m[row][column] * center[column];
+            worldExtent += std::fabs(transform.m[row][column]) * extent[column];
+        }
+        lower[row] = worldCenter - worldExtent;
+        upper[row] = worldCenter + worldExtent;
+    }
+    return { XMFLOAT3(lower[0], lower[1], lower[2]), XMFLOAT3(upper[0], upper[1], upper[2]) };
+}
+
+InstanceList::CullStats InstanceList::Cull(const Frustum& frustum, std::vector<uint32_t>& visible) const
+{
+    CullStats stats;
+    visible.clear();
+    const float maxDistanceSquared = frustum.maxDistance < FLT_MAX ? frustum.maxDistance * frustum.maxDistance : FLT_MAX;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_instances.size()); i++)
+    {
+        const Bounds bounds = WorldBounds(m_instances[i].object, m_instances[i].transform);
+
+        // Outside if the corner of the bounds farthest along a plane's normal is behind it
+        bool inside = true;
+        for (const XMFLOAT4& plane : frustum.planes)
+        {
+            const float x = plane.x >= 0.0f ? bounds.upper.x : bounds.lower.x;
+            const float y = plane.y >= 0.0f ? bounds.upper.y : bounds.lower.y;
+            const float z = plane.z >= 0.0f ? bounds.upper.z : bounds.lower.z;
+            if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f)
+            {
+                inside = false;
+                break;
+            }
+        }
+        if (!inside)
+        {
+            stats.frustumCulled++;
+            continue;
+        }
+
+        if (DistanceSquared(bounds, frustum.eye) > maxDistanceSquared)
+        {
+            stats.distanceCulled++;
+            continue;
+        }
+
+        visible.push_back(i);
+        stats.visible++;
+    }
+    return stats;
+}
+
+float InstanceList::DistanceSquared(const Bounds& bounds, const XMFLOAT3& point)
+{
+    const float dx = (std::max)((std::max)(bounds.lower.x - point.x, point.x - bounds.upper.x), 0.0f);
+    const float dy = (std::max)((std::max)(bounds.lower.y - point.y, point.y - bounds.upper.y), 0.0f);
+    const float dz = (std::max)((std::max)(bounds.lower.z - point.z, point.z - bounds.upper.z), 0.0f);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+InstanceList::Frustum InstanceList::MakeFrustum(FXMMATRIX viewProj, const XMFLOAT3& eye, float maxDistance)
+{
+    // Points are row vectors, so clip space coordinates are dot products with the columns of viewProj, i.e. the rows of its transpose.
+    // The planes bound -w <= x <= w, -w <= y <= w and 0 <= z <= w.
+    XMMATRIX columns = XMMatrixTranspose(viewProj);
+    const XMVECTOR planes[6] = {
+        XMVectorAdd(columns.r[3], columns.r[0]),
+        XMVectorSubtract(columns.r[3], columns.r[0]),
+        XMVectorAdd(columns.r[3], columns.r[1]),
+        XMVectorSubtract(columns.r[3], columns.r[1]),
+        columns.r[2],
+        XMVectorSubtract(columns.r[3], columns.r[2])
+    };
+
+    Frustum frustum;
+    for (int i = 0; i < 6; i++)
+    {
+        XMStoreFloat4(&frustum.planes[i], XMPlaneNormalize(planes[i]));
+    }
+    frustum.eye         = eye;
+    frustum.maxDistance = maxDistance;
+    return frustum;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "LoadScene.h"
+
+#include <cfloat>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Instances of the scene's objects that can be added, removed and moved between frames, from which the TLAS is rebuilt every frame.
+// Instances are referred to by handles that stay valid until the instance is removed, while the instances themselves are kept densely
+// packed (removing one moves the last instance into its place), so they can be copied into instance descs in one pass.
+// Instances can be culled against the view frustum and a maximum distance from the camera by the bounds of their objects. Culled
+// instances are missing from the TLAS altogether, so they do not cast shadows or show up in reflections either.
+// This is pure bookkeeping without any device access.
+class InstanceList
+{
+public:
+    using Handle = uint32_t;
+
+    // Object space bounds of an object
+    struct Bounds
+    {
+        XMFLOAT3 lower;
+        XMFLOAT3 upper;
+    };
+
+    struct Frustum
+    {
+        XMFLOAT4 planes[6];                 // Facing inwards, a point p is inside if dot(plane.xyz, p) + plane.w >= 0
+        XMFLOAT3 eye;
+        float maxDistance   = FLT_MAX;      // Instances whose bounds are farther away from the eye are culled
+    };
+
+    struct CullStats
+    {
+        uint32_t visible        = 0;
+        uint32_t frustumCulled  = 0;
+        uint32_t distanceCulled = 0;
+    };
+
+    // Every object needs bounds before its instances can be culled
+    void SetObjectBounds(std::vector<Bounds> objectBounds) { m_objectBounds = std::move(objectBounds); }
+
+    Handle Add(uint32_t object, const XMFLOAT3X4& transform);
+    void Remove(Handle instance);
+    void SetTransform(Handle instance, const XMFLOAT3X4& transform);
+    void Clear();
+
+    const LoadScene::ObjectInstance& Get(Handle instance) const { return m_instances[m_denseIndices[instance]]; }
+    Handle GetHandle(size_t index) const { return m_handles[index]; }
+
+    // All instances, in no particular order
+    std::span<const LoadScene::ObjectInstance> Instances() const { return m_instances; }
+    size_t Size() const { return m_instances.size(); }
+
+    // Indices into Instances() of the instances that are at least partially inside the frustum, in order
+    CullStats Cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+
+    // Bounds of the given object under the given transform
+    Bounds WorldBounds(uint32_t object, const XMFLOAT3X4& transform) const;
+
+    // Squared distance from a point to the closest point of the bounds, zero if it is inside
+    static float DistanceSquared(const Bounds& bounds, const XMFLOAT3& point);
+
+    // Frustum of a left handed projection with depth from 0 to 1 (like XMMatrixPerspectiveFovLH) applied after the view matrix
+    static Frustum MakeFrustum(FXMMATRIX viewProj, const XMFLOAT3& eye, float maxDistance = FLT_MAX);
+
+    static constexpr Handle InvalidHandle = UINT32_MAX;
+
+private:
+    std::vector<LoadScene::ObjectInstance>  m_instances;
+    std::vector<Handle>                     m_handles;          // Handle of every instance
+    std::vector<uint32_t>                   m_denseIndices;     // Index into m_instances of every handle, InvalidHandle if free
+    std::vector<Handle>                     m_freeHandles;
+    std::vector<Bounds>                     m_objectBounds;
+};
@@ -0,0 +1,273 @@
+#include "LoadScene.h"
+
+#include "../minipbrt/minipbrt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+using Matrix4 = float[4][4];
+
+// Transforms a point by a row major pbrt matrix (column vector convention, translation in the last column)
+XMFLOAT3 transform_point(const Matrix4& m, const float* p) {
+    float x = m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3];
+    float y = m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3];
+    float z = m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3];
+    float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+    float inv_w = (w != 0.0f && w != 1.0f) ? 1.0f / w : 1.0f;
+    return { x * inv_w, y * inv_w, z * inv_w };
+}
+
+XMFLOAT3 normalize(XMFLOAT3 v) {
+    float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    return length > 0.0f ? XMFLOAT3(v.x / length, v.y / length, v.z / length) : XMFLOAT3(0.0f, 1.0f, 0.0f);
+}
+
+// Converts pbrt's roughness parameters into the perceptual roughness used by Materials.hlsl.
+// Unless remapped by pbrt, roughness values are microfacet alphas, i.e. already squared.
+float perceptual_roughness(float uroughness, float vroughness, bool remaproughness) {
+    float roughness = 0.5f * (uroughness + vroughness);
+    return std::clamp(remaproughness ? roughness : std::sqrt((std::max)(roughness, 0.0f)), 0.0f, 1.0f);
+}
+
+XMFLOAT3 color(const minipbrt::ColorTex& tex) {
+    // Textures are not supported, their constant value is used instead
+    return { tex.value[0], tex.value[1], tex.value[2] };
+}
+
+MaterialPBR material_to_pbr(const minipbrt::Scene& scene, const minipbrt::Material* material, int depth = 0) {
+    MaterialPBR pbr = { .albedo = { 0.5f, 0.5f, 0.5f }, .metallic = 0.0f, .roughness = 1.0f };
+    switch (material->type()) {
+        case minipbrt::MaterialType::Matte: {
+            auto matte      = static_cast<const minipbrt::MatteMaterial*>(material);
+            pbr.albedo      = color(matte->Kd);
+            break;
+        }
+        case minipbrt::MaterialType::Plastic: {
+            auto plastic    = static_cast<const minipbrt::PlasticMaterial*>(material);
+            pbr.albedo      = color(plastic->Kd);
+            pbr.roughness   = perceptual_roughness(plastic->roughness.value, plastic->roughness.value, plastic->remaproughness);
+            break;
+        }
+        case minipbrt::MaterialType::Substrate: {
+            auto substrate  = static_cast<const minipbrt::SubstrateMaterial*>(material);
+            pbr.albedo      = color(substrate->Kd);
+            pbr.roughness   = perceptual_roughness(substrate->uroughness.value, substrate->vroughness.value, substrate->remaproughness);
+            break;
+        }
+        case minipbrt::MaterialType::Uber: {
+            auto uber       = static_cast<const minipbrt::UberMaterial*>(material);
+            pbr.albedo      = color(uber->Kd);
+            pbr.roughness   = perceptual_roughness(uber->uroughness.value, uber->vroughness.value, uber->remaproughness);
+            break;
+        }
+        case minipbrt::MaterialType::Translucent: {
+            auto translucent    = static_cast<const minipbrt::TranslucentMaterial*>(material);
+            pbr.albedo          = color(translucent->Kd);
+            pbr.roughness       = perceptual_roughness(translucent->roughness.value, translucent->roughness.value, translucent->remaproughness);
+            break;
+        }
+        case minipbrt::MaterialType::Disney: {
+            auto disney     = static_cast<const minipbrt::DisneyMaterial*>(material);
+            pbr.albedo      = color(disney->color);
+            pbr.metallic    = disney->metallic.value;
+            pbr.roughness   = disney->roughness.value;
+            break;
+        }
+        case minipbrt::MaterialType::Metal: {
+            // Normal incidence Fresnel reflectance of a conductor, F0 = ((eta - 1)^2 + k^2) / ((eta + 1)^2 + k^2)
+            auto metal = static_cast<const minipbrt::MetalMaterial*>(material);
+            float f0[3];
+            for (int c = 0; c < 3; c++) {
+                float eta = metal->eta.value[c], k = metal->k.value[c];
+                f0[c] = ((eta - 1.0f) * (eta - 1.0f) + k * k) / ((eta + 1.0f) * (eta + 1.0f) + k * k);
+            }
+            pbr.albedo      = { f0[0], f0[1], f0[2] };
+            pbr.metallic    = 1.0f;
+            pbr.roughness   = perceptual_roughness(metal->uroughness.value, metal->vroughness.value, metal->remaproughness);
+            break;
+        }
+        case minipbrt::MaterialType::Mirror: {
+            auto mirror     = static_cast<const minipbrt::MirrorMaterial*>(material);
+            pbr.albedo      = color(mirror->Kr);
+            pbr.metallic    = 1.0f;
+            pbr.roughness   = 0.0f;
+            break;
+        }
+        case minipbrt::MaterialType::Glass: {
+            auto glass      = static_cast<const minipbrt::GlassMaterial*>(material);
+            pbr.albedo      = color(glass->Kt);
+            pbr.roughness   = perceptual_roughness(glass->uroughness.value, glass->vroughness.value, glass->remaproughness);
+            break;
+        }
+        case minipbrt::MaterialType::Mix: {
+            // Approximate a mix by its first material; the amount is usually a texture anyway
+            auto mix = static_cast<const minipbrt::MixMaterial*>(material);
+            if (depth < 4 && mix->namedmaterial1 < scene.materials.size()) {
+                pbr = material_to_pbr(scene, scene.materials[mix->namedmaterial1], depth + 1);
+            }
+            break;
+        }
+        default: {
+            // Fourier, hair, subsurface, and none materials keep the neutral defaults
+            break;
+        }
+    }
+    return pbr;
+}
+
+// Appends one object with the given mesh, transformed to world space (or to the space of the instanced object it belongs to). Normals are computed from the triangles if the mesh has none.
+void append_mesh(LoadScene::LoadedObj& loaded_obj, const minipbrt::TriangleMesh& mesh, const Matrix4& to_world, int material_id) {
+    Indices indices(mesh.indices, mesh.indices + mesh.num_indices);
+    Vertices vertices(mesh.num_vertices);
+    MaterialIndices material_indices(mesh.num_indices / 3U, static_cast<Index>(material_id));
+
+    // Normals transform by the inverse transpose, which is the cofactor matrix up to a scale (whose sign matters)
+    const float (*m)[4] = to_world;
+    float cofactor[3][3] = {
+        { m[1][1] * m[2][2] - m[1][2] * m[2][1], m[1][2] * m[2][0] - m[1][0] * m[2][2], m[1][0] * m[2][1] - m[1][1] * m[2][0] },
+        { m[0][2] * m[2][1] - m[0][1] * m[2][2], m[0][0] * m[2][2] - m[0][2] * m[2][0], m[0][1] * m[2][0] - m[0][0] * m[2][1] },
+        { m[0][1] * m[1][2] - m[0][2] * m[1][1], m[0][2] * m[1][0] - m[0][0] * m[1][2], m[0][0] * m[1][1] - m[0][1] * m[1][0] }
+    };
+    float determinant_sign = (m[0][0] * cofactor[0][0] + m[0][1] * cofactor[0][1] + m[0][2] * cofactor[0][2]) < 0.0f ? -1.0f : 1.0f;
+
+    for (unsigned int v = 0U; v < mesh.num_vertices; v++) {
+        vertices[v].position = transform_point(to_world, mesh.P + 3U * v);
+        if (mesh.N) {
+            const float* n = mesh.N + 3U * v;
+            vertices[v].normal = normalize({
+                determinant_sign * (cofactor[0][0] * n[0] + cofactor[0][1] * n[1] + cofactor[0][2] * n[2]),
+                determinant_sign * (cofactor[1][0] * n[0] + cofactor[1][1] * n[1] + cofactor[1][2] * n[2]),
+                determinant_sign * (cofactor[2][0] * n[0] + cofactor[2][1] * n[1] + cofactor[2][2] * n[2])
+            });
+        }
+    }
+
+    if (!mesh.N) {
+        // Area weighted average of the normals of all triangles sharing a vertex
+        std::vector<XMFLOAT3> normals(mesh.num_vertices, XMFLOAT3(0.0f, 0.0f, 0.0f));
+        for (size_t t = 0ULL; t + 2ULL < indices.size(); t += 3ULL) {
+            XMFLOAT3 p0 = vertices[indices[t]].position, p1 = vertices[indices[t + 1ULL]].position, p2 = vertices[indices[t + 2ULL]].position;
+            XMFLOAT3 e1 = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+            XMFLOAT3 e2 = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+            XMFLOAT3 face_normal = { e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x };
+            for (size_t k = 0ULL; k < 3ULL; k++) {
+                XMFLOAT3& normal = normals[indices[t + k]];
+                normal = { normal.x + face_normal.x, normal.y + face_normal.y, normal.z + face_normal.z };
+            }
+        }
+        for (unsigned int v = 0U; v < mesh.num_vertices; v++) {
+            vertices[v].normal = normalize(normals[v]);
+        }
+    }
+
+    loaded_obj.indices_per_object.push_back(std::move(indices));
+    loaded_obj.vertices_per_object.push_back(std::move(vertices));
+    loaded_obj.material_indices_per_object.push_back(std::move(material_indices));
+}
+}
+
+
+LoadScene::LoadedObj LoadScene::load_pbrt(std::string path) {
+    minipbrt::Loader loader;
+    if (!loader.load(path.c_str())) {
+        const minipbrt::Error* error = loader.error();
+        if (error) {
+            std::cerr << "minipbrt: " << error->filename() << ":" << error->line() << ":" << error->column() << ": " << error->message() << std::endl;
+        }
+        exit(EXIT_FAILURE);
+    }
+    std::unique_ptr<minipbrt::Scene> scene(loader.take_scene());
+
+    // Load PLY meshes in parallel, this is the parallel equivalent of Scene::load_all_ply_meshes() and dominates load time on large scenes.
+    // Scene::to_triangle_mesh() may be called concurrently as long as every thread converts different shapes.
+    const int num_shapes = static_cast<int>(scene->shapes.size());
+    int num_failed_shapes = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:num_failed_shapes)
+    for (int s = 0; s < num_shapes; s++) {
+        if (scene->shapes[s]->type() == minipbrt::ShapeType::PLYMesh && !scene->to_triangle_mesh(static_cast<uint32_t>(s))) {
+            num_failed_shapes++;
+        }
+    }
+    // The remaining convertible shapes are cheap to tessellate
+    minipbrt::Bits<minipbrt::ShapeType> other_convertible_types = minipbrt::ShapeType::HeightField | minipbrt::ShapeType::LoopSubdiv;
+    other_convertible_types.set(minipbrt::ShapeType::Nurbs);
+    scene->shapes_to_triangle_mesh(other_convertible_types, false);
+
+    LoadedObj loaded_obj = {};
+
+    // Materials map one to one, shapes without a material use the default material
+    for (const minipbrt::Material* material : scene->materials) {
+        loaded_obj.materials.push_back(material_to_pbr(*scene, material));
+    }
+    auto material_id = [&](const minipbrt::Shape* shape) {
+        return shape->material == minipbrt::kInvalidIndex ? -1 : static_cast<int>(shape->material);
+    };
+
+    // Every top level mesh becomes an object in world space
+    size_t num_unsupported_shapes = 0ULL;
+    for (const minipbrt::Shape* shape : scene->shapes) {
+        if (shape->type() != minipbrt::ShapeType::TriangleMesh) {
+            num_unsupported_shapes += shape->type() != minipbrt::ShapeType::PLYMesh ? 1ULL : 0ULL;
+        } else if (shape->object == minipbrt::kInvalidIndex) {
+            append_mesh(loaded_obj, *static_cast<const minipbrt::TriangleMesh*>(shape), shape->shapeToWorld.start, material_id(shape));
+        }
+    }
+
+    // The meshes of instanced objects are loaded once, when their object is first instanced, and every instance places all of them
+    if (!scene->instances.empty()) {
+        loaded_obj.instances = loaded_obj.object_instances();
+    }
+    const size_t no_objects = ~0ULL;
+    std::vector<std::pair<size_t, size_t>> object_meshes(scene->objects.size(), { no_objects, 0ULL }); // First object and count
+    for (const minipbrt::Instance* instance : scene->instances) {
+        std::pair<size_t, size_t>& meshes = object_meshes[instance->object];
+        if (meshes.first == no_objects) {
+            const minipbrt::Object* object  = scene->objects[instance->object];
+            meshes.first                    = loaded_obj.indices_per_object.size();
+            for (uint32_t s = object->firstShape; s < object->firstShape + object->numShapes; s++) {
+                const minipbrt::Shape* shape = scene->shapes[s];
+                if (shape->type() == minipbrt::ShapeType::TriangleMesh) {
+                    append_mesh(loaded_obj, *static_cast<const minipbrt::TriangleMesh*>(shape), shape->shapeToWorld.start, material_id(shape));
+                }
+            }
+            meshes.second = loaded_obj.indices_per_object.size() - meshes.first;
+        }
+
+        // Instances are affine, the bottom row of the matrix is ignored
+        const float (*m)[4] = instance->instanceToWorld.start;
+        ObjectInstance object_instance = {};
+        object_instance.transform = XMFLOAT3X4(m[0][0], m[0][1], m[0][2], m[0][3],
+                                               m[1][0], m[1][1], m[1][2], m[1][3],
+                                               m[2][0], m[2][1], m[2][2], m[2][3]);
+        for (size_t i = meshes.first; i < meshes.first + meshes.second; i++) {
+            object_instance.object = static_cast<uint32_t>(i);
+            loaded_obj.instances.push_back(object_instance);
+        }
+    }
+
+    // Point lights are supported directly, other light types are skipped
+    size_t num_unsupported_lights = 0ULL;
+    for (const minipbrt::Light* light : scene->lights) {
+        if (light->type() != minipbrt::LightType::Point) {
+            num_unsupported_lights++;
+            continue;
+        }
+        auto point_light = static_cast<const minipbrt::PointLight*>(light);
+        PointLight pl = {};
+        pl.position = transform_point(point_light->lightToWorld.start, point_light->from);
+        pl.color    = { point_light->I[0] * point_light->scale[0], point_light->I[1] * point_light->scale[1], point_light->I[2] * point_light->scale[2] };
+        loaded_obj.lights.push_back(pl);
+    }
+
+    std::cout << "LoadScene: loaded " << loaded_obj.indices_per_object.size() << " objects, " << loaded_obj.instances.size() << " instances, "
+              << loaded_obj.materials.size() << " materials, and "
+              << loaded_obj.lights.size() << " point lights from " << path << std::endl;
+    if (num_failed_shapes > 0 || num_unsupported_shapes > 0ULL || num_unsupported_lights > 0ULL) {
+        std::cout << "LoadScene: skipped " << num_failed_shapes << " unreadable PLY meshes, " << num_unsupported_shapes
+                  << " non-triangle shapes, and " << num_unsupported_lights << " non-point lights" << std::endl;
+    }
+
+    return loaded_obj;
+}
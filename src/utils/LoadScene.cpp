@@ -1,75 +1,263 @@
-#include "stdafx.h"
 #include "LoadScene.h"
+#include "AllocationCounter.h"
+#include "ParallelObjParser.h"
+#include "SceneCache.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
 #include "../tinyobjloader/tiny_obj_loader.h"
 
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <memory_resource>
+#include <unordered_map>
 
+namespace {
+// Geometry of a single output object while it is being assembled. The buffers are sized exactly up front and moved into the LoadedObj.
+// The welding map is scratch memory of the load.
+struct ObjectBuilder {
+    explicit ObjectBuilder(std::pmr::memory_resource* scratch) : welded_vertices(scratch) {}
 
-LoadScene::LoadedObj LoadScene::load_obj(std::string path) {
-    tinyobj::ObjReaderConfig reader_config;
-    tinyobj::ObjReader reader;
-    if (!reader.ParseFromFile(path, reader_config)) {
-        if (!reader.Error().empty()) {
-            std::cerr << "TinyObjReader: " << reader.Error();
+    size_t num_faces = 0ULL;
+    size_t num_face_corners = 0ULL;
+    Indices indices;
+    Vertices vertices;
+    MaterialIndices material_indices;
+    std::pmr::unordered_map<uint64_t, Index> welded_vertices; // (vertex_index, normal_index) -> index into vertices
+};
+
+uint64_t weld_key(const tinyobj::index_t& idx) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(idx.vertex_index)) << 32) | static_cast<uint32_t>(idx.normal_index);
+}
+}
+
+size_t LoadScene::LoadedObj::object_count() const {
+    return cache ? cache->object_count() : indices_per_object.size();
+}
+
+std::span<const Index> LoadScene::LoadedObj::object_indices(size_t object) const {
+    return cache ? cache->object_indices(object) : std::span<const Index>(indices_per_object[object]);
+}
+
+std::span<const Vertex> LoadScene::LoadedObj::object_vertices(size_t object) const {
+    return cache ? cache->object_vertices(object) : std::span<const Vertex>(vertices_per_object[object]);
+}
+
+std::span<const Index> LoadScene::LoadedObj::object_material_indices(size_t object) const {
+    return cache ? cache->object_material_indices(object) : std::span<const Index>(material_indices_per_object[object]);
+}
+
+std::span<const MaterialPBR> LoadScene::LoadedObj::material_data() const {
+    return cache ? cache->material_data() : std::span<const MaterialPBR>(materials);
+}
+
+std::vector<PointLight> LoadScene::LoadedObj::point_lights() const {
+    if (!lights.empty()) {
+        return lights;
+    }
+
+    // Fall back to a pair of dummy lights
+    PointLight p0 = {
+        .position = { 0.5f, 1.0f, -0.3f },
+        .color = { 0.35f, 0.35f, 0.35f }
+    };
+    PointLight p1 = {
+        .position = { -0.5f, 1.0f, 0.2f },
+        .color = { 0.65f, 0.65f, 0.65f }
+    };
+    return { p0, p1 };
+}
+
+std::vector<LoadScene::ObjectInstance> LoadScene::LoadedObj::object_instances() const {
+    if (!instances.empty()) {
+        return instances;
+    }
+
+    // Place every object once, as is
+    std::vector<ObjectInstance> identity_instances(object_count());
+    for (size_t i = 0ULL; i < identity_instances.size(); i++) {
+        identity_instances[i].transform = XMFLOAT3X4(1.0f, 0.0f, 0.0f, 0.0f,
+                                                     0.0f, 1.0f, 0.0f, 0.0f,
+                                                     0.0f, 0.0f, 1.0f, 0.0f);
+        identity_instances[i].object    = static_cast<uint32_t>(i);
+    }
+    return identity_instances;
+}
+
+LoadScene::BuildPreference LoadScene::LoadedObj::object_build_preference(size_t object) const {
+    return object < build_preferences.size() ? build_preferences[object] : BuildPreference::FastTrace;
+}
+
+LoadScene::LoadedObj LoadScene::load_scene(std::string path) {
+    // pbrt-v3 scenes are recognized by their extension and everything else is treated as an OBJ file
+    return std::filesystem::path(path).extension() == ".pbrt" ? load_pbrt(path) : load_obj(path, ObjectSplit::PerShape);
+}
+
+
+LoadScene::LoadedObj LoadScene::load_obj(std::string path, ObjectSplit split, ObjParser parser, SceneCacheMode cache_mode) {
+    // Count every heap allocation of the load, including those of the parser and of the output buffers
+    AllocationCounter::Scope load_allocations;
+
+    // Serve the scene straight from the cache if it is still up to date; every object split gets its own cache file
+    std::string cache_path = path + ".split" + std::to_string(static_cast<int>(split)) + ".scenecache";
+    if (cache_mode == SceneCacheMode::ReadWrite) {
+        LoadedObj cached_obj = {};
+        cached_obj.cache = SceneCache::open(cache_path, path, split);
+        if (cached_obj.cache) {
+            const AllocationCounter::Counts load_counts = load_allocations.GetCounts();
+            std::cout << "LoadScene: loaded " << cached_obj.object_count() << " objects from cache " << cache_path << " with "
+                      << load_counts.allocations << " heap allocations (" << load_counts.bytes << " bytes)" << std::endl;
+            return cached_obj;
+        }
+    }
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warning, error;
+    bool parsed;
+    if (parser == ObjParser::Parallel) {
+        parsed = parse_obj_parallel(path, attrib, shapes, materials, warning, error);
+    } else {
+        // Equivalent to tinyobj::ObjReader::ParseFromFile() with a default config, without copying the results out of the reader
+        size_t last_separator       = path.find_last_of("/\\");
+        std::string mtl_search_path = last_separator == std::string::npos ? std::string() : path.substr(0, last_separator);
+        parsed = tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, path.c_str(), mtl_search_path.c_str(), true, true);
+    }
+    if (!parsed) {
+        if (!error.empty()) {
+            std::cerr << "TinyObjReader: " << error;
         }
         exit(EXIT_FAILURE);
     }
-    if (!reader.Warning().empty()) {
-        std::cout << "TinyObjReader: " << reader.Warning();
+    if (!warning.empty()) {
+        std::cout << "TinyObjReader: " << warning;
     }
 
     LoadedObj loaded_obj = {};
-    auto& attrib    = reader.GetAttrib();
-    auto& shapes    = reader.GetShapes();
-    auto& materials = reader.GetMaterials();
+
+    size_t num_faces = 0ULL;
+    size_t num_face_corners = 0ULL;
+    for (const tinyobj::shape_t& shape : shapes) {
+        num_faces += shape.mesh.num_face_vertices.size();
+        num_face_corners += shape.mesh.indices.size();
+    }
+
+    // Scratch memory of the assembly is carved out of a monotonic arena sized for the face assignments, and released all at once when
+    // loading is done. The welding maps grow while they are filled, so they live in a pool that hands the bucket arrays they outgrow
+    // back to the heap and packs their nodes into a few large chunks.
+    AllocationCounter arena_blocks;
+    std::pmr::monotonic_buffer_resource arena(num_faces * sizeof(uint32_t), &arena_blocks);
+    std::pmr::unsynchronized_pool_resource welding_pool(&arena_blocks);
+    std::pmr::vector<uint32_t> face_objects(num_faces, &arena);
+    std::pmr::vector<ObjectBuilder> objects(&arena);
+    std::pmr::unordered_map<int, size_t> material_to_object(&arena);
+
+    // Assign every face to its output object, and count the faces and face corners of every object so their buffers can be sized up front.
+    // Face corners that reference the same (position, normal) pair within an object are welded into a single vertex, which gives the
+    // exact vertex count as well. Vertices are numbered in the order they are first referenced.
+    switch (split) {
+        case ObjectSplit::PerShape: { objects.reserve(shapes.size()); break; }
+        case ObjectSplit::PerMaterial: { objects.reserve(materials.size() + 1ULL); break; }
+        default: { objects.emplace_back(&welding_pool); break; }
+    }
+    size_t face = 0ULL;
+    for (size_t s = 0; s < shapes.size(); s++) {
+        if (split == ObjectSplit::PerShape) {
+            objects.emplace_back(&welding_pool);
+        }
+        size_t index_offset = 0;
+        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++, face++) {
+            size_t object = 0ULL;
+            if (split == ObjectSplit::PerShape) {
+                object = s;
+            } else if (split == ObjectSplit::PerMaterial) {
+                auto [mapping, inserted] = material_to_object.try_emplace(shapes[s].mesh.material_ids[f], objects.size());
+                if (inserted) { objects.emplace_back(&welding_pool); }
+                object = mapping->second;
+            }
+            face_objects[face]      = static_cast<uint32_t>(object);
+            ObjectBuilder& builder  = objects[object];
+            size_t fv               = size_t(shapes[s].mesh.num_face_vertices[f]);
+            builder.num_faces++;
+            builder.num_face_corners += fv;
+            for (size_t v = 0; v < fv; v++) {
+                // Ensure normals are present
+                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+                assert(idx.normal_index >= 0);
+                builder.welded_vertices.try_emplace(weld_key(idx), static_cast<Index>(builder.welded_vertices.size()));
+            }
+            index_offset += fv;
+        }
+    }
+
+    // An object has as many indices as face corners, one material index per face, and one vertex per welded (position, normal) pair
+    for (ObjectBuilder& object : objects) {
+        object.indices.reserve(object.num_face_corners);
+        object.material_indices.reserve(object.num_faces);
+        object.vertices.resize(object.welded_vertices.size());
+        for (const auto& [key, index] : object.welded_vertices) {
+            const size_t vertex_index   = static_cast<size_t>(key >> 32);
+            const size_t normal_index   = static_cast<size_t>(key & UINT32_MAX);
+            Vertex& vertex              = object.vertices[index];
+            // Positions
+            vertex.position.x = attrib.vertices[3 * vertex_index + 0];
+            vertex.position.y = attrib.vertices[3 * vertex_index + 1];
+            vertex.position.z = attrib.vertices[3 * vertex_index + 2];
+            // Normals
+            vertex.normal.x = attrib.normals[3 * normal_index + 0];
+            vertex.normal.y = attrib.normals[3 * normal_index + 1];
+            vertex.normal.z = attrib.normals[3 * normal_index + 2];
+        }
+    }
 
     // Loop over shapes
-    Indices loaded_indices;
-    Vertices loaded_vertices;
-    MaterialIndices loaded_material_indices;
+    // Indices are relative to the object's own vertex buffer, not to the shape or the whole file
+    face = 0ULL;
     for (size_t s = 0; s < shapes.size(); s++) {
         // Loop over faces(polygon)
         size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++, face++) {
             // Material index for this face
-            loaded_material_indices.push_back(shapes[s].mesh.material_ids[f]);
+            int material_id         = shapes[s].mesh.material_ids[f];
+            ObjectBuilder& object   = objects[face_objects[face]];
+            object.material_indices.push_back(material_id);
 
             // Loop over vertices in the face.
             size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
             for (size_t v = 0; v < fv; v++) {
-                // Get face index and ensure normals are present
                 tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                assert(idx.normal_index >= 0);
-
-                // Index data
-                loaded_indices.push_back(static_cast<UINT32>(index_offset + v));
-
-                // Process vertex data
-                Vertex vertex = {};
-                // Positions
-                vertex.position.x = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-                vertex.position.y = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-                vertex.position.z = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-                // Normals
-                vertex.normal.x = attrib.normals[3 * size_t(idx.normal_index) + 0];
-                vertex.normal.y = attrib.normals[3 * size_t(idx.normal_index) + 1];
-                vertex.normal.z = attrib.normals[3 * size_t(idx.normal_index) + 2];
-                // Push vertex data to return object
-                loaded_vertices.push_back(vertex);
+                object.indices.push_back(object.welded_vertices.find(weld_key(idx))->second);
             }
 
             index_offset += fv;
         }
     }
 
-    // Add loaded shapes as a single object in the return struct
-    loaded_obj.indices_per_object.push_back(loaded_indices);
-    loaded_obj.vertices_per_object.push_back(loaded_vertices);
-    loaded_obj.material_indices_per_object.push_back(loaded_material_indices);
+    // Add every non-empty object to the return struct (shapes without faces, e.g. point or line only shapes, produce no object)
+    size_t num_welded_vertices = 0ULL;
+    loaded_obj.indices_per_object.reserve(objects.size());
+    loaded_obj.vertices_per_object.reserve(objects.size());
+    loaded_obj.material_indices_per_object.reserve(objects.size());
+    for (ObjectBuilder& object : objects) {
+        if (object.indices.empty()) {
+            continue;
+        }
+        num_welded_vertices += object.vertices.size();
+        loaded_obj.indices_per_object.push_back(std::move(object.indices));
+        loaded_obj.vertices_per_object.push_back(std::move(object.vertices));
+        loaded_obj.material_indices_per_object.push_back(std::move(object.material_indices));
+    }
+
+    // Report how much vertex memory welding saved compared to emitting one vertex per face corner
+    size_t welded_bytes_saved = (num_face_corners - num_welded_vertices) * sizeof(Vertex);
+    std::cout << "LoadScene: welded " << num_face_corners << " face corners into " << num_welded_vertices
+              << " vertices across " << loaded_obj.indices_per_object.size() << " objects (" << welded_bytes_saved << " bytes saved)" << std::endl;
 
     // Loop over materials
+    loaded_obj.materials.reserve(materials.size());
     for (const tinyobj::material_t& material : materials) {
         MaterialPBR pbr = {};
 
@@ -77,12 +265,12 @@ LoadScene::LoadedObj LoadScene::load_obj(std::string path) {
         float albedo_normalizing_factor_r = material.diffuse[0] + material.specular[0];
         pbr.albedo.x = (material.diffuse[0] / albedo_normalizing_factor_r) * material.diffuse[0] + (material.specular[0] / albedo_normalizing_factor_r) * material.specular[0];
         float albedo_normalizing_factor_g = material.diffuse[1] + material.specular[1];
-        pbr.albedo.y = (material.diffuse[1] / albedo_normalizing_factor_r) * material.diffuse[1] + (material.specular[1] / albedo_normalizing_factor_r) * material.specular[1];
+        pbr.albedo.y = (material.diffuse[1] / albedo_normalizing_factor_g) * material.diffuse[1] + (material.specular[1] / albedo_normalizing_factor_g) * material.specular[1];
         float albedo_normalizing_factor_b = material.diffuse[2] + material.specular[2];
-        pbr.albedo.z = (material.diffuse[2] / albedo_normalizing_factor_r) * material.diffuse[2] + (material.specular[2] / albedo_normalizing_factor_r) * material.specular[2];
+        pbr.albedo.z = (material.diffuse[2] / albedo_normalizing_factor_b) * material.diffuse[2] + (material.specular[2] / albedo_normalizing_factor_b) * material.specular[2];
 
         // Compute roughness as a weighted average of specular components
-        float specular_normalizing_factor = max(material.specular[0] + material.specular[1] + material.specular[2], 0.001f);
+        float specular_normalizing_factor = (std::max)(material.specular[0] + material.specular[1] + material.specular[2], 0.001f);
         float shininess = (material.specular[0] / specular_normalizing_factor) * material.specular[0] +
             (material.specular[1] / specular_normalizing_factor) * material.specular[1] +
             (material.specular[2] / specular_normalizing_factor) * material.specular[2];
@@ -94,5 +282,48 @@ LoadScene::LoadedObj LoadScene::load_obj(std::string path) {
         loaded_obj.materials.push_back(pbr);
     }
 
+    // Apart from the output buffers, the arena's and the pool's blocks are the only heap allocations of the assembly, the rest are the parser's
+    const AllocationCounter::Counts load_counts     = load_allocations.GetCounts();
+    const AllocationCounter::Counts& arena_counts   = arena_blocks.GetCounts();
+    std::cout << "LoadScene: loaded " << path << " with " << load_counts.allocations << " heap allocations (" << load_counts.bytes
+              << " bytes), the assembly's scratch memory took " << arena_counts.allocations << " of them (" << arena_counts.bytes << " bytes)" << std::endl;
+
+    if (cache_mode == SceneCacheMode::ReadWrite && !SceneCache::write(cache_path, path, split, loaded_obj)) {
+        std::cout << "LoadScene: failed to write cache " << cache_path << std::endl;
+    }
+
     return loaded_obj;
 }
+
+
+void LoadScene::benchmark_obj_parsers(std::string path, ObjectSplit split) {
+    using Clock = std::chrono::steady_clock;
+    auto time_load = [&](ObjParser parser, LoadedObj& loaded_obj) {
+        Clock::time_point start = Clock::now();
+        loaded_obj              = load_obj(path, split, parser, SceneCacheMode::Disabled);
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+    auto same_data = [](const auto& lhs, const auto& rhs) {
+        if (lhs.size() != rhs.size()) { return false; }
+        for (size_t i = 0ULL; i < lhs.size(); i++) {
+            if (lhs[i].size() != rhs[i].size() || memcmp(lhs[i].data(), rhs[i].data(), lhs[i].size() * sizeof(lhs[i][0])) != 0) { return false; }
+        }
+        return true;
+    };
+
+    LoadedObj single_threaded, parallel;
+    double single_threaded_seconds  = time_load(ObjParser::TinyObj, single_threaded);
+    double parallel_seconds         = time_load(ObjParser::Parallel, parallel);
+    bool identical = same_data(single_threaded.indices_per_object, parallel.indices_per_object) &&
+                     same_data(single_threaded.vertices_per_object, parallel.vertices_per_object) &&
+                     same_data(single_threaded.material_indices_per_object, parallel.material_indices_per_object) &&
+                     single_threaded.materials.size() == parallel.materials.size() &&
+                     memcmp(single_threaded.materials.data(), parallel.materials.data(), parallel.materials.size() * sizeof(MaterialPBR)) == 0;
+
+    double megabytes = static_cast<double>(std::filesystem::file_size(path)) / (1024.0 * 1024.0);
+    std::cout << std::fixed << std::setprecision(2)
+              << "LoadScene benchmark: " << path << " (" << megabytes << " MB)\n"
+              << "    tinyobj:  " << single_threaded_seconds << " s, " << megabytes / single_threaded_seconds << " MB/s\n"
+              << "    parallel: " << parallel_seconds << " s, " << megabytes / parallel_seconds << " MB/s (" << single_threaded_seconds / parallel_seconds << "x)\n"
+              << "    results " << (identical ? "identical" : "DIFFER") << std::endl;
+}
\ No newline at end of file
@@ -1,13 +1,52 @@
 #pragma once
 
-#include "../hlsl/RayTracingHlslCompat.h"
-#include "stdafx.h"
+#include "../hlsl/SceneHlslCompat.h"
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
 
 using Indices			= std::vector<Index>;
 using Vertices			= std::vector<Vertex>;
 using MaterialIndices	= std::vector<Index>;
 
 namespace LoadScene {
+// Controls how the faces of an OBJ file are grouped into objects (one BLAS is built per object)
+enum class ObjectSplit {
+	SingleObject,	// All shapes are flattened into a single object
+	PerShape,		// Every tinyobj shape (o/g statement) becomes its own object
+	PerMaterial		// Faces are grouped by material, regardless of the shape they belong to
+};
+
+// Front-end used to parse OBJ text
+enum class ObjParser {
+	TinyObj,	// Single-threaded tinyobj::LoadObj
+	Parallel	// Memory mapped, multithreaded tokenizer producing identical results (see ParallelObjParser.h)
+};
+
+// Whether load_obj may serve the scene from, and store it to, a binary cache next to the OBJ file (see SceneCache.h)
+enum class SceneCacheMode {
+	Disabled,
+	ReadWrite
+};
+
+// How an object's acceleration structure trades build time for trace performance, for objects that are rebuilt often (animated or edited)
+// or traced a lot. Selects the BLAS build flags on the GPU and the BVH builder of the CPU renderer.
+enum class BuildPreference : uint8_t {
+	FastTrace,	// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE, binned SAH BVH on the CPU
+	Balanced,	// Neither flag, LBVH followed by treelet reoptimization on the CPU
+	FastBuild	// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD, LBVH on the CPU
+};
+
+class SceneCache;
+
+// Placement of an object in the scene, the counterpart of a D3D12_RAYTRACING_INSTANCE_DESC
+struct ObjectInstance {
+	XMFLOAT3X4 transform;	// Object to world, row major with the translation in the last column like D3D12_RAYTRACING_INSTANCE_DESC::Transform
+	uint32_t object;		// Index of the instanced object, which is also the InstanceID() the shaders see
+};
+
 struct LoadedObj {
 	// Geometry
 	std::vector<Indices> indices_per_object;
@@ -16,8 +55,48 @@ struct LoadedObj {
 
 	// Materials
 	std::vector<MaterialPBR> materials;
+
+	// Lights, only provided by scene formats that describe them (empty for OBJ files)
+	std::vector<PointLight> lights;
+
+	// Instances, only provided by scene formats that support instancing (empty if every object is placed once, as is)
+	std::vector<ObjectInstance> instances;
+
+	// Per object, empty if every object prefers fast tracing. Not provided by any scene format, but set by the application.
+	std::vector<BuildPreference> build_preferences;
+
+	// Set when the scene is served straight from a memory mapped cache, in which case the vectors above are empty.
+	// The accessors below work for both cases and should be used by anything consuming the scene.
+	std::shared_ptr<const SceneCache> cache;
+
+	size_t object_count() const;
+	std::span<const Index> object_indices(size_t object) const;
+	std::span<const Vertex> object_vertices(size_t object) const;
+	std::span<const Index> object_material_indices(size_t object) const;
+	std::span<const MaterialPBR> material_data() const;
+
+	// Lights the scene is rendered with, a pair of default lights if the scene does not provide any
+	std::vector<PointLight> point_lights() const;
+
+	// Instances the scene is rendered with, one instance with an identity transform per object if the scene does not provide any
+	std::vector<ObjectInstance> object_instances() const;
+
+	BuildPreference object_build_preference(size_t object) const;
 };
 
-LoadedObj load_obj(std::string path);
+LoadedObj load_obj(std::string path, ObjectSplit split = ObjectSplit::SingleObject, ObjParser parser = ObjParser::Parallel,
+				   SceneCacheMode cache_mode = SceneCacheMode::ReadWrite);
+
+// Loads a pbrt-v3 scene through minipbrt. Triangle meshes (including PLY meshes, which are loaded in parallel) become one object each.
+// Top level meshes are transformed to world space, while the meshes of instanced objects are loaded once and placed by one instance per
+// pbrt instance. Materials are approximated by MaterialPBR and point lights are converted to PointLight; other shapes and light types
+// are skipped.
+LoadedObj load_pbrt(std::string path);
+
+// Loads a pbrt-v3 scene if the path has a .pbrt extension and an OBJ file with one object per shape otherwise
+LoadedObj load_scene(std::string path);
+
+// Loads the given OBJ file with both parsers, reports their throughput in MB/s, and checks that they produce the same LoadedObj
+void benchmark_obj_parsers(std::string path, ObjectSplit split = ObjectSplit::SingleObject);
 }
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. The mapping is released when the object is destroyed.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) { return false; }
+        LARGE_INTEGER fileSize = {};
+        if (!GetFileSizeEx(m_file, &fileSize)) { Close(); return false; }
+        m_size = static_cast<size_t>(fileSize.QuadPart);
+        if (m_size == 0) { return true; } // Empty files cannot be mapped, but are valid
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping == nullptr) { Close(); return false; }
+        m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        m_file = open(path.c_str(), O_RDONLY);
+        if (m_file < 0) { return false; }
+        struct stat fileStat = {};
+        if (fstat(m_file, &fileStat) != 0) { Close(); return false; }
+        m_size = static_cast<size_t>(fileStat.st_size);
+        if (m_size == 0) { return true; }
+        void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+        m_data = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+#endif
+        if (m_data == nullptr) { Close(); return false; }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_data)                         { UnmapViewOfFile(m_data); }
+        if (m_mapping)                      { CloseHandle(m_mapping); }
+        if (m_file != INVALID_HANDLE_VALUE) { CloseHandle(m_file); }
+        m_mapping   = nullptr;
+        m_file      = INVALID_HANDLE_VALUE;
+#else
+        if (m_data)         { munmap(const_cast<char*>(m_data), m_size); }
+        if (m_file >= 0)    { close(m_file); }
+        m_file      = -1;
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    // Accessors
+    const char* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+#ifdef _WIN32
+    HANDLE m_file       = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping    = nullptr;
+#else
+    int m_file          = -1;
+#endif
+    const char* m_data  = nullptr;
+    size_t m_size       = 0;
+};
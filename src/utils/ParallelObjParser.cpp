@@ -0,0 +1,413 @@
+#include "ParallelObjParser.h"
+#include "MappedFile.h"
+
+// The tinyobjloader implementation lives in this translation unit so that the parallel parser can reuse tinyobj's own
+// number and index parsing routines, which guarantees bit-identical results to the single-threaded reader.
+// The header has already been included above, so only the implementation section is expanded here.
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../tinyobjloader/tiny_obj_loader.h"
+
+#include <omp.h>
+#include <map>
+#include <set>
+
+
+namespace {
+// Largest polygon the parallel path triangulates itself (triangles and quads, using tinyobj's shortest diagonal split)
+constexpr size_t MaxParallelFaceCorners = 4ULL;
+
+// Face corner as written in the file. Relative (negative) indices are stored relative to the start of their chunk
+// and flagged as such in the face's relative mask, since the number of preceding records is only known after merging.
+struct RawCorner {
+    int v;
+    int vt;
+    int vn;
+};
+
+enum class EventType {
+    Group,
+    Object,
+    UseMtl,
+    MtlLib
+};
+
+// Structural statement that changes how the faces following it are grouped
+struct Event {
+    EventType type;
+    size_t face;            // Number of faces parsed in this chunk before the event
+    std::string argument;
+};
+
+struct Chunk {
+    const char* begin;
+    const char* end;
+
+    // Tokenized records
+    std::vector<tinyobj::real_t> positions;
+    std::vector<tinyobj::real_t> normals;
+    size_t num_texcoords = 0ULL;
+    std::vector<RawCorner> corners;
+    std::vector<uint32_t> face_corner_offsets = { 0U }; // Face f uses corners [offsets[f], offsets[f + 1])
+    std::vector<uint16_t> face_relative_masks;          // 3 bits (v, vt, vn) per corner
+    std::vector<Event> events;
+
+    // Diagnostics
+    bool has_large_polygon = false;
+    bool has_zero_vertex_index = false;
+};
+
+// Contiguous range of faces of a single chunk that share a shape and material
+struct FaceRun {
+    size_t chunk;
+    size_t face_begin;
+    size_t face_end;
+    size_t shape;
+    int material_id;
+    size_t num_triangles;
+    size_t triangle_offset; // Offset of the run's first triangle within its shape
+};
+
+void tokenize_chunk(Chunk& chunk) {
+    std::string line;
+    const char* cursor = chunk.begin;
+    while (cursor < chunk.end) {
+        const char* line_end = static_cast<const char*>(memchr(cursor, '\n', chunk.end - cursor));
+        if (!line_end) { line_end = chunk.end; }
+
+        // Copy the line so tinyobj's parsing routines see a null-terminated string without the line break
+        line.assign(cursor, line_end);
+        cursor = line_end + 1;
+        if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+
+        const char* token = line.c_str();
+        token += strspn(token, " \t");
+        if (token[0] == '\0' || token[0] == '#') {
+            continue;
+        }
+
+        if (token[0] == 'v' && IS_SPACE(token[1])) {
+            token += 2;
+            tinyobj::real_t x, y, z;
+            tinyobj::parseReal3(&x, &y, &z, &token);
+            chunk.positions.insert(chunk.positions.end(), { x, y, z });
+        } else if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2])) {
+            token += 3;
+            tinyobj::real_t x, y, z;
+            tinyobj::parseReal3(&x, &y, &z, &token);
+            chunk.normals.insert(chunk.normals.end(), { x, y, z });
+        } else if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2])) {
+            chunk.num_texcoords++;
+        } else if (token[0] == 'f' && IS_SPACE(token[1])) {
+            token += 2;
+            token += strspn(token, " \t");
+
+            const int num_positions = static_cast<int>(chunk.positions.size() / 3ULL);
+            const int num_normals   = static_cast<int>(chunk.normals.size() / 3ULL);
+            const int num_texcoords = static_cast<int>(chunk.num_texcoords);
+            uint16_t relative_mask  = 0U;
+            size_t num_corners      = 0ULL;
+            while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+                tinyobj::vertex_index_t raw = tinyobj::parseRawTriple(&token);
+                token += strspn(token, " \t\r");
+
+                // Mirror tinyobj's fixIndex(): positive indices are 1-based, zero is only allowed for attributes, negative indices are relative
+                auto resolve = [&](int idx, int count, uint16_t relative_bit) {
+                    if (idx > 0) { return idx - 1; }
+                    if (idx == 0) { return -1; }
+                    if (num_corners < MaxParallelFaceCorners) { relative_mask |= relative_bit << (3U * num_corners); }
+                    return count + idx;
+                };
+                chunk.has_zero_vertex_index |= (raw.v_idx == 0);
+                chunk.corners.push_back({ resolve(raw.v_idx, num_positions, 1U), resolve(raw.vt_idx, num_texcoords, 2U), resolve(raw.vn_idx, num_normals, 4U) });
+                num_corners++;
+            }
+
+            chunk.has_large_polygon |= (num_corners > MaxParallelFaceCorners);
+            chunk.face_corner_offsets.push_back(static_cast<uint32_t>(chunk.corners.size()));
+            chunk.face_relative_masks.push_back(relative_mask);
+        } else if (0 == strncmp(token, "usemtl", 6)) {
+            token += 6;
+            chunk.events.push_back({ EventType::UseMtl, chunk.face_relative_masks.size(), tinyobj::parseString(&token) });
+        } else if (0 == strncmp(token, "mtllib", 6) && IS_SPACE(token[6])) {
+            chunk.events.push_back({ EventType::MtlLib, chunk.face_relative_masks.size(), std::string(token + 7) });
+        } else if (token[0] == 'g' && IS_SPACE(token[1])) {
+            chunk.events.push_back({ EventType::Group, chunk.face_relative_masks.size(), std::string() });
+        } else if (token[0] == 'o' && IS_SPACE(token[1])) {
+            chunk.events.push_back({ EventType::Object, chunk.face_relative_masks.size(), std::string() });
+        }
+    }
+}
+}
+
+
+bool LoadScene::parse_obj_parallel(const std::string& path, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+                                   std::vector<tinyobj::material_t>& materials, std::string& warn, std::string& err) {
+    // Materials are searched for in the directory of the OBJ file, like tinyobj::ObjReader does by default
+    std::string mtl_search_path;
+    size_t last_separator = path.find_last_of("/\\");
+    if (last_separator != std::string::npos) {
+        mtl_search_path = path.substr(0, last_separator);
+    }
+
+    MappedFile file;
+    if (!file.Open(path)) {
+        err += "Cannot open file [" + path + "]\n";
+        return false;
+    }
+
+    // Split the file into line-aligned chunks, several per thread to balance uneven record mixes
+    const size_t num_threads        = static_cast<size_t>(omp_get_max_threads());
+    const size_t min_chunk_size     = 1ULL << 20;
+    const size_t num_chunks_target  = std::max<size_t>(1ULL, std::min<size_t>(num_threads * 4ULL, file.Size() / min_chunk_size));
+    const char* file_begin          = file.Data();
+    const char* file_end            = file.Data() + file.Size();
+    std::vector<Chunk> chunks;
+    chunks.reserve(num_chunks_target);
+    const char* chunk_begin = file_begin;
+    for (size_t c = 1ULL; c <= num_chunks_target && chunk_begin < file_end; c++) {
+        const char* chunk_end = c == num_chunks_target ? file_end : file_begin + (file.Size() / num_chunks_target) * c;
+        chunk_end = std::max(chunk_end, chunk_begin);
+        const char* line_break = static_cast<const char*>(memchr(chunk_end, '\n', file_end - chunk_end));
+        chunk_end = line_break ? line_break + 1 : file_end;
+        chunks.emplace_back();
+        chunks.back().begin = chunk_begin;
+        chunks.back().end   = chunk_end;
+        chunk_begin = chunk_end;
+    }
+
+    // Tokenize all chunks in parallel
+    const int num_chunks = static_cast<int>(chunks.size());
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < num_chunks; c++) {
+        tokenize_chunk(chunks[c]);
+    }
+
+    // Polygons which tinyobj would ear clip are rare enough to simply hand the whole file to tinyobj
+    for (const Chunk& chunk : chunks) {
+        if (chunk.has_large_polygon) {
+            file.Close();
+            return tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str(), mtl_search_path.c_str(), true, true);
+        }
+        if (chunk.has_zero_vertex_index) {
+            err += "Failed to parse `f' line (e.g. a zero value for vertex index or invalid relative vertex index).\n";
+            return false;
+        }
+    }
+
+    // Determine where every chunk's records start in the merged attribute arrays
+    std::vector<size_t> position_bases(chunks.size() + 1ULL, 0ULL);
+    std::vector<size_t> normal_bases(chunks.size() + 1ULL, 0ULL);
+    std::vector<size_t> texcoord_bases(chunks.size() + 1ULL, 0ULL);
+    for (size_t c = 0ULL; c < chunks.size(); c++) {
+        position_bases[c + 1ULL]    = position_bases[c] + chunks[c].positions.size() / 3ULL;
+        normal_bases[c + 1ULL]      = normal_bases[c] + chunks[c].normals.size() / 3ULL;
+        texcoord_bases[c + 1ULL]    = texcoord_bases[c] + chunks[c].num_texcoords;
+    }
+
+    // Merge vertex attributes
+    attrib.vertices.resize(position_bases.back() * 3ULL);
+    attrib.normals.resize(normal_bases.back() * 3ULL);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < num_chunks; c++) {
+        std::copy(chunks[c].positions.begin(), chunks[c].positions.end(), attrib.vertices.begin() + position_bases[c] * 3ULL);
+        std::copy(chunks[c].normals.begin(), chunks[c].normals.end(), attrib.normals.begin() + normal_bases[c] * 3ULL);
+        chunks[c].positions = {};
+        chunks[c].normals   = {};
+    }
+
+    // Walk the structural statements in file order to assign a shape and material to every run of faces.
+    // This mirrors tinyobj: every g/o statement starts a new shape and faces keep the material that was active when they were parsed.
+    std::vector<FaceRun> runs;
+    std::map<std::string, int> material_map;
+    std::set<std::string> material_filenames;
+    tinyobj::MaterialFileReader material_reader(mtl_search_path);
+    int material_id = -1;
+    size_t shape    = 0ULL;
+    for (size_t c = 0ULL; c < chunks.size(); c++) {
+        size_t face_cursor = 0ULL;
+        auto emit_run = [&](size_t face_end) {
+            if (face_end > face_cursor) {
+                runs.push_back({ c, face_cursor, face_end, shape, material_id, 0ULL, 0ULL });
+            }
+            face_cursor = face_end;
+        };
+
+        for (const Event& event : chunks[c].events) {
+            emit_run(event.face);
+            switch (event.type) {
+                case EventType::Group:
+                case EventType::Object: {
+                    shape++;
+                    break;
+                }
+                case EventType::UseMtl: {
+                    auto material = material_map.find(event.argument);
+                    if (material == material_map.end()) {
+                        warn += "material [ '" + event.argument + "' ] not found in .mtl\n";
+                        material_id = -1;
+                    } else {
+                        material_id = material->second;
+                    }
+                    break;
+                }
+                case EventType::MtlLib: {
+                    std::vector<std::string> filenames;
+                    tinyobj::SplitString(event.argument, ' ', '\\', filenames);
+                    if (filenames.empty()) {
+                        warn += "Looks like empty filename for mtllib. Use default material.\n";
+                        break;
+                    }
+                    bool found = false;
+                    for (const std::string& filename : filenames) {
+                        if (material_filenames.count(filename) > 0) {
+                            found = true;
+                            continue;
+                        }
+                        std::string warn_mtl, err_mtl;
+                        bool ok = material_reader(filename, &materials, &material_map, &warn_mtl, &err_mtl);
+                        warn    += warn_mtl;
+                        err     += err_mtl;
+                        if (ok) {
+                            found = true;
+                            material_filenames.insert(filename);
+                            break;
+                        }
+                    }
+                    if (!found) {
+                        warn += "Failed to load material file(s). Use default material.\n";
+                    }
+                    break;
+                }
+            }
+        }
+        emit_run(chunks[c].face_relative_masks.size());
+    }
+
+    // Resolve a corner's indices against the merged attribute arrays
+    auto resolve_corner = [&](size_t c, size_t corner, size_t corner_in_face, uint16_t relative_mask) {
+        const RawCorner& raw = chunks[c].corners[corner];
+        tinyobj::index_t idx;
+        uint16_t corner_mask    = corner_in_face < MaxParallelFaceCorners ? (relative_mask >> (3U * corner_in_face)) : 0U;
+        idx.vertex_index        = raw.v + ((corner_mask & 1U) ? static_cast<int>(position_bases[c]) : 0);
+        idx.texcoord_index      = raw.vt + ((corner_mask & 2U) ? static_cast<int>(texcoord_bases[c]) : 0);
+        idx.normal_index        = raw.vn + ((corner_mask & 4U) ? static_cast<int>(normal_bases[c]) : 0);
+        return idx;
+    };
+
+    // Count the triangles every run produces, dropping the same faces tinyobj drops
+    const int num_runs          = static_cast<int>(runs.size());
+    const size_t num_positions  = position_bases.back();
+    std::vector<size_t> num_degenerate_faces(runs.size(), 0ULL);
+    std::vector<size_t> num_invalid_faces(runs.size(), 0ULL);
+    std::vector<char> has_invalid_relative_index(runs.size(), 0);
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int r = 0; r < num_runs; r++) {
+        FaceRun& run        = runs[r];
+        const Chunk& chunk  = chunks[run.chunk];
+        for (size_t f = run.face_begin; f < run.face_end; f++) {
+            const size_t corner_begin   = chunk.face_corner_offsets[f];
+            const size_t num_corners    = chunk.face_corner_offsets[f + 1ULL] - corner_begin;
+            bool valid_indices          = true;
+            for (size_t k = 0ULL; k < num_corners; k++) {
+                tinyobj::index_t idx = resolve_corner(run.chunk, corner_begin + k, k, chunk.face_relative_masks[f]);
+                has_invalid_relative_index[r] |= (idx.vertex_index < 0);
+                valid_indices &= (idx.vertex_index >= 0 && static_cast<size_t>(idx.vertex_index) < num_positions);
+            }
+
+            if (num_corners < 3ULL) {
+                num_degenerate_faces[r]++;
+            } else if (num_corners == 3ULL) {
+                run.num_triangles += 1ULL;
+            } else if (valid_indices) {
+                run.num_triangles += 2ULL;
+            } else {
+                num_invalid_faces[r]++;
+            }
+        }
+    }
+    for (size_t r = 0ULL; r < runs.size(); r++) {
+        if (has_invalid_relative_index[r]) {
+            err += "Failed to parse `f' line (e.g. a zero value for vertex index or invalid relative vertex index).\n";
+            return false;
+        }
+        for (size_t i = 0ULL; i < num_degenerate_faces[r]; i++) { warn += "Degenerated face found\n."; }
+        for (size_t i = 0ULL; i < num_invalid_faces[r]; i++)    { warn += "Face with invalid vertex index found.\n"; }
+    }
+
+    // Lay out every shape's triangles, skipping shapes without any (like tinyobj does)
+    std::vector<size_t> shape_triangle_counts(shape + 1ULL, 0ULL);
+    for (FaceRun& run : runs) {
+        run.triangle_offset                 = shape_triangle_counts[run.shape];
+        shape_triangle_counts[run.shape]    += run.num_triangles;
+    }
+    std::vector<size_t> shape_output_index(shape + 1ULL, SIZE_MAX);
+    for (size_t s = 0ULL; s <= shape; s++) {
+        if (shape_triangle_counts[s] == 0ULL) {
+            continue;
+        }
+        shape_output_index[s] = shapes.size();
+        tinyobj::shape_t& output_shape = shapes.emplace_back();
+        output_shape.mesh.indices.resize(shape_triangle_counts[s] * 3ULL);
+        output_shape.mesh.num_face_vertices.assign(shape_triangle_counts[s], 3U);
+        output_shape.mesh.material_ids.resize(shape_triangle_counts[s]);
+        output_shape.mesh.smoothing_group_ids.assign(shape_triangle_counts[s], 0U);
+    }
+
+    // Emit triangles in parallel; quads are split along their shorter diagonal exactly like tinyobj does
+    const std::vector<tinyobj::real_t>& v = attrib.vertices;
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int r = 0; r < num_runs; r++) {
+        const FaceRun& run  = runs[r];
+        const Chunk& chunk  = chunks[run.chunk];
+        if (run.num_triangles == 0ULL) {
+            continue;
+        }
+        tinyobj::mesh_t& mesh   = shapes[shape_output_index[run.shape]].mesh;
+        size_t triangle         = run.triangle_offset;
+        auto emit_triangle = [&](const tinyobj::index_t& a, const tinyobj::index_t& b, const tinyobj::index_t& c) {
+            mesh.indices[3ULL * triangle + 0ULL]    = a;
+            mesh.indices[3ULL * triangle + 1ULL]    = b;
+            mesh.indices[3ULL * triangle + 2ULL]    = c;
+            mesh.material_ids[triangle]             = run.material_id;
+            triangle++;
+        };
+
+        for (size_t f = run.face_begin; f < run.face_end; f++) {
+            const size_t corner_begin   = chunk.face_corner_offsets[f];
+            const size_t num_corners    = chunk.face_corner_offsets[f + 1ULL] - corner_begin;
+            if (num_corners < 3ULL) {
+                continue;
+            }
+            tinyobj::index_t idx[MaxParallelFaceCorners];
+            bool valid_indices = true;
+            for (size_t k = 0ULL; k < num_corners; k++) {
+                idx[k]          = resolve_corner(run.chunk, corner_begin + k, k, chunk.face_relative_masks[f]);
+                valid_indices   &= static_cast<size_t>(idx[k].vertex_index) < num_positions;
+            }
+
+            if (num_corners == 3ULL) {
+                emit_triangle(idx[0], idx[1], idx[2]);
+            } else if (valid_indices) {
+                const size_t vi0 = size_t(idx[0].vertex_index), vi1 = size_t(idx[1].vertex_index);
+                const size_t vi2 = size_t(idx[2].vertex_index), vi3 = size_t(idx[3].vertex_index);
+                tinyobj::real_t e02x = v[vi2 * 3 + 0] - v[vi0 * 3 + 0];
+                tinyobj::real_t e02y = v[vi2 * 3 + 1] - v[vi0 * 3 + 1];
+                tinyobj::real_t e02z = v[vi2 * 3 + 2] - v[vi0 * 3 + 2];
+                tinyobj::real_t e13x = v[vi3 * 3 + 0] - v[vi1 * 3 + 0];
+                tinyobj::real_t e13y = v[vi3 * 3 + 1] - v[vi1 * 3 + 1];
+                tinyobj::real_t e13z = v[vi3 * 3 + 2] - v[vi1 * 3 + 2];
+                tinyobj::real_t sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+                tinyobj::real_t sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+                if (sqr02 < sqr13) {
+                    emit_triangle(idx[0], idx[1], idx[2]);
+                    emit_triangle(idx[0], idx[2], idx[3]);
+                } else {
+                    emit_triangle(idx[0], idx[1], idx[3]);
+                    emit_triangle(idx[1], idx[2], idx[3]);
+                }
+            }
+        }
+    }
+
+    return true;
+}
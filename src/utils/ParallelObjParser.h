@@ -0,0 +1,17 @@
+#pragma once
+
+#include "../tinyobjloader/tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+namespace LoadScene {
+// Multithreaded replacement for tinyobj::ObjReader::ParseFromFile with the default reader config (triangulation enabled,
+// materials searched for next to the OBJ file).
+// The file is memory mapped and split into line-aligned chunks whose v/vn/f records are tokenized in parallel, after which
+// the chunks are merged into the same vertex positions, normals, shapes, and materials that tinyobj would have produced.
+// Texture coordinates, vertex colors, lines, points, and tags are not kept as LoadScene does not use them.
+// Files containing polygons with more than 4 vertices fall back to tinyobj, whose ear clipping is not replicated here.
+bool parse_obj_parallel(const std::string& path, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+                        std::vector<tinyobj::material_t>& materials, std::string& warn, std::string& err);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// Storage types of DirectXMath that the scene data is declared with. Windows builds use DirectXMath itself, other platforms get
+// stand-ins with the same layout and constructors, so the scene loaders and the CPU renderer build without the Windows SDK. Only
+// the storage types are provided, the SIMD types and the math functions (XMVECTOR, XMMATRIX, ...) remain Windows only.
+#if defined(_WIN32)
+#include <DirectXMath.h>
+#else
+namespace DirectX {
+struct XMFLOAT3 {
+    float x;
+    float y;
+    float z;
+
+    XMFLOAT3() = default;
+    constexpr XMFLOAT3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+};
+
+struct XMFLOAT3X4 {
+    float m[3][4];
+
+    XMFLOAT3X4() = default;
+    constexpr XMFLOAT3X4(float m00, float m01, float m02, float m03,
+                         float m10, float m11, float m12, float m13,
+                         float m20, float m21, float m22, float m23)
+        : m{ { m00, m01, m02, m03 }, { m10, m11, m12, m13 }, { m20, m21, m22, m23 } } {}
+};
+}
+#endif
@@ -0,0 +1,149 @@
+#include "ResidencyPolicy.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+ResidencyPolicy::ResidencyPolicy(Order order, uint32_t minIdleFrames, float budgetFraction) :
+    m_order(order),
+    m_minIdleFrames(minIdleFrames),
+    m_budgetFraction(budgetFraction)
+{
+    assert(budgetFraction > 0.0f && budgetFraction <= 1.0f);
+}
+
+uint32_t ResidencyPolicy::AddObject(uint64_t footprint)
+{
+    // New objects count as used in frame 0, before the first Update()
+    Object object;
+    object.footprint = footprint;
+    m_objects.push_back(object);
+    m_residentBytes += footprint;
+    return static_cast<uint32_t>(m_objects.size() - 1);
+}
+
+void ResidencyPolicy::Clear()
+{
+    m_objects.clear();
+    m_residentBytes = 0;
+    m_decisions.evict.clear();
+    m_decisions.restore.clear();
+}
+
+void ResidencyPolicy::Use(uint32_t object)
+{
+    assert(object < m_objects.size());
+    m_objects[object].used = true;
+}
+
+void ResidencyPolicy::SetDistance(uint32_t object, float distance)
+{
+    assert(object < m_objects.size());
+    m_objects[object].distance = distance;
+}
+
+const ResidencyPolicy::Decisions& ResidencyPolicy::Update(uint64_t frame, const Budget& budget)
+{
+    m_decisions.evict.clear();
+    m_decisions.restore.clear();
+    for (Object& object : m_objects)
+    {
+        assert(object.lastUsedFrame < frame);
+        if (object.used)
+        {
+            object.lastUsedFrame    = frame;
+            object.used             = false;
+        }
+    }
+
+    const uint64_t target   = static_cast<uint64_t>(static_cast<double>(budget.budgetBytes) * m_budgetFraction);
+    uint64_t usage          = budget.usageBytes;
+
+    // Evicted objects that are in use again ask to be restored, nearest first
+    m_requests.clear();
+    uint64_t requestedBytes = 0;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_objects.size()); i++)
+    {
+        if (!m_objects[i].resident && m_objects[i].lastUsedFrame == frame)
+        {
+            m_requests.push_back(i);
+            requestedBytes += m_objects[i].footprint;
+        }
+    }
+    std::sort(m_requests.begin(), m_requests.end(), [this](uint32_t a, uint32_t b) {
+        return m_objects[a].distance != m_objects[b].distance ? m_objects[a].distance < m_objects[b].distance : a < b;
+    });
+
+    // Evict idle objects until usage is back within the target with room for the requests. Ties are broken by index to keep the
+    // decisions deterministic.
+    if (usage + requestedBytes > target)
+    {
+        m_candidates.clear();
+        for (uint32_t i = 0; i < static_cast<uint32_t>(m_objects.size()); i++)
+        {
+            if (m_objects[i].resident && frame - m_objects[i].lastUsedFrame >= m_minIdleFrames)
+            {
+                m_candidates.push_back(i);
+            }
+        }
+        auto leastRecentlyUsed = [this](uint32_t a, uint32_t b) {
+            const Object& objectA = m_objects[a];
+            const Object& objectB = m_objects[b];
+            if (objectA.lastUsedFrame != objectB.lastUsedFrame)
+            {
+                return objectA.lastUsedFrame < objectB.lastUsedFrame;
+            }
+            return objectA.distance != objectB.distance ? objectA.distance > objectB.distance : a < b;
+        };
+        auto farthest = [this](uint32_t a, uint32_t b) {
+            const Object& objectA = m_objects[a];
+            const Object& objectB = m_objects[b];
+            if (objectA.distance != objectB.distance)
+            {
+                return objectA.distance > objectB.distance;
+            }
+            return objectA.lastUsedFrame != objectB.lastUsedFrame ? objectA.lastUsedFrame < objectB.lastUsedFrame : a < b;
+        };
+        if (m_order == Order::LeastRecentlyUsed)
+        {
+            std::sort(m_candidates.begin(), m_candidates.end(), leastRecentlyUsed);
+        }
+        else
+        {
+            std::sort(m_candidates.begin(), m_candidates.end(), farthest);
+        }
+
+        for (uint32_t candidate : m_candidates)
+        {
+            if (usage + requestedBytes <= target)
+            {
+                break;
+            }
+            Object& object          = m_objects[candidate];
+            object.resident         = false;
+            usage                   -= (std::min)(object.footprint, usage);
+            m_residentBytes         -= object.footprint;
+            m_stats.evictedBytes    += object.footprint;
+            m_stats.evictions++;
+            m_decisions.evict.push_back(candidate);
+        }
+    }
+
+    // Restore the requests that fit, the rest stay evicted for now
+    for (uint32_t request : m_requests)
+    {
+        Object& object = m_objects[request];
+        if (usage + object.footprint > target)
+        {
+            m_stats.deferredRestores++;
+            continue;
+        }
+        object.resident         = true;
+        usage                   += object.footprint;
+        m_residentBytes         += object.footprint;
+        m_stats.restoredBytes   += object.footprint;
+        m_stats.restores++;
+        m_decisions.restore.push_back(request);
+    }
+    return m_decisions;
+}
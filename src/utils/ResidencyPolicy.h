@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Decides which objects of a scene stay resident in video memory when the scene does not fit into the budget. Objects are evicted and
+// restored whole, an object's footprint being all memory that goes with it. Every frame the objects in use are marked with Use(), then
+// Update() compares the memory usage against the budget: if it is over budget, objects that have been idle for a few frames are
+// evicted, least recently used or farthest from the camera first, and evicted objects that are in use again are restored as long as
+// they fit. Objects in use are never evicted, so usage may stay over budget. This is pure bookkeeping without any device access.
+class ResidencyPolicy
+{
+public:
+    enum class Order
+    {
+        LeastRecentlyUsed,
+        Farthest
+    };
+
+    struct Budget
+    {
+        uint64_t usageBytes;    // Memory used by the whole process, including all resident objects
+        uint64_t budgetBytes;
+    };
+
+    struct Decisions
+    {
+        std::vector<uint32_t> evict;
+        std::vector<uint32_t> restore;
+    };
+
+    struct Stats
+    {
+        uint64_t evictedBytes       = 0;
+        uint64_t restoredBytes      = 0;
+        uint32_t evictions          = 0;
+        uint32_t restores           = 0;
+        uint32_t deferredRestores   = 0;    // Frames an object in use stayed evicted for because it did not fit into the budget
+    };
+
+    // Usage is kept below this fraction of the budget, which leaves room for allocations the policy does not know about
+    static constexpr float DefaultBudgetFraction = 0.9f;
+
+    // An object that was used within minIdleFrames frames may still be in use by the GPU, so it is not evicted
+    explicit ResidencyPolicy(Order order, uint32_t minIdleFrames, float budgetFraction = DefaultBudgetFraction);
+
+    // Register a resident object and return its index
+    uint32_t AddObject(uint64_t footprint);
+    void Clear();
+
+    // Mark an object as in use in the frame of the next Update()
+    void Use(uint32_t object);
+    void SetDistance(uint32_t object, float distance);
+
+    // Decide which objects to evict and restore for frame, which has to increase with every call. The decisions take effect right away.
+    const Decisions& Update(uint64_t frame, const Budget& budget);
+
+    // Accessors
+    size_t ObjectCount() const { return m_objects.size(); }
+    bool IsResident(uint32_t object) const { return m_objects[object].resident; }
+    uint64_t ResidentBytes() const { return m_residentBytes; }
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    struct Object
+    {
+        uint64_t footprint;
+        uint64_t lastUsedFrame  = 0;
+        float    distance       = 0.0f;
+        bool     resident       = true;
+        bool     used           = false;    // Used since the last Update()
+    };
+
+    Order                   m_order;
+    uint32_t                m_minIdleFrames;
+    float                   m_budgetFraction;
+    std::vector<Object>     m_objects;
+    uint64_t                m_residentBytes = 0;
+    Decisions               m_decisions;
+    std::vector<uint32_t>   m_requests;         // Scratch space of Update()
+    std::vector<uint32_t>   m_candidates;
+    Stats                   m_stats;
+};
@@ -0,0 +1,310 @@
+#include "SceneCache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+
+namespace {
+constexpr uint64_t FnvOffsetBasis   = 14695981039346656037ULL;
+constexpr uint64_t FnvPrime         = 1099511628211ULL;
+constexpr size_t HashBlockSize      = 1ULL << 22;
+
+uint64_t fnv1a(uint64_t hash, const char* data, size_t size) {
+    // Consume 8 bytes at a time, the result is only compared against hashes computed by this same function
+    size_t i = 0ULL;
+    for (; i + 8ULL <= size; i += 8ULL) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * FnvPrime;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * FnvPrime;
+    }
+    return hash;
+}
+
+uint64_t align_offset(uint64_t offset) {
+    return (offset + LoadScene::SceneCache::SectionAlignment - 1ULL) & ~(LoadScene::SceneCache::SectionAlignment - 1ULL);
+}
+
+int64_t last_write_time(const std::string& path) {
+    std::error_code error;
+    auto write_time = std::filesystem::last_write_time(path, error);
+    return error ? 0LL : static_cast<int64_t>(write_time.time_since_epoch().count());
+}
+
+// Names of the material libraries an OBJ file references, split like tinyobj splits mtllib statements
+std::vector<std::string> material_library_names(const MappedFile& source) {
+    std::vector<std::string> names;
+    auto add_name = [&names](std::string& name) {
+        if (!name.empty() && std::find(names.begin(), names.end(), name) == names.end()) {
+            names.push_back(name);
+        }
+        name.clear();
+    };
+    const char* end = source.Data() + source.Size();
+    for (const char* line = source.Data(); line < end;) {
+        const char* line_end = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end - line)));
+        line_end = line_end ? line_end : end;
+        // The mapping is not null terminated, so the line is only scanned up to its end
+        const char* token = line;
+        while (token < line_end && (*token == ' ' || *token == '\t')) {
+            token++;
+        }
+        if (line_end - token > 7 && strncmp(token, "mtllib", 6) == 0 && (token[6] == ' ' || token[6] == '\t')) {
+            std::string name;
+            bool escaping = false;
+            for (const char* c = token + 7; c < line_end && *c != '\r'; c++) {
+                if (!escaping && *c == '\\') {
+                    escaping = true;
+                    continue;
+                }
+                if (!escaping && *c == ' ') {
+                    add_name(name);
+                    continue;
+                }
+                escaping = false;
+                name += *c;
+            }
+            add_name(name);
+        }
+        line = line_end + 1;
+    }
+    return names;
+}
+
+// Material libraries are looked up in the directory of the OBJ file, like the parsers do
+std::string material_library_path(const std::string& source_path, const std::string& name) {
+    size_t last_separator = source_path.find_last_of("/\\");
+    return last_separator == std::string::npos ? name : source_path.substr(0, last_separator + 1) + name;
+}
+
+// Compares a file against what was recorded when the cache was written. Returns false if it changed, and sets write_time_changed if
+// only its write time did, in which case the contents were hashed to make sure.
+bool file_unchanged(const std::string& path, uint64_t size, int64_t write_time, uint64_t hash, bool& write_time_changed) {
+    std::error_code error;
+    uint64_t current_size = std::filesystem::file_size(path, error);
+    current_size = error ? LoadScene::SceneCache::MissingFileSize : current_size;
+    write_time_changed = false;
+    if (current_size != size) {
+        return false;
+    }
+    if (size == LoadScene::SceneCache::MissingFileSize || last_write_time(path) == write_time) {
+        return true;
+    }
+    MappedFile file;
+    if (!file.Open(path) || LoadScene::SceneCache::hash_contents(file) != hash) {
+        return false;
+    }
+    write_time_changed = true;
+    return true;
+}
+}
+
+
+uint64_t LoadScene::SceneCache::hash_contents(const MappedFile& file) {
+    const int num_blocks = static_cast<int>((file.Size() + HashBlockSize - 1ULL) / HashBlockSize);
+    std::vector<uint64_t> block_hashes(num_blocks);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < num_blocks; b++) {
+        size_t block_begin  = static_cast<size_t>(b) * HashBlockSize;
+        size_t block_size   = (std::min)(HashBlockSize, file.Size() - block_begin);
+        block_hashes[b]     = fnv1a(FnvOffsetBasis, file.Data() + block_begin, block_size);
+    }
+    return fnv1a(FnvOffsetBasis ^ file.Size(), reinterpret_cast<const char*>(block_hashes.data()), block_hashes.size() * sizeof(uint64_t));
+}
+
+std::shared_ptr<const LoadScene::SceneCache> LoadScene::SceneCache::open(const std::string& cache_path, const std::string& source_path, ObjectSplit split) {
+    std::shared_ptr<SceneCache> cache = std::make_shared<SceneCache>();
+    if (!cache->m_file.Open(cache_path) || cache->m_file.Size() < sizeof(SceneCacheHeader)) {
+        return nullptr;
+    }
+
+    // Validate format and layout
+    SceneCacheHeader& header = cache->m_header;
+    memcpy(&header, cache->m_file.Data(), sizeof(SceneCacheHeader));
+    if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version ||
+        header.object_split != static_cast<uint32_t>(split) || header.index_size != sizeof(Index) ||
+        header.vertex_size != sizeof(Vertex) || header.material_size != sizeof(MaterialPBR) ||
+        header.file_size != cache->m_file.Size()) {
+        return nullptr;
+    }
+    auto section_in_bounds = [&](uint64_t offset, uint64_t count, uint64_t element_size) {
+        return offset % SectionAlignment == 0ULL && offset <= header.file_size && count <= (header.file_size - offset) / element_size;
+    };
+    if (!section_in_bounds(header.objects_offset, header.num_objects, sizeof(SceneCacheObject)) ||
+        !section_in_bounds(header.materials_offset, header.num_materials, sizeof(MaterialPBR)) ||
+        !section_in_bounds(header.material_files_offset, header.num_material_files, sizeof(SceneCacheMaterialFile)) ||
+        !section_in_bounds(header.material_file_names_offset, header.material_file_names_size, sizeof(char))) {
+        return nullptr;
+    }
+    std::span<const SceneCacheMaterialFile> material_files = { cache->section<SceneCacheMaterialFile>(header.material_files_offset), header.num_material_files };
+    for (const SceneCacheMaterialFile& material_file : material_files) {
+        if (material_file.name_offset > header.material_file_names_size ||
+            material_file.name_length > header.material_file_names_size - material_file.name_offset) {
+            return nullptr;
+        }
+    }
+    cache->m_objects = { cache->section<SceneCacheObject>(header.objects_offset), header.num_objects };
+    for (const SceneCacheObject& object : cache->m_objects) {
+        if (!section_in_bounds(object.indices_offset, object.num_indices, sizeof(Index)) ||
+            !section_in_bounds(object.vertices_offset, object.num_vertices, sizeof(Vertex)) ||
+            !section_in_bounds(object.material_indices_offset, object.num_material_indices, sizeof(Index))) {
+            return nullptr;
+        }
+    }
+
+    // Validate the source and its material libraries. Only hash their contents if the cheap size and write time checks are
+    // inconclusive, and remember the new write times of those that turn out to be unchanged.
+    std::vector<std::pair<uint64_t, int64_t>> refreshed_write_times;
+    bool write_time_changed;
+    if (!file_unchanged(source_path, header.source_size, header.source_write_time, header.source_hash, write_time_changed)) {
+        return nullptr;
+    }
+    if (write_time_changed) {
+        header.source_write_time = last_write_time(source_path);
+        refreshed_write_times.emplace_back(offsetof(SceneCacheHeader, source_write_time), header.source_write_time);
+    }
+    const char* material_file_names = cache->section<char>(header.material_file_names_offset);
+    for (size_t i = 0ULL; i < material_files.size(); i++) {
+        const SceneCacheMaterialFile& material_file = material_files[i];
+        std::string path = material_library_path(source_path, std::string(material_file_names + material_file.name_offset, material_file.name_length));
+        if (!file_unchanged(path, material_file.size, material_file.write_time, material_file.hash, write_time_changed)) {
+            return nullptr;
+        }
+        if (write_time_changed) {
+            refreshed_write_times.emplace_back(header.material_files_offset + i * sizeof(SceneCacheMaterialFile) + offsetof(SceneCacheMaterialFile, write_time),
+                                               last_write_time(path));
+        }
+    }
+
+    // Store the new write times so the next run does not have to hash the files again. The mapping does not allow writing to the
+    // file on all platforms, so it is released while the write times are updated in place. Failing to update them is harmless.
+    if (!refreshed_write_times.empty()) {
+        cache->m_file.Close();
+        {
+            std::fstream cache_file(cache_path, std::ios::binary | std::ios::in | std::ios::out);
+            for (const auto& [offset, write_time] : refreshed_write_times) {
+                cache_file.seekp(static_cast<std::streamoff>(offset));
+                cache_file.write(reinterpret_cast<const char*>(&write_time), sizeof(write_time));
+            }
+        }
+        if (!cache->m_file.Open(cache_path) || cache->m_file.Size() != header.file_size) {
+            return nullptr;
+        }
+        cache->m_objects = { cache->section<SceneCacheObject>(header.objects_offset), header.num_objects };
+    }
+
+    return cache;
+}
+
+bool LoadScene::SceneCache::write(const std::string& cache_path, const std::string& source_path, ObjectSplit split, const LoadedObj& loaded_obj) {
+    MappedFile source;
+    if (!source.Open(source_path)) {
+        return false;
+    }
+
+    // Lay out all sections
+    SceneCacheHeader header = {};
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version              = Version;
+    header.object_split         = static_cast<uint32_t>(split);
+    header.index_size           = sizeof(Index);
+    header.vertex_size          = sizeof(Vertex);
+    header.material_size        = sizeof(MaterialPBR);
+    header.num_objects          = static_cast<uint32_t>(loaded_obj.object_count());
+    header.num_materials        = loaded_obj.material_data().size();
+    header.source_size          = source.Size();
+    header.source_write_time    = last_write_time(source_path);
+    header.source_hash          = hash_contents(source);
+
+    // Identify the material libraries the same way, including those that do not exist (yet)
+    std::vector<SceneCacheMaterialFile> material_files;
+    std::string material_file_names;
+    for (const std::string& name : material_library_names(source)) {
+        std::string path = material_library_path(source_path, name);
+        SceneCacheMaterialFile material_file = {};
+        material_file.name_offset   = material_file_names.size();
+        material_file.name_length   = name.size();
+        material_file.size          = MissingFileSize;
+        MappedFile file;
+        if (file.Open(path)) {
+            material_file.size          = file.Size();
+            material_file.write_time    = last_write_time(path);
+            material_file.hash          = hash_contents(file);
+        }
+        material_files.push_back(material_file);
+        material_file_names += name;
+    }
+    header.num_material_files           = material_files.size();
+    header.material_file_names_size     = material_file_names.size();
+
+    header.objects_offset               = align_offset(sizeof(SceneCacheHeader));
+    header.materials_offset             = align_offset(header.objects_offset + header.num_objects * sizeof(SceneCacheObject));
+    header.material_files_offset        = align_offset(header.materials_offset + header.num_materials * sizeof(MaterialPBR));
+    header.material_file_names_offset   = align_offset(header.material_files_offset + header.num_material_files * sizeof(SceneCacheMaterialFile));
+    uint64_t offset                     = align_offset(header.material_file_names_offset + header.material_file_names_size);
+    std::vector<SceneCacheObject> objects(header.num_objects);
+    for (size_t i = 0ULL; i < objects.size(); i++) {
+        objects[i].num_indices                  = loaded_obj.object_indices(i).size();
+        objects[i].num_vertices                 = loaded_obj.object_vertices(i).size();
+        objects[i].num_material_indices         = loaded_obj.object_material_indices(i).size();
+        objects[i].indices_offset               = offset;
+        objects[i].vertices_offset              = align_offset(objects[i].indices_offset + objects[i].num_indices * sizeof(Index));
+        objects[i].material_indices_offset      = align_offset(objects[i].vertices_offset + objects[i].num_vertices * sizeof(Vertex));
+        offset                                  = align_offset(objects[i].material_indices_offset + objects[i].num_material_indices * sizeof(Index));
+    }
+    header.file_size = offset;
+
+    // Write to a temporary file first so that an interrupted write never leaves a cache that looks valid
+    std::string temporary_path = cache_path + ".tmp";
+    {
+        std::ofstream cache_file(temporary_path, std::ios::binary | std::ios::trunc);
+        if (!cache_file) {
+            return false;
+        }
+        auto write_section = [&](uint64_t section_offset, const void* data, size_t size) {
+            static const char padding[SectionAlignment] = {};
+            cache_file.write(padding, static_cast<std::streamsize>(section_offset - static_cast<uint64_t>(cache_file.tellp())));
+            cache_file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        };
+        cache_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_section(header.objects_offset, objects.data(), objects.size() * sizeof(SceneCacheObject));
+        write_section(header.materials_offset, loaded_obj.material_data().data(), loaded_obj.material_data().size_bytes());
+        write_section(header.material_files_offset, material_files.data(), material_files.size() * sizeof(SceneCacheMaterialFile));
+        write_section(header.material_file_names_offset, material_file_names.data(), material_file_names.size());
+        for (size_t i = 0ULL; i < objects.size(); i++) {
+            write_section(objects[i].indices_offset, loaded_obj.object_indices(i).data(), loaded_obj.object_indices(i).size_bytes());
+            write_section(objects[i].vertices_offset, loaded_obj.object_vertices(i).data(), loaded_obj.object_vertices(i).size_bytes());
+            write_section(objects[i].material_indices_offset, loaded_obj.object_material_indices(i).data(), loaded_obj.object_material_indices(i).size_bytes());
+        }
+        write_section(header.file_size, nullptr, 0ULL);
+        if (!cache_file) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary_path, cache_path, error);
+    return !error;
+}
+
+std::span<const Index> LoadScene::SceneCache::object_indices(size_t object) const {
+    return { section<Index>(m_objects[object].indices_offset), m_objects[object].num_indices };
+}
+
+std::span<const Vertex> LoadScene::SceneCache::object_vertices(size_t object) const {
+    return { section<Vertex>(m_objects[object].vertices_offset), m_objects[object].num_vertices };
+}
+
+std::span<const Index> LoadScene::SceneCache::object_material_indices(size_t object) const {
+    return { section<Index>(m_objects[object].material_indices_offset), m_objects[object].num_material_indices };
+}
+
+std::span<const MaterialPBR> LoadScene::SceneCache::material_data() const {
+    return { section<MaterialPBR>(m_header.materials_offset), m_header.num_materials };
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "LoadScene.h"
+#include "MappedFile.h"
+
+namespace LoadScene {
+// Versioned binary snapshot of a LoadedObj which can be memory mapped and used without copying.
+//
+// Layout (all offsets are relative to the start of the file, every section starts on a SectionAlignment boundary):
+//   SceneCacheHeader
+//   SceneCacheObject[num_objects]
+//   MaterialPBR[num_materials]
+//   SceneCacheMaterialFile[num_material_files], char[material_file_names_size]
+//   per object: Index[num_indices], Vertex[num_vertices], Index[num_material_indices]
+//
+// A cache is only used if it was produced from the same source file with the same object split, and the material libraries the
+// source references with mtllib are unchanged. Every file is identified by its size and last write time, and by a content hash if
+// only its write time changed (e.g. after a checkout) to avoid needless rebuilds. The write time in the cache is updated then, so
+// the file is only hashed once.
+class SceneCache {
+public:
+	static constexpr char Magic[8]				= { 'D', 'X', 'R', 'S', 'C', 'N', '\0', '\0' };
+	static constexpr uint32_t Version			= 3U;
+	static constexpr uint64_t SectionAlignment	= 64ULL;
+	// Size recorded for a referenced material library that does not exist, the cache becomes stale if it appears
+	static constexpr uint64_t MissingFileSize	= UINT64_MAX;
+
+	struct SceneCacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t object_split;
+		// Layout validation, the cache is only valid for the struct definitions it was written with
+		uint32_t index_size;
+		uint32_t vertex_size;
+		uint32_t material_size;
+		uint32_t num_objects;
+		uint64_t num_materials;
+		// Source identification
+		uint64_t source_size;
+		int64_t source_write_time;
+		uint64_t source_hash;
+		uint64_t num_material_files;
+		// Section locations
+		uint64_t objects_offset;
+		uint64_t materials_offset;
+		uint64_t material_files_offset;
+		uint64_t material_file_names_offset;
+		uint64_t material_file_names_size;
+		uint64_t file_size;
+	};
+
+	// Material library referenced by the source, identified like the source itself
+	struct SceneCacheMaterialFile {
+		uint64_t name_offset;	// Relative to the names section, the name is relative to the directory of the source like in the mtllib statement
+		uint64_t name_length;
+		uint64_t size;
+		int64_t write_time;
+		uint64_t hash;
+	};
+
+	struct SceneCacheObject {
+		uint64_t indices_offset;
+		uint64_t num_indices;
+		uint64_t vertices_offset;
+		uint64_t num_vertices;
+		uint64_t material_indices_offset;
+		uint64_t num_material_indices;
+	};
+
+	// Maps the cache at cache_path and validates it against source_path. Returns nullptr if the cache is missing or stale.
+	static std::shared_ptr<const SceneCache> open(const std::string& cache_path, const std::string& source_path, ObjectSplit split);
+
+	// Serializes loaded_obj, which was loaded from source_path with the given split, to cache_path
+	static bool write(const std::string& cache_path, const std::string& source_path, ObjectSplit split, const LoadedObj& loaded_obj);
+
+	// Content hash of a whole file. Blocks are hashed in parallel, but the result does not depend on the number of threads.
+	static uint64_t hash_contents(const MappedFile& file);
+
+	// Accessors
+	size_t object_count() const { return m_objects.size(); }
+	std::span<const Index> object_indices(size_t object) const;
+	std::span<const Vertex> object_vertices(size_t object) const;
+	std::span<const Index> object_material_indices(size_t object) const;
+	std::span<const MaterialPBR> material_data() const;
+
+private:
+	template <typename T>
+	const T* section(uint64_t offset) const { return reinterpret_cast<const T*>(m_file.Data() + offset); }
+
+	MappedFile m_file;
+	SceneCacheHeader m_header = {};
+	std::span<const SceneCacheObject> m_objects;
+};
+}
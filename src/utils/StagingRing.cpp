@@ -0,0 +1,95 @@
+#include "StagingRing.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+StagingRing::StagingRing(StagingQueue& queue, uint64_t chunkSize, uint32_t chunkCount) :
+    m_queue(queue),
+    m_layout(chunkSize),
+    m_chunkFenceValues(chunkCount, 0),
+    m_chunkBytesUsed(chunkCount, 0)
+{
+    assert(chunkSize > 0 && chunkCount > 0);
+}
+
+StagingRing::Allocation StagingRing::Allocate(uint64_t size, uint64_t alignment)
+{
+    // The layout decides when data moves on to a new chunk, the ring maps every new chunk to the next slot of staging memory
+    UploadLayout::Placement placement = m_layout.Allocate(size, alignment);
+    if (!m_chunkOpen || placement.chunk != m_openLayoutChunk)
+    {
+        Submit();
+        Open();
+        m_openLayoutChunk = placement.chunk;
+    }
+
+    Allocation allocation       = { static_cast<uint64_t>(m_chunk) * ChunkSize() + placement.offset, placement.size };
+    m_chunkBytesUsed[m_chunk]   = m_layout.ChunkBytesUsed();
+    m_stats.bytesAllocated      = m_layout.TotalSize();
+    m_stats.peakBytesInFlight   = (std::max)(m_stats.peakBytesInFlight, BytesInFlight());
+    return allocation;
+}
+
+void StagingRing::Open()
+{
+    if (m_chunkOpen)
+    {
+        return;
+    }
+
+    // Chunks are opened round robin, so this only waits if the GPU is more than ChunkCount() submissions behind
+    m_chunkOpen = true;
+    if (m_chunkFenceValues[m_chunk] > m_queue.CompletedFenceValue())
+    {
+        m_stats.waits++;
+        m_queue.WaitForFenceValue(m_chunkFenceValues[m_chunk]);
+    }
+    m_chunkBytesUsed[m_chunk] = 0;
+    m_queue.BeginChunk(m_chunk);
+}
+
+void StagingRing::Flush()
+{
+    // Later allocations must not be placed behind the data of the submitted chunk
+    Submit();
+    m_layout.CloseChunk();
+}
+
+void StagingRing::Submit()
+{
+    if (!m_chunkOpen)
+    {
+        return;
+    }
+
+    m_chunkFenceValues[m_chunk] = m_queue.SubmitChunk(m_chunk);
+    m_stats.submissions++;
+    m_chunkOpen = false;
+    m_chunk     = (m_chunk + 1) % ChunkCount();
+}
+
+void StagingRing::Finish()
+{
+    Flush();
+    uint64_t lastFenceValue = *std::max_element(m_chunkFenceValues.begin(), m_chunkFenceValues.end());
+    if (lastFenceValue > m_queue.CompletedFenceValue())
+    {
+        m_queue.WaitForFenceValue(lastFenceValue);
+    }
+}
+
+uint64_t StagingRing::BytesInFlight()
+{
+    // The open chunk plus every submitted chunk the GPU has not finished with
+    uint64_t completedFenceValue    = m_queue.CompletedFenceValue();
+    uint64_t bytesInFlight          = 0;
+    for (uint32_t chunk = 0; chunk < ChunkCount(); chunk++)
+    {
+        if ((chunk == m_chunk && m_chunkOpen) || m_chunkFenceValues[chunk] > completedFenceValue)
+        {
+            bytesInFlight += m_chunkBytesUsed[chunk];
+        }
+    }
+    return bytesInFlight;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "UploadLayout.h"
+
+#include <cstdint>
+#include <vector>
+
+// Queue that executes the copies recorded into staging chunks. The ring only schedules work through this interface,
+// so it can be driven by a D3D12 command queue and fence as well as by a fake queue without any device.
+class StagingQueue
+{
+public:
+    virtual ~StagingQueue() = default;
+
+    // Start recording copies that read from the given chunk. The chunk's previous submission has completed at this point.
+    virtual void BeginChunk(uint32_t chunk) = 0;
+
+    // Submit all copies recorded since BeginChunk() and return the fence value that signals their completion
+    virtual uint64_t SubmitChunk(uint32_t chunk) = 0;
+
+    virtual uint64_t CompletedFenceValue() = 0;
+    virtual void WaitForFenceValue(uint64_t fenceValue) = 0;
+};
+
+// Bounded staging memory split into a fixed number of equally sized chunks that are used round robin.
+// Data is packed into the open chunk until it is full, at which point the chunk is submitted and the next one is opened,
+// waiting for its previous submission only if the GPU has not caught up yet. This overlaps CPU packing with GPU copies while
+// never using more than ChunkSize() * ChunkCount() bytes of staging memory, regardless of the amount of data uploaded.
+class StagingRing
+{
+public:
+    // Region of staging memory returned by Allocate(), offsets are relative to the start of the whole ring
+    struct Allocation
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Stats
+    {
+        uint64_t bytesAllocated     = 0;    // Including alignment padding
+        uint64_t peakBytesInFlight  = 0;    // Largest amount of staging memory referenced by open or unfinished chunks
+        uint32_t submissions        = 0;
+        uint32_t waits              = 0;    // Number of times a chunk was still in use by the GPU when it was needed again
+    };
+
+    StagingRing(StagingQueue& queue, uint64_t chunkSize, uint32_t chunkCount);
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    // Allocate staging memory for up to size bytes. Requests that do not fit into the open chunk move on to the next one.
+    // Requests larger than a chunk are split: the returned allocation may be smaller than size, in which case the caller
+    // copies that part and calls Allocate() again for the remainder.
+    Allocation Allocate(uint64_t size, uint64_t alignment = UploadLayout::DefaultAlignment);
+
+    // Submit the open chunk, if any
+    void Flush();
+
+    // Submit the open chunk and wait for all submissions to complete
+    void Finish();
+
+    // Accessors
+    uint64_t ChunkSize() const { return m_layout.ChunkSize(); }
+    uint32_t ChunkCount() const { return static_cast<uint32_t>(m_chunkFenceValues.size()); }
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    void Open();
+    void Submit();
+    uint64_t BytesInFlight();
+
+    StagingQueue&           m_queue;
+    UploadLayout            m_layout;
+    std::vector<uint64_t>   m_chunkFenceValues;     // Fence value of every chunk's last submission, 0 if never submitted
+    std::vector<uint64_t>   m_chunkBytesUsed;       // Bytes used by every chunk's last (or current) use
+    uint32_t                m_chunk             = 0;    // Slot of the open (or next) chunk
+    uint64_t                m_openLayoutChunk   = 0;    // Layout chunk index of the open chunk
+    bool                    m_chunkOpen         = false;
+    Stats                   m_stats;
+};
@@ -0,0 +1,33 @@
+#include "UploadLayout.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+UploadLayout::UploadLayout(uint64_t chunkSize) :
+    m_chunkSize(chunkSize)
+{
+    assert(chunkSize > 0);
+}
+
+UploadLayout::Placement UploadLayout::Allocate(uint64_t size, uint64_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0 && alignment <= m_chunkSize);
+
+    // Only split requests which would not even fit into an empty chunk, everything else moves on to the next chunk
+    uint64_t offset = AlignUp(m_cursor, alignment);
+    bool startChunk = m_chunkClosed || offset < m_cursor || offset >= m_chunkSize ||
+                      (size > m_chunkSize - offset && (size <= m_chunkSize || offset > 0));
+    if (startChunk)
+    {
+        m_chunkCount++;
+        m_chunkClosed   = false;
+        m_cursor        = 0;
+        offset          = 0;
+    }
+
+    Placement placement = { m_chunkCount - 1, offset, (std::min)(size, m_chunkSize - offset) };
+    m_totalSize += offset + placement.size - m_cursor;
+    m_cursor    = offset + placement.size;
+    return placement;
+}
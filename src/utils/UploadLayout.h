@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+// Plans where uploaded data lives in a staging arena that is divided into chunks of ChunkSize() bytes.
+// Allocations are placed back to back at their required alignment. An allocation that does not fit into the rest of the current
+// chunk starts the next chunk; only allocations larger than a whole chunk are split, in which case the returned placement covers
+// as much as fits and the caller allocates the remainder separately. With a chunk size of at least TotalSize() everything ends up
+// in a single chunk, i.e. a single contiguous arena.
+// This is pure bookkeeping without any memory or device access, StagingRing uses it to place data in its chunks.
+class UploadLayout
+{
+public:
+    struct Placement
+    {
+        uint64_t chunk;     // Index of the chunk within the whole upload, not wrapped around any ring
+        uint64_t offset;    // Offset within the chunk
+        uint64_t size;      // May be smaller than the requested size for allocations larger than a chunk
+    };
+
+    explicit UploadLayout(uint64_t chunkSize = UINT64_MAX);
+
+    Placement Allocate(uint64_t size, uint64_t alignment = DefaultAlignment);
+
+    // Make the next allocation start a new chunk, e.g. because the current one has been submitted
+    void CloseChunk() { m_chunkClosed = true; }
+
+    // Number of chunks used so far and bytes used in the current (last) chunk
+    uint64_t ChunkCount() const { return m_chunkCount; }
+    uint64_t ChunkBytesUsed() const { return m_cursor; }
+
+    // Bytes used across all chunks, including alignment padding but excluding the unused ends of chunks
+    uint64_t TotalSize() const { return m_totalSize; }
+    uint64_t ChunkSize() const { return m_chunkSize; }
+
+    static uint64_t AlignUp(uint64_t value, uint64_t alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+    // Alignment which satisfies copies (4 bytes) and structured/raw buffer element access
+    static constexpr uint64_t DefaultAlignment = 16;
+
+private:
+    uint64_t m_chunkSize;
+    uint64_t m_chunkCount   = 0;
+    uint64_t m_cursor       = 0;
+    uint64_t m_totalSize    = 0;
+    bool m_chunkClosed      = true;
+};
@@ -0,0 +1,72 @@
+#include "UploadRing.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+UploadRing::UploadRing(UploadFence& fence, uint64_t capacity) :
+    m_fence(fence),
+    m_capacity(capacity)
+{
+    assert(capacity > 0);
+}
+
+bool UploadRing::Allocate(uint64_t size, uint64_t alignment, Allocation& allocation)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    Retire();
+    for (;;)
+    {
+        // Allocations that do not fit into the rest of the ring start over at its beginning, the end of the ring is skipped
+        const uint64_t offset           = m_head % m_capacity;
+        const uint64_t alignedOffset    = UploadLayout::AlignUp(offset, alignment);
+        const uint64_t start            = m_head + (alignedOffset + size <= m_capacity ? alignedOffset : m_capacity) - offset;
+        const uint64_t end              = start + size;
+        // With nothing in use the skipped end of the ring does not have to stay free, only the allocation has to fit
+        const uint64_t tail             = m_tail == m_head ? start : m_tail;
+        if (end - tail <= m_capacity)
+        {
+            allocation              = { start % m_capacity, size };
+            m_tail                  = tail;
+            m_stats.bytesAllocated  += end - m_head;
+            m_head                  = end;
+            m_stats.peakBytesInUse  = (std::max)(m_stats.peakBytesInUse, BytesInUse());
+            return true;
+        }
+
+        // The ring is full, make room by waiting for the oldest frame in flight
+        if (m_frames.empty())
+        {
+            return false;
+        }
+        m_stats.waits++;
+        m_fence.WaitForFenceValue(m_frames.front().fenceValue);
+        Retire();
+    }
+}
+
+void UploadRing::EndFrame(uint64_t fenceValue)
+{
+    assert(m_frames.empty() || m_frames.back().fenceValue <= fenceValue);
+    m_frames.push_back({ fenceValue, m_head });
+    m_stats.frames++;
+}
+
+void UploadRing::Reset(uint64_t capacity)
+{
+    assert(capacity > 0);
+    m_capacity  = capacity;
+    m_head      = 0;
+    m_tail      = 0;
+    m_frames.clear();
+}
+
+void UploadRing::Retire()
+{
+    const uint64_t completedFenceValue = m_fence.CompletedFenceValue();
+    while (!m_frames.empty() && m_frames.front().fenceValue <= completedFenceValue)
+    {
+        m_tail = (std::max)(m_tail, m_frames.front().end);
+        m_frames.pop_front();
+    }
+}
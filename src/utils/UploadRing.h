@@ -0,0 +1,81 @@
+#pragma once
+
+#include "UploadLayout.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+// Fence that signals when the GPU is done with the upload memory of a frame. The ring only retires memory through this interface,
+// so it can be driven by a D3D12 fence as well as by a fake fence without any device.
+class UploadFence
+{
+public:
+    virtual ~UploadFence() = default;
+
+    virtual uint64_t CompletedFenceValue() = 0;
+    virtual void WaitForFenceValue(uint64_t fenceValue) = 0;
+};
+
+// Linear allocator over a ring of Capacity() bytes for data that is written by the CPU once per frame, such as constants.
+// Allocations of a frame are placed back to back at their required alignment, wrapping around to the start of the ring when they
+// do not fit into the rest of it. EndFrame() tags the frame's allocations with the fence value that signals the end of the frame,
+// and they are recycled once the fence has reached it. Allocating only waits for the fence if the ring is full of frames that are
+// still in flight. This is pure bookkeeping without any memory or device access.
+class UploadRing
+{
+public:
+    // Region of the ring returned by Allocate()
+    struct Allocation
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Stats
+    {
+        uint64_t bytesAllocated = 0;    // Including alignment padding and the skipped ends of the ring
+        uint64_t peakBytesInUse = 0;    // Largest amount of memory referenced by the current frame and the frames in flight
+        uint32_t frames         = 0;
+        uint32_t waits          = 0;    // Number of times a frame in flight had to be waited for to make room
+    };
+
+    UploadRing(UploadFence& fence, uint64_t capacity);
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    // Allocate size bytes for the current frame. Returns false if they do not fit even once all previous frames have retired, in
+    // which case the current frame alone needs a larger ring.
+    bool Allocate(uint64_t size, uint64_t alignment, Allocation& allocation);
+
+    // Close the current frame, its allocations are recycled once the fence reaches fenceValue
+    void EndFrame(uint64_t fenceValue);
+
+    // Start over with an empty ring of the given capacity, e.g. after moving to a larger buffer. Frames in flight are forgotten.
+    void Reset(uint64_t capacity);
+
+    // Accessors
+    uint64_t Capacity() const { return m_capacity; }
+    uint64_t BytesInUse() const { return m_head - m_tail; }
+    uint64_t CurrentFrameBytes() const { return m_head - (m_frames.empty() ? m_tail : (std::max)(m_tail, m_frames.back().end)); }
+    size_t FramesInFlight() const { return m_frames.size(); }
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    struct Frame
+    {
+        uint64_t fenceValue;
+        uint64_t end;       // Position after the frame's last allocation
+    };
+
+    void Retire();
+
+    // Positions only ever grow, the offset of a position within the ring is the position modulo the capacity
+    UploadFence&        m_fence;
+    uint64_t            m_capacity;
+    uint64_t            m_head  = 0;    // Position of the next allocation
+    uint64_t            m_tail  = 0;    // Position of the oldest allocation still in use
+    std::deque<Frame>   m_frames;       // Closed frames that have not retired yet, oldest first
+    Stats               m_stats;
+};
@@ -0,0 +1,220 @@
+#include "stdafx.h"
+#include "VertexCompression.h"
+
+#include <DirectXPackedVector.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+constexpr float SnormScale              = 32767.0f;
+constexpr int SnormMax                  = 32767;
+constexpr int ParallelEncodeThreshold   = 1 << 16;
+
+float sign_not_zero(float value) {
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+float dot(const XMFLOAT3& a, const XMFLOAT3& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+XMFLOAT3 normalize(const XMFLOAT3& v) {
+    float length = std::sqrt(dot(v, v));
+    return length > 0.0f ? XMFLOAT3(v.x / length, v.y / length, v.z / length) : v;
+}
+
+// Unlike acos of the dot product this stays accurate for tiny angles
+float angle(const XMFLOAT3& a, const XMFLOAT3& b) {
+    XMFLOAT3 c(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    return std::atan2(std::sqrt(dot(c, c)), dot(a, b));
+}
+
+float distance(const XMFLOAT3& a, const XMFLOAT3& b) {
+    XMFLOAT3 d(a.x - b.x, a.y - b.y, a.z - b.z);
+    return std::sqrt(dot(d, d));
+}
+
+// Bounding box of a non-empty set of vertices
+void bounds(std::span<const Vertex> vertices, XMFLOAT3& lower, XMFLOAT3& upper) {
+    lower = upper = vertices[0].position;
+    for (const Vertex& vertex : vertices) {
+        lower = XMFLOAT3((std::min)(lower.x, vertex.position.x), (std::min)(lower.y, vertex.position.y), (std::min)(lower.z, vertex.position.z));
+        upper = XMFLOAT3((std::max)(upper.x, vertex.position.x), (std::max)(upper.y, vertex.position.y), (std::max)(upper.z, vertex.position.z));
+    }
+}
+
+UINT pack_snorm16x2(int x, int y) {
+    return static_cast<UINT>(static_cast<uint16_t>(x)) | (static_cast<UINT>(static_cast<uint16_t>(y)) << 16);
+}
+
+float unpack_snorm16(UINT packed, int shift) {
+    int value = static_cast<int16_t>(static_cast<uint16_t>(packed >> shift));
+    return (std::max)(static_cast<float>(value) / SnormScale, -1.0f);
+}
+
+// Same as DecodeOctahedralNormal in Raytracing.hlsl
+XMFLOAT3 decode_octahedral(float u, float v) {
+    XMFLOAT3 n(u, v, 1.0f - std::abs(u) - std::abs(v));
+    float t = (std::max)(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+}
+
+
+UINT LoadScene::encode_octahedral_normal(XMFLOAT3 normal) {
+    // Project onto the octahedron and fold the lower hemisphere over the upper one, degenerate normals end up as +z
+    float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (!(l1 > 0.0f) || !std::isfinite(l1)) {
+        return 0U;
+    }
+    float u = normal.x / l1;
+    float v = normal.y / l1;
+    if (normal.z < 0.0f) {
+        float folded_u  = (1.0f - std::abs(v)) * sign_not_zero(u);
+        v               = (1.0f - std::abs(u)) * sign_not_zero(v);
+        u               = folded_u;
+    }
+
+    // Rounding to the nearest grid point is not always the most accurate choice, try all four surrounding ones
+    XMFLOAT3 unit   = normalize(normal);
+    int base_u      = static_cast<int>(std::floor(u * SnormScale));
+    int base_v      = static_cast<int>(std::floor(v * SnormScale));
+    int best_u = 0, best_v = 0;
+    float best_dot  = -2.0f;
+    for (int du = 0; du <= 1; du++) {
+        for (int dv = 0; dv <= 1; dv++) {
+            int qu = std::clamp(base_u + du, -SnormMax, SnormMax);
+            int qv = std::clamp(base_v + dv, -SnormMax, SnormMax);
+            float d = dot(decode_octahedral(qu / SnormScale, qv / SnormScale), unit);
+            if (d > best_dot) {
+                best_dot    = d;
+                best_u      = qu;
+                best_v      = qv;
+            }
+        }
+    }
+    return pack_snorm16x2(best_u, best_v);
+}
+
+XMFLOAT3 LoadScene::decode_octahedral_normal(UINT encoded) {
+    return decode_octahedral(unpack_snorm16(encoded, 0), unpack_snorm16(encoded, 16));
+}
+
+LoadScene::PositionDequantization LoadScene::encode_vertices(std::span<const Vertex> vertices, PositionEncoding encoding, std::vector<CompactVertex>& out) {
+    out.resize(vertices.size());
+
+    // Quantize against the object's bounding box, axes without any extent keep a scale of one
+    PositionDequantization dequantization = { XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 1.0f, 1.0f) };
+    if (encoding == PositionEncoding::AabbSnorm16 && !vertices.empty()) {
+        XMFLOAT3 lower, upper;
+        bounds(vertices, lower, upper);
+        float* offset       = &dequantization.offset.x;
+        float* scale        = &dequantization.scale.x;
+        const float* lo     = &lower.x;
+        const float* hi     = &upper.x;
+        for (int axis = 0; axis < 3; axis++) {
+            offset[axis]    = 0.5f * (lo[axis] + hi[axis]);
+            scale[axis]     = hi[axis] > lo[axis] ? 0.5f * (hi[axis] - lo[axis]) : 1.0f;
+        }
+    }
+    const XMFLOAT3 offset           = dequantization.offset;
+    const XMFLOAT3 inverse_scale    = XMFLOAT3(1.0f / dequantization.scale.x, 1.0f / dequantization.scale.y, 1.0f / dequantization.scale.z);
+    auto quantize = [](float value, float center, float inverse_extent) {
+        return static_cast<int>(std::lround(std::clamp((value - center) * inverse_extent, -1.0f, 1.0f) * SnormScale));
+    };
+
+    const int num_vertices = static_cast<int>(vertices.size());
+    #pragma omp parallel for if(num_vertices >= ParallelEncodeThreshold)
+    for (int i = 0; i < num_vertices; i++) {
+        const XMFLOAT3& position    = vertices[i].position;
+        CompactVertex& compact      = out[i];
+        if (encoding == PositionEncoding::Float16) {
+            compact.positionXY  = static_cast<UINT>(PackedVector::XMConvertFloatToHalf(position.x)) |
+                                  (static_cast<UINT>(PackedVector::XMConvertFloatToHalf(position.y)) << 16);
+            compact.positionZ   = static_cast<UINT>(PackedVector::XMConvertFloatToHalf(position.z));
+        } else {
+            compact.positionXY  = pack_snorm16x2(quantize(position.x, offset.x, inverse_scale.x), quantize(position.y, offset.y, inverse_scale.y));
+            compact.positionZ   = pack_snorm16x2(quantize(position.z, offset.z, inverse_scale.z), 0);
+        }
+        compact.normal = encode_octahedral_normal(vertices[i].normal);
+    }
+    return dequantization;
+}
+
+Vertex LoadScene::decode_vertex(const CompactVertex& vertex, PositionEncoding encoding, const PositionDequantization& dequantization) {
+    XMFLOAT3 q;
+    if (encoding == PositionEncoding::Float16) {
+        q = XMFLOAT3(PackedVector::XMConvertHalfToFloat(static_cast<PackedVector::HALF>(vertex.positionXY & 0xFFFFU)),
+                     PackedVector::XMConvertHalfToFloat(static_cast<PackedVector::HALF>(vertex.positionXY >> 16)),
+                     PackedVector::XMConvertHalfToFloat(static_cast<PackedVector::HALF>(vertex.positionZ & 0xFFFFU)));
+    } else {
+        q = XMFLOAT3(unpack_snorm16(vertex.positionXY, 0), unpack_snorm16(vertex.positionXY, 16), unpack_snorm16(vertex.positionZ, 0));
+    }
+
+    Vertex decoded;
+    decoded.position    = XMFLOAT3(dequantization.offset.x + dequantization.scale.x * q.x,
+                                   dequantization.offset.y + dequantization.scale.y * q.y,
+                                   dequantization.offset.z + dequantization.scale.z * q.z);
+    decoded.normal      = decode_octahedral_normal(vertex.normal);
+    return decoded;
+}
+
+void LoadScene::report_vertex_compression_error(const LoadedObj& loaded_obj) {
+    struct ObjectError {
+        float normal_degrees    = 0.0f;
+        float position[2]       = {};   // Float16, AabbSnorm16
+        float diagonal          = 0.0f;
+    };
+    static const PositionEncoding encodings[2] = { PositionEncoding::Float16, PositionEncoding::AabbSnorm16 };
+    static const float degrees_per_radian = 57.2957795f;
+
+    const int num_objects = static_cast<int>(loaded_obj.object_count());
+    std::vector<ObjectError> errors(num_objects);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < num_objects; i++) {
+        std::span<const Vertex> vertices = loaded_obj.object_vertices(i);
+        std::vector<CompactVertex> encoded;
+        ObjectError& error = errors[i];
+        if (!vertices.empty()) {
+            XMFLOAT3 lower, upper;
+            bounds(vertices, lower, upper);
+            error.diagonal = distance(lower, upper);
+        }
+        for (int e = 0; e < 2; e++) {
+            PositionDequantization dequantization = encode_vertices(vertices, encodings[e], encoded);
+            for (size_t v = 0ULL; v < vertices.size(); v++) {
+                Vertex decoded      = decode_vertex(encoded[v], encodings[e], dequantization);
+                error.position[e]   = (std::max)(error.position[e], distance(vertices[v].position, decoded.position));
+                if (e == 0 && dot(vertices[v].normal, vertices[v].normal) > 0.0f) {
+                    error.normal_degrees    = (std::max)(error.normal_degrees, angle(normalize(vertices[v].normal), decoded.normal) * degrees_per_radian);
+                }
+            }
+        }
+    }
+
+    size_t total_vertices = 0ULL;
+    ObjectError worst;
+    for (int i = 0; i < num_objects; i++) {
+        total_vertices          += loaded_obj.object_vertices(i).size();
+        worst.normal_degrees    = (std::max)(worst.normal_degrees, errors[i].normal_degrees);
+        worst.position[0]       = (std::max)(worst.position[0], errors[i].position[0]);
+        worst.position[1]       = (std::max)(worst.position[1], errors[i].position[1]);
+    }
+
+    auto relative = [](float error, float diagonal) { return diagonal > 0.0f ? error / diagonal : 0.0f; };
+    std::cout << std::setprecision(3)
+              << "Vertex compression error: " << num_objects << " objects, " << total_vertices << " vertices, "
+              << sizeof(Vertex) << " -> " << sizeof(CompactVertex) << " bytes per vertex\n";
+    for (int i = 0; i < num_objects; i++) {
+        std::cout << "    object " << i << " (" << loaded_obj.object_vertices(i).size() << " vertices): normal " << errors[i].normal_degrees << " deg, "
+                  << "float16 position " << errors[i].position[0] << " (" << relative(errors[i].position[0], errors[i].diagonal) << " of diagonal), "
+                  << "aabb snorm16 position " << errors[i].position[1] << " (" << relative(errors[i].position[1], errors[i].diagonal) << " of diagonal)\n";
+    }
+    std::cout << "    max: normal " << worst.normal_degrees << " deg, float16 position " << worst.position[0]
+              << ", aabb snorm16 position " << worst.position[1] << std::endl;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../hlsl/RaytracingHlslCompat.h"
+#include "LoadScene.h"
+
+#include <span>
+#include <vector>
+
+namespace LoadScene {
+// Position encodings of CompactVertex, see COMPACT_VERTEX_POSITIONS
+enum class PositionEncoding {
+	Float16,	// Half precision object space coordinates
+	AabbSnorm16	// 16 bit SNORM coordinates relative to the object's bounding box
+};
+
+// Encoding used for the vertices uploaded to the GPU
+constexpr PositionEncoding DevicePositionEncoding = COMPACT_VERTEX_POSITIONS == COMPACT_POSITIONS_AABB_SNORM16 ?
+	PositionEncoding::AabbSnorm16 : PositionEncoding::Float16;
+
+// Maps decoded position components q (in [-1, 1] for AabbSnorm16) back to object space as offset + scale * q.
+// This is the identity for Float16 and is applied through the BLAS geometry transform on the GPU.
+struct PositionDequantization {
+	XMFLOAT3 offset;
+	XMFLOAT3 scale;
+};
+
+// Encodes vertices into out, which is resized to match, and returns how the encoded positions map back to object space
+PositionDequantization encode_vertices(std::span<const Vertex> vertices, PositionEncoding encoding, std::vector<CompactVertex>& out);
+Vertex decode_vertex(const CompactVertex& vertex, PositionEncoding encoding, const PositionDequantization& dequantization);
+
+// Octahedral normal encoding with two 16 bit SNORMs, the encoder picks the grid point whose decoded normal is closest to the input
+UINT encode_octahedral_normal(XMFLOAT3 normal);
+XMFLOAT3 decode_octahedral_normal(UINT encoded);
+
+// Encodes every object of the scene with both position encodings and reports the largest angular error of its normals and the largest
+// distance between original and decoded positions (absolute and relative to the object's bounding box diagonal)
+void report_vertex_compression_error(const LoadedObj& loaded_obj);
+}
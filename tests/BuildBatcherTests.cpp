@@ -0,0 +1,143 @@
+#include "TestCheck.h"
+#include "utils/BuildBatcher.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+bool HasPlacement(const BuildBatcher::Batch& batch, uint32_t build, uint64_t scratchOffset)
+{
+    return std::any_of(batch.builds.begin(), batch.builds.end(),
+                       [&](const BuildBatcher::Placement& p) { return p.build == build && p.scratchOffset == scratchOffset; });
+}
+
+// Every build is placed exactly once, at an aligned offset, and the regions of a batch neither overlap nor exceed its scratchBytes
+void CheckPlacements(const BuildBatcher& batcher, const std::vector<BuildBatcher::Batch>& batches)
+{
+    std::vector<uint32_t> placed(batcher.Size(), 0);
+    for (const BuildBatcher::Batch& batch : batches)
+    {
+        CHECK(!batch.builds.empty());
+        CHECK(batch.scratchBytes <= batcher.ScratchBudget() || batch.builds.size() == 1);
+
+        uint64_t alignedBytes = 0;
+        for (const BuildBatcher::Placement& placement : batch.builds)
+        {
+            placed[placement.build]++;
+            CHECK(placement.scratchOffset % BuildBatcher::ScratchAlignment == 0);
+            CHECK(placement.scratchOffset + batcher.ScratchSize(placement.build) <= batch.scratchBytes);
+            for (const BuildBatcher::Placement& other : batch.builds)
+            {
+                CHECK(&other == &placement || placement.scratchOffset + batcher.ScratchSize(placement.build) <= other.scratchOffset ||
+                      other.scratchOffset + batcher.ScratchSize(other.build) <= placement.scratchOffset);
+            }
+            alignedBytes += (batcher.ScratchSize(placement.build) + BuildBatcher::ScratchAlignment - 1) / BuildBatcher::ScratchAlignment *
+                            BuildBatcher::ScratchAlignment;
+        }
+        CHECK(batch.scratchBytes == alignedBytes);
+    }
+    CHECK(std::all_of(placed.begin(), placed.end(), [](uint32_t count) { return count == 1; }));
+}
+
+void TestFirstFitDecreasing()
+{
+    BuildBatcher batcher(1024);
+    for (uint64_t size : { 256, 768, 512, 512, 256 })
+    {
+        batcher.Add(size);
+    }
+
+    // Largest first, each into the first batch with room, equal sizes in the order they were added
+    std::vector<BuildBatcher::Batch> batches = batcher.Pack();
+    CHECK(batches.size() == 3);
+    if (batches.size() == 3)
+    {
+        CHECK(batches[0].builds.size() == 2 && HasPlacement(batches[0], 1, 0) && HasPlacement(batches[0], 0, 768));
+        CHECK(batches[1].builds.size() == 2 && HasPlacement(batches[1], 2, 0) && HasPlacement(batches[1], 3, 512));
+        CHECK(batches[2].builds.size() == 1 && HasPlacement(batches[2], 4, 0));
+        CHECK(batches[0].scratchBytes == 1024 && batches[1].scratchBytes == 1024 && batches[2].scratchBytes == 256);
+    }
+    CheckPlacements(batcher, batches);
+}
+
+void TestBuildsLargerThanBudget()
+{
+    BuildBatcher batcher(1024);
+    batcher.Add(300);
+    batcher.Add(5000);
+    batcher.Add(700);
+
+    // The oversized build gets a batch of its own and the scratch buffer grows to fit it, the others are packed as usual
+    std::vector<BuildBatcher::Batch> batches = batcher.Pack();
+    CHECK(batches.size() == 3);
+    if (batches.size() == 3)
+    {
+        CHECK(batches[0].builds.size() == 1 && HasPlacement(batches[0], 1, 0) && batches[0].scratchBytes == 5120);
+        CHECK(batches[1].builds.size() == 1 && HasPlacement(batches[1], 2, 0) && batches[1].scratchBytes == 768);
+        CHECK(batches[2].builds.size() == 1 && HasPlacement(batches[2], 0, 0) && batches[2].scratchBytes == 512);
+    }
+    CHECK(BuildBatcher::ScratchBufferSize(batches) == 5120);
+    CheckPlacements(batcher, batches);
+}
+
+void TestAlignment()
+{
+    // Sizes that are not multiples of the alignment, from a fixed linear congruential sequence
+    BuildBatcher batcher(64 * 1024);
+    uint32_t state = 12345;
+    for (int i = 0; i < 500; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        batcher.Add(1 + (state >> 8) % (20 * 1024));
+    }
+    batcher.Add(200 * 1024 + 1);
+
+    std::vector<BuildBatcher::Batch> batches = batcher.Pack();
+    CheckPlacements(batcher, batches);
+
+    // First fit decreasing leaves at most one batch that is less than half full
+    uint32_t halfEmpty = 0;
+    for (const BuildBatcher::Batch& batch : batches)
+    {
+        halfEmpty += batch.scratchBytes * 2 < batcher.ScratchBudget() ? 1 : 0;
+    }
+    CHECK(halfEmpty <= 1);
+}
+
+void TestScratchBufferSize()
+{
+    CHECK(BuildBatcher::ScratchBufferSize({}) == 0);
+
+    BuildBatcher empty(1024);
+    CHECK(empty.Pack().empty());
+
+    BuildBatcher batcher(4096);
+    batcher.Add(1000);
+    batcher.Add(3000);
+    batcher.Add(2000);
+    batcher.Add(100);
+
+    // Batches of 3072 + 1024 and 2048 + 256 bytes after rounding up to the alignment
+    std::vector<BuildBatcher::Batch> batches = batcher.Pack();
+    CHECK(batches.size() == 2);
+    CHECK(BuildBatcher::ScratchBufferSize(batches) == 4096);
+
+    const BuildBatcher::Stats stats = batcher.ComputeStats(batches);
+    CHECK(stats.builds == 4);
+    CHECK(stats.batches == 2);
+    CHECK(stats.scratchBufferSize == 4096);
+    CHECK(stats.scratchBytes == 6100);
+    CHECK(stats.separateScratch == 1024 + 3072 + 2048 + 256);
+    CheckPlacements(batcher, batches);
+}
+}
+
+int main()
+{
+    TestFirstFitDecreasing();
+    TestBuildsLargerThanBudget();
+    TestAlignment();
+    TestScratchBufferSize();
+    return TestResult();
+}
@@ -0,0 +1,184 @@
+#include "TestCheck.h"
+#include "utils/CompactionPlanner.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+constexpr uint64_t KB = 1024;
+
+// Device that tracks the memory of every structure and checks that originals are only released once their copy has completed
+class FakeDevice : public CompactionDevice
+{
+public:
+    explicit FakeDevice(const CompactionPlanner& planner) : m_states(planner.Size(), State::Original)
+    {
+        for (uint32_t i = 0; i < static_cast<uint32_t>(planner.Size()); i++)
+        {
+            m_originalSizes.push_back(planner.OriginalSize(i));
+            bytesInUse += planner.OriginalSize(i);
+        }
+        peakBytes = bytesInUse;
+    }
+
+    void CopyCompacted(uint32_t structure, uint64_t size) override
+    {
+        CHECK(m_states[structure] == State::Original);
+        m_states[structure] = State::Copying;
+        bytesInUse          += size;
+        peakBytes           = (std::max)(peakBytes, bytesInUse);
+        events.push_back("copy " + std::to_string(structure));
+    }
+
+    void ExecuteCopies() override
+    {
+        std::replace(m_states.begin(), m_states.end(), State::Copying, State::Copied);
+        events.push_back("execute");
+    }
+
+    void ReleaseOriginal(uint32_t structure) override
+    {
+        CHECK(m_states[structure] == State::Copied);
+        m_states[structure] = State::Compacted;
+        bytesInUse          -= m_originalSizes[structure];
+        events.push_back("release " + std::to_string(structure));
+    }
+
+    bool Compacted(uint32_t structure) const { return m_states[structure] == State::Compacted; }
+
+    std::vector<std::string> events;
+    uint64_t bytesInUse = 0;
+    uint64_t peakBytes  = 0;
+
+private:
+    enum class State
+    {
+        Original,
+        Copying,    // Recorded, but not executed yet
+        Copied,
+        Compacted
+    };
+    std::vector<State> m_states;
+    std::vector<uint64_t> m_originalSizes;
+};
+
+void AddStructure(CompactionPlanner& planner, uint64_t originalSize, uint64_t compactedSize)
+{
+    planner.SetCompactedSize(planner.Add(originalSize), compactedSize);
+}
+
+void TestBatchingUnderBudget()
+{
+    CompactionPlanner planner(64 * KB);
+    AddStructure(planner, 64 * KB, 16 * KB);
+    AddStructure(planner, 64 * KB, 40 * KB);
+    AddStructure(planner, 64 * KB, 62 * KB);    // Saves less than DefaultMinSavedBytes
+    AddStructure(planner, 256 * KB, 100 * KB);  // Larger than the budget
+    AddStructure(planner, 32 * KB, 8 * KB);
+    AddStructure(planner, 32 * KB, 24 * KB);
+    AddStructure(planner, 8 * KB, 4 * KB);      // Saves exactly DefaultMinSavedBytes
+
+    std::vector<CompactionPlanner::Batch> batches = planner.Plan();
+    CHECK(batches.size() == 3);
+    if (batches.size() == 3)
+    {
+        CHECK((batches[0].structures == std::vector<uint32_t>{ 0, 1 }) && batches[0].compactedBytes == 56 * KB);
+        CHECK((batches[1].structures == std::vector<uint32_t>{ 3 }) && batches[1].compactedBytes == 100 * KB);
+        CHECK((batches[2].structures == std::vector<uint32_t>{ 4, 5, 6 }) && batches[2].compactedBytes == 36 * KB);
+    }
+
+    FakeDevice device(planner);
+    const CompactionPlanner::Stats& stats = planner.Execute(device);
+    CHECK(stats.originalBytes == 520 * KB);
+    CHECK(stats.compactedBytes == 256 * KB);
+    CHECK(stats.SavedBytes() == 264 * KB);
+
+    // 520 KB + the first batch's 56 KB of copies, before its 128 KB of originals are released
+    CHECK(stats.peakBytes == 576 * KB);
+    CHECK(stats.compacted == 6 && stats.skipped == 1 && stats.batches == 3);
+    CHECK(device.peakBytes == stats.peakBytes && device.bytesInUse == stats.compactedBytes);
+    CHECK(!device.Compacted(2));
+}
+
+void TestOriginalsReleasedAfterTheirBatch()
+{
+    CompactionPlanner planner(10 * KB);
+    AddStructure(planner, 20 * KB, 6 * KB);
+    AddStructure(planner, 20 * KB, 4 * KB);
+    AddStructure(planner, 20 * KB, 8 * KB);
+
+    FakeDevice device(planner);
+    planner.Execute(device);
+    const std::vector<std::string> expected = {
+        "copy 0", "copy 1", "execute", "release 0", "release 1",
+        "copy 2", "execute", "release 2"
+    };
+    CHECK(device.events == expected);
+}
+
+void TestNothingToCompact()
+{
+    CompactionPlanner planner(64 * KB);
+    AddStructure(planner, 64 * KB, 64 * KB);
+    AddStructure(planner, 8 * KB, 5 * KB);
+
+    FakeDevice device(planner);
+    const CompactionPlanner::Stats& stats = planner.Execute(device);
+    CHECK(planner.Plan().empty());
+    CHECK(device.events.empty());
+    CHECK(stats.compacted == 0 && stats.skipped == 2 && stats.batches == 0);
+    CHECK(stats.peakBytes == 72 * KB && stats.compactedBytes == 72 * KB && stats.SavedBytes() == 0);
+
+    // Without a minimum every saved byte counts
+    CompactionPlanner eager(64 * KB, 0);
+    AddStructure(eager, 8 * KB, 5 * KB);
+    CHECK(eager.Plan().size() == 1);
+}
+
+void TestAccountingMatchesDevice()
+{
+    // Sizes from a fixed linear congruential sequence
+    CompactionPlanner planner(256 * KB);
+    uint32_t state = 12345;
+    auto next = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    for (int i = 0; i < 300; i++)
+    {
+        const uint64_t originalSize = 1 + next() % (512 * KB);
+        AddStructure(planner, originalSize, 1 + next() % originalSize);
+    }
+
+    for (const CompactionPlanner::Batch& batch : planner.Plan())
+    {
+        CHECK(batch.compactedBytes <= planner.BatchBudget() || batch.structures.size() == 1);
+        CHECK(std::is_sorted(batch.structures.begin(), batch.structures.end()));
+    }
+
+    FakeDevice device(planner);
+    const CompactionPlanner::Stats& stats = planner.Execute(device);
+    CHECK(device.peakBytes == stats.peakBytes);
+    CHECK(device.bytesInUse == stats.compactedBytes);
+    CHECK(stats.compacted + stats.skipped == planner.Size());
+
+    // Compaction needs at most one batch on top of the original memory
+    uint64_t largestBatch = 0;
+    for (const CompactionPlanner::Batch& batch : planner.Plan())
+    {
+        largestBatch = (std::max)(largestBatch, batch.compactedBytes);
+    }
+    CHECK(stats.peakBytes <= stats.originalBytes + largestBatch);
+}
+}
+
+int main()
+{
+    TestBatchingUnderBudget();
+    TestOriginalsReleasedAfterTheirBatch();
+    TestNothingToCompact();
+    TestAccountingMatchesDevice();
+    return TestResult();
+}
@@ -0,0 +1,145 @@
+#include "TestCheck.h"
+#include "utils/DefragScheduler.h"
+
+#include <vector>
+
+// D3D12MemAlloc.h needs the Windows SDK's d3d12.h, so instead of a D3D12MA::VirtualBlock the usages are scripted. They are what
+// VirtualBlock::CalculateStatistics() reports for the layouts described next to them.
+namespace
+{
+constexpr uint64_t MB = 1024 * 1024;
+
+using Perform = std::vector<uint8_t>;
+
+void TestFragmentedBytes()
+{
+    // 600 bytes in use, 400 unused in ranges of 300 and 100
+    const DefragScheduler::Usage scattered = { 1000, 600, 300 };
+    CHECK(DefragScheduler::FragmentedBytes(scattered) == 100);
+    CHECK(DefragScheduler::Fragmentation(scattered) == 0.25);
+
+    // All unused memory in one range at the end, all memory in use, and an empty pool are not fragmented
+    CHECK(DefragScheduler::FragmentedBytes({ 1000, 600, 400 }) == 0);
+    CHECK(DefragScheduler::FragmentedBytes({ 1000, 1000, 0 }) == 0);
+    CHECK(DefragScheduler::Fragmentation({ 1000, 1000, 0 }) == 0.0);
+    CHECK(DefragScheduler::Fragmentation({ 0, 0, 0 }) == 0.0);
+
+    // Every other 64 KB allocation of a 4 MB block freed: 32 ranges of 64 KB, all but one of them fragmented
+    const DefragScheduler::Usage checkerboard = { 4 * MB, 2 * MB, 64 * 1024 };
+    CHECK(DefragScheduler::FragmentedBytes(checkerboard) == 2 * MB - 64 * 1024);
+    CHECK(DefragScheduler::Fragmentation(checkerboard) == 31.0 / 32.0);
+}
+
+void TestBeginRunThreshold()
+{
+    DefragScheduler scheduler({ 4 * MB, 16 }, 0.25f, 1 * MB);
+
+    // 10 MB unused, of which 2 MB lie outside the largest range: 20% is below the threshold
+    CHECK(!scheduler.BeginRun({ 20 * MB, 10 * MB, 8 * MB }));
+
+    // 512 KB outside the largest range is too little to bother, however scattered it is
+    CHECK(!scheduler.BeginRun({ 2 * MB, 1 * MB, MB / 2 }));
+    CHECK(scheduler.GetStats().runs == 0 && !scheduler.IsRunning());
+
+    // 3 MB of 10 MB, 30%
+    CHECK(scheduler.BeginRun({ 20 * MB, 10 * MB, 7 * MB }));
+    CHECK(scheduler.IsRunning() && scheduler.GetStats().runs == 1);
+}
+
+void TestSettledBytesHysteresis()
+{
+    DefragScheduler scheduler({ 4 * MB, 16 }, 0.25f, 1 * MB);
+    CHECK(scheduler.BeginRun({ 32 * MB, 16 * MB, 8 * MB }));
+
+    // The remaining allocations could not be packed tighter than leaving 4 MB fragmented
+    scheduler.EndRun({ 32 * MB, 16 * MB, 12 * MB });
+    CHECK(!scheduler.IsRunning());
+
+    // Fragmentation has to grow by at least the minimum over what the last run settled at before another run starts
+    CHECK(!scheduler.BeginRun({ 32 * MB, 16 * MB, 12 * MB }));
+    CHECK(!scheduler.BeginRun({ 32 * MB, 16 * MB, 11 * MB + MB / 2 }));
+    CHECK(scheduler.BeginRun({ 32 * MB, 16 * MB, 11 * MB }));
+    CHECK(scheduler.GetStats().runs == 2);
+
+    // A run that packs everything lowers the bar again
+    scheduler.EndRun({ 32 * MB, 16 * MB, 16 * MB });
+    CHECK(scheduler.BeginRun({ 8 * MB, 4 * MB, 3 * MB }));
+    CHECK(scheduler.GetStats().runs == 3);
+}
+
+void TestSelectMovesBudget()
+{
+    DefragScheduler scheduler({ 1000, 3 });
+    CHECK(scheduler.BeginRun({ 32 * MB, 16 * MB, 8 * MB }));
+    Perform perform;
+
+    // Moves are taken in order until the next one would exceed the bytes, later smaller ones wait for the next pass
+    CHECK(scheduler.SelectMoves({ 400, 500, 200, 50 }, perform) == 2);
+    CHECK((perform == Perform{ 1, 1, 0, 0 }));
+
+    // At most maxMovesPerFrame moves, however small
+    CHECK(scheduler.SelectMoves({ 10, 10, 10, 10, 10 }, perform) == 3);
+    CHECK((perform == Perform{ 1, 1, 1, 0, 0 }));
+
+    // Exactly the byte budget fits
+    CHECK(scheduler.SelectMoves({ 600, 400 }, perform) == 2);
+
+    // The first move is always taken, even if it exceeds the budget on its own
+    CHECK(scheduler.SelectMoves({ 5000, 10 }, perform) == 1);
+    CHECK((perform == Perform{ 1, 0 }));
+
+    CHECK(scheduler.SelectMoves({}, perform) == 0);
+    CHECK(perform.empty());
+
+    const DefragScheduler::Stats& stats = scheduler.GetStats();
+    CHECK(stats.passes == 5);
+    CHECK(stats.moves == 2 + 3 + 2 + 1);
+    CHECK(stats.deferredMoves == 2 + 2 + 0 + 1);
+    CHECK(stats.bytesMoved == 900 + 30 + 1000 + 5000);
+    CHECK(stats.peakBytesPerFrame == 5000);
+}
+
+void TestMovesPerFrameBounded()
+{
+    // Move sizes from a fixed linear congruential sequence, passes of up to 64 proposed moves
+    const DefragScheduler::Budget budget = { 256 * 1024, 8 };
+    DefragScheduler scheduler(budget);
+    CHECK(scheduler.BeginRun({ 64 * MB, 32 * MB, 4 * MB }));
+    uint32_t state = 12345;
+    auto next = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    for (int pass = 0; pass < 200; pass++)
+    {
+        std::vector<uint64_t> moveSizes(1 + next() % 64);
+        for (uint64_t& size : moveSizes)
+        {
+            size = 1 + next() % (96 * 1024);
+        }
+        Perform perform;
+        const uint32_t moves = scheduler.SelectMoves(moveSizes, perform);
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < moveSizes.size(); i++)
+        {
+            // Performed moves are a prefix of the proposed ones
+            CHECK(perform[i] == (i < moves ? 1 : 0));
+            bytes += perform[i] ? moveSizes[i] : 0;
+        }
+        CHECK(moves >= 1 && moves <= budget.maxMovesPerFrame);
+        CHECK(bytes <= budget.maxBytesPerFrame);
+    }
+    CHECK(scheduler.GetStats().peakBytesPerFrame <= budget.maxBytesPerFrame);
+    scheduler.EndRun({ 64 * MB, 32 * MB, 32 * MB });
+}
+}
+
+int main()
+{
+    TestFragmentedBytes();
+    TestBeginRunThreshold();
+    TestSettledBytesHysteresis();
+    TestSelectMovesBudget();
+    TestMovesPerFrameBounded();
+    return TestResult();
+}
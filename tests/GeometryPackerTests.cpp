@@ -0,0 +1,86 @@
+#include "TestCheck.h"
+#include "utils/GeometryPacker.h"
+
+namespace
+{
+bool RecordIs(const GeometryRecord& record, uint32_t firstIndex, uint32_t firstVertex, uint32_t firstTriangle)
+{
+    return record.firstIndex == firstIndex && record.firstVertex == firstVertex && record.firstTriangle == firstTriangle && record.padding == 0;
+}
+
+void TestRecordsAccumulate()
+{
+    GeometryPacker packer;
+    CHECK(packer.Add(36, 24) == 0);
+    CHECK(packer.Add(6, 4) == 1);
+    CHECK(packer.Add(0, 0) == 2);
+    CHECK(packer.Add(3, 3) == 3);
+
+    const std::vector<GeometryRecord>& records = packer.Records();
+    CHECK(packer.ObjectCount() == 4 && records.size() == 4);
+    CHECK(RecordIs(records[0], 0, 0, 0));
+    CHECK(RecordIs(records[1], 36, 24, 12));
+    CHECK(RecordIs(records[2], 42, 28, 14));
+    CHECK(RecordIs(records[3], 42, 28, 14));
+
+    // The last object ends where the packed buffers do
+    CHECK(packer.ObjectIndexCount(0) == 36 && packer.ObjectVertexCount(0) == 24 && packer.ObjectTriangleCount(0) == 12);
+    CHECK(packer.ObjectIndexCount(1) == 6 && packer.ObjectVertexCount(1) == 4);
+    CHECK(packer.ObjectIndexCount(2) == 0 && packer.ObjectVertexCount(2) == 0);
+    CHECK(packer.ObjectIndexCount(3) == 3 && packer.ObjectVertexCount(3) == 3 && packer.ObjectTriangleCount(3) == 1);
+
+    CHECK(packer.IndexCount() == 45 && packer.VertexCount() == 31 && packer.TriangleCount() == 15);
+    CHECK(packer.FitsShaderAddressing());
+
+    packer.Clear();
+    CHECK(packer.ObjectCount() == 0 && packer.IndexCount() == 0 && packer.VertexCount() == 0);
+    CHECK(packer.Add(3, 3) == 0);
+    CHECK(RecordIs(packer.Records()[0], 0, 0, 0));
+}
+
+void TestIndexAddressingLimit()
+{
+    // Indices are read by 32 bit byte address, so the last four bytes of the index buffer have to start at or below UINT32_MAX - 3
+    const uint64_t maxIndices = UINT32_MAX / sizeof(Index) / 3 * 3;
+    GeometryPacker packer;
+    packer.Add(maxIndices, 3);
+    CHECK(packer.FitsShaderAddressing());
+    packer.Add(3, 3);
+    CHECK(!packer.FitsShaderAddressing());
+}
+
+void TestVertexAddressingLimit()
+{
+    // Vertices are read by 32 bit element index
+    GeometryPacker packer;
+    packer.Add(3, UINT32_MAX - 1);
+    packer.Add(3, 1);
+    CHECK(packer.FitsShaderAddressing());
+    CHECK(packer.Records()[1].firstVertex == UINT32_MAX - 1);
+    packer.Add(3, 1);
+    CHECK(!packer.FitsShaderAddressing());
+}
+
+void TestInstanceIdLimit()
+{
+    // InstanceID() only has 24 bits to index the records with
+    GeometryPacker packer;
+    for (uint32_t i = 0; i < (1u << 24); i++)
+    {
+        packer.Add(3, 3);
+    }
+    CHECK(packer.FitsShaderAddressing());
+    CHECK(packer.ObjectIndexCount(packer.ObjectCount() - 1) == 3);
+    packer.Add(3, 3);
+    CHECK(!packer.FitsShaderAddressing());
+}
+}
+
+int main()
+{
+    TestRecordsAccumulate();
+    TestIndexAddressingLimit();
+    TestVertexAddressingLimit();
+    TestInstanceIdLimit();
+    return TestResult();
+}
@@ -0,0 +1,143 @@
+#include "TestCheck.h"
+#include "utils/ResidencyPolicy.h"
+
+#include <initializer_list>
+#include <vector>
+
+namespace
+{
+using Objects = std::vector<uint32_t>;
+
+// The whole budget is usable and the process uses no memory besides the objects, so the scripted budgets are exact
+ResidencyPolicy MakePolicy(ResidencyPolicy::Order order, uint32_t minIdleFrames, std::initializer_list<uint64_t> footprints)
+{
+    ResidencyPolicy policy(order, minIdleFrames, 1.0f);
+    for (uint64_t footprint : footprints)
+    {
+        policy.AddObject(footprint);
+    }
+    return policy;
+}
+
+// One scripted frame: the objects in use, then an update against the budget
+ResidencyPolicy::Decisions Frame(ResidencyPolicy& policy, uint64_t frame, std::initializer_list<uint32_t> used, uint64_t budgetBytes)
+{
+    for (uint32_t object : used)
+    {
+        policy.Use(object);
+    }
+    return policy.Update(frame, { policy.ResidentBytes(), budgetBytes });
+}
+
+// Objects 0, 1, and 2 were last used in frames 1, 2, and 3, object 3 is in use, and the budget only has room for two of them
+ResidencyPolicy::Decisions EvictTwoOfFour(ResidencyPolicy::Order order)
+{
+    ResidencyPolicy policy = MakePolicy(order, 1, { 100, 100, 100, 100 });
+    const float distances[] = { 1.0f, 4.0f, 3.0f, 2.0f };
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        policy.SetDistance(i, distances[i]);
+    }
+    for (uint32_t frame = 1; frame <= 4; frame++)
+    {
+        CHECK(Frame(policy, frame, { frame - 1 }, 1000).evict.empty());
+    }
+    ResidencyPolicy::Decisions decisions = Frame(policy, 5, { 3 }, 250);
+    CHECK(policy.ResidentBytes() == 200);
+    CHECK(policy.IsResident(3));
+    return decisions;
+}
+
+void TestEvictionOrder()
+{
+    CHECK(EvictTwoOfFour(ResidencyPolicy::Order::LeastRecentlyUsed).evict == (Objects{ 0, 1 }));
+    CHECK(EvictTwoOfFour(ResidencyPolicy::Order::Farthest).evict == (Objects{ 1, 2 }));
+}
+
+void TestIdleFrameGuard()
+{
+    ResidencyPolicy policy = MakePolicy(ResidencyPolicy::Order::LeastRecentlyUsed, 3, { 100, 100, 100 });
+    CHECK(Frame(policy, 1, { 0, 1, 2 }, 50).evict.empty());
+
+    // Objects used within the last three frames may still be in use by the GPU, even though usage is over budget
+    CHECK(Frame(policy, 2, { 2 }, 50).evict.empty());
+    CHECK(Frame(policy, 3, { 2 }, 50).evict.empty());
+    CHECK(policy.ResidentBytes() == 300);
+
+    // The object in use every frame is never evicted, so usage stays over budget
+    CHECK(Frame(policy, 4, { 2 }, 50).evict == (Objects{ 0, 1 }));
+    CHECK(Frame(policy, 5, { 2 }, 50).evict.empty());
+    CHECK(policy.IsResident(2));
+    CHECK(policy.ResidentBytes() == 100);
+    CHECK(policy.GetStats().evictions == 2);
+    CHECK(policy.GetStats().evictedBytes == 200);
+}
+
+void TestDeferredRestore()
+{
+    ResidencyPolicy policy = MakePolicy(ResidencyPolicy::Order::LeastRecentlyUsed, 1, { 100, 100, 100 });
+    CHECK(Frame(policy, 1, { 0, 1 }, 200).evict == (Objects{ 2 }));
+
+    // Object 2 is needed again, but the others are in use as well, so there is no room to restore it
+    ResidencyPolicy::Decisions decisions = Frame(policy, 2, { 0, 1, 2 }, 200);
+    CHECK(decisions.evict.empty() && decisions.restore.empty());
+    CHECK(!policy.IsResident(2));
+    CHECK(policy.GetStats().deferredRestores == 1);
+
+    // Once the others are idle one of them makes room for it
+    decisions = Frame(policy, 3, { 2 }, 200);
+    CHECK(decisions.evict == (Objects{ 0 }));
+    CHECK(decisions.restore == (Objects{ 2 }));
+    CHECK(policy.IsResident(1) && policy.IsResident(2));
+    CHECK(policy.ResidentBytes() == 200);
+
+    const ResidencyPolicy::Stats& stats = policy.GetStats();
+    CHECK(stats.evictions == 2 && stats.evictedBytes == 200);
+    CHECK(stats.restores == 1 && stats.restoredBytes == 100);
+    CHECK(stats.deferredRestores == 1);
+}
+
+void TestTieBreaking()
+{
+    // Least recently used: equally idle objects are evicted farthest first, then by index
+    {
+        ResidencyPolicy policy = MakePolicy(ResidencyPolicy::Order::LeastRecentlyUsed, 1, { 100, 100, 100, 100 });
+        policy.SetDistance(0, 1.0f);
+        policy.SetDistance(1, 5.0f);
+        policy.SetDistance(2, 5.0f);
+        policy.SetDistance(3, 2.0f);
+        CHECK(Frame(policy, 1, {}, 200).evict == (Objects{ 1, 2 }));
+    }
+
+    // Farthest: objects at the same distance are evicted least recently used first, then by index
+    {
+        ResidencyPolicy policy = MakePolicy(ResidencyPolicy::Order::Farthest, 1, { 100, 100, 100, 100 });
+        Frame(policy, 1, { 0, 2 }, 1000);
+        Frame(policy, 2, { 2 }, 1000);
+        CHECK(Frame(policy, 3, {}, 100).evict == (Objects{ 1, 3, 0 }));
+    }
+
+    // Restores: nearest first, then by index, as long as they fit
+    {
+        ResidencyPolicy policy = MakePolicy(ResidencyPolicy::Order::LeastRecentlyUsed, 1, { 100, 100, 100, 100 });
+        CHECK(Frame(policy, 1, {}, 1).evict == (Objects{ 0, 1, 2, 3 }));
+        policy.SetDistance(0, 3.0f);
+        policy.SetDistance(1, 2.0f);
+        policy.SetDistance(2, 2.0f);
+        policy.SetDistance(3, 1.0f);
+        ResidencyPolicy::Decisions decisions = Frame(policy, 2, { 0, 1, 2, 3 }, 300);
+        CHECK(decisions.restore == (Objects{ 3, 1, 2 }));
+        CHECK(!policy.IsResident(0));
+        CHECK(policy.GetStats().deferredRestores == 1);
+    }
+}
+}
+
+int main()
+{
+    TestEvictionOrder();
+    TestIdleFrameGuard();
+    TestDeferredRestore();
+    TestTieBreaking();
+    return TestResult();
+}
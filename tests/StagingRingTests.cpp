@@ -0,0 +1,199 @@
+#include "TestCheck.h"
+#include "utils/StagingRing.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+// Queue whose GPU only makes progress when the test says so, or when the ring waits for it
+class FakeQueue : public StagingQueue
+{
+public:
+    explicit FakeQueue(uint32_t chunkCount) : m_chunkFenceValues(chunkCount, 0) {}
+
+    void BeginChunk(uint32_t chunk) override
+    {
+        // The ring must not record into a chunk the GPU may still be reading from
+        CHECK(m_chunkFenceValues[chunk] <= m_completedFenceValue);
+        begunChunks.push_back(chunk);
+    }
+
+    uint64_t SubmitChunk(uint32_t chunk) override
+    {
+        m_chunkFenceValues[chunk] = ++m_lastFenceValue;
+        if (completeImmediately)
+        {
+            m_completedFenceValue = m_lastFenceValue;
+        }
+        return m_lastFenceValue;
+    }
+
+    uint64_t CompletedFenceValue() override { return m_completedFenceValue; }
+
+    void WaitForFenceValue(uint64_t fenceValue) override
+    {
+        CHECK(fenceValue > m_completedFenceValue && fenceValue <= m_lastFenceValue);
+        waits++;
+        m_completedFenceValue = fenceValue;
+    }
+
+    void Complete(uint64_t fenceValue) { m_completedFenceValue = (std::max)(m_completedFenceValue, (std::min)(fenceValue, m_lastFenceValue)); }
+    uint64_t LastFenceValue() const { return m_lastFenceValue; }
+
+    std::vector<uint32_t> begunChunks;
+    uint32_t waits              = 0;
+    bool completeImmediately    = false;
+
+private:
+    std::vector<uint64_t> m_chunkFenceValues;
+    uint64_t m_lastFenceValue       = 0;
+    uint64_t m_completedFenceValue  = 0;
+};
+
+// Allocates a buffer like StagingUploader does, split into as many allocations as it takes
+std::vector<StagingRing::Allocation> Upload(StagingRing& ring, uint64_t size)
+{
+    std::vector<StagingRing::Allocation> allocations;
+    while (size > 0)
+    {
+        allocations.push_back(ring.Allocate(size));
+        size -= allocations.back().size;
+    }
+    return allocations;
+}
+
+void TestRoundRobinReuse()
+{
+    FakeQueue queue(3);
+    StagingRing ring(queue, 64, 3);
+    for (uint64_t chunk = 0; chunk < 3; chunk++)
+    {
+        StagingRing::Allocation allocation = ring.Allocate(64);
+        CHECK(allocation.offset == chunk * 64 && allocation.size == 64);
+    }
+    CHECK(ring.GetStats().submissions == 2);
+    CHECK(ring.GetStats().waits == 0);
+
+    // The GPU has not finished any chunk, so reusing the first one has to wait for its submission
+    StagingRing::Allocation allocation = ring.Allocate(16);
+    CHECK(allocation.offset == 0 && allocation.size == 16);
+    CHECK(ring.GetStats().waits == 1 && queue.waits == 1);
+    CHECK(queue.CompletedFenceValue() == 1);
+
+    // Once the GPU has caught up the next chunk is reused without waiting
+    queue.Complete(2);
+    allocation = ring.Allocate(64);
+    CHECK(allocation.offset == 64 && allocation.size == 64);
+    CHECK(ring.GetStats().waits == 1 && queue.waits == 1);
+    CHECK((queue.begunChunks == std::vector<uint32_t>{ 0, 1, 2, 0, 1 }));
+    CHECK(ring.GetStats().submissions == 4);
+}
+
+void TestNoWaitsWhenTheGpuKeepsUp()
+{
+    FakeQueue queue(2);
+    queue.completeImmediately = true;
+    StagingRing ring(queue, 256, 2);
+    for (int i = 0; i < 100; i++)
+    {
+        ring.Allocate(200);
+    }
+    ring.Finish();
+    CHECK(ring.GetStats().submissions == 100);
+    CHECK(ring.GetStats().waits == 0 && queue.waits == 0);
+
+    // Only the open chunk is in flight
+    CHECK(ring.GetStats().peakBytesInFlight == 200);
+}
+
+void TestLargeAllocationsAreSplit()
+{
+    FakeQueue queue(2);
+    StagingRing ring(queue, 64, 2);
+    CHECK(ring.Allocate(20).offset == 0);
+
+    // Starts in a new chunk and fills whole chunks, the third part reuses the first chunk after waiting for it
+    std::vector<StagingRing::Allocation> allocations = Upload(ring, 150);
+    CHECK(allocations.size() == 3);
+    if (allocations.size() == 3)
+    {
+        CHECK(allocations[0].offset == 64 && allocations[0].size == 64);
+        CHECK(allocations[1].offset == 0 && allocations[1].size == 64);
+        CHECK(allocations[2].offset == 64 && allocations[2].size == 22);
+    }
+    CHECK(ring.GetStats().waits == 2);
+    CHECK(ring.GetStats().bytesAllocated == 20 + 150);
+    CHECK(ring.GetStats().peakBytesInFlight <= ring.ChunkSize() * ring.ChunkCount());
+}
+
+void TestFlush()
+{
+    FakeQueue queue(4);
+    StagingRing ring(queue, 64, 4);
+    ring.Allocate(8);
+    ring.Flush();
+    CHECK(ring.GetStats().submissions == 1);
+
+    // Data allocated after a flush goes to the next chunk, not behind the submitted data
+    CHECK(ring.Allocate(8).offset == 64);
+
+    // Flushing without an open chunk submits nothing
+    ring.Flush();
+    ring.Flush();
+    CHECK(ring.GetStats().submissions == 2);
+
+    ring.Finish();
+    CHECK(queue.CompletedFenceValue() == queue.LastFenceValue());
+}
+
+void TestStagingMemoryIsBounded()
+{
+    // Sizes and GPU progress from a fixed linear congruential sequence
+    FakeQueue queue(4);
+    StagingRing ring(queue, 1024, 4);
+    uint32_t state = 12345;
+    auto next = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    uint64_t uploaded = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        const uint64_t size = 1 + next() % 3000;
+        for (const StagingRing::Allocation& allocation : Upload(ring, size))
+        {
+            // Every allocation lies within a single chunk of the ring
+            CHECK(allocation.size > 0);
+            CHECK(allocation.offset / ring.ChunkSize() == (allocation.offset + allocation.size - 1) / ring.ChunkSize());
+            CHECK(allocation.offset + allocation.size <= ring.ChunkSize() * ring.ChunkCount());
+            CHECK(allocation.offset % UploadLayout::DefaultAlignment == 0);
+        }
+        uploaded += size;
+        if (next() % 4 == 0)
+        {
+            queue.Complete(queue.LastFenceValue() - next() % 3);
+        }
+    }
+    CHECK(ring.GetStats().waits == queue.waits);
+
+    // Finishing waits for the last submission, which does not count as waiting for a chunk
+    ring.Finish();
+    const StagingRing::Stats& stats = ring.GetStats();
+    CHECK(stats.waits > 0 && queue.waits <= stats.waits + 1);
+    CHECK(stats.bytesAllocated >= uploaded);
+    CHECK(stats.peakBytesInFlight <= ring.ChunkSize() * ring.ChunkCount());
+    CHECK(stats.submissions == queue.LastFenceValue());
+    CHECK(queue.CompletedFenceValue() == queue.LastFenceValue());
+}
+}
+
+int main()
+{
+    TestRoundRobinReuse();
+    TestNoWaitsWhenTheGpuKeepsUp();
+    TestLargeAllocationsAreSplit();
+    TestFlush();
+    TestStagingMemoryIsBounded();
+    return TestResult();
+}
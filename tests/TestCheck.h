@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// Minimal checks for the test executables: a failed CHECK() reports the expression and the test keeps running, main() returns
+// TestResult() so ctest sees the failure.
+inline int& TestFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(expression)                                                                               \
+    do                                                                                                  \
+    {                                                                                                   \
+        if (!(expression))                                                                              \
+        {                                                                                               \
+            std::cerr << __FILE__ << "(" << __LINE__ << "): check failed: " #expression "\n";          \
+            TestFailures()++;                                                                           \
+        }                                                                                               \
+    } while (false)
+
+inline int TestResult()
+{
+    if (TestFailures() > 0)
+    {
+        std::cerr << TestFailures() << " checks failed\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+#include "TestCheck.h"
+#include "utils/UploadLayout.h"
+
+#include <algorithm>
+#include <vector>
+
+// Placement is declared in the global namespace, so its comparison has to be as well to be found by std::equal()
+static bool operator==(const UploadLayout::Placement& a, const UploadLayout::Placement& b)
+{
+    return a.chunk == b.chunk && a.offset == b.offset && a.size == b.size;
+}
+
+namespace
+{
+// Places a buffer like BuildSceneBuffers() plans it, split into as many placements as it takes
+std::vector<UploadLayout::Placement> PlanBuffer(UploadLayout& layout, uint64_t size)
+{
+    std::vector<UploadLayout::Placement> placements;
+    while (size > 0)
+    {
+        placements.push_back(layout.Allocate(size));
+        size -= placements.back().size;
+    }
+    return placements;
+}
+
+void TestAlignmentPadding()
+{
+    UploadLayout layout;
+    CHECK((layout.Allocate(10) == UploadLayout::Placement{ 0, 0, 10 }));
+    CHECK((layout.Allocate(4) == UploadLayout::Placement{ 0, 16, 4 }));
+    CHECK((layout.Allocate(1, 256) == UploadLayout::Placement{ 0, 256, 1 }));
+    CHECK((layout.Allocate(8, 4) == UploadLayout::Placement{ 0, 260, 8 }));
+
+    // Padding counts towards the total size
+    CHECK(layout.ChunkCount() == 1);
+    CHECK(layout.ChunkBytesUsed() == 268);
+    CHECK(layout.TotalSize() == 268);
+}
+
+void TestAllocationsMoveToNextChunk()
+{
+    UploadLayout layout(64);
+    CHECK((layout.Allocate(40) == UploadLayout::Placement{ 0, 0, 40 }));
+    CHECK((layout.Allocate(40) == UploadLayout::Placement{ 1, 0, 40 }));
+    CHECK((layout.Allocate(16) == UploadLayout::Placement{ 1, 48, 16 }));
+
+    // Alignment padding that reaches the end of the chunk moves on as well
+    CHECK((layout.Allocate(4) == UploadLayout::Placement{ 2, 0, 4 }));
+
+    // The unused end of the first chunk is not part of the total size
+    CHECK(layout.ChunkCount() == 3);
+    CHECK(layout.TotalSize() == 40 + 64 + 4);
+}
+
+void TestLargeAllocationsAreSplit()
+{
+    UploadLayout layout(64);
+    CHECK((layout.Allocate(20) == UploadLayout::Placement{ 0, 0, 20 }));
+
+    // Larger than a chunk: starts in a new chunk instead of filling the rest of the current one, then fills whole chunks
+    std::vector<UploadLayout::Placement> placements = PlanBuffer(layout, 150);
+    CHECK(placements.size() == 3);
+    CHECK((placements[0] == UploadLayout::Placement{ 1, 0, 64 }));
+    CHECK((placements[1] == UploadLayout::Placement{ 2, 0, 64 }));
+    CHECK((placements[2] == UploadLayout::Placement{ 3, 0, 22 }));
+
+    // The remainder shares its chunk with what follows
+    CHECK((layout.Allocate(8) == UploadLayout::Placement{ 3, 32, 8 }));
+    CHECK(layout.ChunkCount() == 4);
+    CHECK(layout.TotalSize() == 20 + 150 + 10 + 8);
+
+    // Exactly a chunk fits into an empty chunk without being split
+    UploadLayout exact(64);
+    CHECK(PlanBuffer(exact, 64).size() == 1);
+    CHECK(exact.TotalSize() == 64);
+}
+
+void TestCloseChunk()
+{
+    UploadLayout layout(64);
+    layout.Allocate(8);
+    layout.CloseChunk();
+    CHECK((layout.Allocate(8) == UploadLayout::Placement{ 1, 0, 8 }));
+    CHECK(layout.ChunkCount() == 2);
+    CHECK(layout.TotalSize() == 16);
+}
+
+// BuildSceneBuffers() plans a scene with the streaming chunk size, and if it fits into a single chunk uploads it from an arena of exactly
+// TotalSize() bytes, or at least the default alignment. Replaying the same allocations into a chunk of that size has to place them
+// identically, in one chunk, without splitting any of them.
+void TestSingleArenaSizeMatchesPlan(const std::vector<uint64_t>& bufferSizes)
+{
+    UploadLayout plan(64ULL * 1024 * 1024);
+    std::vector<UploadLayout::Placement> planned;
+    for (uint64_t size : bufferSizes)
+    {
+        std::vector<UploadLayout::Placement> placements = PlanBuffer(plan, size);
+        planned.insert(planned.end(), placements.begin(), placements.end());
+    }
+    CHECK(plan.ChunkCount() <= 1);
+
+    UploadLayout arena((std::max)(plan.TotalSize(), UploadLayout::DefaultAlignment));
+    std::vector<UploadLayout::Placement> replayed;
+    for (uint64_t size : bufferSizes)
+    {
+        std::vector<UploadLayout::Placement> placements = PlanBuffer(arena, size);
+        CHECK(size == 0 || placements.size() == 1);
+        replayed.insert(replayed.end(), placements.begin(), placements.end());
+    }
+    CHECK(arena.ChunkCount() == plan.ChunkCount());
+    CHECK(arena.TotalSize() == plan.TotalSize());
+    CHECK(replayed.size() == planned.size() && std::equal(replayed.begin(), replayed.end(), planned.begin()));
+    CHECK(replayed.empty() || replayed.back().offset + replayed.back().size == arena.TotalSize());
+}
+}
+
+int main()
+{
+    TestAlignmentPadding();
+    TestAllocationsMoveToNextChunk();
+    TestLargeAllocationsAreSplit();
+    TestCloseChunk();
+
+    // Lights, materials, then indices, vertices, and material indices of every object, with sizes that need padding
+    TestSingleArenaSizeMatchesPlan({ 2 * 24, 3 * 20, 36 * 4, 24 * 24, 12 * 4, 6 * 4, 4 * 24, 2 * 4, 2 * 48 });
+    TestSingleArenaSizeMatchesPlan({ 1 });
+    TestSingleArenaSizeMatchesPlan({ 7, 0, 33 });
+    TestSingleArenaSizeMatchesPlan({});
+    return TestResult();
+}
@@ -0,0 +1,209 @@
+#include "TestCheck.h"
+#include "utils/UploadRing.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+// Fence whose GPU only makes progress when the test says so, or when the ring waits for it
+class FakeFence : public UploadFence
+{
+public:
+    uint64_t CompletedFenceValue() override { return completedFenceValue; }
+
+    void WaitForFenceValue(uint64_t fenceValue) override
+    {
+        CHECK(fenceValue > completedFenceValue);
+        waits++;
+        completedFenceValue = fenceValue;
+    }
+
+    uint64_t completedFenceValue    = 0;
+    uint32_t waits                  = 0;
+};
+
+UploadRing::Allocation Allocate(UploadRing& ring, uint64_t size, uint64_t alignment = 1)
+{
+    UploadRing::Allocation allocation = { UINT64_MAX, 0 };
+    CHECK(ring.Allocate(size, alignment, allocation));
+    return allocation;
+}
+
+void TestAlignment()
+{
+    FakeFence fence;
+    UploadRing ring(fence, 1024);
+    CHECK(Allocate(ring, 10).offset == 0);
+    CHECK(Allocate(ring, 4, 16).offset == 16);
+    CHECK(Allocate(ring, 1, 256).offset == 256);
+    CHECK(Allocate(ring, 8, 4).offset == 260);
+
+    // Padding counts towards the frame
+    CHECK(ring.CurrentFrameBytes() == 268);
+    CHECK(ring.BytesInUse() == 268);
+    CHECK(ring.GetStats().bytesAllocated == 268);
+}
+
+void TestWrapAround()
+{
+    FakeFence fence;
+    UploadRing ring(fence, 256);
+    Allocate(ring, 100);
+    ring.EndFrame(1);
+    Allocate(ring, 100);
+    ring.EndFrame(2);
+    fence.completedFenceValue = 1;
+
+    // 80 bytes do not fit behind the second frame, so the end of the ring is skipped and the allocation starts over where the first
+    // frame was
+    UploadRing::Allocation allocation = Allocate(ring, 80);
+    CHECK(allocation.offset == 0 && allocation.size == 80);
+    CHECK(ring.FramesInFlight() == 1);
+    CHECK(ring.BytesInUse() == 100 + 56 + 80);
+    CHECK(ring.CurrentFrameBytes() == 56 + 80);
+    CHECK(ring.GetStats().bytesAllocated == 100 + 100 + 56 + 80);
+
+    // Alignment padding that reaches the end of the ring wraps around as well
+    FakeFence alignedFence;
+    UploadRing aligned(alignedFence, 256);
+    Allocate(aligned, 20);
+    aligned.EndFrame(1);
+    Allocate(aligned, 230);
+    aligned.EndFrame(2);
+    alignedFence.completedFenceValue = 1;
+    CHECK(Allocate(aligned, 4, 16).offset == 0);
+    CHECK(aligned.GetStats().waits == 0);
+}
+
+void TestRetirement()
+{
+    FakeFence fence;
+    UploadRing ring(fence, 1024);
+    Allocate(ring, 100);
+    ring.EndFrame(5);
+    Allocate(ring, 100);
+    ring.EndFrame(6);
+
+    // Frames retire once the fence reaches the value they ended with, not before
+    fence.completedFenceValue = 4;
+    Allocate(ring, 1);
+    CHECK(ring.FramesInFlight() == 2 && ring.BytesInUse() == 201);
+    fence.completedFenceValue = 5;
+    Allocate(ring, 1);
+    CHECK(ring.FramesInFlight() == 1 && ring.BytesInUse() == 102);
+    ring.EndFrame(7);
+    fence.completedFenceValue = 7;
+    Allocate(ring, 1);
+    CHECK(ring.FramesInFlight() == 0 && ring.BytesInUse() == 1);
+    CHECK(ring.GetStats().frames == 3);
+    CHECK(ring.GetStats().waits == 0 && fence.waits == 0);
+}
+
+void TestWaitWhenFull()
+{
+    FakeFence fence;
+    UploadRing ring(fence, 256);
+    Allocate(ring, 128);
+    ring.EndFrame(1);
+    Allocate(ring, 128);
+    ring.EndFrame(2);
+
+    // Both frames are in flight and fill the ring, only the oldest one is waited for
+    UploadRing::Allocation allocation = Allocate(ring, 64);
+    CHECK(allocation.offset == 0);
+    CHECK(ring.GetStats().waits == 1 && fence.waits == 1);
+    CHECK(fence.completedFenceValue == 1);
+    CHECK(ring.FramesInFlight() == 1);
+    CHECK(ring.GetStats().peakBytesInUse == 256);
+}
+
+void TestFrameLargerThanCapacity()
+{
+    FakeFence fence;
+    UploadRing ring(fence, 256);
+    UploadRing::Allocation allocation = { UINT64_MAX, 0 };
+    CHECK(!ring.Allocate(300, 1, allocation));
+    CHECK(ring.GetStats().waits == 0 && ring.BytesInUse() == 0);
+
+    Allocate(ring, 100);
+    ring.EndFrame(1);
+
+    // The frame in flight has to be waited for, after that the ring is empty and 200 bytes fit at its start even though the
+    // position is in the middle of it
+    CHECK(Allocate(ring, 200).offset == 0);
+    CHECK(ring.GetStats().waits == 1);
+
+    // The current frame alone would need more than the whole ring, FrameUploadRing moves to a larger one in that case
+    const UploadRing::Stats stats = ring.GetStats();
+    CHECK(!ring.Allocate(100, 1, allocation));
+    CHECK(ring.CurrentFrameBytes() == 200);
+    CHECK(ring.GetStats().bytesAllocated == stats.bytesAllocated && ring.GetStats().waits == stats.waits);
+
+    ring.Reset(1024);
+    CHECK(Allocate(ring, 100).offset == 0);
+    CHECK(ring.Capacity() == 1024 && ring.FramesInFlight() == 0);
+}
+
+void TestAllocationsInUseNeverOverlap()
+{
+    struct Live
+    {
+        UploadRing::Allocation allocation;
+        uint64_t fenceValue;    // UINT64_MAX for the current frame
+    };
+
+    // Frame sizes, alignments, and GPU progress from a fixed linear congruential sequence
+    FakeFence fence;
+    UploadRing ring(fence, 6144);
+    uint32_t state = 12345;
+    auto next = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    std::vector<Live> live;
+    for (uint64_t frame = 1; frame <= 500; frame++)
+    {
+        const uint32_t allocations = 1 + next() % 8;
+        for (uint32_t i = 0; i < allocations; i++)
+        {
+            const uint64_t size         = 1 + next() % 400;
+            const uint64_t alignment    = 1ULL << (next() % 9);
+            UploadRing::Allocation allocation = Allocate(ring, size, alignment);
+            CHECK(allocation.size == size);
+            CHECK(allocation.offset % alignment == 0);
+            CHECK(allocation.offset + allocation.size <= ring.Capacity());
+
+            // Memory of frames the GPU may still read, and of the current frame, is never handed out twice
+            std::erase_if(live, [&](const Live& l) { return l.fenceValue <= fence.completedFenceValue; });
+            for (const Live& l : live)
+            {
+                CHECK(allocation.offset + allocation.size <= l.allocation.offset || l.allocation.offset + l.allocation.size <= allocation.offset);
+            }
+            live.push_back({ allocation, UINT64_MAX });
+        }
+        ring.EndFrame(frame);
+        for (Live& l : live)
+        {
+            l.fenceValue = (std::min)(l.fenceValue, frame);
+        }
+
+        // The GPU lags up to five frames behind
+        fence.completedFenceValue = (std::max)(fence.completedFenceValue, frame - (std::min)(frame, static_cast<uint64_t>(next() % 6)));
+    }
+    CHECK(ring.GetStats().frames == 500);
+    CHECK(ring.GetStats().waits == fence.waits && fence.waits > 0);
+    CHECK(ring.GetStats().peakBytesInUse <= ring.Capacity());
+}
+}
+
+int main()
+{
+    TestAlignment();
+    TestWrapAround();
+    TestRetirement();
+    TestWaitWhenFull();
+    TestFrameLargerThanCapacity();
+    TestAllocationsInUseNeverOverlap();
+    return TestResult();
+}